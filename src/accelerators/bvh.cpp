@@ -33,8 +33,12 @@
 // accelerators/bvh.cpp*
 #include "stdafx.h"
 #include "accelerators/bvh.h"
+#include "accelerators/treelet.h"
 #include "probes.h"
 #include "paramset.h"
+#ifdef PBRT_HAS_SSE
+#include <emmintrin.h>
+#endif
 
 // BVHAccel Local Declarations
 struct BVHPrimitiveInfo {
@@ -115,6 +119,7 @@ struct LinearBVHNode {
     union {
         uint32_t primitivesOffset;    // leaf
         uint32_t secondChildOffset;   // interior
+        uint32_t childPairOffset;     // interior, treelet layout
     };
 
     uint8_t nPrimitives;  // 0 -> interior node
@@ -123,6 +128,60 @@ struct LinearBVHNode {
 };
 
 
+struct QuantizedBVHNode {
+    // Child bounds are _origin_ plus $2^\roman{exponent}$ times _qMin_ and _qMax_
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t interiorMask;      // bit _i_ set if child _i_ is a node
+    uint8_t nPrimitives[4];    // leaf children; zero for unused slots
+    uint8_t qMin[3][4], qMax[3][4];
+    uint32_t childOffset[4];   // node index, or first primitive of a leaf
+    uint8_t nChildren;
+    uint8_t pad[3];            // ensure 64 byte total size
+};
+
+
+static inline float Exp2i(int e) {
+    // Build the float $2^e$ for $-126 \le e \le 127$ from its exponent bits
+    uint32_t bits = uint32_t(e + 127) << 23;
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+
+static inline float Dequantize(float origin, uint8_t q, float scale) {
+    return origin + q * scale;
+}
+
+
+static void LayoutQuantizedNodes(vector<QuantizedBVHNode> &qnodes) {
+    // Reorder wide nodes into treelets and rewrite interior child offsets
+    vector<uint32_t> childStart, children;
+    for (uint32_t i = 0; i < qnodes.size(); ++i) {
+        childStart.push_back(children.size());
+        for (uint32_t c = 0; c < qnodes[i].nChildren; ++c)
+            if (qnodes[i].interiorMask & (1 << c))
+                children.push_back(qnodes[i].childOffset[c]);
+    }
+    childStart.push_back(children.size());
+    vector<int32_t> order;
+    TreeletOrder(childStart, children, sizeof(QuantizedBVHNode), &order);
+    vector<uint32_t> newOffset(qnodes.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        if (order[i] >= 0) newOffset[order[i]] = i;
+    vector<QuantizedBVHNode> laidOut(order.size());
+    for (uint32_t i = 0; i < qnodes.size(); ++i) {
+        QuantizedBVHNode &node = laidOut[newOffset[i]];
+        node = qnodes[i];
+        for (uint32_t c = 0; c < node.nChildren; ++c)
+            if (node.interiorMask & (1 << c))
+                node.childOffset[c] = newOffset[node.childOffset[c]];
+    }
+    qnodes.swap(laidOut);
+}
+
+
 static inline bool IntersectP(const BBox &bounds, const Ray &ray,
         const Vector &invDir, const uint32_t dirIsNeg[3]) {
     // Check for ray intersection against $x$ and $y$ slabs
@@ -151,8 +210,10 @@ static inline bool IntersectP(const BBox &bounds, const Ray &ray,
 
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(const vector<Reference<Primitive> > &p,
-                   uint32_t mp, const string &sm) {
+                   uint32_t mp, const string &sm, bool quantize,
+                   bool treelets) {
     maxPrimsInNode = min(255u, mp);
+    treeletLayout = treelets;
     for (uint32_t i = 0; i < p.size(); ++i)
         p[i]->FullyRefine(primitives);
     if (sm == "sah")         splitMethod = SPLIT_SAH;
@@ -164,10 +225,10 @@ BVHAccel::BVHAccel(const vector<Reference<Primitive> > &p,
         splitMethod = SPLIT_SAH;
     }
 
-    if (primitives.size() == 0) {
-        nodes = NULL;
+    nodes = NULL;
+    quantizedNodes = NULL;
+    if (primitives.size() == 0)
         return;
-    }
     // Build BVH from _primitives_
     PBRT_BVH_STARTED_CONSTRUCTION(this, primitives.size());
 
@@ -188,6 +249,22 @@ BVHAccel::BVHAccel(const vector<Reference<Primitive> > &p,
                                         primitives.size(), &totalNodes,
                                         orderedPrims);
     primitives.swap(orderedPrims);
+    bounds = root->bounds;
+    if (quantize) {
+        // Collapse BVH into wide nodes with quantized child bounds
+        vector<QuantizedBVHNode> qnodes;
+        flattenQuantizedBVHTree(root, qnodes);
+        if (treelets) LayoutQuantizedNodes(qnodes);
+        quantizedNodes = AllocAligned<QuantizedBVHNode>(qnodes.size(),
+            treelets ? PBRT_TREELET_PAGE_SIZE : PBRT_L1_CACHE_LINE_SIZE);
+        memcpy(quantizedNodes, &qnodes[0],
+               qnodes.size() * sizeof(QuantizedBVHNode));
+        Info("Quantized BVH created with %d nodes for %d primitives (%.2f MB)",
+             (int)qnodes.size(), (int)primitives.size(),
+             float(qnodes.size() * sizeof(QuantizedBVHNode))/(1024.f*1024.f));
+        PBRT_BVH_FINISHED_CONSTRUCTION(this);
+        return;
+    }
         Info("BVH created with %d nodes for %d primitives (%.2f MB)", totalNodes,
              (int)primitives.size(), float(totalNodes * sizeof(LinearBVHNode))/(1024.f*1024.f));
 
@@ -198,12 +275,13 @@ BVHAccel::BVHAccel(const vector<Reference<Primitive> > &p,
     uint32_t offset = 0;
     flattenBVHTree(root, &offset);
     Assert(offset == totalNodes);
+    if (treelets) layoutNodes(totalNodes);
     PBRT_BVH_FINISHED_CONSTRUCTION(this);
 }
 
 
 BBox BVHAccel::WorldBound() const {
-    return nodes ? nodes[0].bounds : BBox();
+    return bounds;
 }
 
 
@@ -395,12 +473,215 @@ uint32_t BVHAccel::flattenBVHTree(BVHBuildNode *node, uint32_t *offset) {
 }
 
 
+void BVHAccel::layoutNodes(uint32_t totalNodes) {
+    // Find children of depth-first nodes
+    vector<uint32_t> children(2 * totalNodes, 0);
+    for (uint32_t i = 0; i < totalNodes; ++i)
+        if (nodes[i].nPrimitives == 0) {
+            children[2*i] = i + 1;
+            children[2*i+1] = nodes[i].secondChildOffset;
+        }
+
+    // Copy nodes into page-aligned treelets with siblings adjacent
+    vector<uint32_t> newOffset;
+    uint32_t nNodes = TreeletLayoutBinaryTree(children, sizeof(LinearBVHNode),
+                                              &newOffset);
+    LinearBVHNode *laidOut = AllocAligned<LinearBVHNode>(nNodes,
+                                                         PBRT_TREELET_PAGE_SIZE);
+    for (uint32_t i = 0; i < nNodes; ++i)
+        new (&laidOut[i]) LinearBVHNode;
+    for (uint32_t i = 0; i < totalNodes; ++i) {
+        LinearBVHNode &node = laidOut[newOffset[i]];
+        node = nodes[i];
+        if (node.nPrimitives == 0)
+            node.childPairOffset = newOffset[i + 1];
+    }
+    FreeAligned(nodes);
+    nodes = laidOut;
+}
+
+
+uint32_t BVHAccel::flattenQuantizedBVHTree(BVHBuildNode *node,
+        vector<QuantizedBVHNode> &qnodes) {
+    // Gather up to four descendants of _node_, opening the largest first
+    BVHBuildNode *children[4];
+    uint32_t nChildren = 0;
+    if (node->nPrimitives > 0)
+        children[nChildren++] = node;
+    else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+        while (nChildren < 4) {
+            int open = -1;
+            float maxArea = -1.f;
+            for (uint32_t i = 0; i < nChildren; ++i)
+                if (children[i]->nPrimitives == 0 &&
+                    children[i]->bounds.SurfaceArea() > maxArea) {
+                    open = i;
+                    maxArea = children[i]->bounds.SurfaceArea();
+                }
+            if (open == -1) break;
+            BVHBuildNode *interior = children[open];
+            children[open] = interior->children[0];
+            children[nChildren++] = interior->children[1];
+        }
+    }
+    uint32_t myOffset = qnodes.size();
+    qnodes.push_back(QuantizedBVHNode());
+    QuantizedBVHNode qnode;
+    memset(&qnode, 0, sizeof(QuantizedBVHNode));
+    qnode.nChildren = nChildren;
+
+    // Quantize child bounds conservatively on a power-of-two grid
+    for (int axis = 0; axis < 3; ++axis) {
+        float origin = node->bounds.pMin[axis];
+        float extent = node->bounds.pMax[axis] - origin;
+        int e = -126;
+        if (extent > 0.f) frexpf(extent / 255.f, &e);
+        for (e = Clamp(e, -126, 127); ; ++e) {
+            float scale = Exp2i(e);
+            bool covered = true;
+            for (uint32_t i = 0; i < nChildren && covered; ++i) {
+                float cMin = children[i]->bounds.pMin[axis];
+                float cMax = children[i]->bounds.pMax[axis];
+                int qMin = Floor2Int(Clamp((cMin - origin) / scale, 0.f, 255.f));
+                int qMax = Ceil2Int(Clamp((cMax - origin) / scale, 0.f, 255.f));
+                while (qMin > 0 && Dequantize(origin, qMin, scale) > cMin)
+                    --qMin;
+                while (qMax < 255 && Dequantize(origin, qMax, scale) < cMax)
+                    ++qMax;
+                covered = Dequantize(origin, qMin, scale) <= cMin &&
+                          Dequantize(origin, qMax, scale) >= cMax;
+                qnode.qMin[axis][i] = qMin;
+                qnode.qMax[axis][i] = qMax;
+            }
+            if (covered || e == 127) break;
+        }
+        qnode.origin[axis] = origin;
+        qnode.exponent[axis] = e;
+    }
+
+    // Record leaf children and flatten interior ones
+    for (uint32_t i = 0; i < nChildren; ++i) {
+        if (children[i]->nPrimitives > 0) {
+            qnode.nPrimitives[i] = children[i]->nPrimitives;
+            qnode.childOffset[i] = children[i]->firstPrimOffset;
+        }
+        else {
+            qnode.interiorMask |= (1 << i);
+            qnode.childOffset[i] = flattenQuantizedBVHTree(children[i], qnodes);
+        }
+    }
+    qnodes[myOffset] = qnode;
+    return myOffset;
+}
+
+
 BVHAccel::~BVHAccel() {
     FreeAligned(nodes);
+    FreeAligned(quantizedNodes);
+}
+
+
+bool BVHAccel::quantizedIntersect(const Ray &ray, Intersection *isect) const {
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    // Visit nodes and leaves nearest first; _isect_ is _NULL_ for shadow rays
+    struct TodoEntry {
+        uint32_t offset, nPrimitives;
+        float tMin;
+    };
+    TodoEntry todo[256];
+    todo[0].offset = todo[0].nPrimitives = 0;
+    todo[0].tMin = ray.mint;
+    uint32_t todoOffset = 1;
+    bool hit = false;
+    while (todoOffset > 0) {
+        TodoEntry entry = todo[--todoOffset];
+        if (entry.tMin > ray.maxt)
+            continue;
+        if (entry.nPrimitives > 0) {
+            // Intersect ray with primitives in leaf
+            for (uint32_t i = 0; i < entry.nPrimitives; ++i) {
+                const Reference<Primitive> &prim = primitives[entry.offset + i];
+                if (!isect) {
+                    if (prim->IntersectP(ray)) return true;
+                }
+                else if (prim->Intersect(ray, isect))
+                    hit = true;
+            }
+            continue;
+        }
+
+        // Intersect ray with slabs of all four children in grid units
+        const QuantizedBVHNode *node = &quantizedNodes[entry.offset];
+        float tMin[4];
+        uint32_t hitMask = 0;
+#ifdef PBRT_HAS_SSE
+        __m128 tMin4 = _mm_set1_ps(ray.mint), tMax4 = _mm_set1_ps(ray.maxt);
+        for (int axis = 0; axis < 3; ++axis) {
+            __m128 base = _mm_set1_ps((node->origin[axis] - ray.o[axis]) * invDir[axis]);
+            __m128 step = _mm_set1_ps(Exp2i(node->exponent[axis]) * invDir[axis]);
+            int32_t qNear, qFar;
+            memcpy(&qNear, dirIsNeg[axis] ? node->qMax[axis] : node->qMin[axis], 4);
+            memcpy(&qFar, dirIsNeg[axis] ? node->qMin[axis] : node->qMax[axis], 4);
+            __m128i zero = _mm_setzero_si128();
+            __m128i qn = _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+                _mm_cvtsi32_si128(qNear), zero), zero);
+            __m128i qf = _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+                _mm_cvtsi32_si128(qFar), zero), zero);
+            // Operand order keeps the current interval if a distance is NaN
+            tMin4 = _mm_max_ps(_mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(qn), step)),
+                               tMin4);
+            tMax4 = _mm_min_ps(_mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(qf), step)),
+                               tMax4);
+        }
+        _mm_storeu_ps(tMin, tMin4);
+        hitMask = _mm_movemask_ps(_mm_cmple_ps(tMin4, tMax4));
+#else
+        float tMax[4];
+        for (uint32_t c = 0; c < 4; ++c) {
+            tMin[c] = ray.mint;
+            tMax[c] = ray.maxt;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            float base = (node->origin[axis] - ray.o[axis]) * invDir[axis];
+            float step = Exp2i(node->exponent[axis]) * invDir[axis];
+            const uint8_t *qNear = dirIsNeg[axis] ? node->qMax[axis] : node->qMin[axis];
+            const uint8_t *qFar = dirIsNeg[axis] ? node->qMin[axis] : node->qMax[axis];
+            for (uint32_t c = 0; c < 4; ++c) {
+                float tNear = base + qNear[c] * step, tFar = base + qFar[c] * step;
+                if (tNear > tMin[c]) tMin[c] = tNear;
+                if (tFar < tMax[c]) tMax[c] = tFar;
+            }
+        }
+        for (uint32_t c = 0; c < 4; ++c)
+            if (tMin[c] <= tMax[c]) hitMask |= (1 << c);
+#endif
+        TodoEntry childHits[4];
+        uint32_t nHits = 0;
+        for (uint32_t c = 0; c < node->nChildren; ++c) {
+            if (!(hitMask & (1 << c)))
+                continue;
+            // Insert child into _childHits_, farthest first
+            uint32_t j = nHits++;
+            while (j > 0 && childHits[j-1].tMin < tMin[c]) {
+                childHits[j] = childHits[j-1];
+                --j;
+            }
+            childHits[j].offset = node->childOffset[c];
+            childHits[j].nPrimitives = node->nPrimitives[c];
+            childHits[j].tMin = tMin[c];
+        }
+        for (uint32_t i = 0; i < nHits; ++i)
+            todo[todoOffset++] = childHits[i];
+    }
+    return hit;
 }
 
 
 bool BVHAccel::Intersect(const Ray &ray, Intersection *isect) const {
+    if (quantizedNodes) return quantizedIntersect(ray, isect);
     if (!nodes) return false;
     PBRT_BVH_INTERSECTION_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
     bool hit = false;
@@ -434,13 +715,19 @@ bool BVHAccel::Intersect(const Ray &ray, Intersection *isect) const {
             else {
                 // Put far BVH node on _todo_ stack, advance to near node
                 PBRT_BVH_INTERSECTION_TRAVERSED_INTERIOR_NODE(const_cast<LinearBVHNode *>(node));
+                uint32_t firstChild = nodeNum + 1;
+                uint32_t secondChild = node->secondChildOffset;
+                if (treeletLayout) {
+                    firstChild = node->childPairOffset;
+                    secondChild = firstChild + 1;
+                }
                 if (dirIsNeg[node->axis]) {
-                   todo[todoOffset++] = nodeNum + 1;
-                   nodeNum = node->secondChildOffset;
+                   todo[todoOffset++] = firstChild;
+                   nodeNum = secondChild;
                 }
                 else {
-                   todo[todoOffset++] = node->secondChildOffset;
-                   nodeNum = nodeNum + 1;
+                   todo[todoOffset++] = secondChild;
+                   nodeNum = firstChild;
                 }
             }
         }
@@ -455,6 +742,7 @@ bool BVHAccel::Intersect(const Ray &ray, Intersection *isect) const {
 
 
 bool BVHAccel::IntersectP(const Ray &ray) const {
+    if (quantizedNodes) return quantizedIntersect(ray, NULL);
     if (!nodes) return false;
     PBRT_BVH_INTERSECTIONP_STARTED(const_cast<BVHAccel *>(this), const_cast<Ray *>(&ray));
     Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
@@ -482,14 +770,20 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
             }
             else {
                 PBRT_BVH_INTERSECTIONP_TRAVERSED_INTERIOR_NODE(const_cast<LinearBVHNode *>(node));
+                uint32_t firstChild = nodeNum + 1;
+                uint32_t secondChild = node->secondChildOffset;
+                if (treeletLayout) {
+                    firstChild = node->childPairOffset;
+                    secondChild = firstChild + 1;
+                }
                 if (dirIsNeg[node->axis]) {
                    /// second child first
-                   todo[todoOffset++] = nodeNum + 1;
-                   nodeNum = node->secondChildOffset;
+                   todo[todoOffset++] = firstChild;
+                   nodeNum = secondChild;
                 }
                 else {
-                   todo[todoOffset++] = node->secondChildOffset;
-                   nodeNum = nodeNum + 1;
+                   todo[todoOffset++] = secondChild;
+                   nodeNum = firstChild;
                 }
             }
         }
@@ -507,7 +801,20 @@ BVHAccel *CreateBVHAccelerator(const vector<Reference<Primitive> > &prims,
         const ParamSet &ps) {
     string splitMethod = ps.FindOneString("splitmethod", "sah");
     uint32_t maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return new BVHAccel(prims, maxPrimsInNode, splitMethod);
+    string compression = ps.FindOneString("compression", "none");
+    if (compression != "none" && compression != "quantized") {
+        Warning("BVH compression \"%s\" unknown.  Using \"none\".",
+                compression.c_str());
+        compression = "none";
+    }
+    string layout = ps.FindOneString("layout", "depthfirst");
+    if (layout != "depthfirst" && layout != "treelet") {
+        Warning("BVH layout \"%s\" unknown.  Using \"depthfirst\".",
+                layout.c_str());
+        layout = "depthfirst";
+    }
+    return new BVHAccel(prims, maxPrimsInNode, splitMethod,
+                        compression == "quantized", layout == "treelet");
 }
 
 
@@ -44,6 +44,7 @@ struct BVHBuildNode;
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 struct LinearBVHNode;
+struct QuantizedBVHNode;
 
 /*
 (BVHAccel) based on building a hierarchy of bounding boxes around objects in the scene
@@ -65,7 +66,8 @@ class BVHAccel : public Aggregate {
 public:
     // BVHAccel Public Methods
     BVHAccel(const vector<Reference<Primitive> > &p, uint32_t maxPrims = 1,
-             const string &sm = "sah");
+             const string &sm = "sah", bool quantize = false,
+             bool treelets = false);
     BBox WorldBound() const;
     bool CanIntersect() const { return true; }
     ~BVHAccel();
@@ -77,6 +79,10 @@ private:
         vector<BVHPrimitiveInfo> &buildData, uint32_t start, uint32_t end,
         uint32_t *totalNodes, vector<Reference<Primitive> > &orderedPrims);
     uint32_t flattenBVHTree(BVHBuildNode *node, uint32_t *offset);
+    void layoutNodes(uint32_t totalNodes);
+    uint32_t flattenQuantizedBVHTree(BVHBuildNode *node,
+        vector<QuantizedBVHNode> &qnodes);
+    bool quantizedIntersect(const Ray &ray, Intersection *isect) const;
 
     // BVHAccel Private Data
     uint32_t maxPrimsInNode;
@@ -84,6 +90,9 @@ private:
     SplitMethod splitMethod;
     vector<Reference<Primitive> > primitives;
     LinearBVHNode *nodes;
+    QuantizedBVHNode *quantizedNodes;
+    bool treeletLayout;
+    BBox bounds;
 };
 
 
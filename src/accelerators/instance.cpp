@@ -0,0 +1,411 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+
+// accelerators/instance.cpp*
+#include "stdafx.h"
+#include "accelerators/instance.h"
+#include "intersection.h"
+
+// InstanceAccel Local Declarations
+struct InstanceBuildInfo {
+    InstanceBuildInfo() { }
+    InstanceBuildInfo(uint32_t in, const BBox &b)
+        : instanceNumber(in), bounds(b) {
+        centroid = .5f * b.pMin + .5f * b.pMax;
+    }
+    uint32_t instanceNumber;
+    Point centroid;
+    BBox bounds;
+};
+
+
+struct LinearInstanceNode {
+    BBox bounds;
+    union {
+        uint32_t instancesOffset;     // leaf
+        uint32_t secondChildOffset;   // interior
+    };
+
+    uint8_t nInstances;   // 0 -> interior node
+    uint8_t axis;         // interior node: xyz
+    uint8_t pad[2];       // ensure 32 byte total size
+};
+
+
+struct CompareInstanceCentroids {
+    CompareInstanceCentroids(int d) { dim = d; }
+    int dim;
+    bool operator()(const InstanceBuildInfo &a,
+                    const InstanceBuildInfo &b) const {
+        return a.centroid[dim] < b.centroid[dim];
+    }
+};
+
+
+struct CompareToInstanceBucket {
+    CompareToInstanceBucket(int split, int num, int d, const BBox &b)
+        : centroidBounds(b)
+    { splitBucket = split; nBuckets = num; dim = d; }
+    bool operator()(const InstanceBuildInfo &p) const {
+        int b = nBuckets * ((p.centroid[dim] - centroidBounds.pMin[dim]) /
+                (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]));
+        if (b == nBuckets) b = nBuckets-1;
+        Assert(b >= 0 && b < nBuckets);
+        return b <= splitBucket;
+    }
+
+    int splitBucket, nBuckets, dim;
+    const BBox &centroidBounds;
+};
+
+
+static inline bool IntersectP(const BBox &bounds, const Ray &ray,
+        const Vector &invDir, const uint32_t dirIsNeg[3]) {
+    // Check for ray intersection against $x$ and $y$ slabs
+    float tmin =  (bounds[  dirIsNeg[0]].x - ray.o.x) * invDir.x;
+    float tmax =  (bounds[1-dirIsNeg[0]].x - ray.o.x) * invDir.x;
+    float tymin = (bounds[  dirIsNeg[1]].y - ray.o.y) * invDir.y;
+    float tymax = (bounds[1-dirIsNeg[1]].y - ray.o.y) * invDir.y;
+    if ((tmin > tymax) || (tymin > tmax))
+        return false;
+    if (tymin > tmin) tmin = tymin;
+    if (tymax < tmax) tmax = tymax;
+
+    // Check for ray intersection against $z$ slab
+    float tzmin = (bounds[  dirIsNeg[2]].z - ray.o.z) * invDir.z;
+    float tzmax = (bounds[1-dirIsNeg[2]].z - ray.o.z) * invDir.z;
+    if ((tmin > tzmax) || (tzmin > tmax))
+        return false;
+    if (tzmin > tmin)
+        tmin = tzmin;
+    if (tzmax < tmax)
+        tmax = tzmax;
+    return (tmin < ray.maxt) && (tmax > ray.mint);
+}
+
+
+// Build the top-level BVH directly in depth-first linear order; leaves
+// refer to contiguous ranges of _buildData_
+static uint32_t buildInstanceTree(vector<InstanceBuildInfo> &buildData,
+        uint32_t start, uint32_t end, uint32_t maxInstancesInNode,
+        vector<LinearInstanceNode> &nodes) {
+    Assert(start != end);
+    uint32_t nodeNum = nodes.size();
+    nodes.push_back(LinearInstanceNode());
+
+    // Compute bounds of all instances and instance centroids in node
+    BBox bbox, centroidBounds;
+    for (uint32_t i = start; i < end; ++i) {
+        bbox = Union(bbox, buildData[i].bounds);
+        centroidBounds = Union(centroidBounds, buildData[i].centroid);
+    }
+    uint32_t nInstances = end - start;
+    int dim = centroidBounds.MaximumExtent();
+
+    // Choose split position _mid_ or create a leaf
+    uint32_t mid = start;
+    if (nInstances == 1)
+        ;
+    else if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
+        if (nInstances > maxInstancesInNode)
+            mid = (start + end) / 2;
+    }
+    else if (nInstances <= 4) {
+        if (nInstances > maxInstancesInNode) {
+            mid = (start + end) / 2;
+            std::nth_element(&buildData[start], &buildData[mid],
+                             &buildData[end-1]+1, CompareInstanceCentroids(dim));
+        }
+    }
+    else {
+        // Partition instances using approximate SAH
+        const int nBuckets = 12;
+        struct BucketInfo {
+            BucketInfo() { count = 0; }
+            int count;
+            BBox bounds;
+        };
+        BucketInfo buckets[nBuckets];
+        for (uint32_t i = start; i < end; ++i) {
+            int b = nBuckets *
+                ((buildData[i].centroid[dim] - centroidBounds.pMin[dim]) /
+                 (centroidBounds.pMax[dim] - centroidBounds.pMin[dim]));
+            if (b == nBuckets) b = nBuckets-1;
+            Assert(b >= 0 && b < nBuckets);
+            buckets[b].count++;
+            buckets[b].bounds = Union(buckets[b].bounds, buildData[i].bounds);
+        }
+
+        // Sweep the buckets once from each side to find the cheapest split
+        float cost[nBuckets-1];
+        BBox b0;
+        int count0 = 0;
+        for (int i = 0; i < nBuckets-1; ++i) {
+            b0 = Union(b0, buckets[i].bounds);
+            count0 += buckets[i].count;
+            cost[i] = count0 * b0.SurfaceArea();
+        }
+        BBox b1;
+        int count1 = 0;
+        for (int i = nBuckets-1; i > 0; --i) {
+            b1 = Union(b1, buckets[i].bounds);
+            count1 += buckets[i].count;
+            cost[i-1] = .125f + (cost[i-1] + count1 * b1.SurfaceArea()) /
+                        bbox.SurfaceArea();
+        }
+        float minCost = cost[0];
+        int minCostSplit = 0;
+        for (int i = 1; i < nBuckets-1; ++i) {
+            if (cost[i] < minCost) {
+                minCost = cost[i];
+                minCostSplit = i;
+            }
+        }
+        if (nInstances > maxInstancesInNode || minCost < nInstances) {
+            InstanceBuildInfo *pmid = std::partition(&buildData[start],
+                &buildData[end-1]+1,
+                CompareToInstanceBucket(minCostSplit, nBuckets, dim,
+                                        centroidBounds));
+            mid = pmid - &buildData[0];
+            if (mid == start || mid == end) {
+                mid = (start + end) / 2;
+                std::nth_element(&buildData[start], &buildData[mid],
+                    &buildData[end-1]+1, CompareInstanceCentroids(dim));
+            }
+        }
+    }
+
+    if (mid == start) {
+        // Create leaf _LinearInstanceNode_
+        nodes[nodeNum].bounds = bbox;
+        nodes[nodeNum].instancesOffset = start;
+        nodes[nodeNum].nInstances = nInstances;
+    }
+    else {
+        // Create interior _LinearInstanceNode_; first child follows it
+        buildInstanceTree(buildData, start, mid, maxInstancesInNode, nodes);
+        uint32_t second = buildInstanceTree(buildData, mid, end,
+                                            maxInstancesInNode, nodes);
+        nodes[nodeNum].bounds = bbox;
+        nodes[nodeNum].secondChildOffset = second;
+        nodes[nodeNum].nInstances = 0;
+        nodes[nodeNum].axis = dim;
+    }
+    return nodeNum;
+}
+
+
+
+// InstanceRecord Method Definitions
+InstanceRecord::InstanceRecord(const Transform &worldToInstance,
+                               uint32_t proto) {
+    const Matrix4x4 &mat = worldToInstance.GetMatrix();
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j)
+            m[i][j] = mat.m[i][j];
+    prototype = proto;
+}
+
+
+Transform InstanceRecord::WorldToInstance() const {
+    return Transform(Matrix4x4(m[0][0], m[0][1], m[0][2], m[0][3],
+                               m[1][0], m[1][1], m[1][2], m[1][3],
+                               m[2][0], m[2][1], m[2][2], m[2][3],
+                                   0.f,     0.f,     0.f,     1.f));
+}
+
+
+bool IsAffine(const Transform &t) {
+    const Matrix4x4 &m = t.GetMatrix();
+    return m.m[3][0] == 0.f && m.m[3][1] == 0.f && m.m[3][2] == 0.f &&
+           m.m[3][3] == 1.f;
+}
+
+
+
+// InstanceAccel Method Definitions
+InstanceAccel::InstanceAccel(const vector<Reference<BVHAccel> > &protos,
+        vector<InstanceRecord> &inst, uint32_t mi)
+    : prototypes(protos) {
+    maxInstancesInNode = min(255u, max(1u, mi));
+    nodes = NULL;
+    // Reserve a contiguous range of primitive ids, one per instance
+    firstInstanceId = nextprimitiveId;
+    nextprimitiveId += inst.size();
+    if (inst.size() == 0) return;
+
+    // Compute world-space bounds of each instance
+    vector<BBox> protoBounds(prototypes.size());
+    for (uint32_t i = 0; i < prototypes.size(); ++i)
+        protoBounds[i] = prototypes[i]->WorldBound();
+    vector<InstanceBuildInfo> buildData;
+    buildData.reserve(inst.size());
+    for (uint32_t i = 0; i < inst.size(); ++i) {
+        Assert(inst[i].prototype < prototypes.size());
+        Transform instanceToWorld = Inverse(inst[i].WorldToInstance());
+        buildData.push_back(InstanceBuildInfo(i,
+            instanceToWorld(protoBounds[inst[i].prototype])));
+    }
+
+    // Build top-level BVH and reorder instances to match its leaves
+    vector<LinearInstanceNode> buildNodes;
+    buildNodes.reserve(2 * inst.size());
+    buildInstanceTree(buildData, 0, buildData.size(), maxInstancesInNode,
+                      buildNodes);
+    instances.reserve(inst.size());
+    for (uint32_t i = 0; i < buildData.size(); ++i)
+        instances.push_back(inst[buildData[i].instanceNumber]);
+    vector<InstanceRecord>().swap(inst);
+    nodes = AllocAligned<LinearInstanceNode>(buildNodes.size());
+    for (uint32_t i = 0; i < buildNodes.size(); ++i)
+        nodes[i] = buildNodes[i];
+    Info("Instance BVH created with %d nodes for %d instances of %d "
+         "prototypes (%.2f MB)", (int)buildNodes.size(), (int)instances.size(),
+         (int)prototypes.size(),
+         float(buildNodes.size() * sizeof(LinearInstanceNode) +
+               instances.size() * sizeof(InstanceRecord)) / (1024.f*1024.f));
+}
+
+
+InstanceAccel::~InstanceAccel() {
+    FreeAligned(nodes);
+}
+
+
+BBox InstanceAccel::WorldBound() const {
+    return nodes ? nodes[0].bounds : BBox();
+}
+
+
+bool InstanceAccel::Intersect(const Ray &ray, Intersection *isect) const {
+    if (!nodes) return false;
+    uint32_t hitInstance = 0;
+    bool hit = false;
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    // Follow ray through top-level nodes into the prototype BVHs
+    uint32_t todoOffset = 0, nodeNum = 0;
+    uint32_t todo[64];
+    while (true) {
+        const LinearInstanceNode *node = &nodes[nodeNum];
+        if (::IntersectP(node->bounds, ray, invDir, dirIsNeg)) {
+            if (node->nInstances > 0) {
+                // Intersect instance-space ray with each instance's prototype
+                for (uint32_t i = 0; i < node->nInstances; ++i) {
+                    const InstanceRecord &in = instances[node->instancesOffset+i];
+                    Ray r(in.XformPoint(ray.o), in.XformVector(ray.d),
+                          ray.mint, ray.maxt, ray.time, ray.depth);
+                    if (prototypes[in.prototype]->BVHAccel::Intersect(r, isect)) {
+                        ray.maxt = r.maxt;
+                        hitInstance = node->instancesOffset + i;
+                        hit = true;
+                    }
+                }
+                if (todoOffset == 0) break;
+                nodeNum = todo[--todoOffset];
+            }
+            else {
+                // Put far node on _todo_ stack, advance to near node
+                if (dirIsNeg[node->axis]) {
+                   todo[todoOffset++] = nodeNum + 1;
+                   nodeNum = node->secondChildOffset;
+                }
+                else {
+                   todo[todoOffset++] = node->secondChildOffset;
+                   nodeNum = nodeNum + 1;
+                }
+            }
+        }
+        else {
+            if (todoOffset == 0) break;
+            nodeNum = todo[--todoOffset];
+        }
+    }
+    if (!hit) return false;
+
+    // Transform closest hit's differential geometry to world space
+    Transform w2i = instances[hitInstance].WorldToInstance();
+    isect->primitiveId = firstInstanceId + hitInstance;
+    isect->WorldToObject = isect->WorldToObject * w2i;
+    isect->ObjectToWorld = Inverse(isect->WorldToObject);
+    Transform InstanceToWorld = Inverse(w2i);
+    isect->dg.p = InstanceToWorld(isect->dg.p);
+    isect->dg.nn = Normalize(InstanceToWorld(isect->dg.nn));
+    isect->dg.dpdu = InstanceToWorld(isect->dg.dpdu);
+    isect->dg.dpdv = InstanceToWorld(isect->dg.dpdv);
+    isect->dg.dndu = InstanceToWorld(isect->dg.dndu);
+    isect->dg.dndv = InstanceToWorld(isect->dg.dndv);
+    return true;
+}
+
+
+bool InstanceAccel::IntersectP(const Ray &ray) const {
+    if (!nodes) return false;
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    uint32_t todo[64];
+    uint32_t todoOffset = 0, nodeNum = 0;
+    while (true) {
+        const LinearInstanceNode *node = &nodes[nodeNum];
+        if (::IntersectP(node->bounds, ray, invDir, dirIsNeg)) {
+            if (node->nInstances > 0) {
+                for (uint32_t i = 0; i < node->nInstances; ++i) {
+                    const InstanceRecord &in = instances[node->instancesOffset+i];
+                    Ray r(in.XformPoint(ray.o), in.XformVector(ray.d),
+                          ray.mint, ray.maxt, ray.time, ray.depth);
+                    if (prototypes[in.prototype]->BVHAccel::IntersectP(r))
+                        return true;
+                }
+                if (todoOffset == 0) break;
+                nodeNum = todo[--todoOffset];
+            }
+            else {
+                if (dirIsNeg[node->axis]) {
+                   todo[todoOffset++] = nodeNum + 1;
+                   nodeNum = node->secondChildOffset;
+                }
+                else {
+                   todo[todoOffset++] = node->secondChildOffset;
+                   nodeNum = nodeNum + 1;
+                }
+            }
+        }
+        else {
+            if (todoOffset == 0) break;
+            nodeNum = todo[--todoOffset];
+        }
+    }
+    return false;
+}
+
+
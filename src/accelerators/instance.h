@@ -0,0 +1,114 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#ifndef PBRT_ACCELERATORS_INSTANCE_H
+#define PBRT_ACCELERATORS_INSTANCE_H
+
+// accelerators/instance.h*
+#include "pbrt.h"
+#include "primitive.h"
+#include "accelerators/bvh.h"
+
+// InstanceAccel Forward Declarations
+struct LinearInstanceNode;
+
+/*
+An InstanceRecord is the compact, per-instance representation used by
+InstanceAccel: the affine world-to-instance transformation stored as a
+3x4 matrix (the bottom row of an affine matrix is always (0,0,0,1)) and
+the index of the shared prototype BVH. No Transform objects, reference
+counts or per-instance Primitives are allocated, so scenes with millions
+of instances (foliage, crowds) stay within a small, predictable memory
+footprint.
+*/
+// InstanceRecord Declarations
+struct InstanceRecord {
+    // InstanceRecord Public Methods
+    InstanceRecord() { }
+    InstanceRecord(const Transform &worldToInstance, uint32_t proto);
+    Point XformPoint(const Point &p) const {
+        return Point(m[0][0]*p.x + m[0][1]*p.y + m[0][2]*p.z + m[0][3],
+                     m[1][0]*p.x + m[1][1]*p.y + m[1][2]*p.z + m[1][3],
+                     m[2][0]*p.x + m[2][1]*p.y + m[2][2]*p.z + m[2][3]);
+    }
+    Vector XformVector(const Vector &v) const {
+        return Vector(m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+                      m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+                      m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z);
+    }
+    Transform WorldToInstance() const;
+
+    // InstanceRecord Public Data
+    float m[3][4];
+    uint32_t prototype;
+};
+
+
+/*
+InstanceAccel is a two-level acceleration structure for object instancing.
+The bottom level is one BVHAccel per ObjectBegin/ObjectEnd definition,
+shared by every instance of it; the top level is a BVH over the instance
+bounds whose leaves refer directly to InstanceRecords. Rays are transformed
+into instance space with the 3x4 matrix and passed straight to the
+prototype BVHAccel without going through a TransformedPrimitive, and the
+intersection's differential geometry is taken back to world space only
+once, for the closest hit.
+*/
+// InstanceAccel Declarations
+class InstanceAccel : public Aggregate {
+public:
+    // InstanceAccel Public Methods
+    InstanceAccel(const vector<Reference<BVHAccel> > &prototypes,
+                  vector<InstanceRecord> &instances,
+                  uint32_t maxInstancesInNode = 4);
+    ~InstanceAccel();
+    BBox WorldBound() const;
+    bool CanIntersect() const { return true; }
+    bool Intersect(const Ray &ray, Intersection *isect) const;
+    bool IntersectP(const Ray &ray) const;
+private:
+    // InstanceAccel Private Data
+    uint32_t maxInstancesInNode;
+    vector<Reference<BVHAccel> > prototypes;
+    vector<InstanceRecord> instances;
+    LinearInstanceNode *nodes;
+    uint32_t firstInstanceId;
+};
+
+
+bool IsAffine(const Transform &t);
+
+#endif // PBRT_ACCELERATORS_INSTANCE_H
@@ -33,6 +33,7 @@
 // accelerators/kdtreeaccel.cpp*
 #include "stdafx.h"
 #include "accelerators/kdtreeaccel.h"
+#include "accelerators/treelet.h"
 #include "paramset.h"
 
 // KdTreeAccel Local Declarations
@@ -49,6 +50,7 @@ struct KdAccelNode {
     uint32_t SplitAxis() const { return flags & 3; }
     bool IsLeaf() const { return (flags & 3) == 3; }
     uint32_t AboveChild() const { return aboveChild >> 2; }
+    uint32_t ChildPairOffset() const { return childPair >> 2; }
     union {
         float split;            // Interior
         uint32_t onePrimitive;  // Leaf
@@ -60,6 +62,7 @@ private:
         uint32_t flags;         // Both
         uint32_t nPrims;        // Leaf
         uint32_t aboveChild;    // Interior
+        uint32_t childPair;     // Interior, treelet layout
     };
 };
 
@@ -87,9 +90,9 @@ struct BoundEdge {
 // KdTreeAccel Method Definitions
 KdTreeAccel::KdTreeAccel(const vector<Reference<Primitive> > &p,
                          int icost, int tcost, float ebonus, int maxp,
-                         int md)
+                         int md, bool treelets)
     : isectCost(icost), traversalCost(tcost), maxPrims(maxp), maxDepth(md),
-      emptyBonus(ebonus) {
+      emptyBonus(ebonus), treeletLayout(treelets) {
     PBRT_KDTREE_STARTED_CONSTRUCTION(this, p.size());
     for (uint32_t i = 0; i < p.size(); ++i)
         p[i]->FullyRefine(primitives);
@@ -129,6 +132,7 @@ KdTreeAccel::KdTreeAccel(const vector<Reference<Primitive> > &p,
         delete[] edges[i];
     delete[] prims0;
     delete[] prims1;
+    if (treelets) layoutNodes();
     PBRT_KDTREE_FINISHED_CONSTRUCTION(this);
 }
 
@@ -274,6 +278,35 @@ void KdTreeAccel::buildTree(int nodeNum, const BBox &nodeBounds,
 }
 
 
+void KdTreeAccel::layoutNodes() {
+    // Find children of depth-first nodes
+    vector<uint32_t> children(2 * nextFreeNode, 0);
+    for (int i = 0; i < nextFreeNode; ++i)
+        if (!nodes[i].IsLeaf()) {
+            children[2*i] = i + 1;
+            children[2*i+1] = nodes[i].AboveChild();
+        }
+
+    // Copy nodes into page-aligned treelets with siblings adjacent
+    vector<uint32_t> newOffset;
+    uint32_t nNodes = TreeletLayoutBinaryTree(children, sizeof(KdAccelNode),
+                                              &newOffset);
+    KdAccelNode *laidOut = AllocAligned<KdAccelNode>(nNodes,
+                                                     PBRT_TREELET_PAGE_SIZE);
+    for (int i = 0; i < nextFreeNode; ++i) {
+        KdAccelNode &node = laidOut[newOffset[i]];
+        if (nodes[i].IsLeaf())
+            node = nodes[i];
+        else  // _childPair_ holds the below child; the above child follows
+            node.initInterior(nodes[i].SplitAxis(), newOffset[i + 1],
+                              nodes[i].SplitPos());
+    }
+    FreeAligned(nodes);
+    nodes = laidOut;
+    nAllocedNodes = nextFreeNode = nNodes;
+}
+
+
 bool KdTreeAccel::Intersect(const Ray &ray,
                             Intersection *isect) const {
     PBRT_KDTREE_INTERSECTION_TEST(const_cast<KdTreeAccel *>(this), const_cast<Ray *>(&ray));
@@ -309,13 +342,19 @@ bool KdTreeAccel::Intersect(const Ray &ray,
             const KdAccelNode *firstChild, *secondChild;
             int belowFirst = (ray.o[axis] <  node->SplitPos()) ||
                              (ray.o[axis] == node->SplitPos() && ray.d[axis] <= 0);
+            const KdAccelNode *belowChild = node + 1;
+            const KdAccelNode *aboveChild = &nodes[node->AboveChild()];
+            if (treeletLayout) {
+                belowChild = &nodes[node->ChildPairOffset()];
+                aboveChild = belowChild + 1;
+            }
             if (belowFirst) {
-                firstChild = node + 1;
-                secondChild = &nodes[node->AboveChild()];
+                firstChild = belowChild;
+                secondChild = aboveChild;
             }
             else {
-                firstChild = &nodes[node->AboveChild()];
-                secondChild = node + 1;
+                firstChild = aboveChild;
+                secondChild = belowChild;
             }
 
             // Advance to next child node, possibly enqueue other child
@@ -440,13 +479,19 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
             const KdAccelNode *firstChild, *secondChild;
             int belowFirst = (ray.o[axis] <  node->SplitPos()) ||
                              (ray.o[axis] == node->SplitPos() && ray.d[axis] <= 0);
+            const KdAccelNode *belowChild = node + 1;
+            const KdAccelNode *aboveChild = &nodes[node->AboveChild()];
+            if (treeletLayout) {
+                belowChild = &nodes[node->ChildPairOffset()];
+                aboveChild = belowChild + 1;
+            }
             if (belowFirst) {
-                firstChild = node + 1;
-                secondChild = &nodes[node->AboveChild()];
+                firstChild = belowChild;
+                secondChild = aboveChild;
             }
             else {
-                firstChild = &nodes[node->AboveChild()];
-                secondChild = node + 1;
+                firstChild = aboveChild;
+                secondChild = belowChild;
             }
 
             // Advance to next child node, possibly enqueue other child
@@ -477,8 +522,14 @@ KdTreeAccel *CreateKdTreeAccelerator(const vector<Reference<Primitive> > &prims,
     float emptyBonus = ps.FindOneFloat("emptybonus", 0.5f);
     int maxPrims = ps.FindOneInt("maxprims", 1);
     int maxDepth = ps.FindOneInt("maxdepth", -1);
+    string layout = ps.FindOneString("layout", "depthfirst");
+    if (layout != "depthfirst" && layout != "treelet") {
+        Warning("Kd-tree layout \"%s\" unknown.  Using \"depthfirst\".",
+                layout.c_str());
+        layout = "depthfirst";
+    }
     return new KdTreeAccel(prims, isectCost, travCost,
-        emptyBonus, maxPrims, maxDepth);
+        emptyBonus, maxPrims, maxDepth, layout == "treelet");
 }
 
 
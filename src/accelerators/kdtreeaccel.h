@@ -72,7 +72,7 @@ public:
     // KdTreeAccel Public Methods
     KdTreeAccel(const vector<Reference<Primitive> > &p,
                 int icost = 80, int scost = 1,  float ebonus = 0.5f, int maxp = 1,
-                int maxDepth = -1);
+                int maxDepth = -1, bool treelets = false);
     BBox WorldBound() const { return bounds; }
     bool CanIntersect() const { return true; }
     ~KdTreeAccel();
@@ -83,6 +83,7 @@ private:
     void buildTree(int nodeNum, const BBox &bounds,
         const vector<BBox> &primBounds, uint32_t *primNums, int nprims, int depth,
         BoundEdge *edges[3], uint32_t *prims0, uint32_t *prims1, int badRefines = 0);
+    void layoutNodes();
 
     // KdTreeAccel Private Data
     int isectCost, traversalCost, maxPrims, maxDepth;
@@ -90,6 +91,7 @@ private:
     vector<Reference<Primitive> > primitives;
     KdAccelNode *nodes;
     int nAllocedNodes, nextFreeNode;
+    bool treeletLayout;
     BBox bounds;
     MemoryArena arena;
 };
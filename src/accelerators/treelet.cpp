@@ -0,0 +1,159 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// accelerators/treelet.cpp*
+#include "stdafx.h"
+#include "accelerators/treelet.h"
+
+// Treelet Layout Local Declarations
+static const uint32_t NO_NODE = ~0u;
+struct TreeletBuilder {
+    // TreeletBuilder Public Methods
+    TreeletBuilder(const vector<uint32_t> &cs, const vector<uint32_t> &c,
+                   uint32_t unitBytes, vector<int32_t> *o)
+        : childStart(cs), children(c), order(o), nextTreelet(0) {
+        // Size treelets to fill whole cache lines within pages
+        capacity[1] = max(1u, PBRT_L1_CACHE_LINE_SIZE / unitBytes);
+        capacity[0] = max(capacity[1], PBRT_TREELET_PAGE_SIZE / unitBytes /
+                                       capacity[1] * capacity[1]);
+        treelet[0].resize(childStart.size() - 1, -1);
+        treelet[1].resize(childStart.size() - 1, -1);
+    }
+    void Emit(uint32_t root, int level);
+
+    // TreeletBuilder Public Data
+    const vector<uint32_t> &childStart, &children;
+    vector<int32_t> *order;
+    uint32_t capacity[2];
+    vector<int32_t> treelet[2];
+    int32_t nextTreelet;
+    vector<uint32_t> members;
+};
+
+
+
+// Treelet Layout Method Definitions
+void TreeletBuilder::Emit(uint32_t root, int level) {
+    // Gather treelet breadth-first from _root_ within the enclosing treelet
+    int32_t scope = level > 0 ? treelet[level-1][root] : -1;
+    int32_t id = nextTreelet++;
+    uint32_t start = members.size();
+    members.push_back(root);
+    treelet[level][root] = id;
+    for (uint32_t i = start; i < members.size(); ++i) {
+        for (uint32_t j = childStart[members[i]];
+             j < childStart[members[i]+1] &&
+             members.size() - start < capacity[level];
+             ++j) {
+            uint32_t c = children[j];
+            if (level > 0 && treelet[level-1][c] != scope) continue;
+            treelet[level][c] = id;
+            members.push_back(c);
+        }
+    }
+
+    // Emit treelet units, keeping each treelet within a line or page
+    uint32_t end = members.size();
+    if (level == 1) {
+        uint32_t linePos = order->size() % capacity[1];
+        if (linePos + end - start > capacity[1])
+            order->resize(order->size() + capacity[1] - linePos, -1);
+        for (uint32_t i = start; i < end; ++i)
+            order->push_back(members[i]);
+    }
+    else {
+        // Redo a page treelet that straddles a page from the next page
+        uint32_t first = order->size();
+        Emit(root, level + 1);
+        uint32_t pagePos = first % capacity[0];
+        if (pagePos > 0 && pagePos + order->size() - first > capacity[0]) {
+            order->resize(first);
+            order->resize(first + capacity[0] - pagePos, -1);
+            Emit(root, level + 1);
+        }
+    }
+
+    // Emit subtrees below the treelet's frontier; _members_ is a shared stack
+    for (uint32_t i = start; i < end; ++i)
+        for (uint32_t j = childStart[members[i]]; j < childStart[members[i]+1]; ++j) {
+            uint32_t c = children[j];
+            if (level > 0 && treelet[level-1][c] != scope) continue;
+            if (treelet[level][c] != id) Emit(c, level);
+        }
+    members.resize(start);
+}
+
+
+void TreeletOrder(const vector<uint32_t> &childStart,
+                  const vector<uint32_t> &children, uint32_t unitBytes,
+                  vector<int32_t> *order) {
+    // Order units of the tree rooted at unit 0; _-1_ entries are padding
+    order->clear();
+    order->reserve(childStart.size() - 1);
+    TreeletBuilder builder(childStart, children, unitBytes, order);
+    builder.Emit(0, 0);
+}
+
+
+uint32_t TreeletLayoutBinaryTree(const vector<uint32_t> &children,
+                                 uint32_t nodeBytes,
+                                 vector<uint32_t> *newOffset) {
+    // Group sibling nodes into units; unit 0 holds the root and a pad node
+    vector<uint32_t> unitNodes, childStart, childUnits;
+    unitNodes.push_back(0);
+    unitNodes.push_back(NO_NODE);
+    for (uint32_t u = 0; u < unitNodes.size() / 2; ++u) {
+        childStart.push_back(childUnits.size());
+        for (uint32_t s = 0; s < 2; ++s) {
+            uint32_t n = unitNodes[2*u+s];
+            if (n == NO_NODE || children[2*n] == 0) continue;
+            childUnits.push_back(unitNodes.size() / 2);
+            unitNodes.push_back(children[2*n]);
+            unitNodes.push_back(children[2*n+1]);
+        }
+    }
+    childStart.push_back(childUnits.size());
+    vector<int32_t> order;
+    TreeletOrder(childStart, childUnits, 2 * nodeBytes, &order);
+
+    // Compute new offset of each node from its unit's position
+    newOffset->resize(children.size() / 2);
+    for (uint32_t i = 0; i < order.size(); ++i) {
+        if (order[i] < 0) continue;
+        for (uint32_t s = 0; s < 2; ++s)
+            if (unitNodes[2*order[i]+s] != NO_NODE)
+                (*newOffset)[unitNodes[2*order[i]+s]] = 2*i + s;
+    }
+    return 2 * order.size();
+}
+
+
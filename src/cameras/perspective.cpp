@@ -46,6 +46,16 @@ PerspectiveCamera:: PerspectiveCamera(const AnimatedTransform &cam2world,
     // Compute differential changes in origin for perspective camera rays
     dxCamera = RasterToCamera(Point(1,0,0)) - RasterToCamera(Point(0,0,0));
     dyCamera = RasterToCamera(Point(0,1,0)) - RasterToCamera(Point(0,0,0));
+
+    // Compute area of the sampled image region on the $z=1$ plane
+    CameraToRaster = Inverse(RasterToCamera);
+    int xs, xe, ys, ye;
+    film->GetSampleExtent(&xs, &xe, &ys, &ye);
+    xSampleStart = xs; xSampleEnd = xe;
+    ySampleStart = ys; ySampleEnd = ye;
+    Point p00 = RasterToCamera(Point(0,0,0));
+    Vector dx = dxCamera / p00.z, dy = dyCamera / p00.z;
+    sampleArea = Cross(dx, dy).Length() * (xe - xs) * (ye - ys);
 }
 
 
@@ -138,6 +148,31 @@ float PerspectiveCamera::GenerateRayDifferential(const CameraSample &sample,
 }
 
 
+bool PerspectiveCamera::Project(const Point &p, float time,
+        float *rasterX, float *rasterY, Point *pLens, float *pdfDir) const {
+    // Only pinhole cameras can be connected to light subpaths
+    if (lensRadius > 0.f) return false;
+    Transform c2w;
+    CameraToWorld.Interpolate(time, &c2w);
+    Point pCamera = Inverse(c2w)(p);
+    if (pCamera.z <= 0.f) return false;
+
+    // Find raster position of _p_ and check that it's inside the sampled region
+    Point pRaster = CameraToRaster(pCamera);
+    if (pRaster.x < xSampleStart || pRaster.x >= xSampleEnd ||
+        pRaster.y < ySampleStart || pRaster.y >= ySampleEnd)
+        return false;
+    *rasterX = pRaster.x;
+    *rasterY = pRaster.y;
+    *pLens = c2w(Point(0,0,0));
+
+    // Compute directional density of camera rays toward _p_
+    float cosTheta = pCamera.z / Vector(pCamera).Length();
+    *pdfDir = 1.f / (sampleArea * cosTheta * cosTheta * cosTheta);
+    return true;
+}
+
+
 PerspectiveCamera *CreatePerspectiveCamera(const ParamSet &params,
         const AnimatedTransform &cam2world, Film *film) {
     // Extract common camera parameters from _ParamSet_
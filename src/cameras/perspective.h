@@ -51,9 +51,14 @@ public:
     float GenerateRay(const CameraSample &sample, Ray *) const;
     float GenerateRayDifferential(const CameraSample &sample,
                                   RayDifferential *ray) const;
+    bool Project(const Point &p, float time, float *rasterX,
+        float *rasterY, Point *pLens, float *pdfDir) const;
 private:
     // PerspectiveCamera Private Data
     Vector dxCamera, dyCamera;
+    Transform CameraToRaster;
+    float xSampleStart, xSampleEnd, ySampleStart, ySampleEnd;
+    float sampleArea;
 };
 
 
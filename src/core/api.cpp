@@ -45,6 +45,7 @@
 // API Additional Headers
 #include "accelerators/bvh.h"
 #include "accelerators/grid.h"
+#include "accelerators/instance.h"
 #include "accelerators/kdtreeaccel.h"
 #include "cameras/environment.h"
 #include "cameras/orthographic.h"
@@ -56,6 +57,7 @@
 #include "filters/sinc.h"
 #include "filters/triangle.h"
 #include "integrators/ambientocclusion.h"
+#include "integrators/bdpt.h"
 #include "integrators/diffuseprt.h"
 #include "integrators/dipolesubsurface.h"
 #include "integrators/directlighting.h"
@@ -92,11 +94,13 @@
 #include "renderers/createprobes.h"
 #include "renderers/metropolis.h"
 #include "renderers/samplerrenderer.h"
+#include "renderers/sppm.h"
 #include "renderers/surfacepoints.h"
 #include "samplers/adaptive.h"
 #include "samplers/bestcandidate.h"
 #include "samplers/halton.h"
 #include "samplers/lowdiscrepancy.h"
+#include "samplers/sobol.h"
 #include "samplers/random.h"
 #include "samplers/stratified.h"
 #include "shapes/cone.h"
@@ -106,7 +110,9 @@
 #include "shapes/hyperboloid.h"
 #include "shapes/loopsubdiv.h"
 #include "shapes/nurbs.h"
+#include "shapes/objmesh.h"
 #include "shapes/paraboloid.h"
+#include "shapes/plymesh.h"
 #include "shapes/sphere.h"
 #include "shapes/trianglemesh.h"
 #include "textures/bilerp.h"
@@ -191,6 +197,9 @@ struct RenderOptions {
     mutable vector<VolumeRegion *> volumeRegions;
     map<string, vector<Reference<Primitive> > > instances;
     vector<Reference<Primitive> > *currentInstance;
+    map<string, uint32_t> instancePrototypeIndex;
+    vector<Reference<BVHAccel> > instancePrototypes;
+    vector<InstanceRecord> instanceRecords;
 };
 
 
@@ -210,14 +219,21 @@ RenderOptions::RenderOptions() {
 }
 
 
+// Named textures, shared by pushed graphics states and queued shapes
+struct TextureMaps : public ReferenceCounted {
+    map<string, Reference<Texture<float> > > floatTextures;
+    map<string, Reference<Texture<Spectrum> > > spectrumTextures;
+};
+
+
 struct GraphicsState {
     // Graphics State Methods
     GraphicsState();
-    Reference<Material> CreateMaterial(const ParamSet &params);
+    void UnshareTextures();
+    Reference<Material> NamedMaterial() const;
 
     // Graphics State
-    map<string, Reference<Texture<float> > > floatTextures;
-    map<string, Reference<Texture<Spectrum> > > spectrumTextures;
+    Reference<TextureMaps> textures;
     ParamSet materialParams;
     string material;
     map<string, Reference<Material> > namedMaterials;
@@ -230,11 +246,31 @@ struct GraphicsState {
 
 GraphicsState::GraphicsState() {
     // GraphicsState Constructor Implementation
+    textures = new TextureMaps;
     material = "matte";
     reverseOrientation = false;
 }
 
 
+void GraphicsState::UnshareTextures() {
+    // Copy the texture maps before changing maps that are shared
+    if (textures->nReferences > 1) {
+        TextureMaps *tm = new TextureMaps;
+        tm->floatTextures = textures->floatTextures;
+        tm->spectrumTextures = textures->spectrumTextures;
+        textures = tm;
+    }
+}
+
+
+Reference<Material> GraphicsState::NamedMaterial() const {
+    if (currentNamedMaterial == "") return NULL;
+    map<string, Reference<Material> >::const_iterator m =
+        namedMaterials.find(currentNamedMaterial);
+    return m != namedMaterials.end() ? m->second : Reference<Material>();
+}
+
+
 class TransformCache {
 public:
     // TransformCache Public Methods
@@ -283,6 +319,37 @@ static vector<TransformSet> pushedTransforms;
 static vector<uint32_t> pushedActiveTransformBits;
 static TransformCache transformCache;
 
+// Static shapes are queued and created in batches of parallel tasks
+struct PendingShape {
+    string name;
+    ParamSet params, materialParams;
+    Transform *ObjectToWorld, *WorldToObject;
+    bool reverseOrientation;
+    Reference<TextureMaps> textures;
+    string material;
+    Reference<Material> namedMaterial;
+    // Named materials that OBJ mesh _usemtl_ groups are bound to
+    map<string, Reference<Material> > namedMaterials;
+    string areaLight;
+    ParamSet areaLightParams;
+    Transform lightToWorld;
+    vector<Reference<Primitive> > *instance;
+    string file;
+    int line;
+    Reference<Shape> shape;
+};
+
+
+static vector<PendingShape *> pendingShapes;
+static uint32_t maxPendingShapes = 1;
+static void CreatePendingShapes();
+static Reference<Material> MakeShapeMaterial(const ParamSet &params,
+    const Reference<Material> &namedMaterial, const string &material,
+    const ParamSet &materialParams, const Transform &xform,
+    map<string, Reference<Texture<float> > > &floatTextures,
+    map<string, Reference<Texture<Spectrum> > > &spectrumTextures,
+    ParamSet *usedMaterialParams);
+
 // API Macros
 #define VERIFY_INITIALIZED(func) \
 if (currentApiState == STATE_UNINITIALIZED) { \
@@ -316,7 +383,8 @@ do { if (curTransform.IsAnimated()) \
 // Object Creation Function Definitions
 Reference<Shape> MakeShape(const string &name,
         const Transform *object2world, const Transform *world2object,
-        bool reverseOrientation, const ParamSet &paramSet) {
+        bool reverseOrientation, const ParamSet &paramSet,
+        map<string, Reference<Texture<float> > > *floatTextures) {
     Shape *s = NULL;
 
     if (name == "sphere")
@@ -340,7 +408,13 @@ Reference<Shape> MakeShape(const string &name,
                                    paramSet);
     else if (name == "trianglemesh")
         s = CreateTriangleMeshShape(object2world, world2object, reverseOrientation,
-                                    paramSet, &graphicsState.floatTextures);
+                                    paramSet, floatTextures);
+    else if (name == "objmesh")
+        s = CreateOBJMeshShape(object2world, world2object, reverseOrientation,
+                               paramSet, floatTextures);
+    else if (name == "plymesh")
+        s = CreatePLYMeshShape(object2world, world2object, reverseOrientation,
+                               paramSet, floatTextures);
     else if (name == "heightfield")
         s = CreateHeightfieldShape(object2world, world2object, reverseOrientation,
                                    paramSet);
@@ -352,7 +426,6 @@ Reference<Shape> MakeShape(const string &name,
                              paramSet);
     else
         Warning("Shape \"%s\" unknown.", name.c_str());
-    paramSet.ReportUnused();
     return s;
 }
 
@@ -405,7 +478,6 @@ Reference<Material> MakeMaterial(const string &name,
         material = CreateShinyMetalMaterial(mtl2world, mp);
     else
         Warning("Material \"%s\" unknown.", name.c_str());
-    mp.ReportUnused();
     if (!material) Error("Unable to create material \"%s\"", name.c_str());
     return material;
 }
@@ -539,6 +611,8 @@ SurfaceIntegrator *MakeSurfaceIntegrator(const string &name,
         si = CreateDirectLightingIntegrator(paramSet);
     else if (name == "path")
         si = CreatePathSurfaceIntegrator(paramSet);
+    else if (name == "bdpt")
+        si = CreateBDPTSurfaceIntegrator(paramSet);
     else if (name == "photonmap" || name == "exphotonmap")
         si = CreatePhotonMapSurfaceIntegrator(paramSet);
     else if (name == "irradiancecache")
@@ -631,6 +705,8 @@ Sampler *MakeSampler(const string &name,
         sampler = CreateLowDiscrepancySampler(paramSet, film, camera);
     else if (name == "random")
         sampler = CreateRandomSampler(paramSet, film, camera);
+    else if (name == "sobol")
+        sampler = CreateSobolSampler(paramSet, film, camera);
     else if (name == "stratified")
         sampler = CreateStratifiedSampler(paramSet, film, camera);
     else
@@ -673,6 +749,109 @@ Film *MakeFilm(const string &name,
 
 
 
+// Pending Shape Creation Definitions
+class ShapeCreationTask : public Task {
+public:
+    ShapeCreationTask(PendingShape *s) : pending(s) { }
+    void Run() {
+        pending->shape = MakeShape(pending->name, pending->ObjectToWorld,
+            pending->WorldToObject, pending->reverseOrientation,
+            pending->params, &pending->textures->floatTextures);
+    }
+private:
+    PendingShape *pending;
+};
+
+
+static void CreatePendingShapes() {
+    if (pendingShapes.size() == 0) return;
+    extern int line_num;
+    extern string current_file;
+    string savedFile = current_file;
+    int savedLine = line_num;
+    if (pendingShapes.size() == 1) {
+        PendingShape *ps = pendingShapes[0];
+        current_file = ps->file;
+        line_num = ps->line;
+        ps->shape = MakeShape(ps->name, ps->ObjectToWorld, ps->WorldToObject,
+            ps->reverseOrientation, ps->params,
+            &ps->textures->floatTextures);
+    }
+    else {
+        // Create _Shape_s in parallel; their messages can't name a statement
+        line_num = 0;
+        vector<Task *> shapeTasks;
+        for (uint32_t i = 0; i < pendingShapes.size(); ++i)
+            shapeTasks.push_back(new ShapeCreationTask(pendingShapes[i]));
+        EnqueueTasks(shapeTasks);
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < shapeTasks.size(); ++i)
+            delete shapeTasks[i];
+    }
+
+    // Add primitives for the created shapes in scene file order
+    for (uint32_t i = 0; i < pendingShapes.size(); ++i) {
+        PendingShape *ps = pendingShapes[i];
+        current_file = ps->file;
+        line_num = ps->line;
+        if (!ps->shape) {
+            ps->params.ReportUnused();
+            delete ps;
+            continue;
+        }
+        ParamSet usedMaterialParams;
+        Reference<Material> material = MakeShapeMaterial(ps->params,
+            ps->namedMaterial, ps->material, ps->materialParams,
+            *ps->ObjectToWorld, ps->textures->floatTextures,
+            ps->textures->spectrumTextures, &usedMaterialParams);
+        ps->params.ReportUnused();
+        usedMaterialParams.ReportUnused();
+        vector<Reference<Shape> > shapes(1, ps->shape);
+        vector<Reference<Material> > materials(1, material);
+        if (ps->name == "objmesh") {
+            // Use the named material matching each OBJ material group
+            const OBJMesh *obj = (const OBJMesh *)ps->shape.GetPtr();
+            shapes.clear();
+            materials.clear();
+            for (uint32_t j = 0; j < obj->NumGroups(); ++j) {
+                const string &mtlName = obj->GroupMaterial(j);
+                map<string, Reference<Material> >::const_iterator m =
+                    ps->namedMaterials.find(mtlName);
+                if (m == ps->namedMaterials.end() && mtlName != "")
+                    Warning("No named material \"%s\" for OBJ mesh; using "
+                            "current material", mtlName.c_str());
+                shapes.push_back(obj->GroupMesh(j));
+                materials.push_back(m != ps->namedMaterials.end() ?
+                                    m->second : material);
+            }
+        }
+        for (uint32_t j = 0; j < shapes.size(); ++j) {
+            AreaLight *area = NULL;
+            if (ps->areaLight != "")
+                area = MakeAreaLight(ps->areaLight, ps->lightToWorld,
+                                     ps->areaLightParams, shapes[j]);
+            Reference<Primitive> prim =
+                new GeometricPrimitive(shapes[j], materials[j], area);
+            if (ps->instance) {
+                if (area)
+                    Warning("Area lights not supported with object instancing");
+                ps->instance->push_back(prim);
+            }
+            else {
+                renderOptions->primitives.push_back(prim);
+                if (area != NULL)
+                    renderOptions->lights.push_back(area);
+            }
+        }
+        delete ps;
+    }
+    pendingShapes.erase(pendingShapes.begin(), pendingShapes.end());
+    current_file = savedFile;
+    line_num = savedLine;
+}
+
+
+
 // API Function Definitions
 void pbrtInit(const Options &opt) {
 	// еѡ
@@ -695,6 +874,9 @@ void pbrtCleanup() {
     else if (currentApiState == STATE_WORLD_BLOCK)
         Error("pbrtCleanup() called while inside world block.");
     currentApiState = STATE_UNINITIALIZED;
+    for (uint32_t i = 0; i < pendingShapes.size(); ++i)
+        delete pendingShapes[i];
+    pendingShapes.erase(pendingShapes.begin(), pendingShapes.end());
     delete renderOptions;
     renderOptions = NULL;
 }
@@ -860,6 +1042,8 @@ void pbrtWorldBegin() {
         curTransform[i] = Transform();
     activeTransformBits = ALL_TRANSFORMS_BITS;
     namedCoordinateSystems["world"] = curTransform;
+    int nCores = NumSystemCores();
+    maxPendingShapes = (nCores > 1) ? 8 * nCores : 1;
 }
 
 
@@ -911,26 +1095,29 @@ void pbrtTransformEnd() {
 void pbrtTexture(const string &name, const string &type,
                  const string &texname, const ParamSet &params) {
     VERIFY_WORLD("Texture");
-    TextureParams tp(params, params, graphicsState.floatTextures,
-                     graphicsState.spectrumTextures);
+    graphicsState.UnshareTextures();
+    map<string, Reference<Texture<float> > > &floatTextures =
+        graphicsState.textures->floatTextures;
+    map<string, Reference<Texture<Spectrum> > > &spectrumTextures =
+        graphicsState.textures->spectrumTextures;
+    TextureParams tp(params, params, floatTextures, spectrumTextures);
     if (type == "float")  {
         // Create _float_ texture and store in _floatTextures_
-        if (graphicsState.floatTextures.find(name) !=
-            graphicsState.floatTextures.end())
+        if (floatTextures.find(name) != floatTextures.end())
             Info("Texture \"%s\" being redefined", name.c_str());
         WARN_IF_ANIMATED_TRANSFORM("Texture");
         Reference<Texture<float> > ft = MakeFloatTexture(texname,
                                                          curTransform[0], tp);
-        if (ft) graphicsState.floatTextures[name] = ft;
+        if (ft) floatTextures[name] = ft;
     }
     else if (type == "color" || type == "spectrum")  {
         // Create _color_ texture and store in _spectrumTextures_
-        if (graphicsState.spectrumTextures.find(name) != graphicsState.spectrumTextures.end())
+        if (spectrumTextures.find(name) != spectrumTextures.end())
             Info("Texture \"%s\" being redefined", name.c_str());
         WARN_IF_ANIMATED_TRANSFORM("Texture");
         Reference<Texture<Spectrum> > st = MakeSpectrumTexture(texname,
             curTransform[0], tp);
-        if (st) graphicsState.spectrumTextures[name] = st;
+        if (st) spectrumTextures[name] = st;
     }
     else
         Error("Texture type \"%s\" unknown.", type.c_str());
@@ -950,13 +1137,14 @@ void pbrtMakeNamedMaterial(const string &name,
     VERIFY_WORLD("MakeNamedMaterial");
     // error checking, warning if replace, what to use for transform?
     TextureParams mp(params, graphicsState.materialParams,
-                     graphicsState.floatTextures,
-                     graphicsState.spectrumTextures);
+                     graphicsState.textures->floatTextures,
+                     graphicsState.textures->spectrumTextures);
     string matName = mp.FindString("type");
     WARN_IF_ANIMATED_TRANSFORM("MakeNamedMaterial");
     if (matName == "") Error("No parameter string \"type\" found in MakeNamedMaterial");
     else {
         Reference<Material> mtl = MakeMaterial(matName, curTransform[0], mp);
+        mp.ReportUnused();
         if (mtl) graphicsState.namedMaterials[name] = mtl;
     }
 }
@@ -971,6 +1159,7 @@ void pbrtNamedMaterial(const string &name) {
 
 void pbrtLightSource(const string &name, const ParamSet &params) {
     VERIFY_WORLD("LightSource");
+    CreatePendingShapes();
     WARN_IF_ANIMATED_TRANSFORM("LightSource");
     Light *lt = MakeLight(name, curTransform[0], params);
     if (lt == NULL)
@@ -990,26 +1179,39 @@ void pbrtAreaLightSource(const string &name,
 
 void pbrtShape(const string &name, const ParamSet &params) {
     VERIFY_WORLD("Shape");
-    Reference<Primitive> prim;
-    AreaLight *area = NULL;
     if (!curTransform.IsAnimated()) {
-        // Create primitive for static shape
-        Transform *obj2world, *world2obj;
-        transformCache.Lookup(curTransform[0], &obj2world, &world2obj);
-        Reference<Shape> shape = MakeShape(name, obj2world, world2obj,
-            graphicsState.reverseOrientation, params);
-        if (!shape) return;
-        Reference<Material> mtl = graphicsState.CreateMaterial(params);
-        params.ReportUnused();
-
-        // Possibly create area light for shape
-        if (graphicsState.areaLight != "") {
-            area = MakeAreaLight(graphicsState.areaLight, curTransform[0],
-                                 graphicsState.areaLightParams, shape);
-        }
-        prim = new GeometricPrimitive(shape, mtl, area);
+        // OBJ meshes are parsed by tasks of their own, so create them alone
+        bool createNow = (name == "objmesh");
+        if (createNow)
+            CreatePendingShapes();
+
+        // Queue static shape with the graphics state it needs
+        PendingShape *ps = new PendingShape;
+        ps->name = name;
+        ps->params = params;
+        transformCache.Lookup(curTransform[0], &ps->ObjectToWorld,
+                              &ps->WorldToObject);
+        ps->reverseOrientation = graphicsState.reverseOrientation;
+        ps->textures = graphicsState.textures;
+        ps->material = graphicsState.material;
+        ps->materialParams = graphicsState.materialParams;
+        ps->namedMaterial = graphicsState.NamedMaterial();
+        if (name == "objmesh")
+            ps->namedMaterials = graphicsState.namedMaterials;
+        ps->areaLight = graphicsState.areaLight;
+        ps->areaLightParams = graphicsState.areaLightParams;
+        ps->lightToWorld = curTransform[0];
+        ps->instance = renderOptions->currentInstance;
+        extern int line_num;
+        extern string current_file;
+        ps->file = current_file;
+        ps->line = line_num;
+        pendingShapes.push_back(ps);
+        if (createNow || pendingShapes.size() >= maxPendingShapes)
+            CreatePendingShapes();
     } else {
         // Create primitive for animated shape
+        CreatePendingShapes();
 
         // Create initial _Shape_ for animated shape
         if (graphicsState.areaLight != "")
@@ -1018,10 +1220,20 @@ void pbrtShape(const string &name, const ParamSet &params) {
         Transform *identity;
         transformCache.Lookup(Transform(), &identity, NULL);
         Reference<Shape> shape = MakeShape(name, identity, identity,
-            graphicsState.reverseOrientation, params);
-        if (!shape) return;
-        Reference<Material> mtl = graphicsState.CreateMaterial(params);
+            graphicsState.reverseOrientation, params,
+            &graphicsState.textures->floatTextures);
+        if (!shape) {
+            params.ReportUnused();
+            return;
+        }
+        ParamSet materialParams;
+        Reference<Material> mtl = MakeShapeMaterial(params,
+            graphicsState.NamedMaterial(), graphicsState.material,
+            graphicsState.materialParams, curTransform[0],
+            graphicsState.textures->floatTextures,
+            graphicsState.textures->spectrumTextures, &materialParams);
         params.ReportUnused();
+        materialParams.ReportUnused();
 
         // Get _animatedWorldToObject_ transform for shape
         Assert(MAX_TRANSFORMS == 2);
@@ -1042,36 +1254,34 @@ void pbrtShape(const string &name, const ParamSet &params) {
             else
                 baseprim = refinedPrimitives[0];
         }
-        prim = new TransformedPrimitive(baseprim, animatedWorldToObject);
-    }
-    // Add primitive to scene or current instance
-    if (renderOptions->currentInstance) {
-        if (area)
-            Warning("Area lights not supported with object instancing");
-        renderOptions->currentInstance->push_back(prim);
-    }
-    
-    else {
-        renderOptions->primitives.push_back(prim);
-        if (area != NULL) {
-            renderOptions->lights.push_back(area);
-        }
+        Reference<Primitive> prim =
+            new TransformedPrimitive(baseprim, animatedWorldToObject);
+
+        // Add primitive to scene or current instance
+        if (renderOptions->currentInstance)
+            renderOptions->currentInstance->push_back(prim);
+        else
+            renderOptions->primitives.push_back(prim);
     }
 }
 
 
-Reference<Material> GraphicsState::CreateMaterial(const ParamSet &params) {
-    TextureParams mp(params, materialParams,
-                     floatTextures,
+static Reference<Material> MakeShapeMaterial(const ParamSet &params,
+        const Reference<Material> &namedMaterial, const string &material,
+        const ParamSet &materialParams, const Transform &xform,
+        map<string, Reference<Texture<float> > > &floatTextures,
+        map<string, Reference<Texture<Spectrum> > > &spectrumTextures,
+        ParamSet *usedMaterialParams) {
+    TextureParams mp(params, materialParams, floatTextures,
                      spectrumTextures);
-    Reference<Material> mtl;
-    if (currentNamedMaterial != "" &&
-        namedMaterials.find(currentNamedMaterial) != namedMaterials.end())
-        mtl = namedMaterials[graphicsState.currentNamedMaterial];
-    if (!mtl)
-        mtl = MakeMaterial(material, curTransform[0], mp);
+    Reference<Material> mtl = namedMaterial;
+    if (!mtl) {
+        // Unused material parameters are reported after the shape is created
+        mtl = MakeMaterial(material, xform, mp);
+        *usedMaterialParams = materialParams;
+    }
     if (!mtl)
-        mtl = MakeMaterial("matte", curTransform[0], mp);
+        mtl = MakeMaterial("matte", xform, mp);
     if (!mtl)
         Severe("Unable to create \"matte\" material?!");
     return mtl;
@@ -1095,16 +1305,19 @@ void pbrtVolume(const string &name, const ParamSet &params) {
 
 void pbrtObjectBegin(const string &name) {
     VERIFY_WORLD("ObjectBegin");
+    CreatePendingShapes();
     pbrtAttributeBegin();
     if (renderOptions->currentInstance)
         Error("ObjectBegin called inside of instance definition");
     renderOptions->instances[name] = vector<Reference<Primitive> >();
+    renderOptions->instancePrototypeIndex.erase(name);
     renderOptions->currentInstance = &renderOptions->instances[name];
 }
 
 
 void pbrtObjectEnd() {
     VERIFY_WORLD("ObjectEnd");
+    CreatePendingShapes();
     if (!renderOptions->currentInstance)
         Error("ObjectEnd called outside of instance definition");
     renderOptions->currentInstance = NULL;
@@ -1114,6 +1327,7 @@ void pbrtObjectEnd() {
 
 void pbrtObjectInstance(const string &name) {
     VERIFY_WORLD("ObjectInstance");
+    CreatePendingShapes();
     // Object instance error checking
     if (renderOptions->currentInstance) {
         Error("ObjectInstance can't be called inside instance definition");
@@ -1125,15 +1339,24 @@ void pbrtObjectInstance(const string &name) {
     }
     vector<Reference<Primitive> > &in = renderOptions->instances[name];
     if (in.size() == 0) return;
-    if (in.size() > 1 || !in[0]->CanIntersect()) {
-        // Refine instance _Primitive_s and create aggregate
-        Reference<Primitive> accel =
-             MakeAccelerator(renderOptions->AcceleratorName,
-                             in, renderOptions->AcceleratorParams);
-        if (!accel) accel = MakeAccelerator("bvh", in, ParamSet());
-        if (!accel) Severe("Unable to create \"bvh\" accelerator");
+    map<string, uint32_t>::iterator protoIter =
+        renderOptions->instancePrototypeIndex.find(name);
+    if (protoIter == renderOptions->instancePrototypeIndex.end()) {
+        // Create shared bottom-level _BVHAccel_ for instance _Primitive_s
+        BVHAccel *bvh = CreateBVHAccelerator(in,
+            renderOptions->AcceleratorName == "bvh" ?
+                renderOptions->AcceleratorParams : ParamSet());
+        protoIter = renderOptions->instancePrototypeIndex.insert(
+            std::make_pair(name, uint32_t(renderOptions->instancePrototypes.size()))).first;
+        renderOptions->instancePrototypes.push_back(bvh);
         in.erase(in.begin(), in.end());
-        in.push_back(accel);
+        in.push_back(bvh);
+    }
+    if (!curTransform.IsAnimated() && IsAffine(curTransform[0])) {
+        // Add compact instance record for the top-level _InstanceAccel_
+        renderOptions->instanceRecords.push_back(
+            InstanceRecord(Inverse(curTransform[0]), protoIter->second));
+        return;
     }
     Assert(MAX_TRANSFORMS == 2);
     Transform *world2instance[2];
@@ -1151,6 +1374,7 @@ void pbrtObjectInstance(const string &name) {
 // 곡ļʱ򣬾ͻMakeSceneMakeRenderer
 void pbrtWorldEnd() {
     VERIFY_WORLD("WorldEnd");
+    CreatePendingShapes();
     // Ensure there are no pushed graphics states
     while (pushedGraphicsStates.size()) {
         Warning("Missing end to pbrtAttributeBegin()");
@@ -1195,6 +1419,11 @@ Scene *RenderOptions::MakeScene() {
         volumeRegion = volumeRegions[0];
     else
         volumeRegion = new AggregateVolume(volumeRegions);
+    if (instanceRecords.size() > 0) {
+        // Build top-level accelerator over static object instances
+        primitives.push_back(new InstanceAccel(instancePrototypes,
+            instanceRecords, AcceleratorParams.FindOneInt("maxinstanceprims", 4)));
+    }
     Primitive *accelerator = MakeAccelerator(AcceleratorName,
         primitives, AcceleratorParams);
     if (!accelerator)
@@ -1221,6 +1450,14 @@ Renderer *RenderOptions::MakeRenderer() const {
             Warning("No light sources defined in scene; "
                 "possibly rendering a black image.");
     }
+    else if (RendererName == "sppm") {
+        renderer = CreateSPPMRenderer(RendererParams, camera);
+        RendererParams.ReportUnused();
+        // Warn if no light sources are defined
+        if (lights.size() == 0)
+            Warning("No light sources defined in scene; "
+                "possibly rendering a black image.");
+    }
     // Create remaining _Renderer_ types
     else if (RendererName == "createprobes") {
         // Create surface and volume integrators
@@ -80,6 +80,12 @@ float Camera::GenerateRayDifferential(const CameraSample &sample,
 }
 
 
+bool Camera::Project(const Point &p, float time, float *rasterX,
+        float *rasterY, Point *pLens, float *pdfDir) const {
+    return false;
+}
+
+
 ProjectiveCamera::ProjectiveCamera(const AnimatedTransform &cam2world,
         const Transform &proj, const float screenWindow[4], float sopen,
         float sclose, float lensr, float focald, Film *f)
@@ -80,6 +80,15 @@ public:
 	*/
     virtual float GenerateRayDifferential(const CameraSample &sample, RayDifferential *rd) const;
 
+	/*
+	maps a world space point back to the raster position whose camera ray passes
+	through it, so that light subpaths can be splatted onto the film. *pdfDir is the
+	solid angle density with which camera rays are sampled toward p. Cameras that
+	can't be connected to this way return false.
+	*/
+    virtual bool Project(const Point &p, float time, float *rasterX,
+        float *rasterY, Point *pLens, float *pdfDir) const;
+
     // Camera Public Data
     AnimatedTransform CameraToWorld;
 	/*
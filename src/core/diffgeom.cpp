@@ -48,6 +48,8 @@ DifferentialGeometry::DifferentialGeometry(const Point &P,
     v = vv;
     shape = sh;
     dudx = dvdx = dudy = dvdy = 0;
+    wavelength = -1;
+    dispersed = false;
 
     // Adjust normal based on orientation and handedness
     if (shape && (shape->ReverseOrientation ^ shape->TransformSwapsHandedness))
@@ -55,6 +55,8 @@ struct DifferentialGeometry {
     DifferentialGeometry() { 
         u = v = dudx = dvdx = dudy = dvdy = 0.; 
         shape = NULL; 
+        wavelength = -1;
+        dispersed = false;
     }
     // DifferentialGeometry Public Methods
     DifferentialGeometry(const Point &P, const Vector &DPDU,
@@ -72,6 +74,8 @@ struct DifferentialGeometry {
     Normal dndu, dndv;
     mutable Vector dpdx, dpdy;
     mutable float dudx, dvdx, dudy, dvdy;
+    mutable int wavelength;
+    mutable bool dispersed;
 };
 
 
@@ -36,6 +36,10 @@
 #ifndef PBRT_IS_WINDOWS
 #include <libgen.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 static string searchDirectory;
@@ -139,4 +143,67 @@ void SetSearchDirectory(const string &dirname) {
 }
 
 
+// MappedFile Method Definitions
+MappedFile::MappedFile(const string &filename)
+    : data(NULL), size(0), isMapped(false) {
+#ifndef PBRT_IS_WINDOWS
+    // Try to map the file's contents directly into memory
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) {
+            data = (const char *)ptr;
+            size = st.st_size;
+            isMapped = true;
+        }
+    }
+    close(fd);
+    if (isMapped) return;
+#endif
+    // Fall back to reading the whole file into memory
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len > 0) {
+        char *buf = new char[len];
+        if (fread(buf, 1, len, f) == size_t(len)) {
+            data = buf;
+            size = len;
+        }
+        else
+            delete[] buf;
+    }
+    else if (len == 0)
+        data = "";
+    fclose(f);
+}
+
+
+MappedFile::~MappedFile() {
+#ifndef PBRT_IS_WINDOWS
+    if (isMapped) {
+        munmap((void *)data, size);
+        return;
+    }
+#endif
+    if (size > 0) delete[] data;
+}
+
+
+void MappedFile::Release(size_t offset, size_t length) {
+#ifndef PBRT_IS_WINDOWS
+    // Let the OS reclaim the mapped pages covering the given range
+    if (!isMapped) return;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t start = offset / pageSize * pageSize;
+    size_t end = std::min(offset + length, size) / pageSize * pageSize;
+    if (end > start)
+        madvise((void *)(data + start), end - start, MADV_DONTNEED);
+#endif
+}
+
 
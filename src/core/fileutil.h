@@ -37,6 +37,7 @@
 #define PBRT_CORE_FILEUTIL_H
 
 #include <string>
+#include <stddef.h>
 using std::string;
 
 // Platform independent filename-handling functions.
@@ -47,5 +48,24 @@ string ResolveFilename(const string &filename);
 string DirectoryContaining(const string &filename);
 void SetSearchDirectory(const string &dirname);
 
+// MappedFile Declarations
+class MappedFile {
+public:
+    // MappedFile Public Methods
+    MappedFile(const string &filename);
+    ~MappedFile();
+    bool IsValid() const { return data != NULL; }
+    const char *Data() const { return data; }
+    size_t Size() const { return size; }
+    void Release(size_t offset, size_t length);
+private:
+    // MappedFile Private Data
+    const char *data;
+    size_t size;
+    bool isMapped;
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
 #endif // PBRT_CORE_FILEUTIL_H
 
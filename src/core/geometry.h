@@ -322,14 +322,17 @@ public:
 class Ray {
 public:
     // Ray Public Methods
-    Ray() : mint(0.f), maxt(INFINITY), time(0.f), depth(0) { }
+    Ray() : mint(0.f), maxt(INFINITY), time(0.f), depth(0), wavelength(-1),
+            dispersed(false) { }
     Ray(const Point &origin, const Vector &direction,
         float start, float end = INFINITY, float t = 0.f, int d = 0)
-        : o(origin), d(direction), mint(start), maxt(end), time(t), depth(d) { }
+        : o(origin), d(direction), mint(start), maxt(end), time(t), depth(d),
+          wavelength(-1), dispersed(false) { }
     Ray(const Point &origin, const Vector &direction, const Ray &parent,
         float start, float end = INFINITY)
         : o(origin), d(direction), mint(start), maxt(end),
-          time(parent.time), depth(parent.depth+1) { }
+          time(parent.time), depth(parent.depth+1),
+          wavelength(parent.wavelength), dispersed(parent.dispersed) { }
     Point operator()(float t) const { return o + d * t; }
     bool HasNaNs() const {
         return (o.HasNaNs() || d.HasNaNs() ||
@@ -342,6 +345,12 @@ public:
     mutable float mint, maxt;
     float time;
     int depth;
+
+    // _wavelength_ is the spectral component a camera path uses at
+    // dispersive interfaces, or -1 if none was chosen; _dispersed_ is set
+    // once the path has passed one and carries only that component
+    int wavelength;
+    mutable bool dispersed;
 };
 
 /*
@@ -369,7 +378,7 @@ public:
     }
     RayDifferential(const Point &org, const Vector &dir, const Ray &parent,
         float start, float end = INFINITY)
-            : Ray(org, dir, start, end, parent.time, parent.depth+1) {
+            : Ray(org, dir, parent, start, end) {
         hasDifferentials = false;
     }
     explicit RayDifferential(const Ray &ray) : Ray(ray) {
@@ -273,13 +273,13 @@ Spectrum SpecularTransmit(const RayDifferential &ray, BSDF *bsdf,
 }
 
 
-Distribution1D *ComputeLightSamplingCDF(const Scene *scene) {
+AliasDistribution1D *ComputeLightSamplingCDF(const Scene *scene) {
     uint32_t nLights = int(scene->lights.size());
     Assert(nLights > 0);
     vector<float>lightPower(nLights, 0.f);
     for (uint32_t i = 0; i < nLights; ++i)
         lightPower[i] = scene->lights[i]->Power(scene).y();
-    return new Distribution1D(&lightPower[0], nLights);
+    return new AliasDistribution1D(&lightPower[0], nLights);
 }
 
 
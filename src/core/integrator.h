@@ -95,6 +95,6 @@ Spectrum SpecularReflect(const RayDifferential &ray, BSDF *bsdf, RNG &rng,
 Spectrum SpecularTransmit(const RayDifferential &ray, BSDF *bsdf, RNG &rng,
     const Intersection &isect, const Renderer *renderer, const Scene *scene,
     const Sample *sample, MemoryArena &arena);
-Distribution1D *ComputeLightSamplingCDF(const Scene *scene);
+AliasDistribution1D *ComputeLightSamplingCDF(const Scene *scene);
 
 #endif // PBRT_CORE_INTEGRATOR_H
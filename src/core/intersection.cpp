@@ -42,7 +42,12 @@ BSDF *Intersection::GetBSDF(const RayDifferential &ray,
                             MemoryArena &arena) const {
     PBRT_STARTED_BSDF_SHADING(const_cast<RayDifferential *>(&ray));
     dg.ComputeDifferentials(ray);
+    dg.wavelength = ray.wavelength;
+    dg.dispersed = ray.dispersed;
     BSDF *bsdf = primitive->GetBSDF(dg, ObjectToWorld, arena);
+
+    // Restrict rays spawned from _ray_ to its wavelength if shading did
+    ray.dispersed = dg.dispersed;
     PBRT_FINISHED_BSDF_SHADING(const_cast<RayDifferential *>(&ray), bsdf);
     return bsdf;
 }
@@ -61,6 +61,13 @@ Spectrum Light::Le(const RayDifferential &) const {
 }
 
 
+void Light::Pdf_Le(const Point &, const Normal &, const Vector &,
+                   float *pdfPos, float *pdfDir) const {
+    // Lights at infinity don't define densities for emitted rays
+    *pdfPos = *pdfDir = 0.f;
+}
+
+
 LightSampleOffsets::LightSampleOffsets(int count, Sample *sample) {
     nSamples = count;
     componentOffset = sample->Add1D(nSamples);
@@ -133,7 +140,7 @@ ShapeSet::ShapeSet(const Reference<Shape> &s) {
         areas.push_back(a);
         sumArea += a;
     }
-    areaDistribution = new Distribution1D(&areas[0], areas.size());
+    areaDistribution = new AliasDistribution1D(&areas[0], areas.size());
 }
 
 
@@ -70,6 +70,8 @@ public:
     virtual Spectrum Sample_L(const Scene *scene, const LightSample &ls,
                               float u1, float u2, float time, Ray *ray,
                               Normal *Ns, float *pdf) const = 0;
+    virtual void Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+                        float *pdfPos, float *pdfDir) const;
     virtual void SHProject(const Point &p, float pEpsilon, int lmax,
         const Scene *scene, bool computeLightVisibility, float time,
         RNG &rng, Spectrum *coeffs) const;
@@ -154,7 +156,7 @@ private:
     vector<Reference<Shape> > shapes;
     float sumArea;
     vector<float> areas;
-    Distribution1D *areaDistribution;
+    AliasDistribution1D *areaDistribution;
 };
 
 
@@ -35,24 +35,24 @@
 #include "memory.h"
 
 // Memory Allocation Functions
-void *AllocAligned(size_t size) {
+void *AllocAligned(size_t size, size_t alignment) {
 #if defined(PBRT_IS_WINDOWS)
-    return _aligned_malloc(size, PBRT_L1_CACHE_LINE_SIZE);
+    return _aligned_malloc(size, alignment);
 #elif defined (PBRT_IS_OPENBSD) || defined(PBRT_IS_APPLE)
     // Allocate excess memory to ensure an aligned pointer can be returned
-    void *mem = malloc(size + (PBRT_L1_CACHE_LINE_SIZE-1) + sizeof(void*));
+    void *mem = malloc(size + (alignment-1) + sizeof(void*));
     char *amem = ((char*)mem) + sizeof(void*);
 #if (PBRT_POINTER_SIZE == 8)
-    amem += PBRT_L1_CACHE_LINE_SIZE - (reinterpret_cast<uint64_t>(amem) &
-                                       (PBRT_L1_CACHE_LINE_SIZE - 1));
+    amem += alignment - (reinterpret_cast<uint64_t>(amem) &
+                         (alignment - 1));
 #else
-    amem += PBRT_L1_CACHE_LINE_SIZE - (reinterpret_cast<uint32_t>(amem) &
-                                       (PBRT_L1_CACHE_LINE_SIZE - 1));
+    amem += alignment - (reinterpret_cast<uint32_t>(amem) &
+                         (alignment - 1));
 #endif
     ((void**)amem)[-1] = mem;
     return amem;
 #else
-    return memalign(PBRT_L1_CACHE_LINE_SIZE, size);
+    return memalign(alignment, size);
 #endif
 }
 
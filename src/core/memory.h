@@ -87,9 +87,10 @@ private:
 };
 
 
-void *AllocAligned(size_t size);
-template <typename T> T *AllocAligned(uint32_t count) {
-    return (T *)AllocAligned(count * sizeof(T));
+void *AllocAligned(size_t size, size_t alignment = PBRT_L1_CACHE_LINE_SIZE);
+template <typename T> T *AllocAligned(uint32_t count,
+        size_t alignment = PBRT_L1_CACHE_LINE_SIZE) {
+    return (T *)AllocAligned(count * sizeof(T), alignment);
 }
 
 
@@ -378,6 +378,43 @@ void UniformSampleTriangle(float u1, float u2, float *u, float *v) {
 }
 
 
+AliasDistribution1D::AliasDistribution1D(const float *f, int n)
+    : bins(n), count(n) {
+    // Compute discrete probabilities and scaled bin weights
+    double sum = 0.;
+    for (int i = 0; i < n; ++i)
+        sum += f[i];
+    vector<double> q(n);
+    vector<int> small, large;
+    for (int i = 0; i < n; ++i) {
+        bins[i].pdf = (sum > 0.) ? float(f[i] / sum) : 1.f / n;
+        bins[i].alias = i;
+        q[i] = (sum > 0.) ? f[i] * n / sum : 1.;
+        if (q[i] < 1.) small.push_back(i);
+        else           large.push_back(i);
+    }
+
+    // Pair underfull bins with overfull ones until all are filled
+    while (!small.empty() && !large.empty()) {
+        int s = small.back(), l = large.back();
+        small.pop_back();
+        bins[s].threshold = float(q[s]);
+        bins[s].alias = l;
+        q[l] = (q[l] + q[s]) - 1.;
+        if (q[l] < 1.) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Remaining bins are full up to round-off
+    for (uint32_t i = 0; i < large.size(); ++i)
+        bins[large[i]].threshold = 1.f;
+    for (uint32_t i = 0; i < small.size(); ++i)
+        bins[small[i]].threshold = 1.f;
+}
+
+
 Distribution2D::Distribution2D(const float *func, int nu, int nv) {
     pConditionalV.reserve(nv);
     for (int v = 0; v < nv; ++v) {
@@ -400,6 +437,83 @@ Distribution2D::~Distribution2D() {
 }
 
 
+HierarchicalDistribution2D::HierarchicalDistribution2D(const float *func,
+        int nuf, int nvf)
+    : nu(nuf), nv(nvf) {
+    // Initialize finest level from clamped function values
+    levels.push_back(vector<float>(nu * nv));
+    levelRes.push_back(std::make_pair(nu, nv));
+    for (int i = 0; i < nu * nv; ++i)
+        levels[0][i] = max(0.f, func[i]);
+
+    // Sum pairs of texels in each dimension until a single texel remains
+    int w = nu, h = nv;
+    while (w > 1 || h > 1) {
+        int pw = (w + 1) / 2, ph = (h + 1) / 2;
+        const vector<float> &child = levels.back();
+        vector<float> parent(pw * ph, 0.f);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x)
+                parent[(y / 2) * pw + x / 2] += child[y * w + x];
+        levels.push_back(parent);
+        levelRes.push_back(std::make_pair(pw, ph));
+        w = pw;
+        h = ph;
+    }
+}
+
+
+void HierarchicalDistribution2D::SampleContinuous(float u0, float u1,
+        float uv[2], float *pdf) const {
+    if (levels.back()[0] == 0.f) {
+        uv[0] = u0;
+        uv[1] = u1;
+        *pdf = 0.f;
+        return;
+    }
+    int x = 0, y = 0;
+    for (int l = int(levels.size()) - 2; l >= 0; --l) {
+        // Find the (up to) four children of the current texel
+        const vector<float> &level = levels[l];
+        int w = levelRes[l].first, h = levelRes[l].second;
+        x *= 2;
+        y *= 2;
+        bool hasRight = x + 1 < w, hasUpper = y + 1 < h;
+#define TEXEL(xx, yy) level[(yy) * w + (xx)]
+        if (hasRight) {
+            // Choose between left and right children, remapping _u0_
+            float left = TEXEL(x, y), right = TEXEL(x + 1, y);
+            if (hasUpper) {
+                left += TEXEL(x, y + 1);
+                right += TEXEL(x + 1, y + 1);
+            }
+            float pLeft = left / (left + right);
+            if (u0 < pLeft)
+                u0 = min(u0 / pLeft, OneMinusEpsilon);
+            else {
+                u0 = min((u0 - pLeft) / (1.f - pLeft), OneMinusEpsilon);
+                ++x;
+            }
+        }
+        if (hasUpper) {
+            // Choose between lower and upper child in chosen column
+            float lower = TEXEL(x, y), upper = TEXEL(x, y + 1);
+            float pLower = lower / (lower + upper);
+            if (u1 < pLower)
+                u1 = min(u1 / pLower, OneMinusEpsilon);
+            else {
+                u1 = min((u1 - pLower) / (1.f - pLower), OneMinusEpsilon);
+                ++y;
+            }
+        }
+#undef TEXEL
+    }
+    uv[0] = (x + u0) / nu;
+    uv[1] = (y + u1) / nv;
+    *pdf = levels[0][y * nu + x] * (nu * nv) / levels.back()[0];
+}
+
+
 PermutedHalton::PermutedHalton(uint32_t d, RNG &rng) {
     dims = d;
     // Determine bases $b_i$ and their sum
@@ -105,6 +105,9 @@ struct Distribution1D {
         if (pdf) *pdf = func[offset] / (funcInt * count);
         return offset;
     }
+    float DiscretePdf(int index) const {
+        return func[index] / (funcInt * count);
+    }
 private:
     friend struct Distribution2D;
     // Distribution1D Private Data
@@ -114,6 +117,40 @@ private:
 };
 
 
+// AliasDistribution1D samples the same discrete distribution as
+// Distribution1D in constant time using Walker's alias method: each of
+// the _count_ equal-width bins holds a threshold and an alternate index,
+// so a sample is one multiply and one table lookup instead of a binary
+// search over the CDF.  The mapping from _u_ to index isn't monotonic,
+// so only discrete sampling is provided; Distribution1D should still be
+// used where samples are warped.
+struct AliasDistribution1D {
+    // AliasDistribution1D Public Methods
+    AliasDistribution1D(const float *f, int n);
+    int SampleDiscrete(float u, float *pdf) const {
+        // Find bin for _u_ and choose between it and its alias
+        float up = u * count;
+        int offset = min(int(up), count-1);
+        const AliasBin &bin = bins[offset];
+        if (up - offset >= bin.threshold)
+            offset = bin.alias;
+        if (pdf) *pdf = bins[offset].pdf;
+        return offset;
+    }
+    float DiscretePdf(int index) const {
+        return bins[index].pdf;
+    }
+private:
+    // AliasDistribution1D Private Data
+    struct AliasBin {
+        float threshold, pdf;
+        int alias;
+    };
+    vector<AliasBin> bins;
+    int count;
+};
+
+
 void RejectionSampleDisk(float *x, float *y, RNG &rng);
 Vector UniformSampleHemisphere(float u1, float u2);
 float  UniformHemispherePdf();
@@ -167,6 +204,31 @@ private:
 };
 
 
+// HierarchicalDistribution2D samples the same piecewise-constant
+// distribution as Distribution2D by descending a pyramid of partial
+// sums, choosing between pairs of children at each level.  It only
+// stores the pyramid (about 4/3 the size of the function) and touches
+// one small array per level rather than binary-searching
+// full-resolution CDFs.
+struct HierarchicalDistribution2D {
+    // HierarchicalDistribution2D Public Methods
+    HierarchicalDistribution2D(const float *data, int nu, int nv);
+    void SampleContinuous(float u0, float u1, float uv[2], float *pdf) const;
+    float Pdf(float u, float v) const {
+        int iu = Clamp(Float2Int(u * nu), 0, nu-1);
+        int iv = Clamp(Float2Int(v * nv), 0, nv-1);
+        if (levels.back()[0] == 0.f) return 0.f;
+        return levels[0][iv * nu + iu] * (nu * nv) /
+               levels.back()[0];
+    }
+private:
+    // HierarchicalDistribution2D Private Data
+    int nu, nv;
+    vector<vector<float> > levels;
+    vector<std::pair<int, int> > levelRes;
+};
+
+
 void StratifiedSample1D(float *samples, int nsamples, RNG &rng,
                         bool jitter = true);
 void StratifiedSample2D(float *samples, int nx, int ny, RNG &rng,
@@ -94,6 +94,36 @@ void ParamSet::AddNormal(const string &name, const Normal *data, int nItems) {
 }
 
 
+void ParamSet::AdoptFloat(const string &name, float *data, int nItems) {
+    EraseFloat(name);
+    floats.push_back(new ParamSetItem<float>(name, nItems, data));
+}
+
+
+void ParamSet::AdoptInt(const string &name, int *data, int nItems) {
+    EraseInt(name);
+    ints.push_back(new ParamSetItem<int>(name, nItems, data));
+}
+
+
+void ParamSet::AdoptPoint(const string &name, Point *data, int nItems) {
+    ErasePoint(name);
+    points.push_back(new ParamSetItem<Point>(name, nItems, data));
+}
+
+
+void ParamSet::AdoptVector(const string &name, Vector *data, int nItems) {
+    EraseVector(name);
+    vectors.push_back(new ParamSetItem<Vector>(name, nItems, data));
+}
+
+
+void ParamSet::AdoptNormal(const string &name, Normal *data, int nItems) {
+    EraseNormal(name);
+    normals.push_back(new ParamSetItem<Normal>(name, nItems, data));
+}
+
+
 void ParamSet::AddRGBSpectrum(const string &name, const float *data, int nItems) {
     EraseSpectrum(name);
     Assert(nItems % 3 == 0);
@@ -67,6 +67,11 @@ public:
     void AddBlackbodySpectrum(const string &, const float *, int nItems);
     void AddSampledSpectrumFiles(const string &, const char **, int nItems);
     void AddSampledSpectrum(const string &, const float *, int nItems);
+    void AdoptFloat(const string &, float *, int nItems);
+    void AdoptInt(const string &, int *, int nItems);
+    void AdoptPoint(const string &, Point *, int nItems);
+    void AdoptVector(const string &, Vector *, int nItems);
+    void AdoptNormal(const string &, Normal *, int nItems);
     bool EraseInt(const string &);
     bool EraseBool(const string &);
     bool EraseFloat(const string &);
@@ -117,6 +122,7 @@ private:
 template <typename T> struct ParamSetItem : public ReferenceCounted {
     // ParamSetItem Public Methods
     ParamSetItem(const string &name, const T *val, int nItems = 1);
+    ParamSetItem(const string &name, int nItems, T *adoptedVal);
     ~ParamSetItem() {
         delete[] data;
     }
@@ -141,6 +147,16 @@ ParamSetItem<T>::ParamSetItem(const string &n, const T *v, int ni) {
 }
 
 
+template <typename T>
+ParamSetItem<T>::ParamSetItem(const string &n, int ni, T *v) {
+    // Take ownership of _v_, which must have been allocated with _new[]_
+    name = n;
+    nItems = ni;
+    data = v;
+    lookedUp = false;
+}
+
+
 
 // TextureParams Declarations
 class TextureParams {
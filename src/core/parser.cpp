@@ -34,42 +34,1099 @@
 #include "stdafx.h"
 #include "parser.h"
 #include "fileutil.h"
+#include "paramset.h"
+#include "parallel.h"
+#include "api.h"
+#include <stdarg.h>
 
-// Parsing Global Interface
-bool ParseFile(const string &filename) {
-    extern FILE *yyin;
-    extern int yyparse(void);
-    extern string current_file;
-    extern int line_num;
-    extern int yydebug;
-
-	//ȡĵǰֵ
-    if (getenv("PBRT_YYDEBUG") != NULL)
-        yydebug = 1;
-
-    if (filename == "-")
-        yyin = stdin;
+// Parsing Global Data
+int line_num = 0;
+string current_file;
+
+// Token Declarations
+enum TokenType { TOKEN_EOF, TOKEN_NUMBER, TOKEN_STRING, TOKEN_IDENT,
+                 TOKEN_LBRACK, TOKEN_RBRACK };
+struct Token {
+    Token() : type(TOKEN_EOF), start(NULL), end(NULL), line(0) { }
+    bool Is(const char *s) const {
+        if (type == TOKEN_EOF) return false;
+        size_t len = end - start;
+        return strncmp(start, s, len) == 0 && s[len] == '\0';
+    }
+    TokenType type;
+    // Strings exclude the quotes; escapes are processed by _Dequote()_
+    const char *start, *end;
+    int line;
+};
+
+
+static inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+
+static inline bool IsIdentChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           c == '_' || IsDigit(c);
+}
+
+
+// SceneStatement Declarations
+enum StatementType {
+    STMT_NONE, STMT_ACCELERATOR, STMT_ACTIVETRANSFORM, STMT_AREALIGHTSOURCE,
+    STMT_ATTRIBUTEBEGIN, STMT_ATTRIBUTEEND, STMT_CAMERA, STMT_CONCATTRANSFORM,
+    STMT_COORDINATESYSTEM, STMT_COORDSYSTRANSFORM, STMT_FILM, STMT_IDENTITY,
+    STMT_INCLUDE, STMT_LIGHTSOURCE, STMT_LOOKAT, STMT_MAKENAMEDMATERIAL,
+    STMT_MATERIAL, STMT_NAMEDMATERIAL, STMT_OBJECTBEGIN, STMT_OBJECTEND,
+    STMT_OBJECTINSTANCE, STMT_PIXELFILTER, STMT_RENDERER,
+    STMT_REVERSEORIENTATION, STMT_ROTATE, STMT_SAMPLER, STMT_SCALE,
+    STMT_SHAPE, STMT_SURFACEINTEGRATOR, STMT_TEXTURE, STMT_TRANSFORM,
+    STMT_TRANSFORMBEGIN, STMT_TRANSFORMEND, STMT_TRANSFORMTIMES,
+    STMT_TRANSLATE, STMT_VOLUME, STMT_VOLUMEINTEGRATOR, STMT_WORLDBEGIN,
+    STMT_WORLDEND,
+    // Statements recorded by parsers running in worker threads
+    STMT_WARNING, STMT_ERROR, STMT_FATAL, STMT_BEGIN_FILE, STMT_END_FILE
+};
+
+
+struct SpectrumFileParam {
+    string name;
+    vector<string> files;
+};
+
+
+struct SceneStatement {
+    SceneStatement() : type(STMT_NONE), line(0) { }
+    StatementType type;
+    int line;
+    string args[3];
+    float values[16];
+    ParamSet params;
+    // SPD files are read when the statement is executed
+    vector<SpectrumFileParam> spectrumFiles;
+};
+
+
+typedef vector<SceneStatement> StatementList;
+static void ReportV(StatementList *record, StatementType level, int line,
+                    const char *format, va_list args);
+static void Execute(SceneStatement &st);
+static void Replay(StatementList &statements);
+
+// Tokenizer Declarations
+class Tokenizer {
+public:
+    // Tokenizer Public Methods
+    Tokenizer(const char *b, const char *e, MappedFile *f,
+              StatementList *rec)
+        : pos(b), end(e), line(1), reportErrors(true), file(f),
+          releaseMark(b), record(rec) { }
+    Token Next();
+    void Quiet() {
+        // Look-ahead copies neither report errors nor release file pages
+        reportErrors = false;
+        file = NULL;
+    }
+    void Stop() { pos = end; }
+private:
+    // Tokenizer Private Methods
+    const char *ScanNumber(const char *p) const;
+    void Report(const char *format, ...) const {
+        if (!reportErrors) return;
+        va_list args;
+        va_start(args, format);
+        ReportV(record, STMT_ERROR, line, format, args);
+        va_end(args);
+    }
+
+    // Tokenizer Private Data
+    const char *pos, *end;
+    int line;
+    bool reportErrors;
+    MappedFile *file;
+    const char *releaseMark;
+    StatementList *record;
+};
+
+
+
+// Tokenizer Method Definitions
+const char *Tokenizer::ScanNumber(const char *p) const {
+    // Match _[-+]?([0-9]+|[0-9]+\.[0-9]*|\.[0-9]+)([eE][-+]?[0-9]+)?_
+    const char *q = p;
+    if (q < end && (*q == '-' || *q == '+')) ++q;
+    const char *digits = q;
+    while (q < end && IsDigit(*q)) ++q;
+    if (q < end && *q == '.') {
+        const char *f = q + 1;
+        while (f < end && IsDigit(*f)) ++f;
+        if (q > digits || f > q + 1) q = f;
+    }
+    if (q == digits) return p;
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        const char *e = q + 1;
+        if (e < end && (*e == '-' || *e == '+')) ++e;
+        if (e < end && IsDigit(*e)) {
+            while (e < end && IsDigit(*e)) ++e;
+            q = e;
+        }
+    }
+    return q;
+}
+
+
+Token Tokenizer::Next() {
+    // Return pages of large scene files that have been scanned to the OS
+    if (file && pos - releaseMark > (8 << 20)) {
+        file->Release(releaseMark - file->Data(), pos - releaseMark);
+        releaseMark = pos;
+    }
+    for (;;) {
+        // Skip whitespace and comments
+        while (pos < end) {
+            char c = *pos;
+            if (c == '\n') { ++line; ++pos; }
+            else if (c == ' ' || c == '\t' || c == '\r') ++pos;
+            else if (c == '#')
+                while (pos < end && *pos != '\n') ++pos;
+            else break;
+        }
+        Token tok;
+        tok.line = line;
+        if (pos == end) return tok;
+        char c = *pos;
+        tok.start = pos;
+        if (c == '[' || c == ']') {
+            tok.type = (c == '[') ? TOKEN_LBRACK : TOKEN_RBRACK;
+            tok.end = ++pos;
+            return tok;
+        }
+        if (c == '"') {
+            // Find the closing quote, leaving escapes in place
+            tok.type = TOKEN_STRING;
+            tok.start = ++pos;
+            while (pos < end && *pos != '"') {
+                if (*pos == '\n') {
+                    Report("Unterminated string!");
+                    ++line;
+                }
+                else if (*pos == '\\' && pos + 1 < end) {
+                    if (pos[1] == '\n') ++line;
+                    ++pos;
+                }
+                ++pos;
+            }
+            tok.end = pos;
+            if (pos < end) ++pos;
+            else Report("Unterminated string!");
+            return tok;
+        }
+        const char *numEnd = ScanNumber(pos);
+        if (numEnd != pos) {
+            tok.type = TOKEN_NUMBER;
+            tok.end = pos = numEnd;
+            return tok;
+        }
+        if (IsIdentChar(c) && !IsDigit(c)) {
+            tok.type = TOKEN_IDENT;
+            while (pos < end && IsIdentChar(*pos)) ++pos;
+            tok.end = pos;
+            return tok;
+        }
+        Report("Illegal character: %c (0x%x)", c, int(c));
+        ++pos;
+    }
+}
+
+
+static string Dequote(const Token &tok) {
+    string str;
+    str.reserve(tok.end - tok.start);
+    for (const char *p = tok.start; p < tok.end; ++p) {
+        if (*p == '\n') continue;
+        if (*p != '\\' || p + 1 == tok.end) {
+            str += *p;
+            continue;
+        }
+        switch (*++p) {
+        case 'n': str += '\n'; break;
+        case 't': str += '\t'; break;
+        case 'r': str += '\r'; break;
+        case 'b': str += '\b'; break;
+        case 'f': str += '\f'; break;
+        case '\n': break;
+        default:
+            if (p + 2 < tok.end && IsDigit(p[0]) && IsDigit(p[1]) &&
+                IsDigit(p[2])) {
+                int val = 100 * (p[0] - '0') + 10 * (p[1] - '0') + (p[2] - '0');
+                while (val > 256)
+                    val -= 256;
+                str += char(val);
+                p += 2;
+            }
+            else
+                str += *p;
+        }
+    }
+    return str;
+}
+
+
+
+// Number Parsing Definitions
+float ParseFloat(const char *p, const char *end) {
+    // Accumulate the decimal significand and exponent of the number
+    const char *start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    uint64_t significand = 0;
+    int nDigits = 0, exponent = 0;
+    for (; p < end && IsDigit(*p); ++p) {
+        if (significand == 0 && *p == '0') continue;
+        significand = significand * 10 + (*p - '0');
+        ++nDigits;
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && IsDigit(*p); ++p) {
+            --exponent;
+            if (significand == 0 && *p == '0') continue;
+            significand = significand * 10 + (*p - '0');
+            ++nDigits;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negExp = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negExp = (*p++ == '-');
+        int e = 0;
+        for (; p < end && IsDigit(*p); ++p)
+            if (e < 100000) e = e * 10 + (*p - '0');
+        exponent += negExp ? -e : e;
+    }
+
+    // Compute exactly-rounded value when significand and $10^e$ are exact doubles
+    if (nDigits <= 15 && exponent >= -22 && exponent <= 22) {
+        static const double powersOfTen[23] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        double v = double(significand);
+        if (exponent < 0) v /= powersOfTen[-exponent];
+        else              v *= powersOfTen[exponent];
+        return float(negative ? -v : v);
+    }
+
+    // Fall back to _atof()_ for long or extreme values
+    string str(start, end);
+    return float(atof(str.c_str()));
+}
+
+
+
+// SceneParser Declarations
+enum { PARAM_TYPE_INT, PARAM_TYPE_BOOL, PARAM_TYPE_FLOAT, PARAM_TYPE_POINT,
+    PARAM_TYPE_VECTOR, PARAM_TYPE_NORMAL, PARAM_TYPE_RGB, PARAM_TYPE_XYZ,
+    PARAM_TYPE_BLACKBODY, PARAM_TYPE_SPECTRUM,
+    PARAM_TYPE_STRING, PARAM_TYPE_TEXTURE };
+static const char *paramTypeToName(int type);
+struct PrefetchedInclude;
+class SceneParser {
+public:
+    // SceneParser Public Methods
+    SceneParser(const char *b, const char *e, MappedFile *f,
+                StatementList *rec, int d)
+        : tokenizer(b, e, f, rec), hasLookahead(false), lastLine(1),
+          record(rec), depth(d), failed(false), statementStart(NULL),
+          scanner(b, e, NULL, NULL), nextPrefetched(0) {
+        scanner.Quiet();
+    }
+    ~SceneParser();
+    void Parse();
+private:
+    // SceneParser Private Methods
+    Token Next() {
+        if (hasLookahead) hasLookahead = false;
+        else lookahead = tokenizer.Next();
+        lastLine = lookahead.line;
+        return lookahead;
+    }
+    const Token &Peek() {
+        if (!hasLookahead) {
+            lookahead = tokenizer.Next();
+            hasLookahead = true;
+        }
+        return lookahead;
+    }
+    void Report(StatementType level, const char *format, ...);
+    void SyntaxError(const Token &tok, const char *expected);
+    bool ParseStatement(SceneStatement *st);
+    float ExpectNumber();
+    string ExpectString();
+    void ExpectNumbers(float *v, int n);
+    void ParseTransform(SceneStatement *st);
+    void ParseParameterList(SceneStatement *st);
+    void ParseParameter(SceneStatement *st, const string &decl);
+    bool LookupType(const char *name, int *type, string &sname);
+    int CountArrayValues(bool *isString);
+    void ReadNumbers(float *v, int n);
+    void ReadStrings(string *s, int n);
+    void SkipValues(int n);
+    void ParseInclude(const string &filename);
+    bool PrefetchIncludes();
+
+    // SceneParser Private Data
+    Tokenizer tokenizer;
+    Token lookahead;
+    bool hasLookahead;
+    int lastLine;
+    StatementList *record;
+    int depth;
+    bool failed;
+    const char *statementStart;
+    Tokenizer scanner;
+    vector<PrefetchedInclude *> prefetched;
+    uint32_t nextPrefetched;
+};
+
+
+static const struct StatementSyntax {
+    const char *keyword;
+    StatementType type;
+    int nStrings, nNumbers;
+    bool hasParams;
+} statementSyntax[] = {
+    { "Accelerator",        STMT_ACCELERATOR,        1, 0, true },
+    { "ActiveTransform",    STMT_ACTIVETRANSFORM,    0, 0, false },
+    { "AreaLightSource",    STMT_AREALIGHTSOURCE,    1, 0, true },
+    { "AttributeBegin",     STMT_ATTRIBUTEBEGIN,     0, 0, false },
+    { "AttributeEnd",       STMT_ATTRIBUTEEND,       0, 0, false },
+    { "Camera",             STMT_CAMERA,             1, 0, true },
+    { "ConcatTransform",    STMT_CONCATTRANSFORM,    0, 0, false },
+    { "CoordinateSystem",   STMT_COORDINATESYSTEM,   1, 0, false },
+    { "CoordSysTransform",  STMT_COORDSYSTRANSFORM,  1, 0, false },
+    { "Film",               STMT_FILM,               1, 0, true },
+    { "Identity",           STMT_IDENTITY,           0, 0, false },
+    { "Include",            STMT_INCLUDE,            1, 0, false },
+    { "LightSource",        STMT_LIGHTSOURCE,        1, 0, true },
+    { "LookAt",             STMT_LOOKAT,             0, 9, false },
+    { "MakeNamedMaterial",  STMT_MAKENAMEDMATERIAL,  1, 0, true },
+    { "Material",           STMT_MATERIAL,           1, 0, true },
+    { "NamedMaterial",      STMT_NAMEDMATERIAL,      1, 0, false },
+    { "ObjectBegin",        STMT_OBJECTBEGIN,        1, 0, false },
+    { "ObjectEnd",          STMT_OBJECTEND,          0, 0, false },
+    { "ObjectInstance",     STMT_OBJECTINSTANCE,     1, 0, false },
+    { "PixelFilter",        STMT_PIXELFILTER,        1, 0, true },
+    { "Renderer",           STMT_RENDERER,           1, 0, true },
+    { "ReverseOrientation", STMT_REVERSEORIENTATION, 0, 0, false },
+    { "Rotate",             STMT_ROTATE,             0, 4, false },
+    { "Sampler",            STMT_SAMPLER,            1, 0, true },
+    { "Scale",              STMT_SCALE,              0, 3, false },
+    { "Shape",              STMT_SHAPE,              1, 0, true },
+    { "SurfaceIntegrator",  STMT_SURFACEINTEGRATOR,  1, 0, true },
+    { "Texture",            STMT_TEXTURE,            3, 0, true },
+    { "Transform",          STMT_TRANSFORM,          0, 0, false },
+    { "TransformBegin",     STMT_TRANSFORMBEGIN,     0, 0, false },
+    { "TransformEnd",       STMT_TRANSFORMEND,       0, 0, false },
+    { "TransformTimes",     STMT_TRANSFORMTIMES,     0, 2, false },
+    { "Translate",          STMT_TRANSLATE,          0, 3, false },
+    { "Volume",             STMT_VOLUME,             1, 0, true },
+    { "VolumeIntegrator",   STMT_VOLUMEINTEGRATOR,   1, 0, true },
+    { "WorldBegin",         STMT_WORLDBEGIN,         0, 0, false },
+    { "WorldEnd",           STMT_WORLDEND,           0, 0, false },
+};
+
+
+// Included files are parsed ahead in parallel when more than one core is used
+struct PrefetchedInclude {
+    PrefetchedInclude(const char *pos, const string &fn)
+        : position(pos), filename(fn), file(new MappedFile(fn)) { }
+    ~PrefetchedInclude() { delete file; }
+    const char *position;
+    string filename;
+    MappedFile *file;
+    StatementList statements;
+};
+
+
+class IncludeParseTask : public Task {
+public:
+    IncludeParseTask(PrefetchedInclude *inc, int d) : include(inc), depth(d) { }
+    void Run() {
+        MappedFile *file = include->file;
+        SceneParser parser(file->Data(), file->Data() + file->Size(), file,
+                           &include->statements, depth);
+        parser.Parse();
+        delete file;
+        include->file = NULL;
+    }
+private:
+    PrefetchedInclude *include;
+    int depth;
+};
+
+
+
+// Parsing Diagnostics Definitions
+static void EmitDiagnostic(StatementType level, int line, const char *msg) {
+    line_num = line;
+    if (level == STMT_WARNING)
+        Warning("%s", msg);
     else {
-		// filename
-        yyin = fopen(filename.c_str(), "r");
-		//  filenameĿ¼ΪĿ¼
-        SetSearchDirectory(DirectoryContaining(filename));
+        Error("%s", msg);
+        if (level == STMT_FATAL) exit(1);
     }
+}
 
-    if (yyin != NULL) {
-		// õǰļ
-        current_file = filename;
-        if (yyin == stdin) current_file = "<standard input>";
-        line_num = 1;
 
-		// ʼļ
-        yyparse();
+static void ReportV(StatementList *record, StatementType level, int line,
+                    const char *format, va_list args) {
+    char buf[2048];
+#if defined(PBRT_IS_WINDOWS)
+    vsnprintf_s(buf, sizeof(buf), _TRUNCATE, format, args);
+#else
+    vsnprintf(buf, sizeof(buf), format, args);
+#endif
+    // Record diagnostics of worker-thread parsers so they print in order
+    if (record) {
+        SceneStatement st;
+        st.type = level;
+        st.line = line;
+        st.args[0] = buf;
+        record->push_back(st);
+    }
+    else
+        EmitDiagnostic(level, line, buf);
+}
+
+
+
+// SceneParser Method Definitions
+SceneParser::~SceneParser() {
+    for (uint32_t i = nextPrefetched; i < prefetched.size(); ++i)
+        delete prefetched[i];
+}
+
+
+void SceneParser::Report(StatementType level, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    ReportV(record, level, lastLine, format, args);
+    va_end(args);
+}
+
+
+void SceneParser::SyntaxError(const Token &tok, const char *expected) {
+    if (failed) return;
+    lastLine = tok.line;
+    if (tok.type == TOKEN_EOF)
+        Report(STMT_FATAL, "Parsing error: unexpected end of file, expected %s",
+               expected);
+    else
+        Report(STMT_FATAL, "Parsing error: unexpected \"%s\", expected %s",
+               string(tok.start, tok.end).c_str(), expected);
+    // Drain the remaining tokens so a recording parser unwinds cleanly
+    failed = true;
+    tokenizer.Stop();
+    hasLookahead = false;
+}
+
+
+float SceneParser::ExpectNumber() {
+    Token tok = Next();
+    if (tok.type != TOKEN_NUMBER) SyntaxError(tok, "a number");
+    return ParseFloat(tok.start, tok.end);
+}
+
+
+string SceneParser::ExpectString() {
+    Token tok = Next();
+    if (tok.type != TOKEN_STRING) SyntaxError(tok, "a string");
+    return Dequote(tok);
+}
+
+
+void SceneParser::ExpectNumbers(float *v, int n) {
+    for (int i = 0; i < n; ++i)
+        v[i] = ExpectNumber();
+}
+
+
+void SceneParser::Parse() {
+    for (;;) {
+        SceneStatement st;
+        if (!ParseStatement(&st)) return;
+        if (st.type == STMT_INCLUDE) ParseInclude(st.args[0]);
+        else if (record) record->push_back(st);
+        else Execute(st);
+    }
+}
+
+
+bool SceneParser::ParseStatement(SceneStatement *st) {
+    Token tok = Next();
+    if (tok.type == TOKEN_EOF) return false;
+    statementStart = tok.start;
+    const StatementSyntax *syntax = NULL;
+    if (tok.type == TOKEN_IDENT) {
+        int nStatements = sizeof(statementSyntax) / sizeof(statementSyntax[0]);
+        for (int i = 0; i < nStatements; ++i)
+            if (tok.Is(statementSyntax[i].keyword)) {
+                syntax = &statementSyntax[i];
+                break;
+            }
+    }
+    if (!syntax) {
+        SyntaxError(tok, "a statement");
+        return false;
+    }
+
+    // Read the statement's arguments and parameters
+    st->type = syntax->type;
+    if (st->type == STMT_ACTIVETRANSFORM) {
+        Token which = Next();
+        if (which.Is("All") || which.Is("EndTime") || which.Is("StartTime"))
+            st->args[0] = string(which.start, which.end);
+        else
+            SyntaxError(which, "All, EndTime, or StartTime");
+    }
+    else if (st->type == STMT_CONCATTRANSFORM || st->type == STMT_TRANSFORM)
+        ParseTransform(st);
+    else {
+        for (int i = 0; i < syntax->nStrings; ++i)
+            st->args[i] = ExpectString();
+        ExpectNumbers(st->values, syntax->nNumbers);
+        if (syntax->hasParams)
+            ParseParameterList(st);
+    }
+    st->line = lastLine;
+    return !failed;
+}
+
+
+void SceneParser::ParseTransform(SceneStatement *st) {
+    bool isString = false;
+    bool bracketed = (Peek().type == TOKEN_LBRACK);
+    if (bracketed) Next();
+    int n = bracketed ? CountArrayValues(&isString) : 1;
+    if (isString || (!bracketed && Peek().type != TOKEN_NUMBER)) {
+        SyntaxError(Peek(), "a numeric array");
+        return;
+    }
+    if (n != 16) {
+        Report(STMT_ERROR, "\"%s\" requires a %d element array! (%d found)",
+               st->type == STMT_CONCATTRANSFORM ? "ConcatTransform" : "Transform",
+               16, n);
+        SkipValues(n);
+        st->type = STMT_NONE;
+    }
+    else
+        ReadNumbers(st->values, 16);
+    if (bracketed) Next();
+}
+
+
+void SceneParser::ParseParameterList(SceneStatement *st) {
+    while (Peek().type == TOKEN_STRING)
+        ParseParameter(st, Dequote(Next()));
+}
+
+
+int SceneParser::CountArrayValues(bool *isString) {
+    // Scan ahead to the closing bracket without consuming any tokens
+    Assert(!hasLookahead);
+    Tokenizer scan = tokenizer;
+    scan.Quiet();
+    int nNumbers = 0, nStrings = 0;
+    for (;;) {
+        Token tok = scan.Next();
+        if (tok.type == TOKEN_RBRACK) break;
+        if (tok.type == TOKEN_NUMBER) ++nNumbers;
+        else if (tok.type == TOKEN_STRING) ++nStrings;
+        else {
+            SyntaxError(tok, "\"]\"");
+            return 0;
+        }
+    }
+    if (nNumbers > 0 && nStrings > 0) {
+        Report(STMT_FATAL, "Parsing error: array mixes numeric and string values");
+        failed = true;
+        tokenizer.Stop();
+        return 0;
+    }
+    *isString = (nStrings > 0);
+    return nNumbers + nStrings;
+}
+
+
+void SceneParser::ReadNumbers(float *v, int n) {
+    for (int i = 0; i < n; ++i) {
+        Token tok = Next();
+        v[i] = ParseFloat(tok.start, tok.end);
+    }
+}
+
+
+void SceneParser::ReadStrings(string *s, int n) {
+    for (int i = 0; i < n; ++i)
+        s[i] = Dequote(Next());
+}
+
+
+void SceneParser::SkipValues(int n) {
+    for (int i = 0; i < n; ++i)
+        Next();
+}
+
+
+void SceneParser::ParseParameter(SceneStatement *st, const string &decl) {
+    // Find the extent of the parameter's values
+    bool isString = false;
+    bool bracketed = (Peek().type == TOKEN_LBRACK);
+    if (bracketed) Next();
+    int nItems = 1;
+    if (bracketed)
+        nItems = CountArrayValues(&isString);
+    else {
+        const Token &tok = Peek();
+        if (tok.type != TOKEN_NUMBER && tok.type != TOKEN_STRING) {
+            SyntaxError(tok, "a parameter value");
+            return;
+        }
+        isString = (tok.type == TOKEN_STRING);
+    }
+    if (failed) return;
+
+    // Check the values against the declared type
+    int type;
+    string name;
+    const char *declName = decl.c_str();
+    bool valid = LookupType(declName, &type, name);
+    if (!valid)
+        Report(STMT_WARNING, "Type of parameter \"%s\" is unknown", declName);
+    else if (type == PARAM_TYPE_TEXTURE || type == PARAM_TYPE_STRING ||
+             type == PARAM_TYPE_BOOL) {
+        if (!isString) {
+            Report(STMT_ERROR, "Expected string parameter value for parameter \"%s\" with type \"%s\". Ignoring.",
+                   name.c_str(), paramTypeToName(type));
+            valid = false;
+        }
+    }
+    else if (type != PARAM_TYPE_SPECTRUM) { /* spectrum can be either... */
+        if (isString) {
+            Report(STMT_ERROR, "Expected numeric parameter value for parameter \"%s\" with type \"%s\".  Ignoring.",
+                   name.c_str(), paramTypeToName(type));
+            valid = false;
+        }
+    }
+    if (!valid) {
+        SkipValues(nItems);
+        if (bracketed) Next();
+        return;
+    }
+
+    // Read values directly into the storage handed to the _ParamSet_
+    ParamSet &ps = st->params;
+    if (type == PARAM_TYPE_INT) {
+        int *idata = new int[nItems];
+        for (int i = 0; i < nItems; ++i) {
+            Token tok = Next();
+            idata[i] = int(ParseFloat(tok.start, tok.end));
+        }
+        ps.AdoptInt(name, idata, nItems);
+    }
+    else if (type == PARAM_TYPE_FLOAT) {
+        float *fdata = new float[nItems];
+        ReadNumbers(fdata, nItems);
+        ps.AdoptFloat(name, fdata, nItems);
+    }
+    else if (type == PARAM_TYPE_POINT || type == PARAM_TYPE_VECTOR ||
+             type == PARAM_TYPE_NORMAL) {
+        if ((nItems % 3) != 0)
+            Report(STMT_WARNING, "Excess values given with %s parameter \"%s\". "
+                   "Ignoring last %d of them", paramTypeToName(type),
+                   declName, nItems % 3);
+        int n = nItems / 3;
+        if (type == PARAM_TYPE_POINT) {
+            Point *pdata = new Point[n];
+            ReadNumbers((float *)pdata, 3 * n);
+            ps.AdoptPoint(name, pdata, n);
+        }
+        else if (type == PARAM_TYPE_VECTOR) {
+            Vector *vdata = new Vector[n];
+            ReadNumbers((float *)vdata, 3 * n);
+            ps.AdoptVector(name, vdata, n);
+        }
+        else {
+            Normal *ndata = new Normal[n];
+            ReadNumbers((float *)ndata, 3 * n);
+            ps.AdoptNormal(name, ndata, n);
+        }
+        SkipValues(nItems % 3);
+    }
+    else if (isString) {
+        vector<string> strings(nItems);
+        ReadStrings(&strings[0], nItems);
+        if (type == PARAM_TYPE_BOOL) {
+            // strings -> bools
+            bool *bdata = new bool[nItems];
+            for (int i = 0; i < nItems; ++i) {
+                if (strings[i] == "true") bdata[i] = true;
+                else if (strings[i] == "false") bdata[i] = false;
+                else {
+                    Report(STMT_WARNING, "Value \"%s\" unknown for boolean parameter \"%s\"."
+                        "Using \"false\".", strings[i].c_str(), declName);
+                    bdata[i] = false;
+                }
+            }
+            ps.AddBool(name, bdata, nItems);
+            delete[] bdata;
+        }
+        else if (type == PARAM_TYPE_STRING)
+            ps.AddString(name, &strings[0], nItems);
+        else if (type == PARAM_TYPE_TEXTURE) {
+            if (nItems == 1)
+                ps.AddTexture(name, strings[0]);
+            else
+                Report(STMT_ERROR, "Only one string allowed for \"texture\" parameter \"%s\"",
+                    name.c_str());
+        }
+        else {
+            // Leave reading the SPD files to _Execute()_
+            ps.EraseSpectrum(name);
+            SpectrumFileParam sf;
+            sf.name = name;
+            sf.files.swap(strings);
+            st->spectrumFiles.push_back(sf);
+        }
+    }
+    else {
+        // Read spectral values, which _ParamSet_ converts to _Spectrum_
+        vector<float> values(nItems + 1);
+        float *data = &values[0];
+        ReadNumbers(data, nItems);
+        for (uint32_t i = 0; i < st->spectrumFiles.size(); ++i)
+            if (st->spectrumFiles[i].name == name) {
+                st->spectrumFiles.erase(st->spectrumFiles.begin() + i);
+                break;
+            }
+        if (type == PARAM_TYPE_RGB) {
+            if ((nItems % 3) != 0)
+                Report(STMT_WARNING, "Excess RGB values given with parameter \"%s\". "
+                       "Ignoring last %d of them", declName, nItems % 3);
+            ps.AddRGBSpectrum(name, data, nItems);
+        } else if (type == PARAM_TYPE_XYZ) {
+            if ((nItems % 3) != 0)
+                Report(STMT_WARNING, "Excess XYZ values given with parameter \"%s\". "
+                       "Ignoring last %d of them", declName, nItems % 3);
+            ps.AddXYZSpectrum(name, data, nItems);
+        } else if (type == PARAM_TYPE_BLACKBODY) {
+            if ((nItems % 2) != 0)
+                Report(STMT_WARNING, "Excess value given with blackbody parameter \"%s\". "
+                       "Ignoring extra one.", declName);
+            ps.AddBlackbodySpectrum(name, data, nItems);
+        } else {
+            if ((nItems % 2) != 0)
+                Report(STMT_WARNING, "Non-even number of values given with sampled spectrum "
+                       "parameter \"%s\". Ignoring extra.", declName);
+            ps.AddSampledSpectrum(name, data, nItems);
+        }
+    }
+    if (bracketed) Next();
+}
+
+
+static const char *paramTypeToName(int type) {
+    switch (type) {
+    case PARAM_TYPE_INT: return "int";
+    case PARAM_TYPE_BOOL: return "bool";
+    case PARAM_TYPE_FLOAT: return "float";
+    case PARAM_TYPE_POINT: return "point";
+    case PARAM_TYPE_VECTOR: return "vector";
+    case PARAM_TYPE_NORMAL: return "normal";
+    case PARAM_TYPE_RGB: return "rgb/color";
+    case PARAM_TYPE_XYZ: return "xyz";
+    case PARAM_TYPE_BLACKBODY: return "blackbody";
+    case PARAM_TYPE_SPECTRUM: return "spectrum";
+    case PARAM_TYPE_STRING: return "string";
+    case PARAM_TYPE_TEXTURE: return "texture";
+    default: Severe("Error in paramTypeToName"); return NULL;
+    }
+}
+
+
+bool SceneParser::LookupType(const char *name, int *type, string &sname) {
+    Assert(name != NULL);
+    *type = 0;
+    const char *strp = name;
+    while (*strp && isspace(*strp))
+        ++strp;
+    if (!*strp) {
+        Report(STMT_ERROR, "Parameter \"%s\" doesn't have a type declaration?!", name);
+        return false;
+    }
+#define TRY_DECODING_TYPE(name, mask) \
+        if (strncmp(name, strp, strlen(name)) == 0) { \
+            *type = mask; strp += strlen(name); \
+        }
+         TRY_DECODING_TYPE("float",     PARAM_TYPE_FLOAT)
+    else TRY_DECODING_TYPE("integer",   PARAM_TYPE_INT)
+    else TRY_DECODING_TYPE("bool",      PARAM_TYPE_BOOL)
+    else TRY_DECODING_TYPE("point",     PARAM_TYPE_POINT)
+    else TRY_DECODING_TYPE("vector",    PARAM_TYPE_VECTOR)
+    else TRY_DECODING_TYPE("normal",    PARAM_TYPE_NORMAL)
+    else TRY_DECODING_TYPE("string",    PARAM_TYPE_STRING)
+    else TRY_DECODING_TYPE("texture",   PARAM_TYPE_TEXTURE)
+    else TRY_DECODING_TYPE("color",     PARAM_TYPE_RGB)
+    else TRY_DECODING_TYPE("rgb",       PARAM_TYPE_RGB)
+    else TRY_DECODING_TYPE("xyz",       PARAM_TYPE_XYZ)
+    else TRY_DECODING_TYPE("blackbody", PARAM_TYPE_BLACKBODY)
+    else TRY_DECODING_TYPE("spectrum",  PARAM_TYPE_SPECTRUM)
+    else {
+        Report(STMT_ERROR, "Unable to decode type for name \"%s\"", name);
+        return false;
+    }
+    while (*strp && isspace(*strp))
+        ++strp;
+    sname = string(strp);
+    return true;
+}
+
+
+void SceneParser::ParseInclude(const string &filename) {
+    if (depth > 32) {
+        Report(STMT_FATAL, "Only 32 levels of nested Include allowed in scene files.");
+        failed = true;
+        tokenizer.Stop();
+        return;
+    }
+    string newFile = AbsolutePath(ResolveFilename(filename));
+    if (!record && PrefetchIncludes()) {
+        // Replay the statements of the file parsed ahead by a worker
+        PrefetchedInclude *inc = prefetched[nextPrefetched];
+        prefetched[nextPrefetched++] = NULL;
+        if (inc->statements.size() == 0)
+            Report(STMT_ERROR, "Unable to open included scene file \"%s\"",
+                   newFile.c_str());
+        else
+            Replay(inc->statements);
+        delete inc;
+        return;
+    }
+
+    // Parse the included file on this thread
+    MappedFile file(newFile);
+    if (!file.IsValid()) {
+        Report(STMT_ERROR, "Unable to open included scene file \"%s\"",
+               newFile.c_str());
+        return;
+    }
+    if (record) {
+        SceneStatement begin;
+        begin.type = STMT_BEGIN_FILE;
+        begin.args[0] = newFile;
+        record->push_back(begin);
+    }
+    string savedFile = current_file;
+    if (!record) current_file = newFile;
+    SceneParser parser(file.Data(), file.Data() + file.Size(), &file,
+                       record, depth + 1);
+    parser.Parse();
+    if (record) {
+        SceneStatement end;
+        end.type = STMT_END_FILE;
+        record->push_back(end);
+    }
+    else
+        current_file = savedFile;
+}
+
+
+bool SceneParser::PrefetchIncludes() {
+    int nCores = NumSystemCores();
+    if (nCores <= 1) return false;
+    if (nextPrefetched < prefetched.size())
+        return prefetched[nextPrefetched]->position == statementStart;
+
+    // Find the next batch of _Include_ statements in this file
+    for (uint32_t i = 0; i < prefetched.size(); ++i)
+        delete prefetched[i];
+    prefetched.erase(prefetched.begin(), prefetched.end());
+    nextPrefetched = 0;
+    size_t batchBytes = 0;
+    while (prefetched.size() < 8 * uint32_t(nCores) &&
+           batchBytes < (256 << 20)) {
+        Token tok = scanner.Next();
+        if (tok.type == TOKEN_EOF) break;
+        if (tok.type != TOKEN_IDENT || !tok.Is("Include") ||
+            tok.start < statementStart)
+            continue;
+        Token name = scanner.Next();
+        if (name.type != TOKEN_STRING) break;
+        PrefetchedInclude *inc = new PrefetchedInclude(tok.start,
+            AbsolutePath(ResolveFilename(Dequote(name))));
+        batchBytes += inc->file->Size();
+        prefetched.push_back(inc);
+    }
+    if (prefetched.size() == 0 || prefetched[0]->position != statementStart) {
+        for (uint32_t i = 0; i < prefetched.size(); ++i)
+            delete prefetched[i];
+        prefetched.erase(prefetched.begin(), prefetched.end());
+        return false;
+    }
+
+    // Parse the batch's files in parallel and wait for all of them
+    vector<Task *> parseTasks;
+    for (uint32_t i = 0; i < prefetched.size(); ++i) {
+        if (!prefetched[i]->file->IsValid()) continue;
+        SceneStatement begin;
+        begin.type = STMT_BEGIN_FILE;
+        begin.args[0] = prefetched[i]->filename;
+        prefetched[i]->statements.push_back(begin);
+        parseTasks.push_back(new IncludeParseTask(prefetched[i], depth + 1));
+    }
+    EnqueueTasks(parseTasks);
+    WaitForAllTasks();
+    for (uint32_t i = 0; i < parseTasks.size(); ++i)
+        delete parseTasks[i];
+    for (uint32_t i = 0; i < prefetched.size(); ++i)
+        if (prefetched[i]->statements.size() > 0) {
+            SceneStatement end;
+            end.type = STMT_END_FILE;
+            prefetched[i]->statements.push_back(end);
+        }
+    return true;
+}
+
+
+
+// Statement Execution Definitions
+static void Execute(SceneStatement &st) {
+    line_num = st.line;
+    for (uint32_t i = 0; i < st.spectrumFiles.size(); ++i) {
+        const vector<string> &files = st.spectrumFiles[i].files;
+        vector<const char *> names(files.size());
+        for (uint32_t j = 0; j < files.size(); ++j)
+            names[j] = files[j].c_str();
+        st.params.AddSampledSpectrumFiles(st.spectrumFiles[i].name,
+                                          &names[0], int(names.size()));
+    }
+    const string *a = st.args;
+    float *v = st.values;
+    switch (st.type) {
+    case STMT_NONE: break;
+    case STMT_ACCELERATOR: pbrtAccelerator(a[0], st.params); break;
+    case STMT_ACTIVETRANSFORM:
+        if (a[0] == "All") pbrtActiveTransformAll();
+        else if (a[0] == "EndTime") pbrtActiveTransformEndTime();
+        else pbrtActiveTransformStartTime();
+        break;
+    case STMT_AREALIGHTSOURCE: pbrtAreaLightSource(a[0], st.params); break;
+    case STMT_ATTRIBUTEBEGIN: pbrtAttributeBegin(); break;
+    case STMT_ATTRIBUTEEND: pbrtAttributeEnd(); break;
+    case STMT_CAMERA: pbrtCamera(a[0], st.params); break;
+    case STMT_CONCATTRANSFORM: pbrtConcatTransform(v); break;
+    case STMT_COORDINATESYSTEM: pbrtCoordinateSystem(a[0]); break;
+    case STMT_COORDSYSTRANSFORM: pbrtCoordSysTransform(a[0]); break;
+    case STMT_FILM: pbrtFilm(a[0], st.params); break;
+    case STMT_IDENTITY: pbrtIdentity(); break;
+    case STMT_LIGHTSOURCE: pbrtLightSource(a[0], st.params); break;
+    case STMT_LOOKAT:
+        pbrtLookAt(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]);
+        break;
+    case STMT_MAKENAMEDMATERIAL: pbrtMakeNamedMaterial(a[0], st.params); break;
+    case STMT_MATERIAL: pbrtMaterial(a[0], st.params); break;
+    case STMT_NAMEDMATERIAL: pbrtNamedMaterial(a[0]); break;
+    case STMT_OBJECTBEGIN: pbrtObjectBegin(a[0]); break;
+    case STMT_OBJECTEND: pbrtObjectEnd(); break;
+    case STMT_OBJECTINSTANCE: pbrtObjectInstance(a[0]); break;
+    case STMT_PIXELFILTER: pbrtPixelFilter(a[0], st.params); break;
+    case STMT_RENDERER: pbrtRenderer(a[0], st.params); break;
+    case STMT_REVERSEORIENTATION: pbrtReverseOrientation(); break;
+    case STMT_ROTATE: pbrtRotate(v[0], v[1], v[2], v[3]); break;
+    case STMT_SAMPLER: pbrtSampler(a[0], st.params); break;
+    case STMT_SCALE: pbrtScale(v[0], v[1], v[2]); break;
+    case STMT_SHAPE: pbrtShape(a[0], st.params); break;
+    case STMT_SURFACEINTEGRATOR: pbrtSurfaceIntegrator(a[0], st.params); break;
+    case STMT_TEXTURE: pbrtTexture(a[0], a[1], a[2], st.params); break;
+    case STMT_TRANSFORM: pbrtTransform(v); break;
+    case STMT_TRANSFORMBEGIN: pbrtTransformBegin(); break;
+    case STMT_TRANSFORMEND: pbrtTransformEnd(); break;
+    case STMT_TRANSFORMTIMES: pbrtTransformTimes(v[0], v[1]); break;
+    case STMT_TRANSLATE: pbrtTranslate(v[0], v[1], v[2]); break;
+    case STMT_VOLUME: pbrtVolume(a[0], st.params); break;
+    case STMT_VOLUMEINTEGRATOR: pbrtVolumeIntegrator(a[0], st.params); break;
+    case STMT_WORLDBEGIN: pbrtWorldBegin(); break;
+    case STMT_WORLDEND: pbrtWorldEnd(); break;
+    case STMT_WARNING: case STMT_ERROR: case STMT_FATAL:
+        EmitDiagnostic(st.type, st.line, a[0].c_str());
+        break;
+    default:
+        Severe("Unexpected statement type %d in Execute()", int(st.type));
+    }
+}
+
+
+static void Replay(StatementList &statements) {
+    // Track the file each recorded statement came from for diagnostics
+    vector<string> files;
+    for (uint32_t i = 0; i < statements.size(); ++i) {
+        SceneStatement &st = statements[i];
+        if (st.type == STMT_BEGIN_FILE) {
+            files.push_back(current_file);
+            current_file = st.args[0];
+        }
+        else if (st.type == STMT_END_FILE) {
+            current_file = files.back();
+            files.pop_back();
+        }
+        else
+            Execute(st);
+        // Free parameter values as soon as they have been consumed
+        st.params.Clear();
+    }
+}
+
+
+
+// Parsing Global Interface
+bool ParseFile(const string &filename) {
+    bool opened;
+    if (filename == "-") {
+        // Read all of standard input into memory
+        vector<char> buf;
+        char chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), stdin)) > 0)
+            buf.insert(buf.end(), chunk, chunk + n);
+        current_file = "<standard input>";
+        line_num = 1;
+        if (buf.empty()) buf.push_back('\n');
+        SceneParser parser(&buf[0], &buf[0] + buf.size(), NULL, NULL, 0);
+        parser.Parse();
+        opened = true;
+    }
+    else {
+        // filename
+        MappedFile file(filename);
+        //  filenameĿ¼ΪĿ¼
+        SetSearchDirectory(DirectoryContaining(filename));
+        opened = file.IsValid();
+        if (opened) {
+            // õǰļ
+            current_file = filename;
+            line_num = 1;
 
-        if (yyin != stdin) fclose(yyin);
+            // ʼļ
+            SceneParser parser(file.Data(), file.Data() + file.Size(), &file,
+                               NULL, 0);
+            parser.Parse();
+        }
     }
     current_file = "";
     line_num = 0;
-    return (yyin != NULL);
+    return opened;
 }
 
 
@@ -39,5 +39,6 @@
 // core/parser.h*
 #include "pbrt.h"
 bool ParseFile(const string &filename);
+float ParseFloat(const char *start, const char *end);
 
 #endif // PBRT_CORE_PARSER_H
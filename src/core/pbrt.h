@@ -153,8 +153,11 @@ class GeometricPrimitive;
 template <int nSamples> class CoefficientSpectrum;
 class RGBSpectrum;
 class SampledSpectrum;
+#ifdef PBRT_SAMPLED_SPECTRUM
+typedef SampledSpectrum Spectrum;
+#else
 typedef RGBSpectrum Spectrum;
-// typedef SampledSpectrum Spectrum;
+#endif
 class Camera;
 class ProjectiveCamera;
 class Sampler;
@@ -174,7 +177,9 @@ class Light;
 struct VisibilityTester;
 class AreaLight;
 struct Distribution1D;
+struct AliasDistribution1D;
 struct Distribution2D;
+struct HierarchicalDistribution2D;
 struct BSDFSample;
 struct BSDFSampleOffsets;
 struct LightSample;
@@ -213,6 +218,16 @@ class VolumeIntegrator;
 #define PBRT_HAS_64_BIT_ATOMICS
 #endif
 #endif // PBRT_HAS_64_BIT_ATOMICS
+#if !defined(PBRT_HAS_SSE) && !defined(PBRT_NO_SSE)
+#if defined(__SSE2__) || defined(_M_X64)
+#define PBRT_HAS_SSE
+#endif
+#endif // PBRT_HAS_SSE
+#if !defined(PBRT_HAS_AVX) && !defined(PBRT_NO_AVX) && defined(PBRT_HAS_SSE)
+#if defined(__AVX__)
+#define PBRT_HAS_AVX
+#endif
+#endif // PBRT_HAS_AVX
 
 // Global Inline Functions
 inline float Lerp(float t, float v1, float v2) {
@@ -323,5 +338,33 @@ inline bool Quadratic(float A, float B, float C, float *t0, float *t1) {
 }
 
 
+inline float HalfToFloat(uint16_t h) {
+    // Rebias half exponent by scaling the shifted bits by $2^{112}$
+    uint32_t bits = uint32_t(h & 0x7fff) << 13;
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    f *= 5.192296858534828e33f;
+    memcpy(&bits, &f, sizeof(float));
+    bits |= uint32_t(h & 0x8000) << 16;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+
+inline uint16_t FloatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(float));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+    memcpy(&f, &bits, sizeof(float));
+    // Rebias exponent by $2^{-112}$, round, and clamp to largest finite half
+    f *= 1.925929944387236e-34f;
+    memcpy(&bits, &f, sizeof(float));
+    bits = (bits + 0x1000) >> 13;
+    if (bits > 0x7bff) bits = 0x7bff;
+    return uint16_t(sign | bits);
+}
+
+
 
 #endif // PBRT_CORE_PBRT_H
@@ -39,6 +39,12 @@
 #include "montecarlo.h"
 #include "imageio.h"
 #include <float.h>
+#ifdef PBRT_HAS_SSE
+#include <emmintrin.h>
+#endif
+#ifdef PBRT_HAS_AVX
+#include <immintrin.h>
+#endif
 
 // Spherical Harmonics Local Definitions
 static void legendrep(float x, int lmax, float *out) {
@@ -168,10 +174,237 @@ static inline float lambda(float l) {
 }
 
 
+// $K_l^m$ values for all supported bands, including $\sqrt{2}$ for $m \ne 0$
+static const int SHMaxLmax = 28;
+static float KlmTable[(SHMaxLmax+1) * (SHMaxLmax+1)];
+static bool InitKlmTable() {
+    const float sqrt2 = sqrtf(2.f);
+    for (int l = 0; l <= SHMaxLmax; ++l)
+        for (int m = -l; m <= l; ++m)
+            KlmTable[SHIndex(l, m)] = (m == 0) ? K(l, m) : sqrt2 * K(l, m);
+    return true;
+}
+
+
+static bool klmTableInitialized = InitKlmTable();
+#ifdef PBRT_HAS_SSE
+static void SHEvaluate4(const Vector *w, int lmax, __m128 *out) {
+    // Compute Legendre polynomial values for four $\cos\theta$ values
+#define P(l,m) out[SHIndex(l,m)]
+    __m128 x = _mm_setr_ps(w[0].z, w[1].z, w[2].z, w[3].z);
+    P(0,0) = _mm_set1_ps(1.f);
+    if (lmax > 0) P(1,0) = x;
+    for (int l = 2; l <= lmax; ++l)
+        P(l, 0) = _mm_div_ps(_mm_sub_ps(
+            _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(float(2*l-1)), x), P(l-1,0)),
+            _mm_mul_ps(_mm_set1_ps(float(l-1)), P(l-2,0))), _mm_set1_ps(float(l)));
+    float neg = -1.f, dfact = 1.f;
+    __m128 xroot = _mm_sqrt_ps(_mm_max_ps(_mm_setzero_ps(),
+        _mm_sub_ps(_mm_set1_ps(1.f), _mm_mul_ps(x, x))));
+    __m128 xpow = xroot;
+    for (int l = 1; l <= lmax; ++l) {
+        P(l, l) = _mm_mul_ps(_mm_set1_ps(neg * dfact), xpow);
+        neg *= -1.f;
+        dfact *= 2*l + 1;
+        xpow = _mm_mul_ps(xpow, xroot);
+    }
+    for (int l = 2; l <= lmax; ++l)
+        P(l, l-1) = _mm_mul_ps(_mm_mul_ps(x, _mm_set1_ps(float(2*l-1))),
+                               P(l-1, l-1));
+    for (int l = 3; l <= lmax; ++l)
+        for (int m = 1; m <= l-2; ++m)
+            P(l, m) = _mm_div_ps(_mm_sub_ps(
+                _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(float(2*(l-1)+1)), x), P(l-1,m)),
+                _mm_mul_ps(_mm_set1_ps(float(l-1+m)), P(l-2,m))),
+                _mm_set1_ps(float(l-m)));
+#undef P
+
+    // Compute $\sin{}i\phi$ and $\cos{}i\phi$ for four directions
+    __m128 sins[SHMaxLmax+1], coss[SHMaxLmax+1];
+    __m128 xyLen = xroot;
+    __m128 poleMask = _mm_cmpeq_ps(xyLen, _mm_setzero_ps());
+    __m128 s = _mm_andnot_ps(poleMask, _mm_div_ps(
+        _mm_setr_ps(w[0].y, w[1].y, w[2].y, w[3].y), xyLen));
+    __m128 c = _mm_or_ps(_mm_andnot_ps(poleMask, _mm_div_ps(
+        _mm_setr_ps(w[0].x, w[1].x, w[2].x, w[3].x), xyLen)),
+        _mm_and_ps(poleMask, _mm_set1_ps(1.f)));
+    __m128 si = _mm_setzero_ps(), ci = _mm_set1_ps(1.f);
+    for (int i = 0; i <= lmax; ++i) {
+        sins[i] = si;
+        coss[i] = ci;
+        __m128 oldsi = si;
+        si = _mm_add_ps(_mm_mul_ps(si, c), _mm_mul_ps(ci, s));
+        ci = _mm_sub_ps(_mm_mul_ps(ci, c), _mm_mul_ps(oldsi, s));
+    }
+
+    // Apply SH definitions to compute final $(l,m)$ values
+    for (int l = 0; l <= lmax; ++l) {
+        for (int m = -l; m < 0; ++m)
+            out[SHIndex(l, m)] = _mm_mul_ps(_mm_mul_ps(
+                _mm_set1_ps(KlmTable[SHIndex(l, m)]), out[SHIndex(l, -m)]), sins[-m]);
+        out[SHIndex(l, 0)] = _mm_mul_ps(out[SHIndex(l, 0)],
+                                        _mm_set1_ps(KlmTable[SHIndex(l, 0)]));
+        for (int m = 1; m <= l; ++m)
+            out[SHIndex(l, m)] = _mm_mul_ps(out[SHIndex(l, m)],
+                _mm_mul_ps(_mm_set1_ps(KlmTable[SHIndex(l, m)]), coss[m]));
+    }
+}
+
+
+#endif // PBRT_HAS_SSE
+static void SHAccumulate(float *acc, const float *v, float scale, int n) {
+    // Compute $\mbox{acc} \leftarrow \mbox{acc} + \mbox{scale} \cdot v$
+    int i = 0;
+#ifdef PBRT_HAS_AVX
+    __m256 s8 = _mm256_set1_ps(scale);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                 _mm256_mul_ps(s8, _mm256_loadu_ps(v + i))));
+#endif
+#ifdef PBRT_HAS_SSE
+    __m128 s = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                          _mm_mul_ps(s, _mm_loadu_ps(v + i))));
+#endif
+    for (; i < n; ++i)
+        acc[i] += scale * v[i];
+}
+
+
+// The $x$-axis rotations by $\pm\pi/2$ used by _SHRotate()_, stored as
+// sparse rows so that batched rotations skip the zero terms
+static const int SHMaxRotationLmax = 9;
+struct SHRotationTerm {
+    int column;
+    float weight;
+};
+
+
+struct SHRotationRows {
+    vector<int> start;
+    vector<SHRotationTerm> terms;
+};
+
+
+static SHRotationRows XPlusRows, XMinusRows;
+static void InitRotationRows(void (*rotate)(const Spectrum *, Spectrum *, int),
+                             SHRotationRows *rows) {
+    // Rotate each basis function and record its nonzero projections
+    int nTerms = SHTerms(SHMaxRotationLmax);
+    vector<float> M(nTerms * nTerms, 0.f);
+    Spectrum *basis = new Spectrum[nTerms], *rotated = new Spectrum[nTerms];
+    for (int k = 0; k < nTerms; ++k) {
+        for (int j = 0; j < nTerms; ++j)
+            basis[j] = Spectrum(j == k ? 1.f : 0.f);
+        rotate(basis, rotated, SHMaxRotationLmax);
+        for (int j = 0; j < nTerms; ++j)
+            M[j * nTerms + k] = rotated[j][0];
+    }
+    delete[] basis;
+    delete[] rotated;
+    for (int j = 0; j < nTerms; ++j) {
+        rows->start.push_back(int(rows->terms.size()));
+        for (int k = 0; k < nTerms; ++k)
+            if (M[j * nTerms + k] != 0.f) {
+                SHRotationTerm term = { k, M[j * nTerms + k] };
+                rows->terms.push_back(term);
+            }
+    }
+    rows->start.push_back(int(rows->terms.size()));
+}
+
+
+static bool InitRotationTables() {
+    InitRotationRows(SHRotateXPlus, &XPlusRows);
+    InitRotationRows(SHRotateXMinus, &XMinusRows);
+    return true;
+}
+
+
+static bool rotationTablesInitialized = InitRotationTables();
+static void SHRotateRows(const SHRotationRows &rows, const float *c_in,
+                         float *c_out, int count, int lmax) {
+    // Multiply _count_ interleaved coefficient vectors by sparse _rows_
+    int nTerms = SHTerms(lmax), i = 0;
+    const int *start = &rows.start[0];
+    const SHRotationTerm *terms = &rows.terms[0];
+#ifdef PBRT_HAS_AVX
+    for (; i + 8 <= count; i += 8)
+        for (int j = 0; j < nTerms; ++j) {
+            __m256 acc = _mm256_setzero_ps();
+            for (const SHRotationTerm *t = &terms[start[j]];
+                 t != &terms[start[j+1]]; ++t)
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(
+                    _mm256_set1_ps(t->weight),
+                    _mm256_loadu_ps(&c_in[t->column * count + i])));
+            _mm256_storeu_ps(&c_out[j * count + i], acc);
+        }
+#endif
+#ifdef PBRT_HAS_SSE
+    for (; i + 4 <= count; i += 4)
+        for (int j = 0; j < nTerms; ++j) {
+            __m128 acc = _mm_setzero_ps();
+            for (const SHRotationTerm *t = &terms[start[j]];
+                 t != &terms[start[j+1]]; ++t)
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(t->weight),
+                    _mm_loadu_ps(&c_in[t->column * count + i])));
+            _mm_storeu_ps(&c_out[j * count + i], acc);
+        }
+#endif
+    for (; i < count; ++i)
+        for (int j = 0; j < nTerms; ++j) {
+            float acc = 0.f;
+            for (const SHRotationTerm *t = &terms[start[j]];
+                 t != &terms[start[j+1]]; ++t)
+                acc += t->weight * c_in[t->column * count + i];
+            c_out[j * count + i] = acc;
+        }
+}
+
+
+static void SHRotateZ(const float *c_in, float *c_out, int count,
+                      float alpha, int lmax) {
+    // Rotate _count_ interleaved coefficient vectors about $z$ by _alpha_
+    float *ct = ALLOCA(float, lmax+1);
+    float *st = ALLOCA(float, lmax+1);
+    sinCosIndexed(sinf(alpha), cosf(alpha), lmax+1, st, ct);
+    for (int l = 0; l <= lmax; ++l)
+        for (int m = -l; m <= l; ++m) {
+            // Compute $(l,m)$ coefficients from the $(l,\pm m)$ inputs
+            const float *a = &c_in[SHIndex(l, m) * count];
+            const float *b = &c_in[SHIndex(l, -m) * count];
+            float *out = &c_out[SHIndex(l, m) * count];
+            float c = ct[abs(m)], s = (m < 0) ? -st[-m] : st[m];
+            int i = 0;
+#ifdef PBRT_HAS_AVX
+            __m256 c8 = _mm256_set1_ps(c), s8 = _mm256_set1_ps(s);
+            for (; i + 8 <= count; i += 8)
+                _mm256_storeu_ps(out + i, _mm256_add_ps(
+                    _mm256_mul_ps(c8, _mm256_loadu_ps(a + i)),
+                    _mm256_mul_ps(s8, _mm256_loadu_ps(b + i))));
+#endif
+#ifdef PBRT_HAS_SSE
+            __m128 c4 = _mm_set1_ps(c), s4 = _mm_set1_ps(s);
+            for (; i + 4 <= count; i += 4)
+                _mm_storeu_ps(out + i, _mm_add_ps(
+                    _mm_mul_ps(c4, _mm_loadu_ps(a + i)),
+                    _mm_mul_ps(s4, _mm_loadu_ps(b + i))));
+#endif
+            for (; i < count; ++i)
+                out[i] = c * a[i] + s * b[i];
+        }
+}
+
+
+// Number of directions evaluated together by the SH projection routines
+static const int SHDirectionBatch = 64;
+
+
 
 // Spherical Harmonics Definitions
 void SHEvaluate(const Vector &w, int lmax, float *out) {
-    if (lmax > 28) {
+    if (lmax > SHMaxLmax) {
         Error("SHEvaluate() runs out of numerical precision for lmax > 28. "
                "If you need more bands, try recompiling using doubles.");
         exit(1);
@@ -181,12 +414,6 @@ void SHEvaluate(const Vector &w, int lmax, float *out) {
     Assert(w.Length() > .995f && w.Length() < 1.005f);
     legendrep(w.z, lmax, out);
 
-    // Compute $K_l^m$ coefficients
-    float *Klm = ALLOCA(float, SHTerms(lmax));
-    for (int l = 0; l <= lmax; ++l)
-        for (int m = -l; m <= l; ++m)
-            Klm[SHIndex(l, m)] = K(l, m);
-
     // Compute $\sin\phi$ and $\cos\phi$ values
     float *sins = ALLOCA(float, lmax+1), *coss = ALLOCA(float, lmax+1);
     float xyLen = sqrtf(max(0.f, 1.f - w.z*w.z));
@@ -198,19 +425,18 @@ void SHEvaluate(const Vector &w, int lmax, float *out) {
         sinCosIndexed(w.y / xyLen, w.x / xyLen, lmax+1, sins, coss);
 
     // Apply SH definitions to compute final $(l,m)$ values
-    static const float sqrt2 = sqrtf(2.f);
     for (int l = 0; l <= lmax; ++l) {
         for (int m = -l; m < 0; ++m)
         {
-            out[SHIndex(l, m)] = sqrt2 * Klm[SHIndex(l, m)] *
+            out[SHIndex(l, m)] = KlmTable[SHIndex(l, m)] *
                 out[SHIndex(l, -m)] * sins[-m];
             Assert(!isnan(out[SHIndex(l,m)]));
             Assert(!isinf(out[SHIndex(l,m)]));
         }
-        out[SHIndex(l, 0)] *= Klm[SHIndex(l, 0)];
+        out[SHIndex(l, 0)] *= KlmTable[SHIndex(l, 0)];
         for (int m = 1; m <= l; ++m)
         {
-            out[SHIndex(l, m)] *= sqrt2 * Klm[SHIndex(l, m)] * coss[m];
+            out[SHIndex(l, m)] *= KlmTable[SHIndex(l, m)] * coss[m];
             Assert(!isnan(out[SHIndex(l,m)]));
             Assert(!isinf(out[SHIndex(l,m)]));
         }
@@ -218,6 +444,31 @@ void SHEvaluate(const Vector &w, int lmax, float *out) {
 }
 
 
+void SHEvaluate(const Vector *w, int count, int lmax, float *out) {
+    if (lmax > SHMaxLmax) {
+        Error("SHEvaluate() runs out of numerical precision for lmax > 28. "
+               "If you need more bands, try recompiling using doubles.");
+        exit(1);
+    }
+    int nTerms = SHTerms(lmax), i = 0;
+#ifdef PBRT_HAS_SSE
+    // Evaluate four directions at a time and scatter their values to _out_
+    __m128 Y4[(SHMaxLmax+1) * (SHMaxLmax+1)];
+    for (; i + 4 <= count; i += 4) {
+        SHEvaluate4(&w[i], lmax, Y4);
+        for (int j = 0; j < nTerms; ++j) {
+            float v[4];
+            _mm_storeu_ps(v, Y4[j]);
+            for (int k = 0; k < 4; ++k)
+                out[(i+k) * nTerms + j] = v[k];
+        }
+    }
+#endif
+    for (; i < count; ++i)
+        SHEvaluate(w[i], lmax, &out[i * nTerms]);
+}
+
+
 #if 0
 // Believe this is correct, but not well tested
 void SHEvaluate(float costheta, float cosphi, float sinphi, int lmax, float *out) {
@@ -335,14 +586,48 @@ void SHReduceRinging(Spectrum *c, int lmax, float lambda) {
 
 void SHRotate(const Spectrum *c_in, Spectrum *c_out, const Matrix4x4 &m,
               int lmax, MemoryArena &arena) {
+    const int nc = Spectrum::nComponents, count = (nc + 3) & ~3;
+    if (nc < 4) {
+        // Rotate RGB coefficients with the unrolled per-band rotations,
+        // which beat repacking three channels for the batched kernels
+        float alpha, beta, gamma;
+        toZYZ(m, &alpha, &beta, &gamma);
+        Spectrum *work = arena.Alloc<Spectrum>(SHTerms(lmax));
+        SHRotateZ(c_in, c_out, gamma, lmax);
+        SHRotateXPlus(c_out, work, lmax);
+        SHRotateZ(work, c_out, beta, lmax);
+        SHRotateXMinus(c_out, work, lmax);
+        SHRotateZ(work, c_out, alpha, lmax);
+        return;
+    }
+
+    // Rotate the spectral channels together as interleaved vectors
+    int nTerms = SHTerms(lmax);
+    float *in = arena.Alloc<float>(nTerms * count);
+    float *out = arena.Alloc<float>(nTerms * count);
+    for (int k = 0; k < nTerms; ++k)
+        for (int i = 0; i < count; ++i)
+            in[k * count + i] = (i < nc) ? c_in[k][i] : 0.f;
+    SHRotate(in, out, count, m, lmax, arena);
+    for (int k = 0; k < nTerms; ++k)
+        for (int i = 0; i < nc; ++i)
+            c_out[k][i] = out[k * count + i];
+}
+
+
+void SHRotate(const float *c_in, float *c_out, int count,
+              const Matrix4x4 &m, int lmax, MemoryArena &arena) {
+    // Rotate _count_ vectors stored with coefficient _k_ of vector _i_ at
+    // _c[k * count + i]_, so that each step works across all of them
+    Assert(c_in != c_out && lmax <= SHMaxRotationLmax);
     float alpha, beta, gamma;
     toZYZ(m, &alpha, &beta, &gamma);
-    Spectrum *work = arena.Alloc<Spectrum>(SHTerms(lmax));
-    SHRotateZ(c_in, c_out, gamma, lmax);
-    SHRotateXPlus(c_out, work, lmax);
-    SHRotateZ(work, c_out, beta, lmax);
-    SHRotateXMinus(c_out, work, lmax);
-    SHRotateZ(work, c_out, alpha, lmax);
+    float *work = arena.Alloc<float>(SHTerms(lmax) * count);
+    SHRotateZ(c_in, c_out, count, gamma, lmax);
+    SHRotateRows(XPlusRows, c_out, work, count, lmax);
+    SHRotateZ(work, c_out, count, beta, lmax);
+    SHRotateRows(XMinusRows, c_out, work, count, lmax);
+    SHRotateZ(work, c_out, count, alpha, lmax);
 }
 
 
@@ -401,21 +686,41 @@ void SHConvolvePhong(int lmax, float n, const Spectrum *c_in,
 void SHComputeDiffuseTransfer(const Point &p, const Normal &n,
         float rayEpsilon, const Scene *scene, RNG &rng, int nSamples,
         int lmax, Spectrum *c_transfer) {
+    float *c = ALLOCA(float, SHTerms(lmax));
+    SHComputeDiffuseTransfer(p, n, rayEpsilon, scene, rng, nSamples, lmax, c);
     for (int i = 0; i < SHTerms(lmax); ++i)
-        c_transfer[i] = 0.f;
+        c_transfer[i] = c[i];
+}
+
+
+void SHComputeDiffuseTransfer(const Point &p, const Normal &n,
+        float rayEpsilon, const Scene *scene, RNG &rng, int nSamples,
+        int lmax, float *c) {
+    int nTerms = SHTerms(lmax);
+    for (int i = 0; i < nTerms; ++i)
+        c[i] = 0.f;
     uint32_t scramble[2] = { rng.RandomUInt(), rng.RandomUInt() };
-    float *Ylm = ALLOCA(float, SHTerms(lmax));
+    Vector wBatch[SHDirectionBatch];
+    float weights[SHDirectionBatch];
+    float *Ylm = ALLOCA(float, SHDirectionBatch * nTerms);
+    int nBatch = 0;
     for (int i = 0; i < nSamples; ++i) {
-        // Sample _i_th direction and compute estimate for transfer coefficients
+        // Sample _i_th direction and record it if it contributes to transfer
         float u[2];
         Sample02(i, scramble, u);
         Vector w = UniformSampleSphere(u[0], u[1]);
         float pdf = UniformSpherePdf();
         if (Dot(w, n) > 0.f && !scene->IntersectP(Ray(p, w, rayEpsilon))) {
-            // Accumulate contribution of direction $\w{}$ to transfer coefficients
-            SHEvaluate(w, lmax, Ylm);
-            for (int j = 0; j < SHTerms(lmax); ++j)
-                c_transfer[j] += (Ylm[j] * AbsDot(w, n)) / (pdf * nSamples);
+            wBatch[nBatch] = w;
+            weights[nBatch++] = AbsDot(w, n) / (pdf * nSamples);
+        }
+
+        // Accumulate contributions of batched directions to transfer coefficients
+        if (nBatch == SHDirectionBatch || (i == nSamples-1 && nBatch > 0)) {
+            SHEvaluate(wBatch, nBatch, lmax, Ylm);
+            for (int j = 0; j < nBatch; ++j)
+                SHAccumulate(c, &Ylm[j * nTerms], weights[j], nTerms);
+            nBatch = 0;
         }
     }
 }
@@ -424,30 +729,58 @@ void SHComputeDiffuseTransfer(const Point &p, const Normal &n,
 void SHComputeTransferMatrix(const Point &p, float rayEpsilon,
         const Scene *scene, RNG &rng, int nSamples, int lmax,
         Spectrum *T) {
-    for (int i = 0; i < SHTerms(lmax)*SHTerms(lmax); ++i)
-        T[i] = 0.f;
+    int nTerms = SHTerms(lmax);
+    float *Tf = new float[nTerms * nTerms];
+    SHComputeTransferMatrix(p, rayEpsilon, scene, rng, nSamples, lmax, Tf);
+    for (int i = 0; i < nTerms * nTerms; ++i)
+        T[i] = Tf[i];
+    delete[] Tf;
+}
+
+
+void SHComputeTransferMatrix(const Point &p, float rayEpsilon,
+        const Scene *scene, RNG &rng, int nSamples, int lmax,
+        float *Tf) {
+    int nTerms = SHTerms(lmax);
+    for (int i = 0; i < nTerms * nTerms; ++i)
+        Tf[i] = 0.f;
     uint32_t scramble[2] = { rng.RandomUInt(), rng.RandomUInt() };
-    float *Ylm = ALLOCA(float, SHTerms(lmax));
+    Vector wBatch[SHDirectionBatch];
+    float *Ylm = ALLOCA(float, SHDirectionBatch * nTerms);
+    int nBatch = 0;
+    float pdf = UniformSpherePdf();
     for (int i = 0; i < nSamples; ++i) {
         // Compute Monte Carlo estimate of $i$th sample for transfer matrix
         float u[2];
         Sample02(i, scramble, u);
         Vector w = UniformSampleSphere(u[0], u[1]);
-        float pdf = UniformSpherePdf();
-        if (!scene->IntersectP(Ray(p, w, rayEpsilon))) {
-            // Update transfer matrix for unoccluded direction
-            SHEvaluate(w, lmax, Ylm);
-            for (int j = 0; j < SHTerms(lmax); ++j)
-                for (int k = 0; k < SHTerms(lmax); ++k)
-                    T[j*SHTerms(lmax)+k] += (Ylm[j] * Ylm[k]) / (pdf * nSamples);
+        if (!scene->IntersectP(Ray(p, w, rayEpsilon)))
+            wBatch[nBatch++] = w;
+
+        // Update upper triangle of transfer matrix for unoccluded directions
+        if (nBatch == SHDirectionBatch || (i == nSamples-1 && nBatch > 0)) {
+            SHEvaluate(wBatch, nBatch, lmax, Ylm);
+            for (int b = 0; b < nBatch; ++b) {
+                const float *Y = &Ylm[b * nTerms];
+                for (int j = 0; j < nTerms; ++j)
+                    SHAccumulate(&Tf[j*nTerms+j], &Y[j],
+                                 Y[j] / (pdf * nSamples), nTerms - j);
+            }
+            nBatch = 0;
         }
     }
+
+    // Fill in lower triangle of the symmetric transfer matrix
+    for (int j = 0; j < nTerms; ++j)
+        for (int k = j + 1; k < nTerms; ++k)
+            Tf[k*nTerms+j] = Tf[j*nTerms+k];
 }
 
 
 void SHComputeBSDFMatrix(const Spectrum &Kd, const Spectrum &Ks,
         float roughness, RNG &rng, int nSamples, int lmax, Spectrum *B) {
-    for (int i = 0; i < SHTerms(lmax)*SHTerms(lmax); ++i)
+    int nTerms = SHTerms(lmax);
+    for (int i = 0; i < nTerms*nTerms; ++i)
         B[i] = 0.f;
     // Create _BSDF_ for computing BSDF transfer matrix
     MemoryArena arena;
@@ -460,35 +793,46 @@ void SHComputeBSDFMatrix(const Spectrum &Kd, const Spectrum &Ks,
                                             BSDF_ALLOC(arena, Blinn)(1.f / roughness)));
 
     // Precompute directions $\w{}$ and SH values for directions
-    float *Ylm = new float[SHTerms(lmax) * nSamples];
+    float *Ylm = new float[nTerms * nSamples];
     Vector *w = new Vector[nSamples];
     uint32_t scramble[2] = { rng.RandomUInt(), rng.RandomUInt() };
     for (int i = 0; i < nSamples; ++i) {
         float u[2];
         Sample02(i, scramble, u);
         w[i] = UniformSampleSphere(u[0], u[1]);
-        SHEvaluate(w[i], lmax, &Ylm[SHTerms(lmax)*i]);
     }
+    SHEvaluate(w, nSamples, lmax, Ylm);
 
     // Compute double spherical integral for BSDF matrix
+    const int nc = Spectrum::nComponents;
+    float *g = new float[nc * nTerms];
     for (int osamp = 0; osamp < nSamples; ++osamp) {
         const Vector &wo = w[osamp];
+        // Project BSDF for outgoing direction $\w{}_o$ into SH
+        for (int i = 0; i < nc * nTerms; ++i)
+            g[i] = 0.f;
         for (int isamp = 0; isamp < nSamples; ++isamp) {
             const Vector &wi = w[isamp];
-            // Update BSDF matrix elements for sampled directions
             Spectrum f = bsdf->f(wo, wi);
             if (!f.IsBlack()) {
                 float pdf = UniformSpherePdf() * UniformSpherePdf();
                 f *= fabsf(CosTheta(wi)) / (pdf * nSamples * nSamples);
-                for (int i = 0; i < SHTerms(lmax); ++i)
-                    for (int j = 0; j < SHTerms(lmax); ++j)
-                        B[i*SHTerms(lmax)+j] += f * Ylm[isamp*SHTerms(lmax)+j] *
-                                                Ylm[osamp*SHTerms(lmax)+i];
+                for (int c = 0; c < nc; ++c)
+                    SHAccumulate(&g[c * nTerms], &Ylm[isamp*nTerms], f[c], nTerms);
             }
         }
+
+        // Update BSDF matrix elements for outgoing direction
+        for (int i = 0; i < nTerms; ++i) {
+            float Yo = Ylm[osamp*nTerms+i];
+            for (int j = 0; j < nTerms; ++j)
+                for (int c = 0; c < nc; ++c)
+                    B[i*nTerms+j][c] += Yo * g[c * nTerms + j];
+        }
     }
 
     // Free memory allocated for SH matrix computation
+    delete[] g;
     delete[] w;
     delete[] Ylm;
 }
@@ -504,3 +848,13 @@ void SHMatrixVectorMultiply(const Spectrum *M, const Spectrum *v,
 }
 
 
+void SHMatrixVectorMultiply(const float *M, const Spectrum *v,
+        Spectrum *vout, int lmax) {
+    for (int i = 0; i < SHTerms(lmax); ++i) {
+        vout[i] = 0.f;
+        for (int j = 0; j < SHTerms(lmax); ++j)
+            vout[i] += M[SHTerms(lmax) * i + j] * v[j];
+    }
+}
+
+
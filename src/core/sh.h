@@ -53,49 +53,33 @@ inline int SHIndex(int l, int m) {
 
 
 void SHEvaluate(const Vector &v, int lmax, float *out);
+void SHEvaluate(const Vector *w, int count, int lmax, float *out);
 void SHWriteImage(const char *filename, const Spectrum *c, int lmax, int yres);
 template <typename Func>
 void SHProjectCube(Func func, const Point &p, int res, int lmax,
                    Spectrum *coeffs) {
-    float *Ylm = ALLOCA(float, SHTerms(lmax));
+    float *Ylm = ALLOCA(float, 6 * SHTerms(lmax));
     for (int u = 0; u < res; ++u) {
         float fu = -1.f + 2.f * (float(u) + 0.5f) / float(res);
         for (int v = 0; v < res; ++v) {
             float fv = -1.f + 2.f * (float(v) + 0.5f) / float(res);
-            // Incorporate results from $+z$ face to coefficients
-            Vector w(fu, fv, 1);
-            SHEvaluate(Normalize(w), lmax, Ylm);
-            Spectrum f = func(u, v, p, w);
-            float dA = 1.f / powf(Dot(w, w), 3.f/2.f);
-            for (int k = 0; k < SHTerms(lmax); ++k)
-                coeffs[k] += f * Ylm[k] * dA * (4.f / (res * res));
-
-            // Incorporate results from other faces to coefficients
-            w = Vector(fu, fv, -1);
-            SHEvaluate(Normalize(w), lmax, Ylm);
-            f = func(u, v, p, w);
-            for (int k = 0; k < SHTerms(lmax); ++k)
-                coeffs[k] += f * Ylm[k] * dA * (4.f / (res * res));
-            w = Vector(fu, 1, fv);
-            SHEvaluate(Normalize(w), lmax, Ylm);
-            f = func(u, v, p, w);
-            for (int k = 0; k < SHTerms(lmax); ++k)
-                coeffs[k] += f * Ylm[k] * dA * (4.f / (res * res));
-            w = Vector(fu, -1, fv);
-            SHEvaluate(Normalize(w), lmax, Ylm);
-            f = func(u, v, p, w);
-            for (int k = 0; k < SHTerms(lmax); ++k)
-                coeffs[k] += f * Ylm[k] * dA * (4.f / (res * res));
-            w = Vector(1, fu, fv);
-            SHEvaluate(Normalize(w), lmax, Ylm);
-            f = func(u, v, p, w);
-            for (int k = 0; k < SHTerms(lmax); ++k)
-                coeffs[k] += f * Ylm[k] * dA * (4.f / (res * res));
-            w = Vector(-1, fu, fv);
-            SHEvaluate(Normalize(w), lmax, Ylm);
-            f = func(u, v, p, w);
-            for (int k = 0; k < SHTerms(lmax); ++k)
-                coeffs[k] += f * Ylm[k] * dA * (4.f / (res * res));
+            // Compute directions to texel on all six cube faces
+            Vector w[6] = { Vector(fu, fv, 1), Vector(fu, fv, -1),
+                            Vector(fu, 1, fv), Vector(fu, -1, fv),
+                            Vector(1, fu, fv), Vector(-1, fu, fv) };
+            float dA = 1.f / powf(Dot(w[0], w[0]), 3.f/2.f);
+            Vector wn[6];
+            for (int face = 0; face < 6; ++face)
+                wn[face] = Normalize(w[face]);
+            SHEvaluate(wn, 6, lmax, Ylm);
+
+            // Incorporate results from each face to coefficients
+            for (int face = 0; face < 6; ++face) {
+                Spectrum f = func(u, v, p, w[face]);
+                const float *Yf = &Ylm[face * SHTerms(lmax)];
+                for (int k = 0; k < SHTerms(lmax); ++k)
+                    coeffs[k] += f * Yf[k] * dA * (4.f / (res * res));
+            }
         }
     }
 }
@@ -110,6 +94,8 @@ void SHProjectIncidentIndirectRadiance(const Point &p, float pEpsilon,
 void SHReduceRinging(Spectrum *c, int lmax, float lambda = .005f);
 void SHRotate(const Spectrum *c_in, Spectrum *c_out, const Matrix4x4 &m,
               int lmax, MemoryArena &arena);
+void SHRotate(const float *c_in, float *c_out, int count,
+              const Matrix4x4 &m, int lmax, MemoryArena &arena);
 void SHRotateZ(const Spectrum *c_in, Spectrum *c_out, float alpha, int lmax);
 void SHRotateXMinus(const Spectrum *c_in, Spectrum *c_out, int lmax);
 void SHRotateXPlus(const Spectrum *c_in, Spectrum *c_out, int lmax);
@@ -118,11 +104,17 @@ void SHConvolveCosTheta(int lmax, const Spectrum *c_in, Spectrum *c_out);
 void SHConvolvePhong(int lmax, float n, const Spectrum *c_in, Spectrum *c_out);
 void SHComputeDiffuseTransfer(const Point &p, const Normal &n, float rayEpsilon,
     const Scene *scene, RNG &rng, int nSamples, int lmax, Spectrum *c_transfer);
+void SHComputeDiffuseTransfer(const Point &p, const Normal &n, float rayEpsilon,
+    const Scene *scene, RNG &rng, int nSamples, int lmax, float *c_transfer);
 void SHComputeTransferMatrix(const Point &p, float rayEpsilon,
     const Scene *scene, RNG &rng, int nSamples, int lmax, Spectrum *T);
+void SHComputeTransferMatrix(const Point &p, float rayEpsilon,
+    const Scene *scene, RNG &rng, int nSamples, int lmax, float *T);
 void SHComputeBSDFMatrix(const Spectrum &Kd, const Spectrum &Ks,
     float roughness, RNG &rng, int nSamples, int lmax, Spectrum *B);
 void SHMatrixVectorMultiply(const Spectrum *M, const Spectrum *v,
                             Spectrum *vout, int lmax);
+void SHMatrixVectorMultiply(const float *M, const Spectrum *v,
+                            Spectrum *vout, int lmax);
 
 #endif // PBRT_CORE_SH_H
@@ -42,13 +42,13 @@ Shape::~Shape() {
 Shape::Shape(const Transform *o2w, const Transform *w2o, bool ro)
     : ObjectToWorld(o2w), WorldToObject(w2o), ReverseOrientation(ro),
       TransformSwapsHandedness(o2w->SwapsHandedness()),
-      shapeId(nextshapeId++) {
+      shapeId(uint32_t(AtomicAdd(&nextshapeId, 1))) {
     // Update shape creation statistics
     PBRT_CREATED_SHAPE(this);
 }
 
 
-uint32_t Shape::nextshapeId = 1;
+AtomicInt32 Shape::nextshapeId = 0;
 BBox Shape::WorldBound() const {
     return (*ObjectToWorld)(ObjectBound());
 }
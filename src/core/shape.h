@@ -126,7 +126,7 @@ public:
     const Transform *ObjectToWorld, *WorldToObject;
     const bool ReverseOrientation, TransformSwapsHandedness;
     const uint32_t shapeId;
-    static uint32_t nextshapeId;
+    static AtomicInt32 nextshapeId;
 };
 
 
@@ -100,87 +100,44 @@ RGBSpectrum SampledSpectrum::ToRGBSpectrum() const {
 
 SampledSpectrum SampledSpectrum::FromRGB(const float rgb[3],
                                          SpectrumType type) {
-    SampledSpectrum r;
+    // Sort _rgb_ channels to find the basis spectra that span it
+    int lo = 0, hi = 0;
+    for (int i = 1; i < 3; ++i) {
+        if (rgb[i] < rgb[lo]) lo = i;
+        if (rgb[i] > rgb[hi]) hi = i;
+    }
+    if (lo == hi) hi = (lo + 1) % 3;
+    int mid = 3 - lo - hi;
+    const SampledSpectrum *white, *secondary, *primary;
+    float scale;
     if (type == SPECTRUM_REFLECTANCE) {
-        // Convert reflectance spectrum to RGB
-        if (rgb[0] <= rgb[1] && rgb[0] <= rgb[2]) {
-            // Compute reflectance _SampledSpectrum_ with _rgb[0]_ as minimum
-            r += rgb[0] * rgbRefl2SpectWhite;
-            if (rgb[1] <= rgb[2]) {
-                r += (rgb[1] - rgb[0]) * rgbRefl2SpectCyan;
-                r += (rgb[2] - rgb[1]) * rgbRefl2SpectBlue;
-            }
-            else {
-                r += (rgb[2] - rgb[0]) * rgbRefl2SpectCyan;
-                r += (rgb[1] - rgb[2]) * rgbRefl2SpectGreen;
-            }
-        }
-        else if (rgb[1] <= rgb[0] && rgb[1] <= rgb[2]) {
-            // Compute reflectance _SampledSpectrum_ with _rgb[1]_ as minimum
-            r += rgb[1] * rgbRefl2SpectWhite;
-            if (rgb[0] <= rgb[2]) {
-                r += (rgb[0] - rgb[1]) * rgbRefl2SpectMagenta;
-                r += (rgb[2] - rgb[0]) * rgbRefl2SpectBlue;
-            }
-            else {
-                r += (rgb[2] - rgb[1]) * rgbRefl2SpectMagenta;
-                r += (rgb[0] - rgb[2]) * rgbRefl2SpectRed;
-            }
-        }
-        else {
-            // Compute reflectance _SampledSpectrum_ with _rgb[2]_ as minimum
-            r += rgb[2] * rgbRefl2SpectWhite;
-            if (rgb[0] <= rgb[1]) {
-                r += (rgb[0] - rgb[2]) * rgbRefl2SpectYellow;
-                r += (rgb[1] - rgb[0]) * rgbRefl2SpectGreen;
-            }
-            else {
-                r += (rgb[1] - rgb[2]) * rgbRefl2SpectYellow;
-                r += (rgb[0] - rgb[1]) * rgbRefl2SpectRed;
-            }
-        }
-        r *= .94;
+        const SampledSpectrum *secondaries[3] = { &rgbRefl2SpectCyan,
+            &rgbRefl2SpectMagenta, &rgbRefl2SpectYellow };
+        const SampledSpectrum *primaries[3] = { &rgbRefl2SpectRed,
+            &rgbRefl2SpectGreen, &rgbRefl2SpectBlue };
+        white = &rgbRefl2SpectWhite;
+        secondary = secondaries[lo];
+        primary = primaries[hi];
+        scale = .94f;
     }
     else {
-        // Convert illuminant spectrum to RGB
-        if (rgb[0] <= rgb[1] && rgb[0] <= rgb[2]) {
-            // Compute illuminant _SampledSpectrum_ with _rgb[0]_ as minimum
-            r += rgb[0] * rgbIllum2SpectWhite;
-            if (rgb[1] <= rgb[2]) {
-                r += (rgb[1] - rgb[0]) * rgbIllum2SpectCyan;
-                r += (rgb[2] - rgb[1]) * rgbIllum2SpectBlue;
-            }
-            else {
-                r += (rgb[2] - rgb[0]) * rgbIllum2SpectCyan;
-                r += (rgb[1] - rgb[2]) * rgbIllum2SpectGreen;
-            }
-        }
-        else if (rgb[1] <= rgb[0] && rgb[1] <= rgb[2]) {
-            // Compute illuminant _SampledSpectrum_ with _rgb[1]_ as minimum
-            r += rgb[1] * rgbIllum2SpectWhite;
-            if (rgb[0] <= rgb[2]) {
-                r += (rgb[0] - rgb[1]) * rgbIllum2SpectMagenta;
-                r += (rgb[2] - rgb[0]) * rgbIllum2SpectBlue;
-            }
-            else {
-                r += (rgb[2] - rgb[1]) * rgbIllum2SpectMagenta;
-                r += (rgb[0] - rgb[2]) * rgbIllum2SpectRed;
-            }
-        }
-        else {
-            // Compute illuminant _SampledSpectrum_ with _rgb[2]_ as minimum
-            r += rgb[2] * rgbIllum2SpectWhite;
-            if (rgb[0] <= rgb[1]) {
-                r += (rgb[0] - rgb[2]) * rgbIllum2SpectYellow;
-                r += (rgb[1] - rgb[0]) * rgbIllum2SpectGreen;
-            }
-            else {
-                r += (rgb[1] - rgb[2]) * rgbIllum2SpectYellow;
-                r += (rgb[0] - rgb[1]) * rgbIllum2SpectRed;
-            }
-        }
-        r *= .86445f;
+        const SampledSpectrum *secondaries[3] = { &rgbIllum2SpectCyan,
+            &rgbIllum2SpectMagenta, &rgbIllum2SpectYellow };
+        const SampledSpectrum *primaries[3] = { &rgbIllum2SpectRed,
+            &rgbIllum2SpectGreen, &rgbIllum2SpectBlue };
+        white = &rgbIllum2SpectWhite;
+        secondary = secondaries[lo];
+        primary = primaries[hi];
+        scale = .86445f;
     }
+
+    // Sum weighted basis spectra in a single pass
+    float wWhite = rgb[lo], wSecondary = rgb[mid] - rgb[lo];
+    float wPrimary = rgb[hi] - rgb[mid];
+    SampledSpectrum r;
+    for (int i = 0; i < nSpectralSamples; ++i)
+        r.c[i] = (wWhite * white->c[i] + wSecondary * secondary->c[i] +
+                  wPrimary * primary->c[i]) * scale;
     return r.Clamp();
 }
 
@@ -253,6 +253,14 @@ public:
             if (isnan(c[i])) return true;
         return false;
     }
+    float operator[](int i) const {
+        Assert(i >= 0 && i < nSamples);
+        return c[i];
+    }
+    float &operator[](int i) {
+        Assert(i >= 0 && i < nSamples);
+        return c[i];
+    }
     bool Write(FILE *f) const {
         for (int i = 0; i < nSamples; ++i)
             if (fprintf(f, "%f ", c[i]) < 0) return false;
@@ -263,6 +271,12 @@ public:
             if (fscanf(f, "%f ", &c[i]) != 1) return false;
         return true;
     }
+    static int SampleComponent(float u) {
+        return min(Floor2Int(u * nSamples), nSamples - 1);
+    }
+
+    // CoefficientSpectrum Public Data
+    static const int nComponents = nSamples;
 protected:
     // CoefficientSpectrum Protected Data
     float c[nSamples];
@@ -288,6 +302,10 @@ public:
     }
     SampledSpectrum(const CoefficientSpectrum<nSpectralSamples> &v)
         : CoefficientSpectrum<nSpectralSamples>(v) { }
+    static float Wavelength(int i) {
+        return Lerp((i + 0.5f) / float(nSpectralSamples),
+                    sampledLambdaStart, sampledLambdaEnd);
+    }
 
 
 	/*
@@ -457,6 +475,11 @@ public:
     RGBSpectrum(const RGBSpectrum &s, SpectrumType type = SPECTRUM_REFLECTANCE) {
         *this = s;
     }
+    static float Wavelength(int i) {
+        // Return dominant wavelength of sRGB primary _i_
+        static const float lambda[3] = { 611.f, 549.f, 464.f };
+        return lambda[i];
+    }
     static RGBSpectrum FromRGB(const float rgb[3],
             SpectrumType type = SPECTRUM_REFLECTANCE) {
         RGBSpectrum s;
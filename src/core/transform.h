@@ -270,6 +270,8 @@ inline void Transform::operator()(const Ray &r, Ray *rt) const {
         rt->maxt = r.maxt;
         rt->time = r.time;
         rt->depth = r.depth;
+        rt->wavelength = r.wavelength;
+        rt->dispersed = r.dispersed;
     }
 }
 
@@ -0,0 +1,552 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+
+// integrators/bdpt.cpp*
+#include "stdafx.h"
+#include "integrators/bdpt.h"
+#include "scene.h"
+#include "camera.h"
+#include "film.h"
+#include "sampler.h"
+#include "montecarlo.h"
+#include "paramset.h"
+#include "probes.h"
+
+// BDPT Local Declarations
+struct BDPTEndpoint {
+    const Light *light;
+    Point p;
+    Normal n;
+    bool isDelta;
+    // Density of choosing this light and point, and of reaching the point
+    // from the first light subpath vertex
+    float pdfOrigin, pdfRev;
+};
+
+
+static inline float ConvertDensity(float pdfDir, const Point &p0,
+        const Point &p1, const Normal &n1) {
+    Vector w = p1 - p0;
+    float dist2 = w.LengthSquared();
+    if (dist2 == 0.f) return 0.f;
+    return pdfDir * AbsDot(n1, w) / (dist2 * sqrtf(dist2));
+}
+
+
+static inline float EmitPdfDir(const BDPTEndpoint &y0, const Point &p) {
+    float pdfPos, pdfDir;
+    y0.light->Pdf_Le(y0.p, y0.n, Normalize(p - y0.p), &pdfPos, &pdfDir);
+    return pdfDir;
+}
+
+
+static inline float Remap0(float f) {
+    return f != 0.f ? f : 1.f;
+}
+
+
+
+// Path Vertex Method Definitions
+uint32_t GeneratePath(const RayDifferential &r, const Spectrum &a,
+        const Scene *scene, MemoryArena &arena, const PathSample *samples,
+        uint32_t maxLength, PathVertex *path, RayDifferential *escapedRay,
+        Spectrum *escapedAlpha, float pdfDir, const Intersection *firstIsect) {
+    PBRT_MLT_STARTED_GENERATE_PATH();
+    RayDifferential ray = r;
+    Spectrum alpha = a;
+    if (escapedAlpha) *escapedAlpha = 0.f;
+    uint32_t length = 0;
+    for (; length < maxLength; ++length) {
+        // Try to generate next vertex of ray path
+        PathVertex &v = path[length];
+        if (length == 0 && firstIsect)
+            v.isect = *firstIsect;
+        else if (!scene->Intersect(ray, &v.isect)) {
+            // Handle ray that leaves the scene during path generation
+            if (escapedAlpha) *escapedAlpha = alpha;
+            if (escapedRay)   *escapedRay = ray;
+            break;
+        }
+
+        // Record information for current path vertex
+        v.alpha = alpha;
+        BSDF *bsdf = v.isect.GetBSDF(ray, arena);
+        v.bsdf = bsdf;
+        v.dispersed = ray.dispersed;
+        v.wPrev = -ray.d;
+        v.pdfFwd = ConvertDensity(pdfDir, ray.o, v.isect.dg.p, v.isect.dg.nn);
+        v.pdfRev = 0.f;
+
+        // Sample direction for outgoing Metropolis path direction
+        float pdf;
+        BxDFType flags;
+        Spectrum f = bsdf->Sample_f(-ray.d, &v.wNext, samples[length].bsdfSample,
+                                    &pdf, BSDF_ALL, &flags);
+        v.specularBounce = (flags & BSDF_SPECULAR) != 0;
+        v.nSpecularComponents = bsdf->NumComponents(BxDFType(BSDF_SPECULAR |
+                                         BSDF_REFLECTION | BSDF_TRANSMISSION));
+        if (f.IsBlack() || pdf == 0.f)
+        {
+            PBRT_MLT_FINISHED_GENERATE_PATH();
+            return length+1;
+        }
+
+        // Compute reverse density of previous vertex and forward density
+        // of the next; specular bounces don't define either
+        pdfDir = v.specularBounce ? 0.f : pdf;
+        if (length > 0) {
+            PathVertex &prev = path[length-1];
+            prev.pdfRev = v.specularBounce ? 0.f :
+                ConvertDensity(bsdf->Pdf(v.wNext, v.wPrev), v.isect.dg.p,
+                               prev.isect.dg.p, prev.isect.dg.nn);
+        }
+
+        // Terminate path with RR or prepare for finding next vertex
+        const Point &p = bsdf->dgShading.p;
+        const Normal &n = bsdf->dgShading.nn;
+        Spectrum pathScale = f * AbsDot(v.wNext, n) / pdf;
+        float rrSurviveProb = min(1.f, pathScale.y());
+        if (samples[length].rrSample > rrSurviveProb)
+        {
+            PBRT_MLT_FINISHED_GENERATE_PATH();
+            return length+1;
+        }
+        alpha *= pathScale / rrSurviveProb;
+        ray = RayDifferential(p, v.wNext, ray, v.isect.rayEpsilon);
+    }
+    PBRT_MLT_FINISHED_GENERATE_PATH();
+    return length;
+}
+
+
+
+// BDPTIntegrator Method Definitions
+BDPTIntegrator::BDPTIntegrator(int md) {
+    maxDepth = md;
+    nPixelSamples = 1;
+    camera = NULL;
+    lightDistribution = NULL;
+}
+
+
+BDPTIntegrator::~BDPTIntegrator() {
+    delete lightDistribution;
+}
+
+
+void BDPTIntegrator::RequestSamples(Sampler *sampler, Sample *sample,
+                                    const Scene *scene) {
+    nPixelSamples = sampler ? sampler->samplesPerPixel : 1;
+    for (int i = 0; i < BDPT_SAMPLE_DEPTH; ++i) {
+        cameraPathOffsets[i] = BSDFSampleOffsets(1, sample);
+        cameraRROffset[i] = sample->Add1D(1);
+        lightPathOffsets[i] = BSDFSampleOffsets(1, sample);
+        lightRROffset[i] = sample->Add1D(1);
+        lightSampleOffsets[i] = LightSampleOffsets(1, sample);
+        lightNumOffset[i] = sample->Add1D(1);
+    }
+    emitSampleOffsets = LightSampleOffsets(1, sample);
+    emitNumOffset = sample->Add1D(1);
+    emitDirOffset = sample->Add2D(1);
+}
+
+
+void BDPTIntegrator::Preprocess(const Scene *scene, const Camera *cam,
+                                const Renderer *renderer) {
+    camera = cam;
+    if (scene->lights.size() == 0) return;
+    lightDistribution = ComputeLightSamplingCDF(scene);
+
+    // Record which lights have finite extent and can start light subpaths
+    finiteLight.resize(scene->lights.size());
+    for (uint32_t i = 0; i < scene->lights.size(); ++i) {
+        const Light *light = scene->lights[i];
+        float pdfPos, pdfDir;
+        light->Pdf_Le(Point(), Normal(0, 0, 1), Vector(0, 0, 1),
+                      &pdfPos, &pdfDir);
+        finiteLight[i] = pdfPos > 0.f;
+        lightIndex[light] = i;
+    }
+}
+
+
+float BDPTIntegrator::MISWeight(const PathVertex *cameraPath, int t,
+        const PathVertex *lightPath, int s, const BDPTEndpoint &y0,
+        float cameraPdfDir, const Point &pCamera) const {
+    // Paths seen directly by the camera have a single strategy
+    int n = s + t;
+    if (n == 2) return 1.f;
+
+    // Gather per-vertex area densities, ordered from camera to light
+    float *pdfCamera = ALLOCA(float, n), *pdfLight = ALLOCA(float, n);
+    bool *delta = ALLOCA(bool, n);
+    pdfCamera[0] = pdfLight[0] = 1.f;
+    delta[0] = (cameraPdfDir == 0.f);
+    for (int i = 1; i < t; ++i) {
+        const PathVertex &v = cameraPath[i-1];
+        pdfCamera[i] = v.pdfFwd;
+        pdfLight[i] = v.pdfRev;
+        delta[i] = v.specularBounce;
+    }
+    for (int j = 1; j < s; ++j) {
+        const PathVertex &v = lightPath[j-1];
+        pdfCamera[n-1-j] = v.pdfRev;
+        pdfLight[n-1-j] = v.pdfFwd;
+        delta[n-1-j] = v.specularBounce;
+    }
+    if (s > 0) {
+        pdfCamera[n-1] = y0.pdfRev;
+        pdfLight[n-1] = y0.pdfOrigin;
+        delta[n-1] = false;
+    }
+
+    // Update densities around the connection of the two subpaths
+    if (s == 0) {
+        // Camera subpath hit the light described by _y0_
+        const PathVertex &pt = cameraPath[t-2];
+        pdfLight[t-1] = y0.pdfOrigin;
+        delta[t-1] = false;
+        if (t > 2) {
+            const PathVertex &ptMinus = cameraPath[t-3];
+            pdfLight[t-2] = ConvertDensity(EmitPdfDir(y0, ptMinus.isect.dg.p),
+                pt.isect.dg.p, ptMinus.isect.dg.p, ptMinus.isect.dg.nn);
+        }
+    }
+    else {
+        const PathVertex *qs = (s > 1) ? &lightPath[s-2] : NULL;
+        const PathVertex *pt = (t > 1) ? &cameraPath[t-2] : NULL;
+        const Point &pq = qs ? qs->isect.dg.p : y0.p;
+        const Normal &nq = qs ? qs->isect.dg.nn : y0.n;
+        const Point &pp = pt ? pt->isect.dg.p : pCamera;
+        Vector wpq = Normalize(pq - pp);
+
+        // Density of $q_s$ and $q_{s-1}$ sampled from the camera side
+        float pdfDir = pt ? pt->bsdf->Pdf(pt->wPrev, wpq) : cameraPdfDir;
+        pdfCamera[t] = (!qs && y0.isDelta) ? 0.f :
+            ConvertDensity(pdfDir, pp, pq, nq);
+        if (qs) {
+            const Point &pqMinus = (s > 2) ? lightPath[s-3].isect.dg.p : y0.p;
+            const Normal &nqMinus = (s > 2) ? lightPath[s-3].isect.dg.nn : y0.n;
+            pdfCamera[t+1] = (s == 2 && y0.isDelta) ? 0.f :
+                ConvertDensity(qs->bsdf->Pdf(-wpq, qs->wPrev), pq,
+                               pqMinus, nqMinus);
+            delta[t] = false;
+        }
+
+        // Density of $p_t$ and $p_{t-1}$ sampled from the light side
+        if (pt) {
+            pdfDir = qs ? qs->bsdf->Pdf(qs->wPrev, -wpq) : EmitPdfDir(y0, pp);
+            pdfLight[t-1] = ConvertDensity(pdfDir, pq, pp, pt->isect.dg.nn);
+            if (t > 2) {
+                const PathVertex &ptMinus = cameraPath[t-3];
+                pdfLight[t-2] = ConvertDensity(pt->bsdf->Pdf(wpq, pt->wPrev),
+                    pp, ptMinus.isect.dg.p, ptMinus.isect.dg.nn);
+            }
+            delta[t-1] = false;
+        }
+    }
+
+    // Sum squared density ratios of the other strategies for this path
+    float sumRi = 0.f, ri = 1.f;
+    for (int i = t - 1; i > 0; --i) {
+        ri *= Remap0(pdfLight[i]) / Remap0(pdfCamera[i]);
+        if (!delta[i] && !delta[i-1])
+            sumRi += ri * ri;
+    }
+    ri = 1.f;
+    for (int i = t; i < n; ++i) {
+        ri *= Remap0(pdfCamera[i]) / Remap0(pdfLight[i]);
+        bool deltaNext = (i == n - 1) ? y0.isDelta : delta[i+1];
+        if (!delta[i] && !deltaNext)
+            sumRi += ri * ri;
+    }
+    return 1.f / (1.f + sumRi);
+}
+
+
+Spectrum BDPTIntegrator::Li(const Scene *scene, const Renderer *renderer,
+        const RayDifferential &ray, const Intersection &isect,
+        const Sample *sample, RNG &rng, MemoryArena &arena) const {
+    Spectrum L = isect.Le(-ray.d);
+    if (!lightDistribution) return L;
+
+    // Allocate per-path samples and vertices from _arena_; as with
+    // _PathIntegrator_, paths have at most _maxDepth_+1 scattering vertices
+    uint32_t maxCamera = maxDepth + 2, maxLight = maxDepth + 1;
+    PathSample *cameraSamples = arena.Alloc<PathSample>(maxCamera);
+    PathSample *lightSamples = arena.Alloc<PathSample>(maxLight);
+    PathVertex *cameraPath = arena.Alloc<PathVertex>(maxCamera);
+    PathVertex *lightPath = arena.Alloc<PathVertex>(maxLight);
+    for (uint32_t i = 0; i < maxCamera; ++i) {
+        PathSample &cs = cameraSamples[i];
+        if (i < BDPT_SAMPLE_DEPTH) {
+            cs.bsdfSample = BSDFSample(sample, cameraPathOffsets[i], 0);
+            cs.rrSample = sample->oneD[cameraRROffset[i]][0];
+        }
+        else {
+            cs.bsdfSample = BSDFSample(rng);
+            cs.rrSample = rng.RandomFloat();
+        }
+    }
+    for (uint32_t i = 0; i < maxLight; ++i) {
+        PathSample &ls = lightSamples[i];
+        if (i < BDPT_SAMPLE_DEPTH) {
+            ls.bsdfSample = BSDFSample(sample, lightPathOffsets[i], 0);
+            ls.rrSample = sample->oneD[lightRROffset[i]][0];
+        }
+        else {
+            ls.bsdfSample = BSDFSample(rng);
+            ls.rrSample = rng.RandomFloat();
+        }
+    }
+
+    // Generate camera subpath starting at _isect_
+    float rasterX, rasterY, cameraPdfDir = 0.f;
+    Point pCamera;
+    if (!camera->Project(isect.dg.p, ray.time, &rasterX, &rasterY, &pCamera,
+                         &cameraPdfDir))
+        cameraPdfDir = 0.f;
+    RayDifferential escapedRay;
+    Spectrum escapedAlpha;
+    uint32_t nCamera = GeneratePath(ray, Spectrum(1.f), scene, arena,
+        cameraSamples, maxCamera, cameraPath, &escapedRay, &escapedAlpha,
+        cameraPdfDir, &isect);
+
+    // Generate light subpath from a light with finite extent
+    BDPTEndpoint origin;
+    uint32_t nLight = 0;
+    float lightPdf;
+    uint32_t lightNum = lightDistribution->SampleDiscrete(
+        sample->oneD[emitNumOffset][0], &lightPdf);
+    if (finiteLight[lightNum]) {
+        const Light *light = scene->lights[lightNum];
+        Ray lightRay;
+        Normal Nl;
+        float pdf, pdfPos, pdfDir;
+        Spectrum Le = light->Sample_L(scene,
+            LightSample(sample, emitSampleOffsets, 0),
+            sample->twoD[emitDirOffset][0], sample->twoD[emitDirOffset][1],
+            ray.time, &lightRay, &Nl, &pdf);
+        light->Pdf_Le(lightRay.o, Nl, lightRay.d, &pdfPos, &pdfDir);
+        if (!Le.IsBlack() && pdf > 0.f && pdfDir > 0.f) {
+            origin.light = light;
+            origin.p = lightRay.o;
+            origin.n = Nl;
+            origin.isDelta = light->IsDeltaLight();
+            origin.pdfOrigin = lightPdf * pdfPos;
+            Spectrum alpha = Le * AbsDot(Nl, lightRay.d) / (lightPdf * pdf);
+            // Trace the light subpath at the camera path's wavelength
+            lightRay.wavelength = ray.wavelength;
+            nLight = GeneratePath(RayDifferential(lightRay), alpha, scene,
+                arena, lightSamples, maxLight, lightPath, NULL, NULL, pdfDir);
+
+            // Compute density of the light point sampled from the camera side
+            origin.pdfRev = 0.f;
+            const PathVertex &v = lightPath[0];
+            if (nLight > 1 && !v.specularBounce && !origin.isDelta)
+                origin.pdfRev = ConvertDensity(v.bsdf->Pdf(v.wNext, v.wPrev),
+                                               v.isect.dg.p, origin.p, origin.n);
+        }
+    }
+
+    // Connect camera subpath vertices to lights and to the light subpath
+    BxDFType nonSpecular = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    for (uint32_t i = 0; i < nCamera; ++i) {
+        const PathVertex &vc = cameraPath[i];
+        const Point &pc = vc.bsdf->dgShading.p;
+        const Normal &nc = vc.bsdf->dgShading.nn;
+        int t = i + 2;
+
+        // Add emitted light at camera subpath vertex ($s=0$)
+        if (i > 0) {
+            const AreaLight *area = vc.isect.primitive->GetAreaLight();
+            Spectrum Le = vc.isect.Le(vc.wPrev);
+            if (area && !Le.IsBlack()) {
+                BDPTEndpoint y0;
+                y0.light = area;
+                y0.p = vc.isect.dg.p;
+                y0.n = vc.isect.dg.nn;
+                y0.isDelta = false;
+                float pdfPos, pdfDir;
+                area->Pdf_Le(y0.p, y0.n, vc.wPrev, &pdfPos, &pdfDir);
+                uint32_t areaNum = lightIndex.find(area)->second;
+                y0.pdfOrigin = lightDistribution->DiscretePdf(areaNum) * pdfPos;
+                y0.pdfRev = 0.f;
+                L += vc.alpha * Le * MISWeight(cameraPath, t, NULL, 0, y0,
+                                               cameraPdfDir, pCamera);
+            }
+        }
+        if (int(i) > maxDepth ||
+            vc.bsdf->NumComponents(nonSpecular) == 0) continue;
+
+        // Sample a light to connect to the camera subpath vertex ($s=1$)
+        float uLightNum;
+        LightSample ls;
+        if (i < BDPT_SAMPLE_DEPTH) {
+            uLightNum = sample->oneD[lightNumOffset[i]][0];
+            ls = LightSample(sample, lightSampleOffsets[i], 0);
+        }
+        else {
+            uLightNum = rng.RandomFloat();
+            ls = LightSample(rng);
+        }
+        float pL;
+        uint32_t ln = lightDistribution->SampleDiscrete(uLightNum, &pL);
+        const Light *light = scene->lights[ln];
+        Vector wi;
+        float pdf;
+        VisibilityTester visibility;
+        Spectrum Li = light->Sample_L(pc, vc.isect.rayEpsilon, ls, ray.time,
+                                      &wi, &pdf, &visibility);
+        Spectrum f;
+        if (!Li.IsBlack() && pdf > 0.f)
+            f = vc.bsdf->f(vc.wPrev, wi);
+        if (!f.IsBlack()) {
+            Spectrum Ld = vc.alpha * f * Li * AbsDot(wi, nc) / (pL * pdf);
+            if (!finiteLight[ln]) {
+                // Weight light at infinity against escaped camera subpaths
+                if (visibility.Unoccluded(scene)) {
+                    float wt = 1.f;
+                    if (!light->IsDeltaLight())
+                        wt = PowerHeuristic(1, pL * pdf, 1,
+                                            vc.bsdf->Pdf(vc.wPrev, wi));
+                    L += Ld * wt;
+                }
+            }
+            else {
+                BDPTEndpoint y0;
+                y0.light = light;
+                y0.isDelta = light->IsDeltaLight();
+                y0.pdfRev = 0.f;
+                bool found = false;
+                if (y0.isDelta) {
+                    if (visibility.Unoccluded(scene)) {
+                        y0.p = visibility.r(visibility.r.maxt);
+                        y0.n = Normal(-wi);
+                        found = true;
+                    }
+                }
+                else {
+                    // Find the sampled point on the area light
+                    Ray r(pc, wi, vc.isect.rayEpsilon, INFINITY, ray.time);
+                    Intersection lightIsect;
+                    if (scene->Intersect(r, &lightIsect) &&
+                        lightIsect.primitive->GetAreaLight() == light &&
+                        r.maxt >= visibility.r.maxt) {
+                        y0.p = lightIsect.dg.p;
+                        y0.n = lightIsect.dg.nn;
+                        found = true;
+                    }
+                }
+                if (found) {
+                    float pdfPos, pdfDir;
+                    light->Pdf_Le(y0.p, y0.n, -wi, &pdfPos, &pdfDir);
+                    y0.pdfOrigin = pL * pdfPos;
+                    L += Ld * MISWeight(cameraPath, t, NULL, 1, y0,
+                                        cameraPdfDir, pCamera);
+                }
+            }
+        }
+
+        // Connect camera subpath vertex to light subpath vertices ($s\geq2$)
+        for (uint32_t j = 0; j < nLight && int(i + j) + 1 <= maxDepth; ++j) {
+            const PathVertex &vl = lightPath[j];
+            if (vl.bsdf->NumComponents(nonSpecular) == 0) continue;
+            const Point &pl = vl.bsdf->dgShading.p;
+            const Normal &nl = vl.bsdf->dgShading.nn;
+            Vector w = Normalize(pl - pc);
+            Spectrum fc = vc.bsdf->f(vc.wPrev, w);
+            Spectrum fl = vl.bsdf->f(-w, vl.wPrev);
+            if (fc.IsBlack() || fl.IsBlack()) continue;
+            Ray r(pc, pl - pc, 1e-3f, .999f, ray.time);
+            if (!scene->IntersectP(r)) {
+                float G = AbsDot(nc, w) * AbsDot(nl, w) / DistanceSquared(pl, pc);
+                // Divide out the wavelength probability counted by both subpaths
+                float wavelengthScale = (vc.dispersed && vl.dispersed) ?
+                    1.f / Spectrum::nComponents : 1.f;
+                L += (vc.alpha * fc * G * fl * vl.alpha) * wavelengthScale *
+                     MISWeight(cameraPath, t, lightPath, j + 2, origin,
+                               cameraPdfDir, pCamera);
+            }
+        }
+    }
+
+    // Add light from lights at infinity along escaped camera subpath
+    if (!escapedAlpha.IsBlack() && nCamera > 0) {
+        const PathVertex &vc = cameraPath[nCamera-1];
+        float bsdfPdf = vc.bsdf->Pdf(vc.wPrev, escapedRay.d);
+        for (uint32_t i = 0; i < scene->lights.size(); ++i) {
+            Spectrum Le = scene->lights[i]->Le(escapedRay);
+            if (Le.IsBlack()) continue;
+            float wt = 1.f;
+            if (!vc.specularBounce)
+                wt = PowerHeuristic(1, bsdfPdf, 1,
+                    lightDistribution->DiscretePdf(i) *
+                    scene->lights[i]->Pdf(vc.isect.dg.p, escapedRay.d));
+            L += escapedAlpha * Le * wt;
+        }
+    }
+
+    // Splat light subpath vertices connected to the camera ($t=1$)
+    for (uint32_t j = 0; j < nLight; ++j) {
+        const PathVertex &vl = lightPath[j];
+        if (vl.bsdf->NumComponents(nonSpecular) == 0) continue;
+        const Point &pl = vl.bsdf->dgShading.p;
+        const Normal &nl = vl.bsdf->dgShading.nn;
+        float pdfDir;
+        Point pLens;
+        if (!camera->Project(pl, ray.time, &rasterX, &rasterY, &pLens, &pdfDir))
+            continue;
+        Vector w = Normalize(pLens - pl);
+        Spectrum fl = vl.bsdf->f(w, vl.wPrev);
+        if (fl.IsBlack()) continue;
+        Ray r(pl, pLens - pl, 1e-3f, .999f, ray.time);
+        if (scene->IntersectP(r)) continue;
+        Spectrum Ls = vl.alpha * fl * AbsDot(nl, w) * pdfDir /
+            (DistanceSquared(pl, pLens) * nPixelSamples);
+        CameraSample cs;
+        cs.imageX = rasterX;
+        cs.imageY = rasterY;
+        camera->film->Splat(cs, Ls * MISWeight(cameraPath, 1, lightPath,
+            j + 2, origin, pdfDir, pLens));
+    }
+    return L;
+}
+
+
+BDPTIntegrator *CreateBDPTSurfaceIntegrator(const ParamSet &params) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    return new BDPTIntegrator(maxDepth);
+}
+
+
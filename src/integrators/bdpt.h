@@ -0,0 +1,115 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_BDPT_H
+#define PBRT_INTEGRATORS_BDPT_H
+
+// integrators/bdpt.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "intersection.h"
+#include "reflection.h"
+#include "light.h"
+#include <map>
+
+// Path Vertex Declarations
+struct PathSample {
+    BSDFSample bsdfSample;
+    float rrSample;
+};
+
+
+struct PathVertex {
+    Intersection isect;
+    Vector wPrev, wNext;
+    BSDF *bsdf;
+    bool specularBounce;
+    int nSpecularComponents;
+    // Set if _alpha_ or _bsdf_ already include the probability of the
+    // subpath's wavelength at a dispersive interface
+    bool dispersed;
+    Spectrum alpha;
+    // Area densities of sampling this vertex from its own subpath
+    // (_pdfFwd_) and from the opposite direction (_pdfRev_)
+    float pdfFwd, pdfRev;
+};
+
+
+uint32_t GeneratePath(const RayDifferential &r, const Spectrum &alpha,
+    const Scene *scene, MemoryArena &arena, const PathSample *samples,
+    uint32_t maxLength, PathVertex *path, RayDifferential *escapedRay,
+    Spectrum *escapedAlpha, float pdfDir = 0.f,
+    const Intersection *firstIsect = NULL);
+struct BDPTEndpoint;
+
+// BDPTIntegrator Declarations
+class BDPTIntegrator : public SurfaceIntegrator {
+public:
+    // BDPTIntegrator Public Methods
+    BDPTIntegrator(int md);
+    ~BDPTIntegrator();
+    Spectrum Li(const Scene *scene, const Renderer *renderer,
+        const RayDifferential &ray, const Intersection &isect,
+        const Sample *sample, RNG &rng, MemoryArena &arena) const;
+    void RequestSamples(Sampler *sampler, Sample *sample, const Scene *scene);
+    void Preprocess(const Scene *scene, const Camera *camera,
+                    const Renderer *renderer);
+private:
+    // BDPTIntegrator Private Methods
+    float MISWeight(const PathVertex *cameraPath, int t,
+        const PathVertex *lightPath, int s, const BDPTEndpoint &y0,
+        float cameraPdfDir, const Point &pCamera) const;
+
+    // BDPTIntegrator Private Data
+    int maxDepth, nPixelSamples;
+    const Camera *camera;
+    AliasDistribution1D *lightDistribution;
+    vector<bool> finiteLight;
+    std::map<const Light *, uint32_t> lightIndex;
+#define BDPT_SAMPLE_DEPTH 3
+    BSDFSampleOffsets cameraPathOffsets[BDPT_SAMPLE_DEPTH];
+    BSDFSampleOffsets lightPathOffsets[BDPT_SAMPLE_DEPTH];
+    int cameraRROffset[BDPT_SAMPLE_DEPTH], lightRROffset[BDPT_SAMPLE_DEPTH];
+    LightSampleOffsets lightSampleOffsets[BDPT_SAMPLE_DEPTH];
+    int lightNumOffset[BDPT_SAMPLE_DEPTH];
+    LightSampleOffsets emitSampleOffsets;
+    int emitNumOffset, emitDirOffset;
+};
+
+
+BDPTIntegrator *CreateBDPTSurfaceIntegrator(const ParamSet &params);
+
+#endif // PBRT_INTEGRATORS_BDPT_H
@@ -42,14 +42,16 @@
 #include "montecarlo.h"
 
 // DiffusePRTIntegrator Method Definitions
-DiffusePRTIntegrator::DiffusePRTIntegrator(int lm, int ns)
+DiffusePRTIntegrator::DiffusePRTIntegrator(int lm, int ns, TransferCache *tc)
     : lmax(lm), nSamples(RoundUpPow2(ns)) {
     c_in = new Spectrum[SHTerms(lmax)];
+    transferCache = tc;
 }
 
 
 DiffusePRTIntegrator::~DiffusePRTIntegrator() {
     delete[] c_in;
+    delete transferCache;
 }
 
 
@@ -61,6 +63,8 @@ void DiffusePRTIntegrator::Preprocess(const Scene *scene,
     MemoryArena arena;
     SHProjectIncidentDirectRadiance(p, 0.f, camera->shutterOpen, arena,
                                     scene, false, lmax, rng, c_in);
+    if (transferCache)
+        transferCache->Preprocess(scene, camera, renderer, this);
 }
 
 
@@ -83,9 +87,16 @@ Spectrum DiffusePRTIntegrator::Li(const Scene *scene, const Renderer *,
     // Compute reflected radiance using diffuse PRT
 
     // Project diffuse transfer function at point to SH
-    Spectrum *c_transfer = arena.Alloc<Spectrum>(SHTerms(lmax));
-    SHComputeDiffuseTransfer(p, Faceforward(n, wo), isect.rayEpsilon,
-                             scene, rng, nSamples, lmax, c_transfer);
+    float *c_transfer = arena.Alloc<float>(SHTerms(lmax));
+    Normal nf = Faceforward(n, wo);
+    if (!transferCache || !transferCache->Lookup(p, nf, c_transfer)) {
+        SHComputeDiffuseTransfer(p, nf, isect.rayEpsilon,
+                                 scene, rng, nSamples, lmax, c_transfer);
+        if (transferCache) {
+            float pixelSpacing = sqrtf(Cross(isect.dg.dpdx, isect.dg.dpdy).Length());
+            transferCache->Add(p, nf, pixelSpacing, c_transfer);
+        }
+    }
 
     // Compute integral of product of incident radiance and transfer function
     Spectrum Kd = bsdf->rho(wo, rng, BSDF_ALL_REFLECTION) * INV_PI;
@@ -99,7 +110,8 @@ Spectrum DiffusePRTIntegrator::Li(const Scene *scene, const Renderer *,
 DiffusePRTIntegrator *CreateDiffusePRTIntegratorSurfaceIntegrator(const ParamSet &params) {
     int lmax = params.FindOneInt("lmax", 4);
     int ns = params.FindOneInt("nsamples", 4096);
-    return new DiffusePRTIntegrator(lmax, ns);
+    TransferCache *tc = CreateTransferCache(lmax, ns, SHTerms(lmax), params);
+    return new DiffusePRTIntegrator(lmax, ns, tc);
 }
 
 
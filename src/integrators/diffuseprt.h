@@ -39,12 +39,13 @@
 // integrators/diffuseprt.h*
 #include "pbrt.h"
 #include "integrator.h"
+#include "integrators/transfercache.h"
 
 // DiffusePRTIntegrator Declarations
 class DiffusePRTIntegrator : public SurfaceIntegrator {
 public:
     // DiffusePRTIntegrator Public Methods
-    DiffusePRTIntegrator(int lm, int ns);
+    DiffusePRTIntegrator(int lm, int ns, TransferCache *tc);
     ~DiffusePRTIntegrator();
     void Preprocess(const Scene *scene, const Camera *camera, const Renderer *renderer);
     void RequestSamples(Sampler *sampler, Sample *sample, const Scene *scene);
@@ -55,6 +56,7 @@ private:
     // DiffusePRTIntegrator Private Data
     const int lmax, nSamples;
     Spectrum *c_in;
+    TransferCache *transferCache;
 };
 
 
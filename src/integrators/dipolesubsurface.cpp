@@ -43,6 +43,12 @@
 #include "octree.h"
 #include "camera.h"
 #include "floatfile.h"
+#include "parallel.h"
+#if defined(PBRT_IS_WINDOWS) || defined(PBRT_IS_LINUX)|| defined(PBRT_IS_OPENBSD)
+#include <errno.h>
+#else
+#include <sys/errno.h>
+#endif
 struct DiffusionReflectance;
 
 // DipoleSubsurfaceIntegrator Local Declarations
@@ -93,7 +99,7 @@ struct SubsurfaceOctreeNode {
         BBox childBound = octreeChildBound(child, nodeBound, pMid);
         children[child]->Insert(childBound, ip, arena);
     }
-    void InitHierarchy() {
+    void InitHierarchy(bool initChildren = true) {
         if (isLeaf) {
             // Init _SubsurfaceOctreeNode_ leaf from _IrradiancePoint_s
             float sumWt = 0.f;
@@ -116,7 +122,7 @@ struct SubsurfaceOctreeNode {
             for (uint32_t i = 0; i < 8; ++i) {
                 if (!children[i]) continue;
                 ++nChildren;
-                children[i]->InitHierarchy();
+                if (initChildren) children[i]->InitHierarchy();
                 float wt = children[i]->E.y();
                 E += children[i]->E;
                 p += wt * children[i]->p;
@@ -142,6 +148,43 @@ struct SubsurfaceOctreeNode {
 };
 
 
+class SubsurfaceIrradianceTask : public Task {
+public:
+    SubsurfaceIrradianceTask(const Scene *sc, const Renderer *ren, float t,
+            const vector<SurfacePoint> &sp, vector<IrradiancePoint> &ip,
+            ProgressReporter &prog, uint32_t tn, uint32_t nt)
+        : scene(sc), renderer(ren), time(t), pts(sp), irradiancePoints(ip),
+          progress(prog), taskNum(tn), numTasks(nt) { }
+    void Run();
+private:
+    const Scene *scene;
+    const Renderer *renderer;
+    float time;
+    const vector<SurfacePoint> &pts;
+    vector<IrradiancePoint> &irradiancePoints;
+    ProgressReporter &progress;
+    uint32_t taskNum, numTasks;
+};
+
+
+class SubsurfaceOctreeTask : public Task {
+public:
+    SubsurfaceOctreeTask(SubsurfaceOctreeNode *n, const BBox &b,
+            const vector<IrradiancePoint *> &ip, MemoryArena &a)
+        : node(n), nodeBound(b), ips(ip), arena(a) { }
+    void Run() {
+        for (uint32_t i = 0; i < ips.size(); ++i)
+            node->Insert(nodeBound, ips[i], arena);
+        node->InitHierarchy();
+    }
+private:
+    SubsurfaceOctreeNode *node;
+    BBox nodeBound;
+    const vector<IrradiancePoint *> &ips;
+    MemoryArena &arena;
+};
+
+
 struct DiffusionReflectance {
     // DiffusionReflectance Public Methods
     DiffusionReflectance(const Spectrum &sigma_a, const Spectrum &sigmap_s,
@@ -197,6 +240,15 @@ void DipoleSubsurfaceIntegrator::RequestSamples(Sampler *sampler, Sample *sample
 void DipoleSubsurfaceIntegrator::Preprocess(const Scene *scene,
         const Camera *camera, const Renderer *renderer) {
     if (scene->lights.size() == 0) return;
+    // Irradiance cache files are only valid for static geometry and lighting
+    if (irradianceFilename == "" || !ReadIrradianceCache(scene, camera))
+        ComputeIrradiancePoints(scene, camera, renderer);
+    BuildOctree();
+}
+
+
+void DipoleSubsurfaceIntegrator::ComputeIrradiancePoints(const Scene *scene,
+        const Camera *camera, const Renderer *renderer) {
     vector<SurfacePoint> pts;
     // Get _SurfacePoint_s for translucent objects in scene
     if (filename != "") {
@@ -220,12 +272,179 @@ void DipoleSubsurfaceIntegrator::Preprocess(const Scene *scene,
     }
 
     // Compute irradiance values at sample points
-    RNG rng;
-    MemoryArena arena;
     PBRT_SUBSURFACE_STARTED_COMPUTING_IRRADIANCE_VALUES();
-    ProgressReporter progress(pts.size(), "Computing Irradiances");
-    for (uint32_t i = 0; i < pts.size(); ++i) {
-        SurfacePoint &sp = pts[i];
+    irradiancePoints.resize(pts.size());
+    uint32_t nTasks = 64;
+    ProgressReporter progress(nTasks, "Computing Irradiances");
+    vector<Task *> tasks;
+    for (uint32_t i = 0; i < nTasks; ++i)
+        tasks.push_back(new SubsurfaceIrradianceTask(scene, renderer,
+            camera->shutterOpen, pts, irradiancePoints, progress, i, nTasks));
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+        delete tasks[i];
+    progress.Done();
+    PBRT_SUBSURFACE_FINISHED_COMPUTING_IRRADIANCE_VALUES();
+    if (irradianceFilename != "")
+        WriteIrradianceCache(scene, camera);
+}
+
+
+void DipoleSubsurfaceIntegrator::BuildOctree() {
+    // Create octree of clustered irradiance samples
+    octree = octreeArena.Alloc<SubsurfaceOctreeNode>();
+    for (uint32_t i = 0; i < irradiancePoints.size(); ++i)
+        octreeBounds = Union(octreeBounds, irradiancePoints[i].p);
+    if (irradiancePoints.size() <= 8) {
+        for (uint32_t i = 0; i < irradiancePoints.size(); ++i)
+            octree->Insert(octreeBounds, &irradiancePoints[i], octreeArena);
+        octree->InitHierarchy();
+        return;
+    }
+
+    // Bucket points by root octant and build each child subtree in parallel
+    vector<IrradiancePoint *> octantPoints[8];
+    Point pMid = .5f * octreeBounds.pMin + .5f * octreeBounds.pMax;
+    for (uint32_t i = 0; i < irradiancePoints.size(); ++i) {
+        IrradiancePoint *ip = &irradiancePoints[i];
+        int child = (ip->p.x > pMid.x ? 4 : 0) +
+            (ip->p.y > pMid.y ? 2 : 0) + (ip->p.z > pMid.z ? 1 : 0);
+        octantPoints[child].push_back(ip);
+    }
+    octree->isLeaf = false;
+    vector<Task *> tasks;
+    for (int child = 0; child < 8; ++child) {
+        octree->children[child] = NULL;
+        if (octantPoints[child].size() == 0) continue;
+        octree->children[child] =
+            octantArenas[child].Alloc<SubsurfaceOctreeNode>();
+        tasks.push_back(new SubsurfaceOctreeTask(octree->children[child],
+            octreeChildBound(child, octreeBounds, pMid), octantPoints[child],
+            octantArenas[child]));
+    }
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+        delete tasks[i];
+    octree->InitHierarchy(false);
+}
+
+
+void DipoleSubsurfaceIntegrator::InitIrradianceCacheHeader(
+        const Scene *scene, const Camera *camera,
+        IrradianceCacheHeader *header) const {
+    // Record scene properties that the cached points depend on
+    memset(header, 0, sizeof(IrradianceCacheHeader));
+    strcpy(header->magic, IRRADIANCE_CACHE_MAGIC);
+    header->version = IRRADIANCE_CACHE_VERSION;
+    header->nChannels = Spectrum::nComponents;
+    header->nLights = scene->lights.size();
+    header->nPoints = irradiancePoints.size();
+    header->minSampleDist = minSampleDist;
+    header->time = camera->shutterOpen;
+    BBox bounds = scene->WorldBound();
+    Point pCamera = camera->CameraToWorld(camera->shutterOpen, Point(0, 0, 0));
+    for (int i = 0; i < 3; ++i) {
+        header->sceneBounds[i] = bounds.pMin[i];
+        header->sceneBounds[i+3] = bounds.pMax[i];
+        header->cameraPos[i] = pCamera[i];
+    }
+}
+
+
+bool DipoleSubsurfaceIntegrator::ReadIrradianceCache(const Scene *scene,
+        const Camera *camera) {
+    FILE *f = fopen(irradianceFilename.c_str(), "rb");
+    if (!f) return false;
+    // Read header and check that the cache matches the current scene
+    IrradianceCacheHeader header, expected;
+    InitIrradianceCacheHeader(scene, camera, &expected);
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+              memcmp(header.magic, IRRADIANCE_CACHE_MAGIC, 8) == 0 &&
+              header.version == IRRADIANCE_CACHE_VERSION &&
+              header.nPoints >= 0;
+    if (ok) {
+        expected.nPoints = header.nPoints;
+        if (memcmp(&header, &expected, sizeof(header)) != 0) {
+            Warning("Irradiance cache \"%s\" was computed for a different "
+                    "scene; recomputing it", irradianceFilename.c_str());
+            fclose(f);
+            return false;
+        }
+    }
+
+    // Read irradiance points at full precision
+    const int nValues = 8 + Spectrum::nComponents;
+    float values[nValues];
+    if (ok) irradiancePoints.resize(header.nPoints);
+    for (int i = 0; ok && i < header.nPoints; ++i) {
+        if (fread(values, sizeof(float), nValues, f) != size_t(nValues)) {
+            ok = false;
+            break;
+        }
+        IrradiancePoint &ip = irradiancePoints[i];
+        ip.p = Point(values[0], values[1], values[2]);
+        ip.n = Normal(values[3], values[4], values[5]);
+        ip.area = values[6];
+        ip.rayEpsilon = values[7];
+        for (int c = 0; c < Spectrum::nComponents; ++c)
+            ip.E[c] = values[8 + c];
+    }
+    fclose(f);
+    if (!ok) {
+        Warning("Error reading irradiance cache \"%s\"; recomputing it",
+                irradianceFilename.c_str());
+        irradiancePoints.clear();
+        return false;
+    }
+    Info("Read %d irradiance points from \"%s\"", header.nPoints,
+         irradianceFilename.c_str());
+    return true;
+}
+
+
+void DipoleSubsurfaceIntegrator::WriteIrradianceCache(const Scene *scene,
+        const Camera *camera) const {
+    FILE *f = fopen(irradianceFilename.c_str(), "wb");
+    if (!f) {
+        Error("Unable to open irradiance cache \"%s\" (%s)",
+              irradianceFilename.c_str(), strerror(errno));
+        return;
+    }
+    IrradianceCacheHeader header;
+    InitIrradianceCacheHeader(scene, camera, &header);
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    const int nValues = 8 + Spectrum::nComponents;
+    float values[nValues];
+    for (uint32_t i = 0; ok && i < irradiancePoints.size(); ++i) {
+        const IrradiancePoint &ip = irradiancePoints[i];
+        values[0] = ip.p.x;  values[1] = ip.p.y;  values[2] = ip.p.z;
+        values[3] = ip.n.x;  values[4] = ip.n.y;  values[5] = ip.n.z;
+        values[6] = ip.area;
+        values[7] = ip.rayEpsilon;
+        for (int c = 0; c < Spectrum::nComponents; ++c)
+            values[8 + c] = ip.E[c];
+        ok = fwrite(values, sizeof(float), nValues, f) == size_t(nValues);
+    }
+    if (fclose(f) != 0 || !ok)
+        Error("Error writing irradiance cache \"%s\" (%s)",
+              irradianceFilename.c_str(), strerror(errno));
+}
+
+
+void SubsurfaceIrradianceTask::Run() {
+    // Compute range of irradiance points to process in task
+    uint32_t taskSize = pts.size() / numTasks;
+    uint32_t excess = pts.size() % numTasks;
+    uint32_t ipStart = min(taskNum, excess) * (taskSize+1) +
+                       max(0, (int)taskNum-(int)excess) * taskSize;
+    uint32_t ipEnd = ipStart + taskSize + (taskNum < excess ? 1 : 0);
+    if (taskNum == numTasks-1) Assert(ipEnd == pts.size());
+    RNG rng(37 * taskNum);
+    MemoryArena arena;
+    for (uint32_t i = ipStart; i < ipEnd; ++i) {
+        const SurfacePoint &sp = pts[i];
         Spectrum E(0.f);
         for (uint32_t j = 0; j < scene->lights.size(); ++j) {
             // Add irradiance from light at point
@@ -243,7 +462,7 @@ void DipoleSubsurfaceIntegrator::Preprocess(const Scene *scene,
                 float lightPdf;
                 VisibilityTester visibility;
                 Spectrum Li = light->Sample_L(sp.p, sp.rayEpsilon,
-                    ls, camera->shutterOpen, &wi, &lightPdf, &visibility);
+                    ls, time, &wi, &lightPdf, &visibility);
                 if (Dot(wi, sp.n) <= 0.) continue;
                 if (Li.IsBlack() || lightPdf == 0.f) continue;
                 Li *= visibility.Transmittance(scene, renderer, NULL, rng, arena);
@@ -252,21 +471,11 @@ void DipoleSubsurfaceIntegrator::Preprocess(const Scene *scene,
             }
             E += Elight / nSamples;
         }
-        irradiancePoints.push_back(IrradiancePoint(sp, E));
-        PBRT_SUBSURFACE_COMPUTED_IRRADIANCE_AT_POINT(&sp, &E);
+        irradiancePoints[i] = IrradiancePoint(sp, E);
+        PBRT_SUBSURFACE_COMPUTED_IRRADIANCE_AT_POINT(const_cast<SurfacePoint *>(&sp), &E);
         arena.FreeAll();
-        progress.Update();
     }
-    progress.Done();
-    PBRT_SUBSURFACE_FINISHED_COMPUTING_IRRADIANCE_VALUES();
-
-    // Create octree of clustered irradiance samples
-    octree = octreeArena.Alloc<SubsurfaceOctreeNode>();
-    for (uint32_t i = 0; i < irradiancePoints.size(); ++i)
-        octreeBounds = Union(octreeBounds, irradiancePoints[i].p);
-    for (uint32_t i = 0; i < irradiancePoints.size(); ++i)
-        octree->Insert(octreeBounds, &irradiancePoints[i], octreeArena);
-    octree->InitHierarchy();
+    progress.Update();
 }
 
 
@@ -352,8 +561,10 @@ DipoleSubsurfaceIntegrator *CreateDipoleSubsurfaceIntegrator(const ParamSet &par
     float maxError = params.FindOneFloat("maxerror", .05f);
     float minDist = params.FindOneFloat("minsampledistance", .25f);
     string pointsfile = params.FindOneFilename("pointsfile", "");
+    string irradiancefile = params.FindOneFilename("irradiancefile", "");
     if (PbrtOptions.quickRender) { maxError *= 4.f; minDist *= 4.f; }
-    return new DipoleSubsurfaceIntegrator(maxDepth, maxError, minDist, pointsfile);
+    return new DipoleSubsurfaceIntegrator(maxDepth, maxError, minDist, pointsfile,
+                                          irradiancefile);
 }
 
 
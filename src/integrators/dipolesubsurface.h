@@ -56,17 +56,34 @@ struct IrradiancePoint {
 };
 
 
+// Irradiance cache files hold this header followed by the irradiance points
+struct IrradianceCacheHeader {
+    // IrradianceCacheHeader Public Data
+    char magic[8];
+    int32_t version, nChannels, nLights, nPoints;
+    float minSampleDist, time;
+    float sceneBounds[6];
+    float cameraPos[3];
+    int32_t pad[3];
+};
+
+
+#define IRRADIANCE_CACHE_MAGIC "PBRTIRR"
+static const int IRRADIANCE_CACHE_VERSION = 1;
+
+
 
 // DipoleSubsurfaceIntegrator Declarations
 class DipoleSubsurfaceIntegrator : public SurfaceIntegrator {
 public:
     // DipoleSubsurfaceIntegrator Public Methods
     DipoleSubsurfaceIntegrator(int mdepth, float merror, float mindist,
-                               const string &fn) {
+                               const string &fn, const string &irrfn) {
         maxSpecularDepth = mdepth;
         maxError = merror;
         minSampleDist = mindist;
         filename = fn;
+        irradianceFilename = irrfn;
         octree = NULL;
     }
     ~DipoleSubsurfaceIntegrator();
@@ -76,14 +93,23 @@ public:
     void RequestSamples(Sampler *sampler, Sample *sample, const Scene *scene);
     void Preprocess(const Scene *, const Camera *, const Renderer *);
 private:
+    // DipoleSubsurfaceIntegrator Private Methods
+    void ComputeIrradiancePoints(const Scene *scene, const Camera *camera,
+                                 const Renderer *renderer);
+    void BuildOctree();
+    void InitIrradianceCacheHeader(const Scene *scene, const Camera *camera,
+                                   IrradianceCacheHeader *header) const;
+    bool ReadIrradianceCache(const Scene *scene, const Camera *camera);
+    void WriteIrradianceCache(const Scene *scene, const Camera *camera) const;
+
     // DipoleSubsurfaceIntegrator Private Data
     int maxSpecularDepth;
     float maxError, minSampleDist;
-    string filename;
+    string filename, irradianceFilename;
     vector<IrradiancePoint> irradiancePoints;
     BBox octreeBounds;
     SubsurfaceOctreeNode *octree;
-    MemoryArena octreeArena;
+    MemoryArena octreeArena, octantArenas[8];
 
     // Declare sample parameters for light source sampling
     LightSampleOffsets *lightSampleOffsets;
@@ -44,6 +44,7 @@
 GlossyPRTIntegrator::~GlossyPRTIntegrator() {
     delete[] c_in;
     delete[] B;
+    delete transferCache;
 }
 
 
@@ -61,6 +62,8 @@ void GlossyPRTIntegrator::Preprocess(const Scene *scene,
     // Compute glossy BSDF matrix for PRT
     B = new Spectrum[SHTerms(lmax)*SHTerms(lmax)];
     SHComputeBSDFMatrix(Kd, Ks, roughness, rng, 1024, lmax, B);
+    if (transferCache)
+        transferCache->Preprocess(scene, camera, renderer, this);
 }
 
 
@@ -83,9 +86,16 @@ Spectrum GlossyPRTIntegrator::Li(const Scene *scene, const Renderer *,
 
     // Compute SH radiance transfer matrix at point and SH coefficients
     Spectrum *c_t = arena.Alloc<Spectrum>(SHTerms(lmax));
-    Spectrum *T = arena.Alloc<Spectrum>(SHTerms(lmax)*SHTerms(lmax));
-    SHComputeTransferMatrix(p, isect.rayEpsilon, scene, rng, nSamples,
-                            lmax, T);
+    float *T = arena.Alloc<float>(SHTerms(lmax)*SHTerms(lmax));
+    Normal ng = Faceforward(isect.dg.nn, wo);
+    if (!transferCache || !transferCache->Lookup(p, ng, T)) {
+        SHComputeTransferMatrix(p, isect.rayEpsilon, scene, rng, nSamples,
+                                lmax, T);
+        if (transferCache) {
+            float pixelSpacing = sqrtf(Cross(isect.dg.dpdx, isect.dg.dpdy).Length());
+            transferCache->Add(p, ng, pixelSpacing, T);
+        }
+    }
     SHMatrixVectorMultiply(T, c_in, c_t, lmax);
 
     // Rotate incident SH lighting to local coordinate frame
@@ -142,7 +152,9 @@ GlossyPRTIntegrator *CreateGlossyPRTIntegratorSurfaceIntegrator(const ParamSet &
     Spectrum Kd = params.FindOneSpectrum("Kd", Spectrum(0.5f));
     Spectrum Ks = params.FindOneSpectrum("Ks", Spectrum(0.25f));
     float roughness = params.FindOneFloat("roughness", 0.1f);
-    return new GlossyPRTIntegrator(Kd, Ks, roughness, lmax, ns);
+    TransferCache *tc = CreateTransferCache(lmax, ns,
+        SHTerms(lmax) * SHTerms(lmax), params);
+    return new GlossyPRTIntegrator(Kd, Ks, roughness, lmax, ns, tc);
 }
 
 
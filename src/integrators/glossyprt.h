@@ -39,16 +39,18 @@
 // integrators/glossyprt.h*
 #include "pbrt.h"
 #include "integrator.h"
+#include "integrators/transfercache.h"
 
 // GlossyPRTIntegrator Declarations
 class GlossyPRTIntegrator : public SurfaceIntegrator {
 public:
     // GlossyPRTIntegrator Public Methods
     GlossyPRTIntegrator(const Spectrum &kd, const Spectrum &ks,
-                        float rough, int lm, int ns)
+                        float rough, int lm, int ns, TransferCache *tc)
         : Kd(kd), Ks(ks), roughness(rough), lmax(lm),
           nSamples(RoundUpPow2(ns)) {
         c_in = B = NULL;
+        transferCache = tc;
     }
     ~GlossyPRTIntegrator();
     void Preprocess(const Scene *scene, const Camera *camera, const Renderer *renderer);
@@ -63,6 +65,7 @@ private:
     const int lmax, nSamples;
     Spectrum *c_in;
     Spectrum *B;
+    TransferCache *transferCache;
 };
 
 
@@ -73,6 +73,9 @@ void IGIIntegrator::Preprocess(const Scene *scene, const Camera *camera,
     if (scene->lights.size() == 0) return;
     MemoryArena arena;
     RNG rng;
+    // Virtual light paths are shared by all camera paths, so each one is
+    // traced at its own wavelength, from a stream that leaves _rng_'s unchanged
+    RNG wavelengthRng(1);
     // Compute samples for emitted rays from lights
     vector<float> lightNum(nLightPaths * nLightSets);
     vector<float> lightSampPos(2 * nLightPaths * nLightSets, 0.f);
@@ -84,7 +87,7 @@ void IGIIntegrator::Preprocess(const Scene *scene, const Camera *camera,
     LDShuffleScrambled2D(nLightPaths, nLightSets, &lightSampDir[0], rng);
 
     // Precompute information for light sampling densities
-    Distribution1D *lightDistribution = ComputeLightSamplingCDF(scene);
+    AliasDistribution1D *lightDistribution = ComputeLightSamplingCDF(scene);
     for (uint32_t s = 0; s < nLightSets; ++s) {
         for (uint32_t i = 0; i < nLightPaths; ++i) {
             // Follow path _i_ from light to create virtual lights
@@ -107,6 +110,7 @@ void IGIIntegrator::Preprocess(const Scene *scene, const Camera *camera,
                                              camera->shutterOpen, &ray, &Nl, &pdf);
             if (pdf == 0.f || alpha.IsBlack()) continue;
             alpha *= AbsDot(Nl, ray.d) / (pdf * lightPdf);
+            ray.wavelength = Spectrum::SampleComponent(wavelengthRng.RandomFloat());
             Intersection isect;
             while (scene->Intersect(ray, &isect) && !alpha.IsBlack()) {
                 // Create virtual light and sample new ray for path
@@ -59,7 +59,7 @@ public:
         ProgressReporter &prog, bool &at, int &ndp,
         vector<Photon> &direct, vector<Photon> &indir, vector<Photon> &caustic,
         vector<RadiancePhoton> &rps, vector<Spectrum> &rpR, vector<Spectrum> &rpT,
-        uint32_t &ns, Distribution1D *distrib, const Scene *sc,
+        uint32_t &ns, AliasDistribution1D *distrib, const Scene *sc,
         const Renderer *sr)
     : taskNum(tn), time(ti), mutex(m), integrator(in), progress(prog),
       abortTasks(at), nDirectPaths(ndp),
@@ -79,7 +79,7 @@ public:
     vector<RadiancePhoton> &radiancePhotons;
     vector<Spectrum> &rpReflectances, &rpTransmittances;
     uint32_t &nshot;
-    const Distribution1D *lightDistribution;
+    const AliasDistribution1D *lightDistribution;
     const Scene *scene;
     const Renderer *renderer;
 };
@@ -351,7 +351,7 @@ void PhotonIntegrator::Preprocess(const Scene *scene,
     vector<Spectrum> rpReflectances, rpTransmittances;
 
     // Compute light power CDF for photon shooting
-    Distribution1D *lightDistribution = ComputeLightSamplingCDF(scene);
+    AliasDistribution1D *lightDistribution = ComputeLightSamplingCDF(scene);
 
     // Run parallel tasks for photon shooting
     ProgressReporter progress(nCausticPhotonsWanted+nIndirectPhotonsWanted, "Shooting photons");
@@ -406,6 +406,9 @@ void PhotonShootingTask::Run() {
     // Declare local variables for _PhotonShootingTask_
     MemoryArena arena;
     RNG rng(31 * taskNum);
+    // Photons are shared by all camera paths, so each one is traced at its
+    // own wavelength, taken from a stream that leaves _rng_'s unchanged
+    RNG wavelengthRng(31 * taskNum + 1);
     vector<Photon> localDirectPhotons, localIndirectPhotons, localCausticPhotons;
     vector<RadiancePhoton> localRadiancePhotons;
     uint32_t totalPaths = 0;
@@ -433,6 +436,7 @@ void PhotonShootingTask::Run() {
                                           time, &photonRay, &Nl, &pdf);
             if (pdf == 0.f || Le.IsBlack()) continue;
             Spectrum alpha = (AbsDot(Nl, photonRay.d) * Le) / (pdf * lightPdf);
+            photonRay.wavelength = Spectrum::SampleComponent(wavelengthRng.RandomFloat());
             if (!alpha.IsBlack()) {
                 // Follow photon path through scene and record intersections
                 PBRT_PHOTON_MAP_STARTED_RAY_PATH(&photonRay, &alpha);
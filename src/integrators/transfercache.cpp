@@ -0,0 +1,352 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+
+// integrators/transfercache.cpp*
+#include "stdafx.h"
+#include "integrators/transfercache.h"
+#include "camera.h"
+#include "film.h"
+#include "scene.h"
+#include "intersection.h"
+#include "progressreporter.h"
+#include "samplers/halton.h"
+#include "paramset.h"
+
+// TransferCache Local Declarations
+
+// Transfer cache files hold this header followed by the transfer samples
+struct TransferCacheHeader {
+    // TransferCacheHeader Public Data
+    char magic[8];
+    int32_t version, lmax, nSamples, nCoeffs, nCached;
+    float sceneBounds[6];
+    int32_t pad[3];
+};
+
+
+#define TRANSFER_CACHE_MAGIC "PBRTPTC"
+static const int TRANSFER_CACHE_VERSION = 2;
+
+
+struct TransferSample {
+    // TransferSample Public Methods
+    TransferSample(const Point &P, const Normal &N, float md, int nc)
+        : p(P), n(N), maxDist(md) {
+        c = new float[nc];
+    }
+    ~TransferSample() { delete[] c; }
+
+    // TransferSample Public Data
+    Point p;
+    Normal n;
+    float maxDist;
+    float *c;
+};
+
+
+struct TransferProcess {
+    // TransferProcess Public Methods
+    TransferProcess(const Point &P, const Normal &N, float cmsad, int nc,
+                    float *coeffs)
+        : p(P), n(N), cosMaxSampleAngleDifference(cmsad), nCoeffs(nc),
+          c(coeffs) {
+        sumWt = 0.f;
+        for (int i = 0; i < nCoeffs; ++i)
+            c[i] = 0.f;
+    }
+    bool operator()(const TransferSample *sample);
+
+    // TransferProcess Data
+    Point p;
+    Normal n;
+    float cosMaxSampleAngleDifference, sumWt;
+    int nCoeffs;
+    float *c;
+};
+
+
+struct TransferPrimeTask : public Task {
+    // TransferPrimeTask Public Methods
+    TransferPrimeTask(const Scene *sc, const Renderer *sr, const Camera *c,
+                      Sampler *samp, Sample *s, const SurfaceIntegrator *si,
+                      ProgressReporter &pr, int tn, int nt)
+        : progress(pr) {
+        scene = sc;
+        renderer = sr;
+        camera = c;
+        origSample = s;
+        sampler = samp->GetSubSampler(tn, nt);
+        integrator = si;
+        taskNum = tn;
+    }
+    void Run();
+
+    // TransferPrimeTask Data
+    const Scene *scene;
+    const Renderer *renderer;
+    const Camera *camera;
+    Sampler *sampler;
+    Sample *origSample;
+    const SurfaceIntegrator *integrator;
+    ProgressReporter &progress;
+    int taskNum;
+};
+
+
+
+// TransferCache Method Definitions
+TransferCache::TransferCache(int lm, int ns, int nc, float minwt,
+                             float maxsp, float maxang, const string &fn) {
+    lmax = lm;
+    nSamples = ns;
+    nCoeffs = nc;
+    minWeight = minwt;
+    maxSamplePixelSpacing = maxsp;
+    cosMaxSampleAngleDifference = cosf(Radians(maxang));
+    filename = fn;
+    mutex = RWMutex::Create();
+    octree = NULL;
+}
+
+
+TransferCache::~TransferCache() {
+    delete octree;
+    for (uint32_t i = 0; i < samples.size(); ++i)
+        delete samples[i];
+    RWMutex::Destroy(mutex);
+}
+
+
+void TransferCache::Preprocess(const Scene *scene, const Camera *camera,
+        const Renderer *renderer, SurfaceIntegrator *integrator) {
+    BBox wb = scene->WorldBound();
+    Vector delta = .01f * (wb.pMax - wb.pMin);
+    wb.pMin -= delta;
+    wb.pMax += delta;
+    octree = new Octree<TransferSample *>(wb);
+    if (filename != "" && Read(scene))
+        return;
+
+    // Prime transfer cache using camera rays
+    minWeight *= 1.5f;
+    int xstart, xend, ystart, yend;
+    camera->film->GetSampleExtent(&xstart, &xend, &ystart, &yend);
+    HaltonSampler sampler(xstart, xend, ystart, yend, 1,
+                          camera->shutterOpen, camera->shutterClose);
+    Sample *sample = new Sample(&sampler, integrator, NULL, scene);
+    const int nTasks = 64;
+    ProgressReporter progress(nTasks, "Priming transfer cache");
+    vector<Task *> tasks;
+    for (int i = 0; i < nTasks; ++i)
+        tasks.push_back(new TransferPrimeTask(scene, renderer, camera,
+                                              &sampler, sample, integrator,
+                                              progress, i, nTasks));
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+        delete tasks[i];
+    progress.Done();
+    delete sample;
+    minWeight /= 1.5f;
+    if (filename != "" && !Write(scene))
+        Warning("Unable to write transfer cache file \"%s\"", filename.c_str());
+}
+
+
+void TransferPrimeTask::Run() {
+    if (!sampler) { progress.Update(); return; }
+    MemoryArena arena;
+    int sampleCount;
+    RNG rng(37 * taskNum);
+    int maxSamples = sampler->MaximumSampleCount();
+    Sample *samples = origSample->Duplicate(maxSamples);
+    while ((sampleCount = sampler->GetMoreSamples(samples, rng)) > 0) {
+        for (int i = 0; i < sampleCount; ++i) {
+            RayDifferential ray;
+            camera->GenerateRayDifferential(samples[i], &ray);
+            Intersection isect;
+            if (scene->Intersect(ray, &isect))
+                (void)integrator->Li(scene, renderer, ray, isect, &samples[i],
+                                     rng, arena);
+        }
+        arena.FreeAll();
+    }
+    delete[] samples;
+    delete sampler;
+    progress.Update();
+}
+
+
+bool TransferCache::Lookup(const Point &p, const Normal &n,
+                           float *coeffs) const {
+    if (!octree) return false;
+    TransferProcess proc(p, n, cosMaxSampleAngleDifference, nCoeffs, coeffs);
+    RWMutexLock lock(*mutex, READ);
+    octree->Lookup(p, proc);
+    if (proc.sumWt < minWeight) return false;
+    float invWt = 1.f / proc.sumWt;
+    for (int i = 0; i < nCoeffs; ++i)
+        coeffs[i] *= invWt;
+    return true;
+}
+
+
+bool TransferProcess::operator()(const TransferSample *sample) {
+    // Compute interpolation error term and possibly use sample
+    float perr = Distance(p, sample->p) / sample->maxDist;
+    float nerr = sqrtf(max(0.f, 1.f - Dot(n, sample->n)) /
+                       (1.f - cosMaxSampleAngleDifference));
+    float err = max(perr, nerr);
+    if (err < 1.f) {
+        float wt = 1.f - err;
+        for (int i = 0; i < nCoeffs; ++i)
+            c[i] += wt * sample->c[i];
+        sumWt += wt;
+    }
+    return true;
+}
+
+
+void TransferCache::Add(const Point &p, const Normal &n, float pixelSpacing,
+                        const float *coeffs) {
+    if (!octree) return;
+    float maxDist = maxSamplePixelSpacing * pixelSpacing;
+    if (maxDist == 0.f) return;
+    TransferSample *sample = new TransferSample(p, n, maxDist, nCoeffs);
+    memcpy(sample->c, coeffs, nCoeffs * sizeof(float));
+    BBox sampleExtent(p);
+    sampleExtent.Expand(maxDist);
+    RWMutexLock lock(*mutex, WRITE);
+    samples.push_back(sample);
+    octree->Add(sample, sampleExtent);
+}
+
+
+void TransferCache::InitHeader(const Scene *scene,
+                               TransferCacheHeader *header) const {
+    // Record the parameters and scene that the cached transfer depends on
+    memset(header, 0, sizeof(TransferCacheHeader));
+    strcpy(header->magic, TRANSFER_CACHE_MAGIC);
+    header->version = TRANSFER_CACHE_VERSION;
+    header->lmax = lmax;
+    header->nSamples = nSamples;
+    header->nCoeffs = nCoeffs;
+    header->nCached = samples.size();
+    BBox bounds = scene->WorldBound();
+    for (int i = 0; i < 3; ++i) {
+        header->sceneBounds[i] = bounds.pMin[i];
+        header->sceneBounds[i+3] = bounds.pMax[i];
+    }
+}
+
+
+bool TransferCache::Read(const Scene *scene) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    // Read header and check that the cache matches the current scene
+    TransferCacheHeader header, expected;
+    InitHeader(scene, &expected);
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, TRANSFER_CACHE_MAGIC, 8) != 0 ||
+        header.version != TRANSFER_CACHE_VERSION || header.nCached < 0) {
+        Warning("Ignoring invalid transfer cache file \"%s\"", filename.c_str());
+        fclose(f);
+        return false;
+    }
+    expected.nCached = header.nCached;
+    if (memcmp(&header, &expected, sizeof(header)) != 0) {
+        Warning("Transfer cache file \"%s\" was computed for a different "
+                "scene or integrator settings; recomputing it",
+                filename.c_str());
+        fclose(f);
+        return false;
+    }
+
+    // Read _TransferSample_s and add them to octree
+    vector<TransferSample *> newSamples;
+    bool ok = true;
+    for (int32_t i = 0; i < header.nCached && ok; ++i) {
+        float v[7];
+        ok = (fread(v, sizeof(float), 7, f) == 7);
+        if (!ok) break;
+        TransferSample *sample = new TransferSample(Point(v[0], v[1], v[2]),
+            Normal(v[3], v[4], v[5]), v[6], nCoeffs);
+        newSamples.push_back(sample);
+        ok = (fread(sample->c, sizeof(float), nCoeffs, f) == size_t(nCoeffs));
+    }
+    fclose(f);
+    if (!ok) {
+        Warning("Error reading transfer cache file \"%s\"", filename.c_str());
+        for (uint32_t i = 0; i < newSamples.size(); ++i)
+            delete newSamples[i];
+        return false;
+    }
+    for (uint32_t i = 0; i < newSamples.size(); ++i) {
+        BBox sampleExtent(newSamples[i]->p);
+        sampleExtent.Expand(newSamples[i]->maxDist);
+        octree->Add(newSamples[i], sampleExtent);
+        samples.push_back(newSamples[i]);
+    }
+    return true;
+}
+
+
+bool TransferCache::Write(const Scene *scene) const {
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (!f) return false;
+    TransferCacheHeader header;
+    InitHeader(scene, &header);
+    bool ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+    for (uint32_t i = 0; i < samples.size() && ok; ++i) {
+        const TransferSample *s = samples[i];
+        float v[7] = { s->p.x, s->p.y, s->p.z, s->n.x, s->n.y, s->n.z,
+                       s->maxDist };
+        ok = (fwrite(v, sizeof(float), 7, f) == 7 &&
+              fwrite(s->c, sizeof(float), nCoeffs, f) == size_t(nCoeffs));
+    }
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
+
+
+TransferCache *CreateTransferCache(int lmax, int nSamples, int nCoeffs,
+                                   const ParamSet &params) {
+    if (!params.FindOneBool("transfercache", false))
+        return NULL;
+    float minWeight = params.FindOneFloat("minweight", 0.5f);
+    float maxSpacing = params.FindOneFloat("maxpixelspacing", 5.f);
+    float maxAngle = params.FindOneFloat("maxangledifference", 10.f);
+    string filename = params.FindOneFilename("cachefile", "");
+    return new TransferCache(lmax, nSamples, nCoeffs, minWeight, maxSpacing,
+                             maxAngle, filename);
+}
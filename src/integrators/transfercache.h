@@ -0,0 +1,82 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_TRANSFERCACHE_H
+#define PBRT_INTEGRATORS_TRANSFERCACHE_H
+
+// integrators/transfercache.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "octree.h"
+#include "parallel.h"
+
+// TransferCache Forward Declarations
+struct TransferSample;
+struct TransferCacheHeader;
+
+// TransferCache Declarations
+class TransferCache {
+public:
+    // TransferCache Public Methods
+    TransferCache(int lmax, int nSamples, int nCoeffs, float minWeight,
+                  float maxPixelSpacing, float maxAngle,
+                  const string &filename);
+    ~TransferCache();
+    void Preprocess(const Scene *scene, const Camera *camera,
+                    const Renderer *renderer, SurfaceIntegrator *integrator);
+    bool Lookup(const Point &p, const Normal &n, float *coeffs) const;
+    void Add(const Point &p, const Normal &n, float pixelSpacing,
+             const float *coeffs);
+private:
+    // TransferCache Private Methods
+    void InitHeader(const Scene *scene, TransferCacheHeader *header) const;
+    bool Read(const Scene *scene);
+    bool Write(const Scene *scene) const;
+
+    // TransferCache Private Data
+    int lmax, nSamples, nCoeffs;
+    float minWeight, maxSamplePixelSpacing, cosMaxSampleAngleDifference;
+    string filename;
+    mutable RWMutex *mutex;
+    Octree<TransferSample *> *octree;
+    vector<TransferSample *> samples;
+};
+
+
+TransferCache *CreateTransferCache(int lmax, int nSamples, int nCoeffs,
+                                   const ParamSet &params);
+
+#endif // PBRT_INTEGRATORS_TRANSFERCACHE_H
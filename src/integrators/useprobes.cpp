@@ -48,6 +48,57 @@
 #else
 #include <sys/errno.h>
 #endif
+#ifdef PBRT_HAS_SSE
+#include <emmintrin.h>
+#endif
+
+// UseRadianceProbes Local Definitions
+static inline float DotProbeCoefficients(const float *w, const float *c, int n) {
+    float sum = 0.f;
+    int i = 0;
+#ifdef PBRT_HAS_SSE
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(w + i),
+                                         _mm_loadu_ps(c + i)));
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i)
+        sum += w[i] * c[i];
+    return sum;
+}
+
+
+static inline float DotProbeCoefficients(const float *w, const uint16_t *c, int n) {
+    float sum = 0.f;
+    int i = 0;
+#ifdef PBRT_HAS_SSE
+    // Decode four half values at a time, following _HalfToFloat()_
+    const __m128i magMask = _mm_set1_epi32(0x7fff);
+    const __m128i signMask = _mm_set1_epi32(0x8000);
+    const __m128 expScale = _mm_set1_ps(5.192296858534828e33f);
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128i h = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(c + i)),
+                                       _mm_setzero_si128());
+        __m128 mag = _mm_mul_ps(_mm_castsi128_ps(
+            _mm_slli_epi32(_mm_and_si128(h, magMask), 13)), expScale);
+        __m128 v = _mm_or_ps(mag, _mm_castsi128_ps(
+            _mm_slli_epi32(_mm_and_si128(h, signMask), 16)));
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(w + i), v));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i)
+        sum += w[i] * HalfToFloat(c[i]);
+    return sum;
+}
+
+
 
 // UseRadianceProbes Method Definitions
 UseRadianceProbes *CreateRadianceProbesSurfaceIntegrator(const ParamSet &paramSet) {
@@ -59,40 +110,116 @@ UseRadianceProbes *CreateRadianceProbesSurfaceIntegrator(const ParamSet &paramSe
 UseRadianceProbes::UseRadianceProbes(const string &filename) {
     lightSampleOffsets = NULL;
     bsdfSampleOffsets = NULL;
+    mappedFile = NULL;
+    coefficients = NULL;
+    halfCoefficients = NULL;
+    lmax = 0;
+    nProbes[0] = nProbes[1] = nProbes[2] = 0;
     // Read precomputed radiance probe values from file
+    if (!ReadBinary(filename) && !ReadText(filename)) {
+        Error("Unable to read saved radiance volume values from file \"%s\"",
+              filename.c_str());
+        return;
+    }
+
+    // Precompute cosine lobe convolution weights for SH coefficients
+    Spectrum *ones = new Spectrum[SHTerms(lmax)];
+    Spectrum *conv = new Spectrum[SHTerms(lmax)];
+    for (int i = 0; i < SHTerms(lmax); ++i)
+        ones[i] = Spectrum(1.f);
+    SHConvolveCosTheta(lmax, ones, conv);
+    cosThetaWeights.resize(SHTerms(lmax));
+    for (int i = 0; i < SHTerms(lmax); ++i)
+        cosThetaWeights[i] = conv[i][0];
+    delete[] ones;
+    delete[] conv;
+}
+
+
+bool UseRadianceProbes::ReadBinary(const string &filename) {
+    MappedFile *mf = new MappedFile(filename);
+    const RadianceProbeFileHeader *header =
+        (const RadianceProbeFileHeader *)mf->Data();
+    if (!mf->IsValid() || mf->Size() < sizeof(RadianceProbeFileHeader) ||
+        memcmp(header->magic, RADIANCE_PROBE_MAGIC, 8) != 0) {
+        delete mf;
+        return false;
+    }
+    if (header->version != RADIANCE_PROBE_VERSION) {
+        Error("Unsupported version %d in radiance probe file \"%s\"",
+              header->version, filename.c_str());
+        exit(1);
+    }
+    if (header->nChannels != Spectrum::nComponents) {
+        Error("Radiance probe file \"%s\" has %d spectral channels, but "
+              "pbrt was compiled with %d", filename.c_str(),
+              header->nChannels, Spectrum::nComponents);
+        exit(1);
+    }
+
+    // Initialize probe grid from header and check data size
+    lmax = header->lmax;
+    includeDirectInProbes = header->includeDirect;
+    includeIndirectInProbes = header->includeIndirect;
+    for (int i = 0; i < 3; ++i)
+        nProbes[i] = header->nProbes[i];
+    bbox = BBox(Point(header->bounds[0], header->bounds[1], header->bounds[2]),
+                Point(header->bounds[3], header->bounds[4], header->bounds[5]));
+    size_t valueSize = header->halfPrecision ? sizeof(uint16_t) : sizeof(float);
+    size_t nValues = size_t(nProbes[0]) * nProbes[1] * nProbes[2] *
+                     Spectrum::nComponents * SHTerms(lmax);
+    if (lmax < 0 || nProbes[0] <= 0 || nProbes[1] <= 0 || nProbes[2] <= 0 ||
+        mf->Size() < sizeof(RadianceProbeFileHeader) + nValues * valueSize) {
+        Error("Error reading data from radiance probe file \"%s\"", filename.c_str());
+        exit(1);
+    }
+    const char *data = mf->Data() + sizeof(RadianceProbeFileHeader);
+    if (header->halfPrecision) halfCoefficients = (const uint16_t *)data;
+    else                       coefficients = (const float *)data;
+    mappedFile = mf;
+    return true;
+}
+
+
+bool UseRadianceProbes::ReadText(const string &filename) {
     FILE *f = fopen(filename.c_str(), "r");
-    if (f) {
-        if (fscanf(f, "%d %d %d", &lmax, &includeDirectInProbes,
-                   &includeIndirectInProbes) != 3 ||
-            fscanf(f, "%d %d %d", &nProbes[0], &nProbes[1], &nProbes[2]) != 3 ||
-            fscanf(f, "%f %f %f %f %f %f", &bbox.pMin.x, &bbox.pMin.y, &bbox.pMin.z,
-                   &bbox.pMax.x, &bbox.pMax.y, &bbox.pMax.z) != 6) {
-            Error("Error reading data from radiance probe file \"%s\"", filename.c_str());
-            exit(1);
-        }
-    
-        c_in = new Spectrum[SHTerms(lmax) * nProbes[0] * nProbes[1] * nProbes[2]];
-        int offset = 0;
-        for (int i = 0; i < nProbes[0] * nProbes[1] * nProbes[2]; ++i) {
-            for (int j = 0; j < SHTerms(lmax); ++j)
-                if (!c_in[offset++].Read(f)) {
-                    Error("Error reading data from radiance probe file \"%s\"",
-                        filename.c_str());
-                    exit(1);
-                }
+    if (!f) return false;
+    if (fscanf(f, "%d %d %d", &lmax, &includeDirectInProbes,
+               &includeIndirectInProbes) != 3 ||
+        fscanf(f, "%d %d %d", &nProbes[0], &nProbes[1], &nProbes[2]) != 3 ||
+        fscanf(f, "%f %f %f %f %f %f", &bbox.pMin.x, &bbox.pMin.y, &bbox.pMin.z,
+               &bbox.pMax.x, &bbox.pMax.y, &bbox.pMax.z) != 6) {
+        Error("Error reading data from radiance probe file \"%s\"", filename.c_str());
+        exit(1);
+    }
+
+    // Read coefficients and store them in the binary file's layout
+    int nTerms = SHTerms(lmax);
+    textCoefficients.resize(size_t(nProbes[0]) * nProbes[1] * nProbes[2] *
+                            Spectrum::nComponents * nTerms);
+    for (int i = 0; i < nProbes[0] * nProbes[1] * nProbes[2]; ++i) {
+        float *c = &textCoefficients[size_t(i) * Spectrum::nComponents * nTerms];
+        for (int j = 0; j < nTerms; ++j) {
+            Spectrum s;
+            if (!s.Read(f)) {
+                Error("Error reading data from radiance probe file \"%s\"",
+                    filename.c_str());
+                exit(1);
+            }
+            for (int ch = 0; ch < Spectrum::nComponents; ++ch)
+                c[ch * nTerms + j] = s[ch];
         }
-        fclose(f);
     }
-    else
-        Error("Unable to read saved radiance volume values from file \"%s\"",
-              filename.c_str());
+    fclose(f);
+    coefficients = &textCoefficients[0];
+    return true;
 }
 
 
 UseRadianceProbes::~UseRadianceProbes() {
     delete[] lightSampleOffsets;
     delete[] bsdfSampleOffsets;
-    delete[] c_in;
+    delete mappedFile;
 }
 
 
@@ -130,6 +257,7 @@ Spectrum UseRadianceProbes::Li(const Scene *scene, const Renderer *renderer,
                 lightSampleOffsets, bsdfSampleOffsets);
 
     // Compute reflected lighting using radiance probes
+    if (!coefficients && !halfCoefficients) return L;
 
     // Compute probe coordinates and offsets for lookup point
     Vector offset = bbox.Offset(p);
@@ -139,40 +267,37 @@ Spectrum UseRadianceProbes::Li(const Scene *scene, const Renderer *renderer,
     int vx = Floor2Int(voxx), vy = Floor2Int(voxy), vz = Floor2Int(voxz);
     float dx = voxx - vx, dy = voxy - vy, dz = voxz - vz;
 
-    // Get radiance probe coefficients around lookup point
-    const Spectrum *b000 = c_inXYZ(lmax, vx,   vy,   vz);
-    const Spectrum *b100 = c_inXYZ(lmax, vx+1, vy,   vz);
-    const Spectrum *b010 = c_inXYZ(lmax, vx,   vy+1, vz);
-    const Spectrum *b110 = c_inXYZ(lmax, vx+1, vy+1, vz);
-    const Spectrum *b001 = c_inXYZ(lmax, vx,   vy,   vz+1);
-    const Spectrum *b101 = c_inXYZ(lmax, vx+1, vy,   vz+1);
-    const Spectrum *b011 = c_inXYZ(lmax, vx,   vy+1, vz+1);
-    const Spectrum *b111 = c_inXYZ(lmax, vx+1, vy+1, vz+1);
-
-    // Compute incident radiance from radiance probe coefficients
-    Spectrum *c_inp = arena.Alloc<Spectrum>(SHTerms(lmax));
-    for (int i = 0; i < SHTerms(lmax); ++i) {
-        // Do trilinear interpolation to compute SH coefficients at point
-        Spectrum c00 = Lerp(dx, b000[i], b100[i]);
-        Spectrum c10 = Lerp(dx, b010[i], b110[i]);
-        Spectrum c01 = Lerp(dx, b001[i], b101[i]);
-        Spectrum c11 = Lerp(dx, b011[i], b111[i]);
-        Spectrum c0 = Lerp(dy, c00, c10);
-        Spectrum c1 = Lerp(dy, c01, c11);
-        c_inp[i] = Lerp(dz, c0, c1);
+    // Compute trilinear weights and offsets of surrounding probes
+    int probeOffsets[8];
+    float probeWeights[8];
+    for (int k = 0; k < 8; ++k) {
+        int ox = k & 1, oy = (k >> 1) & 1, oz = (k >> 2) & 1;
+        probeOffsets[k] = ProbeOffset(vx + ox, vy + oy, vz + oz);
+        probeWeights[k] = (ox ? dx : 1.f - dx) * (oy ? dy : 1.f - dy) *
+                          (oz ? dz : 1.f - dz);
     }
 
-    // Convolve incident radiance to compute irradiance function
-    Spectrum *c_E = arena.Alloc<Spectrum>(SHTerms(lmax));
-    SHConvolveCosTheta(lmax, c_inp, c_E);
+    // Fold cosine convolution into SH basis weights for irradiance
+    int nTerms = SHTerms(lmax);
+    float *w = ALLOCA(float, nTerms);
+    SHEvaluate(Vector(Faceforward(n, wo)), lmax, w);
+    for (int i = 0; i < nTerms; ++i)
+        w[i] *= cosThetaWeights[i];
 
-    // Evaluate irradiance function and accumulate reflection
-    Spectrum rho = bsdf->rho(wo, rng, BSDF_ALL_REFLECTION);
-    float *Ylm = ALLOCA(float, SHTerms(lmax));
-    SHEvaluate(Vector(Faceforward(n, wo)), lmax, Ylm);
+    // Evaluate irradiance directly from probe coefficients
     Spectrum E = 0.f;
-    for (int i = 0; i < SHTerms(lmax); ++i)
-        E += c_E[i] * Ylm[i];
+    for (int ch = 0; ch < Spectrum::nComponents; ++ch) {
+        float e = 0.f;
+        for (int k = 0; k < 8; ++k) {
+            if (probeWeights[k] == 0.f) continue;
+            int o = probeOffsets[k] + ch * nTerms;
+            e += probeWeights[k] * (coefficients ?
+                DotProbeCoefficients(w, coefficients + o, nTerms) :
+                DotProbeCoefficients(w, halfCoefficients + o, nTerms));
+        }
+        E[ch] = e;
+    }
+    Spectrum rho = bsdf->rho(wo, rng, BSDF_ALL_REFLECTION);
     L += rho * INV_PI * E.Clamp();
     return L;
 }
@@ -40,6 +40,25 @@
 #include "pbrt.h"
 #include "integrator.h"
 #include "sh.h"
+#include "fileutil.h"
+
+// Radiance Probe File Declarations
+
+// Binary probe files hold this header followed by each probe's SH
+// coefficients, stored channel by channel as float or half values
+struct RadianceProbeFileHeader {
+    // RadianceProbeFileHeader Public Data
+    char magic[8];
+    int32_t version, lmax, includeDirect, includeIndirect;
+    int32_t nProbes[3];
+    float bounds[6];
+    int32_t nChannels, halfPrecision;
+    int32_t pad[3];
+};
+
+
+#define RADIANCE_PROBE_MAGIC "PBRTPRB"
+static const int RADIANCE_PROBE_VERSION = 1;
 
 // UseRadianceProbes Declarations
 class UseRadianceProbes : public SurfaceIntegrator {
@@ -53,19 +72,25 @@ public:
                 const Sample *sample, RNG &rng, MemoryArena &arena) const;
 private:
     // UseRadianceProbes Private Methods
-    const Spectrum *c_inXYZ(int lmax, int vx, int vy, int vz) const {
+    bool ReadBinary(const string &filename);
+    bool ReadText(const string &filename);
+    int ProbeOffset(int vx, int vy, int vz) const {
         vx = Clamp(vx, 0, nProbes[0]-1);
         vy = Clamp(vy, 0, nProbes[1]-1);
         vz = Clamp(vz, 0, nProbes[2]-1);
         int offset = vx + vy * nProbes[0] + vz * nProbes[0] * nProbes[1];
-        return &c_in[SHTerms(lmax) * offset];
+        return Spectrum::nComponents * SHTerms(lmax) * offset;
     }
 
     // UseRadianceProbes Private Data
     BBox bbox;
     int lmax, includeDirectInProbes, includeIndirectInProbes;
     int nProbes[3];
-    Spectrum *c_in;
+    MappedFile *mappedFile;
+    vector<float> textCoefficients;
+    const float *coefficients;
+    const uint16_t *halfCoefficients;
+    vector<float> cosThetaWeights;
 
     // Declare sample parameters for light source sampling
     LightSampleOffsets *lightSampleOffsets;
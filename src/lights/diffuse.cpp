@@ -86,6 +86,13 @@ float DiffuseAreaLight::Pdf(const Point &p, const Vector &wi) const {
 }
 
 
+void DiffuseAreaLight::Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+        float *pdfPos, float *pdfDir) const {
+    *pdfPos = shapeSet->Pdf(p);
+    *pdfDir = Dot(n, w) > 0.f ? INV_TWOPI : 0.f;
+}
+
+
 Spectrum DiffuseAreaLight::Sample_L(const Scene *scene,
         const LightSample &ls, float u1, float u2, float time,
         Ray *ray, Normal *Ns, float *pdf) const {
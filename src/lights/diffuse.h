@@ -54,6 +54,8 @@ public:
     Spectrum Power(const Scene *) const;
     bool IsDeltaLight() const { return false; }
     float Pdf(const Point &, const Vector &) const;
+    void Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+                float *pdfPos, float *pdfDir) const;
     Spectrum Sample_L(const Point &P, float pEpsilon, const LightSample &ls, float time,
         Vector *wo, float *pdf, VisibilityTester *visibility) const;
     Spectrum Sample_L(const Scene *scene, const LightSample &ls, float u1, float u2,
@@ -92,3 +92,10 @@ float GonioPhotometricLight::Pdf(const Point &, const Vector &) const {
 }
 
 
+void GonioPhotometricLight::Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+        float *pdfPos, float *pdfDir) const {
+    *pdfPos = 1.f;
+    *pdfDir = UniformSpherePdf();
+}
+
+
@@ -66,6 +66,8 @@ public:
     Spectrum Sample_L(const Scene *scene, const LightSample &ls, float u1, float u2,
         float time, Ray *ray, Normal *Ns, float *pdf) const;
     float Pdf(const Point &, const Vector &) const;
+    void Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+                float *pdfPos, float *pdfDir) const;
 private:
     // GonioPhotometricLight Private Data
     Point lightPos;
@@ -100,7 +100,7 @@ InfiniteAreaLight::InfiniteAreaLight(const Transform &light2world,
     }
 
     // Compute sampling distributions for rows and columns of image
-    distribution = new Distribution2D(img, width, height);
+    distribution = new HierarchicalDistribution2D(img, width, height);
     delete[] img;
 }
 
@@ -152,24 +152,29 @@ void InfiniteAreaLight::SHProject(const Point &p, float pEpsilon,
             sinphi[phi] = sinf((phi + .5f)/nphi * 2.f * M_PI);
             cosphi[phi] = cosf((phi + .5f)/nphi * 2.f * M_PI);
         }
-        float *Ylm = ALLOCA(float, SHTerms(lmax));
+        float *Ylm = new float[nphi * SHTerms(lmax)];
+        Vector *w = new Vector[nphi];
         for (int theta = 0; theta < ntheta; ++theta) {
+            // Evaluate SH basis for all directions in lat-long row
+            for (int phi = 0; phi < nphi; ++phi)
+                w[phi] = Normalize(LightToWorld(Vector(sintheta[theta] * cosphi[phi],
+                                                       sintheta[theta] * sinphi[phi],
+                                                       costheta[theta])));
+            SHEvaluate(w, nphi, lmax, Ylm);
             for (int phi = 0; phi < nphi; ++phi) {
                 // Add _InfiniteAreaLight_ texel's contribution to SH coefficients
-                Vector w = Vector(sintheta[theta] * cosphi[phi],
-                                  sintheta[theta] * sinphi[phi],
-                                  costheta[theta]);
-                w = Normalize(LightToWorld(w));
                 Spectrum Le = Spectrum(radianceMap->Texel(0, phi, theta),
                                        SPECTRUM_ILLUMINANT);
-                SHEvaluate(w, lmax, Ylm);
+                const float *Yp = &Ylm[phi * SHTerms(lmax)];
                 for (int i = 0; i < SHTerms(lmax); ++i)
-                    coeffs[i] += Le * Ylm[i] * sintheta[theta] *
+                    coeffs[i] += Le * Yp[i] * sintheta[theta] *
                         (M_PI / ntheta) * (2.f * M_PI / nphi);
             }
         }
 
         // Free memory used for lat-long theta and phi values
+        delete[] w;
+        delete[] Ylm;
         delete[] buf;
     }
     else {
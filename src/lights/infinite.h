@@ -64,7 +64,7 @@ public:
 private:
     // InfiniteAreaLight Private Data
     MIPMap<RGBSpectrum> *radianceMap;
-    Distribution2D *distribution;
+    HierarchicalDistribution2D *distribution;
 };
 
 
@@ -77,6 +77,13 @@ float PointLight::Pdf(const Point &, const Vector &) const {
 }
 
 
+void PointLight::Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+        float *pdfPos, float *pdfDir) const {
+    *pdfPos = 1.f;
+    *pdfDir = UniformSpherePdf();
+}
+
+
 Spectrum PointLight::Sample_L(const Scene *scene, const LightSample &ls,
         float u1, float u2, float time, Ray *ray, Normal *Ns,
         float *pdf) const {
@@ -134,3 +134,11 @@ float ProjectionLight::Pdf(const Point &, const Vector &) const {
 }
 
 
+void ProjectionLight::Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+        float *pdfPos, float *pdfDir) const {
+    *pdfPos = 1.f;
+    Vector wl = Normalize(WorldToLight(w));
+    *pdfDir = wl.z >= cosTotalWidth ? UniformConePdf(cosTotalWidth) : 0.f;
+}
+
+
@@ -103,6 +103,14 @@ float SpotLight::Pdf(const Point &, const Vector &) const {
 }
 
 
+void SpotLight::Pdf_Le(const Point &p, const Normal &n, const Vector &w,
+        float *pdfPos, float *pdfDir) const {
+    *pdfPos = 1.f;
+    Vector wl = Normalize(WorldToLight(w));
+    *pdfDir = wl.z >= cosTotalWidth ? UniformConePdf(cosTotalWidth) : 0.f;
+}
+
+
 Spectrum SpotLight::Sample_L(const Scene *scene, const LightSample &ls,
         float u1, float u2, float time, Ray *ray, Normal *Ns,
         float *pdf) const {
@@ -46,9 +46,25 @@ BSDF *GlassMaterial::GetBSDF(const DifferentialGeometry &dgGeom, const Different
     else
         dgs = dgShading;
     float ior = index->Evaluate(dgs);
-    BSDF *bsdf = BSDF_ALLOC(arena, BSDF)(dgs, dgGeom.nn, ior);
     Spectrum R = Kr->Evaluate(dgs).Clamp();
     Spectrum T = Kt->Evaluate(dgs).Clamp();
+    if (dispersion != 0.f && dgGeom.wavelength >= 0) {
+        // Shade only the path's wavelength, with its index of refraction
+        int c = dgGeom.wavelength;
+        float lambda = Spectrum::Wavelength(c) * 1e-3f;
+        ior += dispersion * (1.f / (lambda * lambda) - 1.f / (.55f * .55f));
+
+        // Divide by the wavelength's probability at the path's first
+        // dispersive interface
+        float scale = dgGeom.dispersed ? 1.f : float(Spectrum::nComponents);
+        Spectrum Rc(0.f), Tc(0.f);
+        Rc[c] = R[c] * scale;
+        Tc[c] = T[c] * scale;
+        R = Rc;
+        T = Tc;
+        dgGeom.dispersed = true;
+    }
+    BSDF *bsdf = BSDF_ALLOC(arena, BSDF)(dgs, dgGeom.nn, ior);
     if (!R.IsBlack())
         bsdf->Add(BSDF_ALLOC(arena, SpecularReflection)(R,
             BSDF_ALLOC(arena, FresnelDielectric)(1., ior)));
@@ -64,7 +80,8 @@ GlassMaterial *CreateGlassMaterial(const Transform &xform,
     Reference<Texture<Spectrum> > Kt = mp.GetSpectrumTexture("Kt", Spectrum(1.f));
     Reference<Texture<float> > index = mp.GetFloatTexture("index", 1.5f);
     Reference<Texture<float> > bumpMap = mp.GetFloatTextureOrNull("bumpmap");
-    return new GlassMaterial(Kr, Kt, index, bumpMap);
+    float dispersion = mp.FindFloat("dispersion", 0.f);
+    return new GlassMaterial(Kr, Kt, index, bumpMap, dispersion);
 }
 
 
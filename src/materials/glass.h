@@ -45,11 +45,13 @@ class GlassMaterial : public Material {
 public:
     // GlassMaterial Public Methods
     GlassMaterial(Reference<Texture<Spectrum> > r, Reference<Texture<Spectrum> > t,
-            Reference<Texture<float> > i, Reference<Texture<float> > bump) {
+            Reference<Texture<float> > i, Reference<Texture<float> > bump,
+            float disp) {
         Kr = r;
         Kt = t;
         index = i;
         bumpMap = bump;
+        dispersion = disp;
     }
     BSDF *GetBSDF(const DifferentialGeometry &dgGeom, const DifferentialGeometry &dgShading, MemoryArena &arena) const;
 private:
@@ -57,6 +59,7 @@ private:
     Reference<Texture<Spectrum> > Kr, Kt;
     Reference<Texture<float> > index;
     Reference<Texture<float> > bumpMap;
+    float dispersion;
 };
 
 
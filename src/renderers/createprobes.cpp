@@ -44,6 +44,7 @@
 #include "volume.h"
 #include "paramset.h"
 #include "montecarlo.h"
+#include "integrators/useprobes.h"
 #if defined(PBRT_IS_WINDOWS) || defined(PBRT_IS_LINUX)|| defined(PBRT_IS_OPENBSD)
 #include <errno.h>
 #else
@@ -76,11 +77,13 @@ private:
 // CreateRadianceProbes Method Definitions
 CreateRadianceProbes::CreateRadianceProbes(SurfaceIntegrator *surf,
         VolumeIntegrator *vol, const Camera *cam, int lm, float ps, const BBox &b,
-        int nindir, bool id, bool ii, float t, const string &fn) {
+        int nindir, bool id, bool ii, float t, const string &fn,
+        const string &fmt) {
     lmax = lm;
     probeSpacing = ps;
     bbox = b;
     filename = fn;
+    format = fmt;
     includeDirectInProbes = id;
     includeIndirectInProbes = ii;
     time = t;
@@ -91,6 +94,56 @@ CreateRadianceProbes::CreateRadianceProbes(SurfaceIntegrator *surf,
 }
 
 
+void CreateRadianceProbes::WriteBinaryProbes(const int nProbes[3],
+        Spectrum **c_in) const {
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        Error("Unable to open radiance file \"%s\" (%s)", filename.c_str(),
+              strerror(errno));
+        return;
+    }
+    // Initialize and write _RadianceProbeFileHeader_
+    RadianceProbeFileHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, RADIANCE_PROBE_MAGIC);
+    header.version = RADIANCE_PROBE_VERSION;
+    header.lmax = lmax;
+    header.includeDirect = includeDirectInProbes ? 1 : 0;
+    header.includeIndirect = includeIndirectInProbes ? 1 : 0;
+    for (int i = 0; i < 3; ++i) {
+        header.nProbes[i] = nProbes[i];
+        header.bounds[i] = bbox.pMin[i];
+        header.bounds[i+3] = bbox.pMax[i];
+    }
+    header.nChannels = Spectrum::nComponents;
+    header.halfPrecision = (format == "half") ? 1 : 0;
+    bool ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+
+    // Write each probe's coefficients, one spectral channel at a time
+    int nTerms = SHTerms(lmax);
+    vector<float> values(Spectrum::nComponents * nTerms);
+    vector<uint16_t> halves(values.size());
+    for (int i = 0; ok && i < nProbes[0] * nProbes[1] * nProbes[2]; ++i) {
+        for (int ch = 0; ch < Spectrum::nComponents; ++ch)
+            for (int j = 0; j < nTerms; ++j)
+                values[ch * nTerms + j] = c_in[i][j][ch];
+        if (header.halfPrecision) {
+            for (uint32_t j = 0; j < values.size(); ++j)
+                halves[j] = FloatToHalf(values[j]);
+            ok = (fwrite(&halves[0], sizeof(uint16_t), halves.size(), f) == halves.size());
+        }
+        else
+            ok = (fwrite(&values[0], sizeof(float), values.size(), f) == values.size());
+    }
+    if (!ok) {
+        Error("Error writing radiance file \"%s\" (%s)", filename.c_str(),
+              strerror(errno));
+        exit(1);
+    }
+    fclose(f);
+}
+
+
 CreateRadianceProbes::~CreateRadianceProbes() {
     delete surfaceIntegrator;
     delete volumeIntegrator;
@@ -206,31 +259,35 @@ void CreateRadianceProbes::Render(const Scene *scene) {
     prog.Done();
 
     // Write radiance probe coefficients to file
-    FILE *f = fopen(filename.c_str(), "w");
-    if (f) {
-        if (fprintf(f, "%d %d %d\n", lmax, includeDirectInProbes?1:0, includeIndirectInProbes?1:0) < 0 ||
-            fprintf(f, "%d %d %d\n", nProbes[0], nProbes[1], nProbes[2]) < 0 ||
-            fprintf(f, "%f %f %f %f %f %f\n", bbox.pMin.x, bbox.pMin.y, bbox.pMin.z,
-                    bbox.pMax.x, bbox.pMax.y, bbox.pMax.z) < 0) {
-            Error("Error writing radiance file \"%s\" (%s)", filename.c_str(),
-                  strerror(errno));
-            exit(1);
-        }
+    if (format == "text") {
+        FILE *f = fopen(filename.c_str(), "w");
+        if (f) {
+            if (fprintf(f, "%d %d %d\n", lmax, includeDirectInProbes?1:0, includeIndirectInProbes?1:0) < 0 ||
+                fprintf(f, "%d %d %d\n", nProbes[0], nProbes[1], nProbes[2]) < 0 ||
+                fprintf(f, "%f %f %f %f %f %f\n", bbox.pMin.x, bbox.pMin.y, bbox.pMin.z,
+                        bbox.pMax.x, bbox.pMax.y, bbox.pMax.z) < 0) {
+                Error("Error writing radiance file \"%s\" (%s)", filename.c_str(),
+                      strerror(errno));
+                exit(1);
+            }
 
-        for (int i = 0; i < nProbes[0] * nProbes[1] * nProbes[2]; ++i) {
-            for (int j = 0; j < SHTerms(lmax); ++j) {
-                fprintf(f, "  ");
-                if (c_in[i][j].Write(f) == false) {
-                    Error("Error writing radiance file \"%s\" (%s)", filename.c_str(),
-                          strerror(errno));
-                    exit(1);
+            for (int i = 0; i < nProbes[0] * nProbes[1] * nProbes[2]; ++i) {
+                for (int j = 0; j < SHTerms(lmax); ++j) {
+                    fprintf(f, "  ");
+                    if (c_in[i][j].Write(f) == false) {
+                        Error("Error writing radiance file \"%s\" (%s)", filename.c_str(),
+                              strerror(errno));
+                        exit(1);
+                    }
+                    fprintf(f, "\n");
                 }
                 fprintf(f, "\n");
             }
-            fprintf(f, "\n");
+            fclose(f);
         }
-        fclose(f);
     }
+    else
+        WriteBinaryProbes(nProbes, c_in);
     for (int i = 0; i < nProbes[0] * nProbes[1] * nProbes[2]; ++i)
         delete[] c_in[i];
     delete[] c_in;
@@ -348,9 +405,15 @@ CreateRadianceProbes *CreateRadianceProbesRenderer(const Camera *camera,
     float probeSpacing = params.FindOneFloat("samplespacing", 1.f);
     float time = params.FindOneFloat("time", 0.f);
     string filename = params.FindOneFilename("filename", "probes.out");
+    string format = params.FindOneString("format", "binary");
+    if (format != "binary" && format != "half" && format != "text") {
+        Warning("Radiance probe format \"%s\" unknown.  Using \"binary\".",
+                format.c_str());
+        format = "binary";
+    }
 
     return new CreateRadianceProbes(surf, vol, camera, lmax, probeSpacing,
-        bounds, nindir, includeDirect, includeIndirect, time, filename);
+        bounds, nindir, includeDirect, includeIndirect, time, filename, format);
 }
 
 
@@ -48,7 +48,7 @@ public:
     CreateRadianceProbes(SurfaceIntegrator *surf, VolumeIntegrator *vol,
         const Camera *camera, int lmax, float probeSpacing, const BBox &bbox,
         int nIndirSamples, bool includeDirect, bool includeIndirect,
-        float time, const string &filename);
+        float time, const string &filename, const string &format);
     ~CreateRadianceProbes();
     void Render(const Scene *scene);
     Spectrum Li(const Scene *scene, const RayDifferential &ray,
@@ -57,6 +57,9 @@ public:
     Spectrum Transmittance(const Scene *scene, const RayDifferential &ray,
         const Sample *sample, RNG &rng, MemoryArena &arena) const;
 private:
+    // CreateRadianceProbes Private Methods
+    void WriteBinaryProbes(const int nProbes[3], Spectrum **c_in) const;
+
     // CreateRadianceProbes Private Data
     SurfaceIntegrator *surfaceIntegrator;
     VolumeIntegrator *volumeIntegrator;
@@ -65,7 +68,7 @@ private:
     BBox bbox;
     bool includeDirectInProbes, includeIndirectInProbes;
     float time, probeSpacing;
-    string filename;
+    string filename, format;
 };
 
 
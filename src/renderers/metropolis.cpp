@@ -48,14 +48,9 @@
 #include "montecarlo.h"
 #include "samplers/lowdiscrepancy.h"
 #include "integrators/directlighting.h"
+#include "integrators/bdpt.h"
 
 // Metropolis Local Declarations
-struct PathSample {
-    BSDFSample bsdfSample;
-    float rrSample;
-};
-
-
 struct LightingSample {
     BSDFSample bsdfSample;
     float lightNum;
@@ -70,20 +65,25 @@ struct MLTSample {
         lightingSamples.resize(maxLength);
     }
     CameraSample cameraSample;
+    // Drawn and mutated with a separate _RNG_ so that the other samples'
+    // sequences don't depend on it
+    float wavelengthSample;
     float lightNumSample, lightRaySamples[5];
     vector<PathSample> cameraPathSamples, lightPathSamples;
     vector<LightingSample> lightingSamples;
 };
 
 
-static void LargeStep(RNG &rng, MLTSample *sample, int maxDepth,
-        float x, float y, float t0, float t1, bool bidirectional) {
+static void LargeStep(RNG &rng, RNG &wavelengthRng, MLTSample *sample,
+        int maxDepth, float x, float y, float t0, float t1,
+        bool bidirectional) {
     // Do large step mutation of _cameraSample_
     sample->cameraSample.imageX = x;
     sample->cameraSample.imageY = y;
     sample->cameraSample.time = Lerp(rng.RandomFloat(), t0, t1);
     sample->cameraSample.lensU = rng.RandomFloat();
     sample->cameraSample.lensV = rng.RandomFloat();
+    sample->wavelengthSample = wavelengthRng.RandomFloat();
     for (int i = 0; i < maxDepth; ++i) {
         // Apply large step to $i$th camera _PathSample_
         PathSample &cps = sample->cameraPathSamples[i];
@@ -119,6 +119,28 @@ static void LargeStep(RNG &rng, MLTSample *sample, int maxDepth,
 }
 
 
+// Bootstrap sample _index_ is a large step from an _RNG_ seeded with the
+// index, so that any sample can be regenerated independently of the others
+static void BootstrapSample(uint32_t index, MLTSample *sample, int maxDepth,
+        int x0, int x1, int y0, int y1, float t0, float t1,
+        bool bidirectional, RNG &rng, RNG &wavelengthRng) {
+    rng.Seed(index);
+    wavelengthRng.Seed(~index);
+    float x = Lerp(rng.RandomFloat(), x0, x1);
+    float y = Lerp(rng.RandomFloat(), y0, y1);
+    LargeStep(rng, wavelengthRng, sample, maxDepth, x, y, t0, t1,
+              bidirectional);
+}
+
+
+static inline void SplatToBuffer(Spectrum *buffer, int x0, int x1,
+        int y0, int y1, const CameraSample &sample, const Spectrum &L) {
+    int x = Floor2Int(sample.imageX), y = Floor2Int(sample.imageY);
+    if (x < x0 || x >= x1 || y < y0 || y >= y1) return;
+    buffer[(y - y0) * (x1 - x0) + (x - x0)] += L;
+}
+
+
 static inline void mutate(RNG &rng, float *v, float min = 0.f,
                           float max = 1.f) {
     if (min == max) { *v = min; return; }
@@ -138,14 +160,15 @@ static inline void mutate(RNG &rng, float *v, float min = 0.f,
 }
 
 
-static void SmallStep(RNG &rng, MLTSample *sample, int maxDepth,
-        int x0, int x1, int y0, int y1, float t0, float t1,
+static void SmallStep(RNG &rng, RNG &wavelengthRng, MLTSample *sample,
+        int maxDepth, int x0, int x1, int y0, int y1, float t0, float t1,
         bool bidirectional) {
     mutate(rng, &sample->cameraSample.imageX, x0, x1);
     mutate(rng, &sample->cameraSample.imageY, y0, y1);
     mutate(rng, &sample->cameraSample.time, t0, t1);
     mutate(rng, &sample->cameraSample.lensU);
     mutate(rng, &sample->cameraSample.lensV);
+    mutate(wavelengthRng, &sample->wavelengthSample);
     // Apply small step mutation to camera, lighting, and light samples
     for (int i = 0; i < maxDepth; ++i) {
         // Apply small step to $i$th camera _PathSample_
@@ -182,110 +205,89 @@ static void SmallStep(RNG &rng, MLTSample *sample, int maxDepth,
 }
 
 
-struct PathVertex {
-    Intersection isect;
-    Vector wPrev, wNext;
-    BSDF *bsdf;
-    bool specularBounce;
-    int nSpecularComponents;
-    Spectrum alpha;
+inline float I(const Spectrum &L);
+class MLTBootstrapTask : public Task {
+public:
+    MLTBootstrapTask(uint32_t start, uint32_t end, int xx0, int xx1,
+        int yy0, int yy1, float tt0, float tt1, const Scene *sc,
+        const Camera *c, const MetropolisRenderer *renderer,
+        const AliasDistribution1D *lightDistribution, float *bootstrapI);
+    void Run();
+
+private:
+    uint32_t start, end;
+    int x0, x1, y0, y1;
+    float t0, t1;
+    const Scene *scene;
+    const Camera *camera;
+    const MetropolisRenderer *renderer;
+    const AliasDistribution1D *lightDistribution;
+    float *bootstrapI;
+};
+
+
+// Film-sized splat buffers are recycled between tasks, so at most one
+// buffer is allocated per concurrently running task
+class MLTSplatBuffers {
+public:
+    MLTSplatBuffers(uint32_t np) : nPixels(np) { mutex = Mutex::Create(); }
+    ~MLTSplatBuffers() {
+        for (uint32_t i = 0; i < freeBuffers.size(); ++i)
+            delete[] freeBuffers[i];
+        Mutex::Destroy(mutex);
+    }
+    Spectrum *Acquire() {
+        MutexLock lock(*mutex);
+        if (freeBuffers.size() == 0) return new Spectrum[nPixels];
+        Spectrum *buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        return buffer;
+    }
+    void Release(Spectrum *buffer) {
+        MutexLock lock(*mutex);
+        freeBuffers.push_back(buffer);
+    }
+private:
+    uint32_t nPixels;
+    Mutex *mutex;
+    vector<Spectrum *> freeBuffers;
 };
 
 
-static uint32_t GeneratePath(const RayDifferential &r, const Spectrum &alpha,
-    const Scene *scene, MemoryArena &arena, const vector<PathSample> &samples,
-    PathVertex *path, RayDifferential *escapedRay,
-    Spectrum *escapedAlpha);
-inline float I(const Spectrum &L);
 class MLTTask : public Task {
 public:
     MLTTask(ProgressReporter &prog, uint32_t pfreq, uint32_t taskNum,
-        float dx, float dy, int xx0, int xx1, int yy0, int yy1, float tt0, float tt1,
-        float bb, const MLTSample &is, const Scene *sc, const Camera *c,
-        MetropolisRenderer *renderer, Mutex *filmMutex,
-        Distribution1D *lightDistribution);
+        uint32_t firstChain, uint32_t nChains, uint32_t chainsPerStratum,
+        const uint32_t scramble[2], int xx0, int xx1, int yy0, int yy1,
+        float tt0, float tt1, float bb, const vector<uint32_t> &chainStart,
+        const Scene *sc, const Camera *c, MetropolisRenderer *renderer,
+        Mutex *filmMutex, MLTSplatBuffers *splatBuffers,
+        AliasDistribution1D *lightDistribution);
     void Run();
 
 private:
     ProgressReporter &progress;
     uint32_t progressUpdateFrequency, taskNum;
-    float dx, dy;
-    int currentPixelSample;
+    uint32_t firstChain, nChains, chainsPerStratum;
+    uint32_t scramble[2];
     int x0, x1, y0, y1;
     float t0, t1;
     float b;
-    const MLTSample &initialSample;
+    const vector<uint32_t> &chainStart;
     const Scene *scene;
     const Camera *camera;
     MetropolisRenderer *renderer;
     Mutex *filmMutex;
-    Distribution1D *lightDistribution;
+    MLTSplatBuffers *splatBuffers;
+    AliasDistribution1D *lightDistribution;
 };
 
 
 
 // Metropolis Method Definitions
-static uint32_t GeneratePath(const RayDifferential &r,
-        const Spectrum &a, const Scene *scene, MemoryArena &arena,
-        const vector<PathSample> &samples, PathVertex *path,
-        RayDifferential *escapedRay, Spectrum *escapedAlpha) {
-    PBRT_MLT_STARTED_GENERATE_PATH();
-    RayDifferential ray = r;
-    Spectrum alpha = a;
-    if (escapedAlpha) *escapedAlpha = 0.f;
-    uint32_t length = 0;
-    for (; length < samples.size(); ++length) {
-        // Try to generate next vertex of ray path
-        PathVertex &v = path[length];
-        if (!scene->Intersect(ray, &v.isect)) {
-            // Handle ray that leaves the scene during path generation
-            if (escapedAlpha) *escapedAlpha = alpha;
-            if (escapedRay)   *escapedRay = ray;
-            break;
-        }
-
-        // Record information for current path vertex
-        v.alpha = alpha;
-        BSDF *bsdf = v.isect.GetBSDF(ray, arena);
-        v.bsdf = bsdf;
-        v.wPrev = -ray.d;
-
-        // Sample direction for outgoing Metropolis path direction
-        float pdf;
-        BxDFType flags;
-        Spectrum f = bsdf->Sample_f(-ray.d, &v.wNext, samples[length].bsdfSample,
-                                    &pdf, BSDF_ALL, &flags);
-        v.specularBounce = (flags & BSDF_SPECULAR) != 0;
-        v.nSpecularComponents = bsdf->NumComponents(BxDFType(BSDF_SPECULAR |
-                                         BSDF_REFLECTION | BSDF_TRANSMISSION));
-        if (f.IsBlack() || pdf == 0.f)
-        {
-            PBRT_MLT_FINISHED_GENERATE_PATH();
-            return length+1;
-        }
-
-        // Terminate path with RR or prepare for finding next vertex
-        const Point &p = bsdf->dgShading.p;
-        const Normal &n = bsdf->dgShading.nn;
-        Spectrum pathScale = f * AbsDot(v.wNext, n) / pdf;
-        float rrSurviveProb = min(1.f, pathScale.y());
-        if (samples[length].rrSample > rrSurviveProb)
-        {
-            PBRT_MLT_FINISHED_GENERATE_PATH();
-            return length+1;
-        }
-        alpha *= pathScale / rrSurviveProb;
-        //alpha *= renderer->Transmittance(scene, ray, NULL, rng, arena);
-        ray = RayDifferential(p, v.wNext, ray, v.isect.rayEpsilon);
-    }
-    PBRT_MLT_FINISHED_GENERATE_PATH();
-    return length;
-}
-
-
 Spectrum MetropolisRenderer::PathL(const MLTSample &sample,
         const Scene *scene, MemoryArena &arena, const Camera *camera,
-        const Distribution1D *lightDistribution,
+        const AliasDistribution1D *lightDistribution,
         PathVertex *cameraPath, PathVertex *lightPath,
         RNG &rng) const {
     // Generate camera path from camera path samples
@@ -294,11 +296,13 @@ Spectrum MetropolisRenderer::PathL(const MLTSample &sample,
     float cameraWt = camera->GenerateRayDifferential(sample.cameraSample,
                                                      &cameraRay);
     cameraRay.ScaleDifferentials(1.f / sqrtf(nPixelSamples));
+    cameraRay.wavelength = Spectrum::SampleComponent(sample.wavelengthSample);
     PBRT_FINISHED_GENERATING_CAMERA_RAY((CameraSample *)(&sample.cameraSample), &cameraRay, cameraWt);
     RayDifferential escapedRay;
     Spectrum escapedAlpha;
     uint32_t cameraLength = GeneratePath(cameraRay, cameraWt, scene, arena,
-        sample.cameraPathSamples, cameraPath, &escapedRay, &escapedAlpha);
+        &sample.cameraPathSamples[0], sample.cameraPathSamples.size(),
+        cameraPath, &escapedRay, &escapedAlpha);
     if (!bidirectional) {
         // Compute radiance along path using path tracing
         return Lpath(scene, cameraPath, cameraLength, arena,
@@ -331,8 +335,10 @@ Spectrum MetropolisRenderer::PathL(const MLTSample &sample,
         else {
             // Compute radiance along paths using bidirectional path tracing
             lightWt *= AbsDot(Normalize(Nl), lightRay.d) / (lightPdf * lightRayPdf);
+            lightRay.wavelength = cameraRay.wavelength;
             uint32_t lightLength = GeneratePath(RayDifferential(lightRay), lightWt,
-                scene, arena, sample.lightPathSamples, lightPath, NULL, NULL);
+                scene, arena, &sample.lightPathSamples[0],
+                sample.lightPathSamples.size(), lightPath, NULL, NULL);
             
             return Lbidir(scene, cameraPath, cameraLength, lightPath, lightLength,
                 arena, sample.lightingSamples, rng, sample.cameraSample.time,
@@ -345,7 +351,7 @@ Spectrum MetropolisRenderer::PathL(const MLTSample &sample,
 Spectrum MetropolisRenderer::Lpath(const Scene *scene,
         const PathVertex *cameraPath, int cameraPathLength,
         MemoryArena &arena, const vector<LightingSample> &samples,
-        RNG &rng, float time, const Distribution1D *lightDistribution,
+        RNG &rng, float time, const AliasDistribution1D *lightDistribution,
         const RayDifferential &eRay, const Spectrum &eAlpha) const {
     PBRT_MLT_STARTED_LPATH();
     Spectrum L = 0.;
@@ -396,7 +402,7 @@ Spectrum MetropolisRenderer::Lbidir(const Scene *scene,
         const PathVertex *cameraPath, int cameraPathLength,
         const PathVertex *lightPath, int lightPathLength,
         MemoryArena &arena, const vector<LightingSample> &samples,
-        RNG &rng, float time, const Distribution1D *lightDistribution,
+        RNG &rng, float time, const AliasDistribution1D *lightDistribution,
         const RayDifferential &eRay, const Spectrum &eAlpha) const {
     PBRT_MLT_STARTED_LBIDIR();
     Spectrum L = 0.;
@@ -459,6 +465,8 @@ Spectrum MetropolisRenderer::Lbidir(const Scene *scene,
                         // Compute weight for bidirectional path, _pathWt_
                         float pathWt = 1.f / (i + j + 2 - nSpecularVertices[i+j+2]);
                         float G = AbsDot(nc, w) * AbsDot(nl, w) / DistanceSquared(pl, pc);
+                        if (vc.dispersed && vl.dispersed)
+                            pathWt /= Spectrum::nComponents;
                         L += (vc.alpha * fc * G * fl * vl.alpha) * pathWt;
                     }
                 }
@@ -477,7 +485,7 @@ Spectrum MetropolisRenderer::Lbidir(const Scene *scene,
 
 MetropolisRenderer::MetropolisRenderer(int perPixelSamples,
         int nboot, int dps, float lsp, bool dds, int mr, int md,
-        Camera *c, bool db) {
+        Camera *c, bool db, int nc) {
     camera = c;
 
     nPixelSamples = perPixelSamples;
@@ -492,12 +500,14 @@ MetropolisRenderer::MetropolisRenderer(int perPixelSamples,
                 nPixelSamples, origPixelSamples);
     }
 
-    nBootstrap = nboot;
+    nBootstrap = max(1, nboot);
+    nChains = max(0, nc);
     nDirectPixelSamples = dps;
 
     maxDepth = md;
     maxConsecutiveRejects = mr;
     nTasksFinished  = 0;
+    nTasksTotal = 0;
     directLighting = dds ? new DirectLightingIntegrator(SAMPLE_ALL_UNIFORM, maxDepth) : NULL;
     bidirectional = db;
 }
@@ -519,6 +529,7 @@ MetropolisRenderer *CreateMetropolisRenderer(const ParamSet &params,
     int mr = params.FindOneInt("maxconsecutiverejects", 512);
     int md = params.FindOneInt("maxdepth", 7);
     bool doBidirectional = params.FindOneBool("bidirectional", true);
+    int nChains = params.FindOneInt("chains", 0);
 
     if (PbrtOptions.quickRender) {
         perPixelSamples = max(1, perPixelSamples / 4);
@@ -528,7 +539,7 @@ MetropolisRenderer *CreateMetropolisRenderer(const ParamSet &params,
 
     return new MetropolisRenderer(perPixelSamples, nBootstrap,
         nDirectPixelSamples, largeStepProbability, doDirectSeparately,
-        mr, md, camera, doBidirectional);
+        mr, md, camera, doBidirectional, nChains);
 }
 
 
@@ -538,7 +549,7 @@ void MetropolisRenderer::Render(const Scene *scene) {
         int x0, x1, y0, y1;
         camera->film->GetPixelExtent(&x0, &x1, &y0, &y1);
         float t0 = camera->shutterOpen, t1 = camera->shutterClose;
-        Distribution1D *lightDistribution = ComputeLightSamplingCDF(scene);
+        AliasDistribution1D *lightDistribution = ComputeLightSamplingCDF(scene);
 
         if (directLighting != NULL) {
             PBRT_MLT_STARTED_DIRECTLIGHTING();
@@ -567,64 +578,74 @@ void MetropolisRenderer::Render(const Scene *scene) {
         }
         // Take initial set of samples to compute $b$
         PBRT_MLT_STARTED_BOOTSTRAPPING(nBootstrap);
-        RNG rng(0);
-        MemoryArena arena;
-        vector<float> bootstrapI;
-        vector<PathVertex> cameraPath(maxDepth, PathVertex());
-        vector<PathVertex> lightPath(maxDepth, PathVertex());
+        vector<float> bootstrapI(nBootstrap, 0.f);
+        vector<Task *> bootstrapTasks;
+        uint32_t nBootstrapTasks = min(nBootstrap,
+                                       uint32_t(32 * NumSystemCores()));
+        for (uint32_t i = 0; i < nBootstrapTasks; ++i) {
+            uint32_t start = uint64_t(i) * nBootstrap / nBootstrapTasks;
+            uint32_t end = uint64_t(i+1) * nBootstrap / nBootstrapTasks;
+            bootstrapTasks.push_back(new MLTBootstrapTask(start, end,
+                x0, x1, y0, y1, t0, t1, scene, camera, this,
+                lightDistribution, &bootstrapI[0]));
+        }
+        EnqueueTasks(bootstrapTasks);
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < bootstrapTasks.size(); ++i)
+            delete bootstrapTasks[i];
+
+        // Compute running sum of bootstrap contributions
+        vector<float> bootstrapCDF(nBootstrap);
         float sumI = 0.f;
-        bootstrapI.reserve(nBootstrap);
-        MLTSample sample(maxDepth);
         for (uint32_t i = 0; i < nBootstrap; ++i) {
-            // Generate random sample and path radiance for MLT bootstrapping
-            float x = Lerp(rng.RandomFloat(), x0, x1);
-            float y = Lerp(rng.RandomFloat(), y0, y1);
-            LargeStep(rng, &sample, maxDepth, x, y, t0, t1, bidirectional);
-            Spectrum L = PathL(sample, scene, arena, camera, lightDistribution,
-                               &cameraPath[0], &lightPath[0], rng);
-
-            // Compute contribution for random sample for MLT bootstrapping
-            float I = ::I(L);
-            sumI += I;
-            bootstrapI.push_back(I);
-            arena.FreeAll();
+            sumI += bootstrapI[i];
+            bootstrapCDF[i] = sumI;
         }
         float b = sumI / nBootstrap;
         PBRT_MLT_FINISHED_BOOTSTRAPPING(b);
         Info("MLT computed b = %f", b);
 
-        // Select initial sample from bootstrap samples
-        float contribOffset = rng.RandomFloat() * sumI;
-        rng.Seed(0);
-        sumI = 0.f;
-        MLTSample initialSample(maxDepth);
-        for (uint32_t i = 0; i < nBootstrap; ++i) {
-            float x = Lerp(rng.RandomFloat(), x0, x1);
-            float y = Lerp(rng.RandomFloat(), y0, y1);
-            LargeStep(rng, &initialSample, maxDepth, x, y, t0, t1,
-                      bidirectional);
-            sumI += bootstrapI[i];
-            if (sumI > contribOffset)
-                break;
+        // Determine number of Markov chains and of tasks to run them
+        uint32_t nPixels = (x1-x0) * (y1-y0);
+        uint32_t minChains = nChains > 0 ? nChains : 16 * NumSystemCores();
+        uint32_t chainsPerStratum = 1;
+        while (largeStepsPerPixel * chainsPerStratum < minChains &&
+               2 * chainsPerStratum <= nPixels)
+            chainsPerStratum *= 2;
+        uint32_t nTotalChains = largeStepsPerPixel * chainsPerStratum;
+        uint32_t nTasks = min(nTotalChains,
+                              RoundUpPow2(4 * NumSystemCores()));
+        Assert(IsPowerOf2(nTotalChains) && IsPowerOf2(nTasks));
+
+        // Select chain starting points by stratified resampling of bootstrap
+        RNG rng(0);
+        vector<uint32_t> chainStart(nTotalChains);
+        float u = rng.RandomFloat();
+        for (uint32_t i = 0; i < nTotalChains; ++i) {
+            float contribOffset = (i + u) / nTotalChains * sumI;
+            chainStart[i] = std::upper_bound(bootstrapCDF.begin(),
+                bootstrapCDF.end(), contribOffset) - bootstrapCDF.begin();
+            chainStart[i] = min(chainStart[i], nBootstrap - 1);
         }
 
         // Launch tasks to generate Metropolis samples
-        uint32_t nTasks = largeStepsPerPixel;
         uint32_t largeStepRate = nPixelSamples / largeStepsPerPixel;
-        Info("MLT running %d tasks, large step rate %d", nTasks, largeStepRate);
-        ProgressReporter progress(nTasks * largeStepRate, "Metropolis");
+        Info("MLT running %d chains in %d tasks, large step rate %d",
+             nTotalChains, nTasks, largeStepRate);
+        ProgressReporter progress(largeStepsPerPixel * largeStepRate,
+                                  "Metropolis");
         vector<Task *> tasks;
         Mutex *filmMutex = Mutex::Create();
-        Assert(IsPowerOf2(nTasks));
+        MLTSplatBuffers splatBuffers(nPixels);
         uint32_t scramble[2] = { rng.RandomUInt(), rng.RandomUInt() };
-        uint32_t pfreq = (x1-x0) * (y1-y0);
-        for (uint32_t i = 0; i < nTasks; ++i) {
-            float d[2];
-            Sample02(i, scramble, d);
-            tasks.push_back(new MLTTask(progress, pfreq, i,
-                d[0], d[1], x0, x1, y0, y1, t0, t1, b, initialSample,
-                scene, camera, this, filmMutex, lightDistribution));
-        }
+        uint32_t chainsPerTask = nTotalChains / nTasks;
+        for (uint32_t i = 0; i < nTasks; ++i)
+            tasks.push_back(new MLTTask(progress, nPixels, i,
+                i * chainsPerTask, chainsPerTask, chainsPerStratum, scramble,
+                x0, x1, y0, y1, t0, t1, b, chainStart, scene, camera, this,
+                filmMutex, &splatBuffers, lightDistribution));
+        nTasksFinished = 0;
+        nTasksTotal = nTasks;
         EnqueueTasks(tasks);
         WaitForAllTasks();
         for (uint32_t i = 0; i < tasks.size(); ++i)
@@ -643,27 +664,70 @@ inline float I(const Spectrum &L) {
 }
 
 
+MLTBootstrapTask::MLTBootstrapTask(uint32_t st, uint32_t en,
+        int xx0, int xx1, int yy0, int yy1, float tt0, float tt1,
+        const Scene *sc, const Camera *c, const MetropolisRenderer *ren,
+        const AliasDistribution1D *ld, float *bI) {
+    start = st;
+    end = en;
+    x0 = xx0;
+    x1 = xx1;
+    y0 = yy0;
+    y1 = yy1;
+    t0 = tt0;
+    t1 = tt1;
+    scene = sc;
+    camera = c;
+    renderer = ren;
+    lightDistribution = ld;
+    bootstrapI = bI;
+}
+
+
+void MLTBootstrapTask::Run() {
+    // Compute path contributions for this task's bootstrap samples
+    RNG rng, wavelengthRng;
+    MemoryArena arena;
+    vector<PathVertex> cameraPath(renderer->maxDepth, PathVertex());
+    vector<PathVertex> lightPath(renderer->maxDepth, PathVertex());
+    MLTSample sample(renderer->maxDepth);
+    for (uint32_t i = start; i < end; ++i) {
+        BootstrapSample(i, &sample, renderer->maxDepth, x0, x1, y0, y1,
+                        t0, t1, renderer->bidirectional, rng, wavelengthRng);
+        Spectrum L = renderer->PathL(sample, scene, arena, camera,
+            lightDistribution, &cameraPath[0], &lightPath[0], rng);
+        bootstrapI[i] = ::I(L);
+        arena.FreeAll();
+    }
+}
+
+
 MLTTask::MLTTask(ProgressReporter &prog, uint32_t pfreq, uint32_t tn,
-        float ddx, float ddy, int xx0, int xx1, int yy0, int yy1, float tt0, float tt1,
-        float bb, const MLTSample &is, const Scene *sc, const Camera *c,
-        MetropolisRenderer *ren, Mutex *fm, Distribution1D *ld)
-    : progress(prog), initialSample(is) {
+        uint32_t fc, uint32_t nc, uint32_t cps, const uint32_t scr[2],
+        int xx0, int xx1, int yy0, int yy1, float tt0, float tt1,
+        float bb, const vector<uint32_t> &cs, const Scene *sc,
+        const Camera *c, MetropolisRenderer *ren, Mutex *fm,
+        MLTSplatBuffers *sb, AliasDistribution1D *ld)
+    : progress(prog), chainStart(cs) {
     progressUpdateFrequency = pfreq;
     taskNum = tn;
-    dx = ddx;
-    dy = ddy;
+    firstChain = fc;
+    nChains = nc;
+    chainsPerStratum = cps;
+    scramble[0] = scr[0];
+    scramble[1] = scr[1];
     x0 = xx0;
     x1 = xx1;
     y0 = yy0;
     y1 = yy1;
     t0 = tt0;
     t1 = tt1;
-    currentPixelSample = 0;
     b = bb;
     scene = sc;
     camera = c;
     renderer = ren;
     filmMutex = fm;
+    splatBuffers = sb;
     lightDistribution = ld;
 }
 
@@ -676,102 +740,134 @@ void MLTTask::Run() {
     uint32_t nPixelSamples = renderer->nPixelSamples;
     uint32_t largeStepRate = nPixelSamples / renderer->largeStepsPerPixel;
     Assert(largeStepRate > 1);
-    uint64_t nTaskSamples = uint64_t(nPixels) * uint64_t(largeStepRate);
-    uint32_t consecutiveRejects = 0;
     uint32_t progressCounter = progressUpdateFrequency;
 
     // Declare variables for storing and computing MLT samples
     MemoryArena arena;
-    RNG rng(taskNum);
+    RNG rng, wavelengthRng;
     vector<PathVertex> cameraPath(renderer->maxDepth, PathVertex());
     vector<PathVertex> lightPath(renderer->maxDepth, PathVertex());
     vector<MLTSample> samples(2, MLTSample(renderer->maxDepth));
     Spectrum L[2];
     float I[2];
-    uint32_t current = 0, proposed = 1;
-
-    // Compute _L[current]_ for initial sample
-    samples[current] = initialSample;
-    L[current] = renderer->PathL(initialSample, scene, arena, camera,
-                     lightDistribution, &cameraPath[0], &lightPath[0], rng);
-    I[current] = ::I(L[current]);
-    arena.FreeAll();
-
-    // Compute randomly permuted table of pixel indices for large steps
-    uint32_t pixelNumOffset = 0;
-    vector<int> largeStepPixelNum;
-    largeStepPixelNum.reserve(nPixels);
-    for (uint32_t i = 0; i < nPixels; ++i) largeStepPixelNum.push_back(i);
-    Shuffle(&largeStepPixelNum[0], nPixels, 1, rng);
+
+    // Get private splat buffer for this task's chains
+    Spectrum *splats = splatBuffers->Acquire();
+    vector<int> largeStepPixelNum(nPixels);
+    uint32_t shuffledStratum = ~0u;
     PBRT_MLT_FINISHED_TASK_INIT();
-    for (uint64_t s = 0; s < nTaskSamples; ++s) {
-        // Compute proposed mutation to current sample
-        PBRT_MLT_STARTED_MUTATION();
-        samples[proposed] = samples[current];
-        bool largeStep = ((s % largeStepRate) == 0);
-        if (largeStep) {
-            int x = x0 + largeStepPixelNum[pixelNumOffset] % (x1 - x0);
-            int y = y0 + largeStepPixelNum[pixelNumOffset] / (x1 - x0);
-            LargeStep(rng, &samples[proposed], renderer->maxDepth,
-                      x + dx, y + dy, t0, t1, renderer->bidirectional);
-            ++pixelNumOffset;
+    for (uint32_t chain = firstChain; chain < firstChain + nChains; ++chain) {
+        // Find large step pixel range and offset for Markov chain
+        uint32_t stratum = chain / chainsPerStratum;
+        uint32_t slice = chain % chainsPerStratum;
+        if (stratum != shuffledStratum) {
+            // Compute randomly permuted table of pixel indices for large steps
+            RNG stratumRng(stratum);
+            for (uint32_t i = 0; i < nPixels; ++i) largeStepPixelNum[i] = i;
+            Shuffle(&largeStepPixelNum[0], nPixels, 1, stratumRng);
+            shuffledStratum = stratum;
         }
-        else
-            SmallStep(rng, &samples[proposed], renderer->maxDepth,
-                      x0, x1, y0, y1, t0, t1, renderer->bidirectional);
-        PBRT_MLT_FINISHED_MUTATION();
-
-        // Compute contribution of proposed sample
-        L[proposed] = renderer->PathL(samples[proposed], scene, arena, camera,
+        float d[2];
+        Sample02(stratum, scramble, d);
+        uint32_t pixelNumOffset = uint64_t(slice) * nPixels / chainsPerStratum;
+        uint32_t pixelNumEnd = uint64_t(slice+1) * nPixels / chainsPerStratum;
+        uint64_t nChainSamples = uint64_t(pixelNumEnd - pixelNumOffset) *
+                                 uint64_t(largeStepRate);
+        uint32_t consecutiveRejects = 0;
+        uint32_t current = 0, proposed = 1;
+
+        // Compute _L[current]_ for chain's initial sample
+        rng.Seed(chain);
+        BootstrapSample(chainStart[chain], &samples[current],
+                        renderer->maxDepth, x0, x1, y0, y1, t0, t1,
+                        renderer->bidirectional, rng, wavelengthRng);
+        rng.Seed(chain);
+        wavelengthRng.Seed(~chain);
+        L[current] = renderer->PathL(samples[current], scene, arena, camera,
                          lightDistribution, &cameraPath[0], &lightPath[0], rng);
-        I[proposed] = ::I(L[proposed]);
+        I[current] = ::I(L[current]);
         arena.FreeAll();
+        for (uint64_t s = 0; s < nChainSamples; ++s) {
+            // Compute proposed mutation to current sample
+            PBRT_MLT_STARTED_MUTATION();
+            samples[proposed] = samples[current];
+            bool largeStep = ((s % largeStepRate) == 0);
+            if (largeStep) {
+                int x = x0 + largeStepPixelNum[pixelNumOffset] % (x1 - x0);
+                int y = y0 + largeStepPixelNum[pixelNumOffset] / (x1 - x0);
+                LargeStep(rng, wavelengthRng, &samples[proposed],
+                          renderer->maxDepth, x + d[0], y + d[1], t0, t1,
+                          renderer->bidirectional);
+                ++pixelNumOffset;
+            }
+            else
+                SmallStep(rng, wavelengthRng, &samples[proposed],
+                          renderer->maxDepth, x0, x1, y0, y1, t0, t1,
+                          renderer->bidirectional);
+            PBRT_MLT_FINISHED_MUTATION();
+
+            // Compute contribution of proposed sample
+            L[proposed] = renderer->PathL(samples[proposed], scene, arena, camera,
+                             lightDistribution, &cameraPath[0], &lightPath[0], rng);
+            I[proposed] = ::I(L[proposed]);
+            arena.FreeAll();
 
-        // Compute acceptance probability for proposed sample
-        float a = min(1.f, I[proposed] / I[current]);
+            // Compute acceptance probability for proposed sample
+            float a = min(1.f, I[proposed] / I[current]);
 
-        // Splat current and proposed samples to _Film_
-        PBRT_MLT_STARTED_SAMPLE_SPLAT();
-        if (I[current] > 0.f) {
-            if (!isinf(1.f / I[current])) {
-            Spectrum contrib =  (b / nPixelSamples) * L[current] / I[current];
-            camera->film->Splat(samples[current].cameraSample,
-                                (1.f - a) * contrib);
-        }
-        }
-        if (I[proposed] > 0.f) {
-            if (!isinf(1.f / I[proposed])) {
-            Spectrum contrib =  (b / nPixelSamples) * L[proposed] / I[proposed];
-            camera->film->Splat(samples[proposed].cameraSample,
-                                a * contrib);
-        }
-        }
-        PBRT_MLT_FINISHED_SAMPLE_SPLAT();
-
-        // Randomly accept proposed path mutation (or not)
-        if (consecutiveRejects >= renderer->maxConsecutiveRejects ||
-            rng.RandomFloat() < a) {
-            PBRT_MLT_ACCEPTED_MUTATION(a, &samples[current], &samples[proposed]);
-            current ^= 1;
-            proposed ^= 1;
-            consecutiveRejects = 0;
-        }
-        else
-        {
-            PBRT_MLT_REJECTED_MUTATION(a, &samples[current], &samples[proposed]);
-            ++consecutiveRejects;
-        }
-        if (--progressCounter == 0) {
-            progress.Update();
-            progressCounter = progressUpdateFrequency;
+            // Splat current and proposed samples to private buffer
+            PBRT_MLT_STARTED_SAMPLE_SPLAT();
+            if (I[current] > 0.f && !isinf(1.f / I[current])) {
+                Spectrum contrib =  (b / nPixelSamples) * L[current] / I[current];
+                SplatToBuffer(splats, x0, x1, y0, y1,
+                              samples[current].cameraSample, (1.f - a) * contrib);
+            }
+            if (I[proposed] > 0.f && !isinf(1.f / I[proposed])) {
+                Spectrum contrib =  (b / nPixelSamples) * L[proposed] / I[proposed];
+                SplatToBuffer(splats, x0, x1, y0, y1,
+                              samples[proposed].cameraSample, a * contrib);
+            }
+            PBRT_MLT_FINISHED_SAMPLE_SPLAT();
+
+            // Randomly accept proposed path mutation (or not)
+            if (consecutiveRejects >= renderer->maxConsecutiveRejects ||
+                rng.RandomFloat() < a) {
+                PBRT_MLT_ACCEPTED_MUTATION(a, &samples[current], &samples[proposed]);
+                current ^= 1;
+                proposed ^= 1;
+                consecutiveRejects = 0;
+            }
+            else
+            {
+                PBRT_MLT_REJECTED_MUTATION(a, &samples[current], &samples[proposed]);
+                ++consecutiveRejects;
+            }
+            if (--progressCounter == 0) {
+                progress.Update();
+                progressCounter = progressUpdateFrequency;
+            }
         }
+        Assert(pixelNumOffset == pixelNumEnd);
     }
-    Assert(pixelNumOffset == nPixels);
-    // Update display for recently computed Metropolis samples
+
+    // Merge private splat buffer into the film, clearing it for reuse
     PBRT_MLT_STARTED_DISPLAY_UPDATE();
+    CameraSample pixelSample;
+    pixelSample.lensU = pixelSample.lensV = pixelSample.time = 0.f;
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x) {
+            Spectrum &s = splats[(y - y0) * (x1 - x0) + (x - x0)];
+            if (s.IsBlack()) continue;
+            pixelSample.imageX = x + 0.5f;
+            pixelSample.imageY = y + 0.5f;
+            camera->film->Splat(pixelSample, s);
+            s = Spectrum(0.f);
+        }
+    splatBuffers->Release(splats);
+
+    // Update display for recently computed Metropolis samples
     int ntf = AtomicAdd(&renderer->nTasksFinished, 1);
-    int64_t totalSamples = int64_t(nPixels) * int64_t(nPixelSamples);
-    float splatScale = float(double(totalSamples) / double(ntf * nTaskSamples));
+    float splatScale = float(renderer->nTasksTotal) / float(ntf);
     camera->film->UpdateDisplay(x0, y0, x1, y1, splatScale);
     if ((taskNum % 8) == 0) {
         MutexLock lock(*filmMutex);
@@ -53,7 +53,7 @@ public:
     MetropolisRenderer(int perPixelSamples, int nBootstrap,
         int directPixelSamples, float largeStepProbability,
         bool doDirectSeparately, int maxConsecutiveRejects, int maxDepth,
-        Camera *camera, bool doBidirectional);
+        Camera *camera, bool doBidirectional, int nChains);
     ~MetropolisRenderer();
     void Render(const Scene *scene);
     Spectrum Li(const Scene *scene, const RayDifferential &ray,
@@ -65,17 +65,17 @@ private:
     // MetropolisRenderer Private Methods
     Spectrum PathL(const MLTSample &sample, const Scene *scene,
         MemoryArena &arena, const Camera *camera,
-        const Distribution1D *lightDistribution, PathVertex *cameraPath,
+        const AliasDistribution1D *lightDistribution, PathVertex *cameraPath,
         PathVertex *lightPath, RNG &rng) const;
     Spectrum Lpath(const Scene *scene, const PathVertex *path, int pathLength,
         MemoryArena &arena, const vector<LightingSample> &samples,
-        RNG &rng, float time, const Distribution1D *lightDistribution,
+        RNG &rng, float time, const AliasDistribution1D *lightDistribution,
         const RayDifferential &escapedRay, const Spectrum &escapedAlpha) const;
     Spectrum Lbidir(const Scene *scene,
         const PathVertex *cameraPath, int cameraPathLength,
         const PathVertex *lightPath, int lightPathLength,
         MemoryArena &arena, const vector<LightingSample> &samples,
-        RNG &rng, float time, const Distribution1D *lightDistribution,
+        RNG &rng, float time, const AliasDistribution1D *lightDistribution,
         const RayDifferential &escapedRay, const Spectrum &escapedAlpha) const;
 
     // MetropolisRenderer Private Data
@@ -83,9 +83,12 @@ private:
     bool bidirectional;
     uint32_t nDirectPixelSamples, nPixelSamples, maxDepth;
     uint32_t largeStepsPerPixel, nBootstrap, maxConsecutiveRejects;
+    uint32_t nChains;
     DirectLightingIntegrator *directLighting;
     AtomicInt32 nTasksFinished;
+    uint32_t nTasksTotal;
     friend class MLTTask;
+    friend class MLTBootstrapTask;
 };
 
 
@@ -84,6 +84,10 @@ void SamplerRendererTask::Run() {
 	// Monte Carlo Sampling
     RNG rng(taskNum);
 
+    // Wavelengths for dispersion come from their own stream, leaving _rng_'s
+    // sequence unchanged for scenes without dispersive materials
+    RNG wavelengthRng(taskCount + taskNum);
+
     // Allocate space for samples and intersections
 
 	// MaximumSampleCount  method returns an upper bound on the number of samples it will
@@ -114,6 +118,7 @@ void SamplerRendererTask::Run() {
 			// method scales the differential ray to account for the actual spacing between 
 			// samples on the film plane
             rays[i].ScaleDifferentials(1.f / sqrtf(sampler->samplesPerPixel));
+            rays[i].wavelength = Spectrum::SampleComponent(wavelengthRng.RandomFloat());
             PBRT_FINISHED_GENERATING_CAMERA_RAY(&samples[i], &rays[i], rayWeight);
 
 
@@ -0,0 +1,495 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+
+// renderers/sppm.cpp*
+#include "stdafx.h"
+#include "renderers/sppm.h"
+#include "scene.h"
+#include "camera.h"
+#include "film.h"
+#include "sampler.h"
+#include "integrator.h"
+#include "intersection.h"
+#include "montecarlo.h"
+#include "progressreporter.h"
+#include "paramset.h"
+#include "parallel.h"
+#include "rng.h"
+
+// SPPM Local Declarations
+struct SPPMPixel {
+    SPPMPixel() {
+        bsdf = NULL;
+        depth = 0;
+        dispersed = false;
+        radius = N = 0.f;
+        Phi[0] = Phi[1] = Phi[2] = 0.f;
+        M = 0;
+    }
+    // Visible point found by the current iteration's camera path
+    Point p;
+    Vector wo;
+    const BSDF *bsdf;
+    Spectrum beta;
+    int depth;
+    // Set if _beta_ or _bsdf_ include the iteration's wavelength probability
+    bool dispersed;
+
+    // Statistics accumulated over all iterations
+    float radius, N;
+    Spectrum Ld, tau, splatted;
+    volatile float Phi[3];
+    AtomicInt32 M;
+};
+
+
+struct SPPMGrid {
+    // SPPMGrid Public Methods
+    bool Cell(const Point &p, int c[3]) const {
+        if (!bounds.Inside(p)) return false;
+        for (int i = 0; i < 3; ++i)
+            c[i] = Clamp(Float2Int(res[i] * (p[i] - bounds.pMin[i]) /
+                         (bounds.pMax[i] - bounds.pMin[i])), 0, res[i] - 1);
+        return true;
+    }
+    uint32_t Hash(const int c[3]) const {
+        return (uint32_t(c[0]) * 73856093u ^ uint32_t(c[1]) * 19349663u ^
+                uint32_t(c[2]) * 83492791u) % nSlots;
+    }
+
+    // SPPMGrid Public Data
+    BBox bounds;
+    int res[3];
+    uint32_t nSlots;
+    // Visible point pixel indices of each hash slot, stored contiguously
+    vector<uint32_t> slotStart, pixelIndex;
+};
+
+
+static void BuildGrid(const SPPMPixel *pixels, uint32_t nPixels,
+                      SPPMGrid *grid) {
+    // Compute bounds of visible points and their search radii
+    BBox bounds;
+    float maxRadius = 0.f;
+    for (uint32_t i = 0; i < nPixels; ++i) {
+        const SPPMPixel &pixel = pixels[i];
+        if (!pixel.bsdf) continue;
+        Vector r(pixel.radius, pixel.radius, pixel.radius);
+        bounds = Union(bounds, BBox(pixel.p - r, pixel.p + r));
+        maxRadius = max(maxRadius, pixel.radius);
+    }
+    grid->bounds = bounds;
+    grid->nSlots = nPixels;
+    grid->slotStart.assign(nPixels + 1, 0);
+    grid->pixelIndex.clear();
+    if (maxRadius == 0.f) {
+        grid->res[0] = grid->res[1] = grid->res[2] = 0;
+        return;
+    }
+
+    // Choose grid resolution so that each search sphere overlaps at most
+    // two cells along each axis
+    Vector diag = bounds.pMax - bounds.pMin;
+    float maxDiag = max(diag.x, max(diag.y, diag.z));
+    int baseRes = max(1, Floor2Int(maxDiag / (2.f * maxRadius)));
+    for (int i = 0; i < 3; ++i)
+        grid->res[i] = max(1, Floor2Int(baseRes * diag[i] / maxDiag));
+
+    // Count, then store, visible points overlapping each hash slot
+    for (int pass = 0; pass < 2; ++pass) {
+        vector<uint32_t> next;
+        if (pass == 1) {
+            for (uint32_t i = 0; i < nPixels; ++i)
+                grid->slotStart[i+1] += grid->slotStart[i];
+            grid->pixelIndex.resize(grid->slotStart[nPixels]);
+            next.assign(grid->slotStart.begin(), grid->slotStart.end() - 1);
+        }
+        for (uint32_t i = 0; i < nPixels; ++i) {
+            const SPPMPixel &pixel = pixels[i];
+            if (!pixel.bsdf) continue;
+            Vector r(pixel.radius, pixel.radius, pixel.radius);
+            int cMin[3], cMax[3];
+            grid->Cell(pixel.p - r, cMin);
+            grid->Cell(pixel.p + r, cMax);
+            // Record each slot once, even if several cells hash to it
+            uint32_t slots[8];
+            int nSlotsUsed = 0;
+            int c[3];
+            for (c[2] = cMin[2]; c[2] <= cMax[2]; ++c[2])
+                for (c[1] = cMin[1]; c[1] <= cMax[1]; ++c[1])
+                    for (c[0] = cMin[0]; c[0] <= cMax[0]; ++c[0]) {
+                        uint32_t h = grid->Hash(c);
+                        if (std::find(slots, slots + nSlotsUsed, h) !=
+                            slots + nSlotsUsed) continue;
+                        Assert(nSlotsUsed < 8);
+                        slots[nSlotsUsed++] = h;
+                        if (pass == 0) ++grid->slotStart[h+1];
+                        else grid->pixelIndex[next[h]++] = i;
+                    }
+        }
+    }
+}
+
+
+class SPPMCameraTask : public Task {
+public:
+    SPPMCameraTask(const Scene *sc, const SPPMRenderer *ren, SPPMPixel *px,
+        int xx0, int xx1, int yy0, uint32_t st, uint32_t en, uint32_t sd,
+        int wl)
+        : scene(sc), renderer(ren), pixels(px), x0(xx0), x1(xx1), y0(yy0),
+          start(st), end(en), seed(sd), wavelength(wl) { }
+    void Run();
+
+    // Holds visible point BSDFs until the iteration's photons are traced
+    MemoryArena arena;
+private:
+    const Scene *scene;
+    const SPPMRenderer *renderer;
+    SPPMPixel *pixels;
+    int x0, x1, y0;
+    uint32_t start, end, seed;
+    int wavelength;
+};
+
+
+class SPPMPhotonTask : public Task {
+public:
+    SPPMPhotonTask(const Scene *sc, const SPPMRenderer *ren, SPPMPixel *px,
+        const SPPMGrid &g, const AliasDistribution1D *ld, uint32_t st,
+        uint32_t en, uint32_t sd, int wl)
+        : scene(sc), renderer(ren), pixels(px), grid(g),
+          lightDistribution(ld), start(st), end(en), seed(sd),
+          wavelength(wl) { }
+    void Run();
+private:
+    const Scene *scene;
+    const SPPMRenderer *renderer;
+    SPPMPixel *pixels;
+    const SPPMGrid &grid;
+    const AliasDistribution1D *lightDistribution;
+    uint32_t start, end, seed;
+    int wavelength;
+};
+
+
+
+// SPPMRenderer Method Definitions
+SPPMRenderer::SPPMRenderer(Camera *c, int ni, int pp, float r, int md,
+                           int wf)
+    : camera(c), nIterations(ni), photonsPerIteration(pp), maxDepth(md),
+      writeFrequency(wf), initialRadius(r) {
+}
+
+
+void SPPMCameraTask::Run() {
+    RNG rng(seed);
+    const Camera *camera = renderer->camera;
+    int maxDepth = renderer->maxDepth;
+    for (uint32_t i = start; i < end; ++i) {
+        // Generate camera ray for pixel _i_
+        SPPMPixel &pixel = pixels[i];
+        CameraSample cs;
+        cs.imageX = x0 + int(i % (x1 - x0)) + rng.RandomFloat();
+        cs.imageY = y0 + int(i / (x1 - x0)) + rng.RandomFloat();
+        cs.lensU = rng.RandomFloat();
+        cs.lensV = rng.RandomFloat();
+        cs.time = Lerp(rng.RandomFloat(), camera->shutterOpen,
+                       camera->shutterClose);
+        RayDifferential ray;
+        Spectrum beta = camera->GenerateRayDifferential(cs, &ray);
+        ray.wavelength = wavelength;
+
+        // Follow camera path to the first diffuse surface it hits
+        bool specularBounce = false;
+        for (int depth = 0; depth <= maxDepth && !beta.IsBlack(); ++depth) {
+            Intersection isect;
+            if (!scene->Intersect(ray, &isect)) {
+                if (depth == 0 || specularBounce)
+                    for (uint32_t j = 0; j < scene->lights.size(); ++j)
+                        pixel.Ld += beta * scene->lights[j]->Le(ray);
+                break;
+            }
+            if (depth == 0 || specularBounce)
+                pixel.Ld += beta * isect.Le(-ray.d);
+            BSDF *bsdf = isect.GetBSDF(ray, arena);
+            const Point &p = bsdf->dgShading.p;
+            const Normal &n = bsdf->dgShading.nn;
+            Vector wo = -ray.d;
+            pixel.Ld += beta * UniformSampleOneLight(scene, renderer, arena,
+                p, n, wo, isect.rayEpsilon, ray.time, bsdf, NULL, rng);
+
+            // Record visible point at diffuse, or final glossy, surface
+            bool isDiffuse = bsdf->NumComponents(BxDFType(BSDF_DIFFUSE |
+                BSDF_REFLECTION | BSDF_TRANSMISSION)) > 0;
+            bool isGlossy = bsdf->NumComponents(BxDFType(BSDF_GLOSSY |
+                BSDF_REFLECTION | BSDF_TRANSMISSION)) > 0;
+            if (isDiffuse || (isGlossy && depth == maxDepth)) {
+                pixel.p = p;
+                pixel.wo = wo;
+                pixel.bsdf = bsdf;
+                pixel.beta = beta;
+                pixel.depth = depth;
+                pixel.dispersed = ray.dispersed;
+                break;
+            }
+
+            // Sample BSDF to continue camera path
+            Vector wi;
+            float pdf;
+            BxDFType flags;
+            Spectrum f = bsdf->Sample_f(wo, &wi, BSDFSample(rng), &pdf,
+                                        BSDF_ALL, &flags);
+            if (f.IsBlack() || pdf == 0.f) break;
+            specularBounce = (flags & BSDF_SPECULAR) != 0;
+            beta *= f * AbsDot(wi, n) / pdf;
+            if (beta.y() < .25f) {
+                float continueProbability = min(1.f, beta.y());
+                if (rng.RandomFloat() > continueProbability) break;
+                beta /= continueProbability;
+            }
+            ray = RayDifferential(p, wi, ray, isect.rayEpsilon);
+        }
+    }
+}
+
+
+void SPPMPhotonTask::Run() {
+    RNG rng(seed);
+    MemoryArena arena;
+    const Camera *camera = renderer->camera;
+    int maxDepth = renderer->maxDepth;
+    for (uint32_t i = start; i < end; ++i) {
+        // Choose light and sample photon ray leaving it
+        float lightPdf;
+        int lightNum = lightDistribution->SampleDiscrete(rng.RandomFloat(),
+                                                         &lightPdf);
+        const Light *light = scene->lights[lightNum];
+        float time = Lerp(rng.RandomFloat(), camera->shutterOpen,
+                          camera->shutterClose);
+        RayDifferential photonRay;
+        Normal Nl;
+        float pdf;
+        LightSample ls(rng);
+        Spectrum Le = light->Sample_L(scene, ls, rng.RandomFloat(),
+            rng.RandomFloat(), time, &photonRay, &Nl, &pdf);
+        if (pdf == 0.f || Le.IsBlack()) continue;
+        Spectrum beta = (AbsDot(Nl, photonRay.d) * Le) / (pdf * lightPdf);
+        photonRay.wavelength = wavelength;
+
+        // Follow photon path, depositing flux at visible points
+        for (int depth = 0; depth <= maxDepth && !beta.IsBlack(); ++depth) {
+            Intersection isect;
+            if (!scene->Intersect(photonRay, &isect)) break;
+            int c[3];
+            if (depth > 0 && grid.Cell(isect.dg.p, c)) {
+                // Add photon contribution to visible points near it
+                uint32_t h = grid.Hash(c);
+                Vector wi = -photonRay.d;
+                for (uint32_t j = grid.slotStart[h]; j < grid.slotStart[h+1]; ++j) {
+                    SPPMPixel &pixel = pixels[grid.pixelIndex[j]];
+                    if (pixel.depth + depth > maxDepth ||
+                        DistanceSquared(pixel.p, isect.dg.p) >
+                        pixel.radius * pixel.radius)
+                        continue;
+                    Spectrum Phi = pixel.beta * beta * pixel.bsdf->f(pixel.wo, wi);
+                    // Divide out the wavelength probability counted by both
+                    // the camera path and the photon path
+                    if (pixel.dispersed && photonRay.dispersed)
+                        Phi /= Spectrum::nComponents;
+                    float rgb[3];
+                    Phi.ToRGB(rgb);
+                    for (int k = 0; k < 3; ++k)
+                        AtomicAdd(&pixel.Phi[k], rgb[k]);
+                    AtomicAdd(&pixel.M, 1);
+                }
+            }
+
+            // Sample new photon direction, terminating with RR
+            BSDF *bsdf = isect.GetBSDF(photonRay, arena);
+            Vector wi;
+            float fpdf;
+            BxDFType flags;
+            Spectrum fr = bsdf->Sample_f(-photonRay.d, &wi, BSDFSample(rng),
+                                         &fpdf, BSDF_ALL, &flags);
+            if (fr.IsBlack() || fpdf == 0.f) break;
+            Spectrum bnew = beta * fr * AbsDot(wi, bsdf->dgShading.nn) / fpdf;
+            float q = beta.y() > 0.f ? max(0.f, 1.f - bnew.y() / beta.y()) : 0.f;
+            if (rng.RandomFloat() < q) break;
+            beta = bnew / (1.f - q);
+            photonRay = RayDifferential(isect.dg.p, wi, photonRay,
+                                        isect.rayEpsilon);
+        }
+        arena.FreeAll();
+    }
+}
+
+
+void SPPMRenderer::Render(const Scene *scene) {
+    int x0, x1, y0, y1;
+    camera->film->GetPixelExtent(&x0, &x1, &y0, &y1);
+    uint32_t nPixels = (x1 - x0) * (y1 - y0);
+    if (scene->lights.size() == 0 || nPixels == 0) {
+        camera->film->WriteImage();
+        return;
+    }
+
+    // Initialize per-pixel statistics and photon pass parameters
+    float radius = initialRadius;
+    if (radius <= 0.f) {
+        Point center;
+        scene->WorldBound().BoundingSphere(&center, &radius);
+        radius *= .01f;
+    }
+    SPPMPixel *pixels = new SPPMPixel[nPixels];
+    for (uint32_t i = 0; i < nPixels; ++i)
+        pixels[i].radius = radius;
+    uint32_t nPhotons = photonsPerIteration > 0 ? photonsPerIteration : nPixels;
+    AliasDistribution1D *lightDistribution = ComputeLightSamplingCDF(scene);
+    uint32_t nCameraTasks = min(uint32_t(32 * NumSystemCores()), nPixels);
+    uint32_t nPhotonTasks = min(uint32_t(32 * NumSystemCores()), nPhotons);
+
+    ProgressReporter progress(nIterations, "SPPM");
+    RNG wavelengthRng;
+    for (int iter = 0; iter < nIterations; ++iter) {
+        // Trace camera paths and photons of this iteration at one wavelength,
+        // used only by dispersive materials
+        int wavelength = Spectrum::SampleComponent(wavelengthRng.RandomFloat());
+
+        // Trace camera paths to find each pixel's visible point
+        vector<Task *> cameraTasks;
+        for (uint32_t i = 0; i < nCameraTasks; ++i)
+            cameraTasks.push_back(new SPPMCameraTask(scene, this, pixels,
+                x0, x1, y0, uint64_t(i) * nPixels / nCameraTasks,
+                uint64_t(i+1) * nPixels / nCameraTasks,
+                2 * (iter * nCameraTasks + i), wavelength));
+        EnqueueTasks(cameraTasks);
+        WaitForAllTasks();
+
+        // Trace a batch of photons against the visible point grid
+        SPPMGrid grid;
+        BuildGrid(pixels, nPixels, &grid);
+        vector<Task *> photonTasks;
+        for (uint32_t i = 0; i < nPhotonTasks; ++i)
+            photonTasks.push_back(new SPPMPhotonTask(scene, this, pixels,
+                grid, lightDistribution,
+                uint64_t(i) * nPhotons / nPhotonTasks,
+                uint64_t(i+1) * nPhotons / nPhotonTasks,
+                2 * (iter * nPhotonTasks + i) + 1, wavelength));
+        EnqueueTasks(photonTasks);
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < photonTasks.size(); ++i)
+            delete photonTasks[i];
+
+        // Update radius and flux of pixels that received photons
+        for (uint32_t i = 0; i < nPixels; ++i) {
+            SPPMPixel &pixel = pixels[i];
+            if (pixel.M > 0) {
+                const float gamma = 2.f / 3.f;
+                float Nnew = pixel.N + gamma * pixel.M;
+                float Rnew = pixel.radius * sqrtf(Nnew / (pixel.N + pixel.M));
+                float rgb[3] = { pixel.Phi[0], pixel.Phi[1], pixel.Phi[2] };
+                pixel.tau = (pixel.tau + Spectrum::FromRGB(rgb, SPECTRUM_ILLUMINANT)) *
+                    (Rnew * Rnew) / (pixel.radius * pixel.radius);
+                pixel.N = Nnew;
+                pixel.radius = Rnew;
+                pixel.M = 0;
+                pixel.Phi[0] = pixel.Phi[1] = pixel.Phi[2] = 0.f;
+            }
+            pixel.bsdf = NULL;
+        }
+
+        // Release visible point storage and optionally write current image
+        for (uint32_t i = 0; i < cameraTasks.size(); ++i)
+            delete cameraTasks[i];
+        if (writeFrequency > 0 && (iter + 1) % writeFrequency == 0 &&
+            iter + 1 < nIterations) {
+            SplatImage(pixels, iter + 1, nPhotons);
+            camera->film->WriteImage();
+        }
+        progress.Update();
+    }
+    progress.Done();
+    SplatImage(pixels, nIterations, nPhotons);
+    camera->film->WriteImage();
+    delete[] pixels;
+    delete lightDistribution;
+}
+
+
+void SPPMRenderer::SplatImage(SPPMPixel *pixels, int iterations,
+                              uint32_t nPhotons) const {
+    // Splat the change of each pixel's estimate since it was last written
+    int x0, x1, y0, y1;
+    camera->film->GetPixelExtent(&x0, &x1, &y0, &y1);
+    double Np = double(iterations) * double(nPhotons);
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x) {
+            SPPMPixel &pixel = pixels[(y - y0) * (x1 - x0) + (x - x0)];
+            Spectrum L = pixel.Ld / float(iterations) + pixel.tau /
+                float(Np * M_PI * pixel.radius * pixel.radius);
+            CameraSample cs;
+            cs.imageX = x + .5f;
+            cs.imageY = y + .5f;
+            camera->film->Splat(cs, L - pixel.splatted);
+            pixel.splatted = L;
+        }
+}
+
+
+Spectrum SPPMRenderer::Li(const Scene *scene, const RayDifferential &ray,
+        const Sample *sample, RNG &rng, MemoryArena &arena,
+        Intersection *isect, Spectrum *T) const {
+    return 0.f;
+}
+
+
+Spectrum SPPMRenderer::Transmittance(const Scene *scene,
+        const RayDifferential &ray, const Sample *sample, RNG &rng,
+        MemoryArena &arena) const {
+    return 1.f;
+}
+
+
+SPPMRenderer *CreateSPPMRenderer(const ParamSet &params, Camera *camera) {
+    int nIterations = params.FindOneInt("iterations", 64);
+    int photonsPerIteration = params.FindOneInt("photonsperiteration", -1);
+    float radius = params.FindOneFloat("radius", 0.f);
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int writeFrequency = params.FindOneInt("imagewritefrequency", 0);
+    if (PbrtOptions.quickRender)
+        nIterations = max(1, nIterations / 4);
+    return new SPPMRenderer(camera, nIterations, photonsPerIteration,
+                            radius, maxDepth, writeFrequency);
+}
+
+
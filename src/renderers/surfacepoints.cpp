@@ -34,7 +34,6 @@
 #include "stdafx.h"
 #include "renderers/surfacepoints.h"
 #include "paramset.h"
-#include "octree.h"
 #include "camera.h"
 #include "probes.h"
 #include "parallel.h"
@@ -53,15 +52,11 @@
 class SurfacePointTask : public Task {
 public:
     SurfacePointTask(const Scene *sc, const Point &org, float ti, int tn,
-        float msd, int mf, RWMutex &m, int &rf, int &mrf,
-        int &tpt, int &trt, int &npa, GeometricPrimitive &sph,
-        Octree<SurfacePoint> &oct, vector<SurfacePoint> &sps,
-        ProgressReporter &pr)
+        float msd, int np, GeometricPrimitive &sph,
+        vector<SurfacePoint> &cands, int &nrays)
         : taskNum(tn), scene(sc), origin(org), time(ti),
-          minSampleDist(msd), maxFails(mf), mutex(m),
-          repeatedFails(rf), maxRepeatedFails(mrf), totalPathsTraced(tpt),
-          totalRaysTraced(trt), numPointsAdded(npa), sphere(sph),
-          octree(oct), surfacePoints(sps), prog(pr) { }
+          minSampleDist(msd), nPaths(np), sphere(sph),
+          candidates(cands), raysTraced(nrays) { }
     void Run();
 
     int taskNum;
@@ -69,34 +64,207 @@ public:
     Point origin;
     float time;
     float minSampleDist;
-    int maxFails;
-
-    RWMutex &mutex;
-    int &repeatedFails, &maxRepeatedFails;
-    int &totalPathsTraced, &totalRaysTraced, &numPointsAdded;
+    int nPaths;
     GeometricPrimitive &sphere;
-    Octree<SurfacePoint> &octree;
-    vector<SurfacePoint> &surfacePoints;
-    ProgressReporter &prog;
+    vector<SurfacePoint> &candidates;
+    int &raysTraced;
 };
 
 
-struct PoissonCheck {
-    PoissonCheck(float md, const Point &pt)
-        { maxDist2 = md * md; failed = false; p = pt; }
-    float maxDist2;
-    bool failed;
-    Point p;
-    bool operator()(const SurfacePoint &sp) {
-        if (DistanceSquared(sp.p, p) < maxDist2) {
-            failed = true; return false;
-        }
-        return true;
+// PoissonGrid stores accepted points in a sparse grid of cells whose
+// width is the minimum point spacing, so that a candidate only needs to
+// be checked against the points in its own cell and its 26 neighbors.
+// Cells with the same coordinate parities are never neighbors; each of
+// the eight parity classes is filled in parallel with no locking.
+class PoissonGrid {
+public:
+    // PoissonGrid Public Methods
+    PoissonGrid(const BBox &b, float md);
+    void AddCandidates(const vector<SurfacePoint> &candidates,
+                       vector<uint8_t> *accepted);
+    void GetPoints(vector<SurfacePoint> *points) const;
+    bool Check(const Point &p) const;
+    void AddToCell(uint32_t cell, const vector<SurfacePoint> &candidates,
+                   vector<uint8_t> &accepted);
+private:
+    // PoissonGrid Private Methods
+    void CellCoords(const Point &p, int c[3]) const {
+        for (int axis = 0; axis < 3; ++axis)
+            c[axis] = Floor2Int((p[axis] - bounds.pMin[axis]) * invCellWidth);
+    }
+    static uint32_t Hash(int ix, int iy, int iz) {
+        return (uint32_t(ix) * 73856093u) ^ (uint32_t(iy) * 19349663u) ^
+               (uint32_t(iz) * 83492791u);
+    }
+    int Find(const int c[3]) const;
+    uint32_t Insert(const int c[3]);
+
+    // PoissonGrid Private Data
+    struct HashEntry {
+        int c[3];
+        int cell;
+    };
+    BBox bounds;
+    float minDist, invCellWidth;
+    vector<HashEntry> table;
+    vector<vector<SurfacePoint> > cellPoints;
+    vector<vector<uint32_t> > cellCandidates;
+};
+
+
+class PoissonCellTask : public Task {
+public:
+    PoissonCellTask(PoissonGrid &g, const vector<uint32_t> &cl,
+        uint32_t s, uint32_t e, const vector<SurfacePoint> &cands,
+        vector<uint8_t> &acc)
+        : grid(g), cells(cl), start(s), end(e), candidates(cands),
+          accepted(acc) { }
+    void Run() {
+        for (uint32_t i = start; i < end; ++i)
+            grid.AddToCell(cells[i], candidates, accepted);
     }
+private:
+    PoissonGrid &grid;
+    const vector<uint32_t> &cells;
+    uint32_t start, end;
+    const vector<SurfacePoint> &candidates;
+    vector<uint8_t> &accepted;
 };
 
 
 
+// PoissonGrid Method Definitions
+PoissonGrid::PoissonGrid(const BBox &b, float md)
+    : bounds(b), minDist(md) {
+    invCellWidth = 1.f / minDist;
+    table.resize(1024);
+    for (uint32_t i = 0; i < table.size(); ++i)
+        table[i].cell = -1;
+}
+
+
+int PoissonGrid::Find(const int c[3]) const {
+    uint32_t mask = table.size() - 1;
+    for (uint32_t h = Hash(c[0], c[1], c[2]) & mask; ; h = (h + 1) & mask) {
+        const HashEntry &e = table[h];
+        if (e.cell == -1) return -1;
+        if (e.c[0] == c[0] && e.c[1] == c[1] && e.c[2] == c[2])
+            return e.cell;
+    }
+}
+
+
+uint32_t PoissonGrid::Insert(const int c[3]) {
+    int cell = Find(c);
+    if (cell != -1) return cell;
+    // Grow hash table if it is more than half full
+    if (2 * (cellPoints.size() + 1) > table.size()) {
+        vector<HashEntry> oldTable(2 * table.size());
+        for (uint32_t i = 0; i < oldTable.size(); ++i)
+            oldTable[i].cell = -1;
+        oldTable.swap(table);
+        uint32_t mask = table.size() - 1;
+        for (uint32_t i = 0; i < oldTable.size(); ++i) {
+            if (oldTable[i].cell == -1) continue;
+            const int *oc = oldTable[i].c;
+            uint32_t h = Hash(oc[0], oc[1], oc[2]) & mask;
+            while (table[h].cell != -1)
+                h = (h + 1) & mask;
+            table[h] = oldTable[i];
+        }
+    }
+
+    // Add new cell to hash table
+    uint32_t mask = table.size() - 1;
+    uint32_t h = Hash(c[0], c[1], c[2]) & mask;
+    while (table[h].cell != -1)
+        h = (h + 1) & mask;
+    for (int axis = 0; axis < 3; ++axis)
+        table[h].c[axis] = c[axis];
+    table[h].cell = cellPoints.size();
+    cellPoints.push_back(vector<SurfacePoint>());
+    cellCandidates.push_back(vector<uint32_t>());
+    return table[h].cell;
+}
+
+
+bool PoissonGrid::Check(const Point &p) const {
+    int c[3];
+    CellCoords(p, c);
+    float minDist2 = minDist * minDist;
+    int nc[3];
+    for (nc[2] = c[2]-1; nc[2] <= c[2]+1; ++nc[2])
+        for (nc[1] = c[1]-1; nc[1] <= c[1]+1; ++nc[1])
+            for (nc[0] = c[0]-1; nc[0] <= c[0]+1; ++nc[0]) {
+                int cell = Find(nc);
+                if (cell == -1) continue;
+                const vector<SurfacePoint> &pts = cellPoints[cell];
+                for (uint32_t i = 0; i < pts.size(); ++i)
+                    if (DistanceSquared(pts[i].p, p) < minDist2)
+                        return false;
+            }
+    return true;
+}
+
+
+void PoissonGrid::AddToCell(uint32_t cell, const vector<SurfacePoint> &candidates,
+                            vector<uint8_t> &accepted) {
+    // Accept candidates in _cell_ in order if they pass the Poisson check
+    const vector<uint32_t> &cands = cellCandidates[cell];
+    for (uint32_t i = 0; i < cands.size(); ++i) {
+        const SurfacePoint &sp = candidates[cands[i]];
+        if (Check(sp.p)) {
+            cellPoints[cell].push_back(sp);
+            accepted[cands[i]] = 1;
+            PBRT_SUBSURFACE_ADDED_POINT_TO_OCTREE(const_cast<SurfacePoint *>(&sp),
+                                                  minDist);
+        }
+    }
+}
+
+
+void PoissonGrid::AddCandidates(const vector<SurfacePoint> &candidates,
+                                vector<uint8_t> *accepted) {
+    accepted->assign(candidates.size(), 0);
+    // Bucket candidates by cell and cells by coordinate parity
+    vector<uint32_t> parityCells[8];
+    for (uint32_t i = 0; i < candidates.size(); ++i) {
+        int c[3];
+        CellCoords(candidates[i].p, c);
+        uint32_t cell = Insert(c);
+        if (cellCandidates[cell].size() == 0)
+            parityCells[(c[0] & 1) + 2 * (c[1] & 1) + 4 * (c[2] & 1)].push_back(cell);
+        cellCandidates[cell].push_back(i);
+    }
+
+    // Accept candidates one parity class at a time
+    int nTasks = 4 * NumSystemCores();
+    for (int parity = 0; parity < 8; ++parity) {
+        const vector<uint32_t> &cells = parityCells[parity];
+        if (cells.size() == 0) continue;
+        vector<Task *> tasks;
+        uint32_t nCellTasks = min(uint32_t(nTasks), uint32_t(cells.size()));
+        for (uint32_t i = 0; i < nCellTasks; ++i)
+            tasks.push_back(new PoissonCellTask(*this, cells,
+                i * cells.size() / nCellTasks, (i+1) * cells.size() / nCellTasks,
+                candidates, *accepted));
+        EnqueueTasks(tasks);
+        WaitForAllTasks();
+        for (uint32_t i = 0; i < tasks.size(); ++i)
+            delete tasks[i];
+        for (uint32_t i = 0; i < cells.size(); ++i)
+            cellCandidates[cells[i]].clear();
+    }
+}
+
+
+void PoissonGrid::GetPoints(vector<SurfacePoint> *points) const {
+    for (uint32_t i = 0; i < cellPoints.size(); ++i)
+        points->insert(points->end(), cellPoints[i].begin(), cellPoints[i].end());
+}
+
+
+
 // SurfacePointsRenderer Method Definitions
 Spectrum SurfacePointsRenderer::Li(const Scene *scene,
     const RayDifferential &ray, const Sample *sample, RNG &rng, MemoryArena &arena,
@@ -113,9 +281,9 @@ Spectrum SurfacePointsRenderer::Transmittance(const Scene *scene, const RayDiffe
 
 void SurfacePointsRenderer::Render(const Scene *scene) {
     // Declare shared variables for Poisson point generation
-    BBox octBounds = scene->WorldBound();
-    octBounds.Expand(.001f * powf(octBounds.Volume(), 1.f/3.f));
-    Octree<SurfacePoint> pointOctree(octBounds);
+    BBox gridBounds = scene->WorldBound();
+    gridBounds.Expand(.001f * powf(gridBounds.Volume(), 1.f/3.f));
+    PoissonGrid grid(gridBounds, minDist);
 
     // Create scene bounding sphere to catch rays that leave the scene
     Point sceneCenter;
@@ -131,21 +299,57 @@ void SurfacePointsRenderer::Render(const Scene *scene) {
     if (PbrtOptions.quickRender) maxFails = max(10, maxFails / 10);
     int totalPathsTraced = 0, totalRaysTraced = 0, numPointsAdded = 0;
     ProgressReporter prog(maxFails, "Depositing samples");
-    // Launch tasks to trace rays to find Poisson points
     PBRT_SUBSURFACE_STARTED_RAYS_FOR_POINTS();
-    vector<Task *> tasks;
-    RWMutex *mutex = RWMutex::Create();
     int nTasks = NumSystemCores();
-    for (int i = 0; i < nTasks; ++i)
-        tasks.push_back(new SurfacePointTask(scene, pCamera, time, i,
-            minDist, maxFails, *mutex, repeatedFails, maxRepeatedFails,
-            totalPathsTraced, totalRaysTraced, numPointsAdded, sphere, pointOctree,
-            points, prog));
-    EnqueueTasks(tasks);
-    WaitForAllTasks();
-    for (uint32_t i = 0; i < tasks.size(); ++i)
-        delete tasks[i];
-    RWMutex::Destroy(mutex);
+    const int pathsPerTask = 20000;
+    vector<vector<SurfacePoint> > taskCandidates(nTasks);
+    vector<int> taskRays(nTasks);
+    vector<SurfacePoint> candidates;
+    vector<uint8_t> accepted;
+    for (int round = 0; ; ++round) {
+        // Launch tasks to trace rays to find candidate Poisson points
+        vector<Task *> tasks;
+        for (int i = 0; i < nTasks; ++i)
+            tasks.push_back(new SurfacePointTask(scene, pCamera, time,
+                round * nTasks + i, minDist, pathsPerTask, sphere,
+                taskCandidates[i], taskRays[i]));
+        EnqueueTasks(tasks);
+        WaitForAllTasks();
+        candidates.clear();
+        for (int i = 0; i < nTasks; ++i) {
+            delete tasks[i];
+            candidates.insert(candidates.end(), taskCandidates[i].begin(),
+                              taskCandidates[i].end());
+            totalRaysTraced += taskRays[i];
+        }
+        totalPathsTraced += nTasks * pathsPerTask;
+
+        // Add candidates to grid and update consecutive failure count
+        grid.AddCandidates(candidates, &accepted);
+        int oldMaxRepeatedFails = maxRepeatedFails;
+        for (uint32_t i = 0; i < accepted.size(); ++i) {
+            if (accepted[i]) {
+                ++numPointsAdded;
+                repeatedFails = 0;
+            }
+            else {
+                ++repeatedFails;
+                maxRepeatedFails = max(maxRepeatedFails, repeatedFails);
+            }
+        }
+
+        // Stop following paths if not finding new points
+        if (maxRepeatedFails > oldMaxRepeatedFails)
+            prog.Update(min(maxRepeatedFails, maxFails) -
+                        min(oldMaxRepeatedFails, maxFails));
+        if (maxRepeatedFails >= maxFails) break;
+        if (totalPathsTraced > 50000 && numPointsAdded == 0) {
+            Warning("There don't seem to be any objects with BSSRDFs "
+                    "in this scene.  Giving up.");
+            break;
+        }
+    }
+    grid.GetPoints(&points);
     prog.Done();
     PBRT_SUBSURFACE_FINISHED_RAYS_FOR_POINTS(totalRaysTraced, numPointsAdded);
     if (filename != "") {
@@ -173,100 +377,39 @@ void SurfacePointTask::Run() {
     // Declare common variables for _SurfacePointTask::Run()_
     RNG rng(37 * taskNum);
     MemoryArena arena;
-    vector<SurfacePoint> candidates;
-    while (true) {
-        int pathsTraced, raysTraced = 0;
-        for (pathsTraced = 0; pathsTraced < 20000; ++pathsTraced) {
-            // Follow ray path and attempt to deposit candidate sample points
-            Vector dir = UniformSampleSphere(rng.RandomFloat(), rng.RandomFloat());
-            Ray ray(origin, dir, 0.f, INFINITY, time);
-            while (ray.depth < 30) {
-                // Find ray intersection with scene geometry or bounding sphere
-                ++raysTraced;
-                Intersection isect;
-                bool hitOnSphere = false;
-                if (!scene->Intersect(ray, &isect)) {
-                    if (!sphere.Intersect(ray, &isect))
-                        break;
-                    hitOnSphere = true;
-                }
-                DifferentialGeometry &hitGeometry = isect.dg;
-                hitGeometry.nn = Faceforward(hitGeometry.nn, -ray.d);
-
-                // Store candidate sample point at ray intersection if appropriate
-                if (!hitOnSphere && ray.depth >= 3 &&
-                    isect.GetBSSRDF(RayDifferential(ray), arena) != NULL) {
-                    float area = M_PI * (minSampleDist / 2.f) * (minSampleDist / 2.f);
-                    candidates.push_back(SurfacePoint(hitGeometry.p, hitGeometry.nn,
-                                                      area, isect.rayEpsilon));
-                }
-
-                // Generate random ray from intersection point
-                Vector dir = UniformSampleSphere(rng.RandomFloat(), rng.RandomFloat());
-                dir = Faceforward(dir, hitGeometry.nn);
-                ray = Ray(hitGeometry.p, dir, ray, isect.rayEpsilon);
+    candidates.clear();
+    raysTraced = 0;
+    for (int pathsTraced = 0; pathsTraced < nPaths; ++pathsTraced) {
+        // Follow ray path and attempt to deposit candidate sample points
+        Vector dir = UniformSampleSphere(rng.RandomFloat(), rng.RandomFloat());
+        Ray ray(origin, dir, 0.f, INFINITY, time);
+        while (ray.depth < 30) {
+            // Find ray intersection with scene geometry or bounding sphere
+            ++raysTraced;
+            Intersection isect;
+            bool hitOnSphere = false;
+            if (!scene->Intersect(ray, &isect)) {
+                if (!sphere.Intersect(ray, &isect))
+                    break;
+                hitOnSphere = true;
             }
-            arena.FreeAll();
-        }
-        // Make first pass through candidate points with reader lock
-        vector<bool> candidateRejected;
-        candidateRejected.reserve(candidates.size());
-        RWMutexLock lock(mutex, READ);
-        for (uint32_t i = 0; i < candidates.size(); ++i) {
-            PoissonCheck check(minSampleDist, candidates[i].p);
-            octree.Lookup(candidates[i].p, check);
-            candidateRejected.push_back(check.failed);
-        }
-
-        // Make second pass through points with writer lock and update octree
-        lock.UpgradeToWrite();
-        if (repeatedFails >= maxFails)
-            return;
-        totalPathsTraced += pathsTraced;
-        totalRaysTraced += raysTraced;
-        int oldMaxRepeatedFails = maxRepeatedFails;
-        for (uint32_t i = 0; i < candidates.size(); ++i) {
-            if (candidateRejected[i]) {
-                // Update for rejected candidate point
-                ++repeatedFails;
-                maxRepeatedFails = max(maxRepeatedFails, repeatedFails);
-                if (repeatedFails >= maxFails)
-                    return;
+            DifferentialGeometry &hitGeometry = isect.dg;
+            hitGeometry.nn = Faceforward(hitGeometry.nn, -ray.d);
+
+            // Store candidate sample point at ray intersection if appropriate
+            if (!hitOnSphere && ray.depth >= 3 &&
+                isect.GetBSSRDF(RayDifferential(ray), arena) != NULL) {
+                float area = M_PI * (minSampleDist / 2.f) * (minSampleDist / 2.f);
+                candidates.push_back(SurfacePoint(hitGeometry.p, hitGeometry.nn,
+                                                  area, isect.rayEpsilon));
             }
-            else {
-                // Recheck candidate point and possibly add to octree
-                SurfacePoint &sp = candidates[i];
-                PoissonCheck check(minSampleDist, sp.p);
-                octree.Lookup(sp.p, check);
-                if (check.failed) {
-                    // Update for rejected candidate point
-                    ++repeatedFails;
-                    maxRepeatedFails = max(maxRepeatedFails, repeatedFails);
-                    if (repeatedFails >= maxFails)
-                        return;
-                }
-                else {
-                    ++numPointsAdded;
-                    repeatedFails = 0;
-                    Vector delta(minSampleDist, minSampleDist, minSampleDist);
-                    octree.Add(sp, BBox(sp.p-delta, sp.p+delta));
-                    PBRT_SUBSURFACE_ADDED_POINT_TO_OCTREE(&sp, minSampleDist);
-                    surfacePoints.push_back(sp);
-                }
-            }
-        }
 
-        // Stop following paths if not finding new points
-        if (repeatedFails > oldMaxRepeatedFails) {
-            int delta = repeatedFails - oldMaxRepeatedFails;
-            prog.Update(delta);
-        }
-        if (totalPathsTraced > 50000 && numPointsAdded == 0) {
-            Warning("There don't seem to be any objects with BSSRDFs "
-                    "in this scene.  Giving up.");
-            return;
+            // Generate random ray from intersection point
+            Vector dir = UniformSampleSphere(rng.RandomFloat(), rng.RandomFloat());
+            dir = Faceforward(dir, hitGeometry.nn);
+            ray = Ray(hitGeometry.p, dir, ray, isect.rayEpsilon);
         }
-        candidates.erase(candidates.begin(), candidates.end());
+        arena.FreeAll();
     }
 }
 
@@ -39,53 +39,39 @@
 #include "intersection.h"
 #include "camera.h"
 #include "montecarlo.h"
+#include "samplers/sobol.h"
 
 // AdaptiveSampler Method Definitions
 AdaptiveSampler::AdaptiveSampler(int xstart, int xend,
                      int ystart, int yend, int mins, int maxs, const string &m,
-                     float sopen, float sclose)
-    : Sampler(xstart, xend, ystart, yend, RoundUpPow2(max(mins, maxs)),
-              sopen, sclose) {
+                     float maxerr, float sopen, float sclose)
+    : Sampler(xstart, xend, ystart, yend, max(mins, maxs), sopen, sclose) {
     xPos = xPixelStart;
     yPos = yPixelStart;
-    supersamplePixel = false;
     if (mins > maxs) std::swap(mins, maxs);
-
-    if (!IsPowerOf2(mins)) {
-        Warning("Minimum pixel samples being rounded up to power of 2");
-        minSamples = RoundUpPow2(mins);
-    }
-    else
-        minSamples = mins;
-    if (!IsPowerOf2(maxs)) {
-        Warning("Maximum pixel samples being rounded up to power of 2");
-        maxSamples = RoundUpPow2(maxs);
-    }
-    else
-        maxSamples = maxs;
+    minSamples = mins;
+    maxSamples = maxs;
+    maxError = maxerr;
 
     if (minSamples < 2) {
         Warning("Adaptive sampler needs at least two initial pixel samples.  Using two.");
         minSamples = 2;
     }
-    if (minSamples == maxSamples) {
-        maxSamples *= 2;
+    if (minSamples >= maxSamples) {
+        maxSamples = 2 * minSamples;
         Warning("Adaptive sampler must have more maximum samples than minimum.  Using %d - %d",
                 minSamples, maxSamples);
     }
     if (m == "contrast") method = ADAPTIVE_CONTRAST_THRESHOLD;
     else if (m == "shapeid") method = ADAPTIVE_COMPARE_SHAPE_ID;
+    else if (m == "variance") method = ADAPTIVE_VARIANCE;
     else {
-        Warning("Adaptive sampling metric \"%s\" unknown.  Using \"contrast\".",
+        Warning("Adaptive sampling metric \"%s\" unknown.  Using \"variance\".",
                 m.c_str());
-        method = ADAPTIVE_CONTRAST_THRESHOLD;
+        method = ADAPTIVE_VARIANCE;
     }
-    sampleBuf = NULL;
-}
-
-
-AdaptiveSampler::~AdaptiveSampler() {
-    delete[] sampleBuf;
+    round = pixelSamples = 0;
+    sumY = sumY2 = 0.;
 }
 
 
@@ -93,57 +79,68 @@ Sampler *AdaptiveSampler::GetSubSampler(int num, int count) {
     int x0, x1, y0, y1;
     ComputeSubWindow(num, count, &x0, &x1, &y0, &y1);
     if (x0 == x1 || y0 == y1) return NULL;
-    return new AdaptiveSampler(x0, x1, y0, y1, minSamples, maxSamples,
-        method == ADAPTIVE_CONTRAST_THRESHOLD ? "contrast" : "shapeid",
-        shutterOpen, shutterClose);
+    const char *m = method == ADAPTIVE_CONTRAST_THRESHOLD ? "contrast" :
+        (method == ADAPTIVE_COMPARE_SHAPE_ID ? "shapeid" : "variance");
+    return new AdaptiveSampler(x0, x1, y0, y1, minSamples, maxSamples, m,
+        maxError, shutterOpen, shutterClose);
 }
 
 
 int AdaptiveSampler::GetMoreSamples(Sample *samples, RNG &rng) {
-    if (!sampleBuf)
-        sampleBuf = new float[LDPixelSampleFloatsNeeded(samples,
-                                                        maxSamples)];
-    if (supersamplePixel) {
-        LDPixelSample(xPos, yPos, shutterOpen, shutterClose, maxSamples,
-                      samples, sampleBuf, rng);
-        return maxSamples;
-    }
-    else {
-        if (yPos == yPixelEnd) return 0;
-        LDPixelSample(xPos, yPos, shutterOpen, shutterClose, minSamples,
-                      samples, sampleBuf, rng);
-        return minSamples;
-    }
+    if (yPos == yPixelEnd) return 0;
+    // Continue the current pixel's progressive Sobol sample stream
+    int count = min(minSamples, maxSamples - pixelSamples);
+    for (int i = 0; i < count; ++i)
+        SobolPixelSample(xPos, yPos, pixelSamples + i, 0, 0,
+                         shutterOpen, shutterClose, &samples[i]);
+    return count;
 }
 
 
 bool AdaptiveSampler::ReportResults(Sample *samples,
         const RayDifferential *rays, const Spectrum *Ls,
         const Intersection *isects, int count) {
-    if (supersamplePixel) {
-        supersamplePixel = false;
-        // Advance to next pixel for sampling for _AdaptiveSampler_
-        if (++xPos == xPixelEnd) {
-            xPos = xPixelStart;
-            ++yPos;
-        }
-        return true;
+    // Update pixel luminance statistics with the new samples
+    for (int i = 0; i < count; ++i) {
+        float y = Ls[i].y();
+        sumY += y;
+        sumY2 += y * y;
     }
-    else if (needsSupersampling(samples, rays, Ls, isects, count)) {
-        PBRT_SUPERSAMPLE_PIXEL_YES(xPos, yPos);
-        supersamplePixel = true;
-        return false;
+    pixelSamples += count;
+
+    // Decide whether to give the current pixel another round of samples
+    bool more;
+    if (pixelSamples >= maxSamples)
+        more = false;
+    else if (round > 0 && method != ADAPTIVE_VARIANCE)
+        more = true;
+    else
+        more = needsSupersampling(samples, rays, Ls, isects, count);
+    if (round == 0) {
+        if (more) PBRT_SUPERSAMPLE_PIXEL_YES(xPos, yPos);
+        else      PBRT_SUPERSAMPLE_PIXEL_NO(xPos, yPos);
     }
-
+    if (more)
+        ++round;
     else {
-        PBRT_SUPERSAMPLE_PIXEL_NO(xPos, yPos);
         // Advance to next pixel for sampling for _AdaptiveSampler_
+        round = pixelSamples = 0;
+        sumY = sumY2 = 0.;
         if (++xPos == xPixelEnd) {
             xPos = xPixelStart;
             ++yPos;
         }
-        return true;
     }
+    return true;
+}
+
+
+bool AdaptiveSampler::errorAboveThreshold() const {
+    // Compare standard error of the pixel mean to _maxError_ relative to it
+    double mean = sumY / pixelSamples;
+    double variance = (sumY2 - pixelSamples * mean * mean) / (pixelSamples - 1);
+    double stdError = sqrt(max(variance, 0.) / pixelSamples);
+    return stdError > maxError * max(mean, .01);
 }
 
 
@@ -151,6 +148,8 @@ bool AdaptiveSampler::needsSupersampling(Sample *samples,
         const RayDifferential *rays, const Spectrum *Ls,
         const Intersection *isects, int count) {
     switch (method) {
+    case ADAPTIVE_VARIANCE:
+        return errorAboveThreshold();
     case ADAPTIVE_COMPARE_SHAPE_ID:
         // See if any shape ids differ within samples
         for (int i = 0; i < count-1; ++i)
@@ -182,9 +181,10 @@ AdaptiveSampler *CreateAdaptiveSampler(const ParamSet &params, const Film *film,
     int minsamp = params.FindOneInt("minsamples", 4);
     int maxsamp = params.FindOneInt("maxsamples", 32);
     if (PbrtOptions.quickRender) { minsamp = 2; maxsamp = 4; }
-    string method = params.FindOneString("method", "contrast");
+    string method = params.FindOneString("method", "variance");
+    float maxerror = params.FindOneFloat("maxerror", .02f);
     return new AdaptiveSampler(xstart, xend, ystart, yend, minsamp, maxsamp, method,
-         camera->shutterOpen, camera->shutterClose);
+         maxerror, camera->shutterOpen, camera->shutterClose);
 }
 
 
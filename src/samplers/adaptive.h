@@ -61,38 +61,33 @@ public:
     // AdaptiveSampler Public Methods
     AdaptiveSampler(int xstart, int xend, int ystart, int yend,
         int minSamples, int maxSamples, const string &method,
-        float sopen, float sclose);
+        float maxError, float sopen, float sclose);
     Sampler *GetSubSampler(int num, int count);
-    ~AdaptiveSampler();
-    int RoundSize(int size) const {
-        return RoundUpPow2(size);
-    }
-    int MaximumSampleCount() { return maxSamples; }
+    int RoundSize(int size) const { return size; }
+    int MaximumSampleCount() { return minSamples; }
     int GetMoreSamples(Sample *sample, RNG &rng);
 
-	/*
-	If further sampling is indicated,
-	ReportResults() sets supersamplePixel to true and leaves (xPos, yPos) unchanged.
-	Thus, the next call to GetMoreSamples() will generate a new set of maxSamples
-	samples for the pixel. When these samples are provided to ReportResults(), super
-	samplePixel is reset to false and the current pixel is advanced.
-	P387
-	*/
+    // Samples are generated in rounds of _minSamples_ and are always kept;
+    // ReportResults() accumulates the pixel's luminance statistics and
+    // decides whether the current pixel gets another round.
     bool ReportResults(Sample *samples, const RayDifferential *rays,
         const Spectrum *Ls, const Intersection *isects, int count);
 private:
     // AdaptiveSampler Private Methods
     bool needsSupersampling(Sample *samples, const RayDifferential *rays,
         const Spectrum *Ls, const Intersection *isects, int count);
+    bool errorAboveThreshold() const;
 
     // AdaptiveSampler Private Data
     int xPos, yPos;
     int minSamples, maxSamples;
-    float *sampleBuf;
+    float maxError;
     enum AdaptiveTest { ADAPTIVE_COMPARE_SHAPE_ID,
-                        ADAPTIVE_CONTRAST_THRESHOLD };
+                        ADAPTIVE_CONTRAST_THRESHOLD,
+                        ADAPTIVE_VARIANCE };
     AdaptiveTest method;
-    bool supersamplePixel;
+    int round, pixelSamples;
+    double sumY, sumY2;
 };
 
 
@@ -35,21 +35,272 @@
 #include "samplers/bestcandidate.h"
 #include "camera.h"
 #include "montecarlo.h"
+#include "parallel.h"
+#include "progressreporter.h"
+#include "floatfile.h"
+#include <queue>
+#if defined(PBRT_IS_WINDOWS) || defined(PBRT_IS_LINUX)|| defined(PBRT_IS_OPENBSD)
+#include <errno.h>
+#else
+#include <sys/errno.h>
+#endif
+
+// BestCandidateSampler Local Declarations
+static inline float Wrapped1DDist(float a, float b) {
+    float d = fabsf(a - b);
+    return d < 0.5f ? d : 1.f - d;
+}
+
+
+static inline float Wrapped2DDist2(const float *a, const float *b) {
+    float dx = Wrapped1DDist(a[0], b[0]), dy = Wrapped1DDist(a[1], b[1]);
+    return dx * dx + dy * dy;
+}
+
+
+// Uniform grid over the unit torus holding the indices of 2D points
+struct ToroidalGrid {
+    ToroidalGrid(int r, const float *p, int n)
+        : res(r >= 3 ? r : 1), cells(res * res) {
+        for (int i = 0; i < n; ++i) Add(p, i);
+    }
+    // Cell offset to search around a cell; a single cell covers everything
+    int Reach() const { return res >= 3 ? 1 : 0; }
+    int Cell(float v) const { return min(int(v * res), res - 1); }
+    void Add(const float *p, int i) {
+        cells[Cell(p[2*i+1]) * res + Cell(p[2*i])].push_back(i);
+    }
+    const vector<int> &Neighbors(int u, int v, int du, int dv) const {
+        u = (u + du + res) % res;
+        v = (v + dv + res) % res;
+        return cells[v * res + u];
+    }
+    int res;
+    vector<vector<int> > cells;
+};
+
+
+class BlueNoiseWeightTask : public Task {
+public:
+    BlueNoiseWeightTask(const ToroidalGrid &g, const float *p, float r,
+                        int s, int e, float *w)
+        : grid(g), pts(p), radius(r), start(s), end(e), weights(w) { }
+    void Run() {
+        for (int i = start; i < end; ++i)
+            weights[i] = Weight(grid, pts, radius, i);
+    }
+    static float Weight(const ToroidalGrid &grid, const float *pts,
+                        float radius, int i) {
+        // Sum falloff of points within _radius_ of point _i_
+        float w = 0.f;
+        int u = grid.Cell(pts[2*i]), v = grid.Cell(pts[2*i+1]);
+        for (int dv = -grid.Reach(); dv <= grid.Reach(); ++dv)
+            for (int du = -grid.Reach(); du <= grid.Reach(); ++du) {
+                const vector<int> &cell = grid.Neighbors(u, v, du, dv);
+                for (uint32_t k = 0; k < cell.size(); ++k) {
+                    int j = cell[k];
+                    if (j == i) continue;
+                    float d2 = Wrapped2DDist2(&pts[2*i], &pts[2*j]);
+                    if (d2 < radius * radius)
+                        w += powf(1.f - sqrtf(d2) / radius, 8.f);
+                }
+            }
+        return w;
+    }
+private:
+    const ToroidalGrid &grid;
+    const float *pts;
+    float radius;
+    int start, end;
+    float *weights;
+};
+
+
+// Computes _n_ blue noise points on the unit torus by weighted sample
+// elimination (Yuksel 2015) from a larger set of uniform random points
+static void BlueNoise2D(int n, RNG &rng, vector<float> *result) {
+    int nInitial = 5 * n;
+    vector<float> pts(2 * nInitial);
+    for (int i = 0; i < 2 * nInitial; ++i)
+        pts[i] = rng.RandomFloat();
+    float rmax = sqrtf(1.f / (2.f * sqrtf(3.f) * n));
+    float radius = 2.f * rmax;
+    ToroidalGrid grid(max(1, min(Floor2Int(1.f / radius), 1024)),
+                      &pts[0], nInitial);
+
+    // Compute initial point weights in parallel
+    vector<float> weights(nInitial);
+    vector<Task *> tasks;
+    int nTasks = 4 * NumSystemCores();
+    for (int i = 0; i < nTasks; ++i)
+        tasks.push_back(new BlueNoiseWeightTask(grid, &pts[0], radius,
+            i * nInitial / nTasks, (i+1) * nInitial / nTasks, &weights[0]));
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    for (uint32_t i = 0; i < tasks.size(); ++i)
+        delete tasks[i];
+
+    // Repeatedly remove the point with the largest weight
+    std::priority_queue<std::pair<float, int> > heap;
+    for (int i = 0; i < nInitial; ++i)
+        heap.push(std::make_pair(weights[i], i));
+    vector<bool> removed(nInitial, false);
+    for (int nLeft = nInitial; nLeft > n; ) {
+        std::pair<float, int> top = heap.top();
+        heap.pop();
+        int i = top.second;
+        if (removed[i] || top.first != weights[i]) continue;
+        removed[i] = true;
+        --nLeft;
+        // Update weights of points near the removed one
+        int u = grid.Cell(pts[2*i]), v = grid.Cell(pts[2*i+1]);
+        for (int dv = -grid.Reach(); dv <= grid.Reach(); ++dv)
+            for (int du = -grid.Reach(); du <= grid.Reach(); ++du) {
+                const vector<int> &cell = grid.Neighbors(u, v, du, dv);
+                for (uint32_t k = 0; k < cell.size(); ++k) {
+                    int j = cell[k];
+                    if (removed[j]) continue;
+                    float d2 = Wrapped2DDist2(&pts[2*i], &pts[2*j]);
+                    if (d2 >= radius * radius) continue;
+                    weights[j] -= powf(1.f - sqrtf(d2) / radius, 8.f);
+                    heap.push(std::make_pair(weights[j], j));
+                }
+            }
+    }
+    result->clear();
+    for (int i = 0; i < nInitial; ++i)
+        if (!removed[i]) {
+            result->push_back(pts[2*i]);
+            result->push_back(pts[2*i+1]);
+        }
+}
+
+
+// Assigns the values in _values_ (_nc_ components each) to the image
+// samples, greedily choosing for each sample the candidate that is
+// farthest from the values already given to its image-space neighbors
+static void Redistribute(BestCandidateTable *table, const ToroidalGrid &imageGrid,
+                         vector<float> &values, int nc, int offset, RNG &rng) {
+    const int nCandidates = 32;
+    int n = table->size;
+    for (int cur = 0; cur < n; ++cur) {
+        const float *img = (*table)[cur];
+        int u = imageGrid.Cell(img[0]), v = imageGrid.Cell(img[1]);
+        int best = cur;
+        float bestDist = -1.f;
+        for (int c = 0; c < min(nCandidates, n - cur); ++c) {
+            int cand = cur + min(int(rng.RandomFloat() * (n - cur)), n - cur - 1);
+            // Find distance from candidate to values at nearby image samples
+            float minDist = INFINITY;
+            for (int dv = -imageGrid.Reach(); dv <= imageGrid.Reach(); ++dv)
+                for (int du = -imageGrid.Reach(); du <= imageGrid.Reach(); ++du) {
+                    const vector<int> &cell = imageGrid.Neighbors(u, v, du, dv);
+                    for (uint32_t k = 0; k < cell.size(); ++k) {
+                        if (cell[k] >= cur) continue;
+                        const float *o = (*table)[cell[k]] + offset;
+                        float d = (nc == 1) ?
+                            Wrapped1DDist(o[0], values[cand]) :
+                            Wrapped2DDist2(o, &values[2*cand]);
+                        minDist = min(minDist, d);
+                    }
+                }
+            if (minDist > bestDist) {
+                bestDist = minDist;
+                best = cand;
+            }
+        }
+        for (int k = 0; k < nc; ++k) {
+            std::swap(values[nc*cur+k], values[nc*best+k]);
+            (*table)[cur][offset+k] = values[nc*cur+k];
+        }
+    }
+}
+
+
+BestCandidateTable *ComputeBestCandidateTable(int sqrtSize) {
+    BestCandidateTable *table = new BestCandidateTable(sqrtSize);
+    int n = table->size;
+    RNG rng(n);
+    ProgressReporter progress(4, "Computing sample table");
+    // Compute blue noise image sample positions
+    vector<float> image;
+    BlueNoise2D(n, rng, &image);
+    for (int i = 0; i < n; ++i) {
+        (*table)[i][0] = image[2*i];
+        (*table)[i][1] = image[2*i+1];
+    }
+    ToroidalGrid imageGrid(max(1, Floor2Int(sqrtf(n / 2.5f))), &image[0], n);
+    progress.Update();
+
+    // Compute stratified time samples and distribute them over the image
+    vector<float> times(n);
+    for (int i = 0; i < n; ++i)
+        times[i] = (i + rng.RandomFloat()) / n;
+    Redistribute(table, imageGrid, times, 1, 2, rng);
+    progress.Update();
+
+    // Compute blue noise lens samples and distribute them over the image
+    vector<float> lens;
+    BlueNoise2D(n, rng, &lens);
+    progress.Update();
+    Redistribute(table, imageGrid, lens, 2, 3, rng);
+    progress.Done();
+    return table;
+}
+
+
+static BestCandidateTable *ReadBestCandidateTable(const string &filename,
+                                                  int sqrtSize) {
+    FILE *f = fopen(filename.c_str(), "r");
+    if (!f) return NULL;
+    fclose(f);
+    vector<float> values;
+    if (!ReadFloatFile(filename.c_str(), &values) || values.size() < 2 ||
+        int(values[0]) != sqrtSize || (values.size() - 2) % 5 != 0 ||
+        int(values[1]) * 5 != int(values.size() - 2)) {
+        Warning("Ignoring invalid sample table file \"%s\"", filename.c_str());
+        return NULL;
+    }
+    BestCandidateTable *table = new BestCandidateTable(sqrtSize);
+    table->size = int(values[1]);
+    table->samples.assign(values.begin() + 2, values.end());
+    return table;
+}
+
+
+static void WriteBestCandidateTable(const string &filename,
+                                    const BestCandidateTable *table) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        Error("Unable to open sample table file \"%s\" for writing (%s)",
+              filename.c_str(), strerror(errno));
+        return;
+    }
+    fprintf(f, "# best-candidate sample table: resolution, count, then\n");
+    fprintf(f, "# image (x,y), time, lens (u,v) per sample\n");
+    fprintf(f, "%d %d\n", table->sqrtSize, table->size);
+    for (int i = 0; i < table->size; ++i) {
+        const float *s = (*table)[i];
+        fprintf(f, "%.9g %.9g %.9g %.9g %.9g\n", s[0], s[1], s[2], s[3], s[4]);
+    }
+    fclose(f);
+}
+
+
 
 // BestCandidateSampler Method Definitions
-#include "samplers/bestcandidate.out"
 Sampler *BestCandidateSampler::GetSubSampler(int num, int count) {
     int x0, x1, y0, y1;
     ComputeSubWindow(num, count, &x0, &x1, &y0, &y1);
     if (x0 == x1 || y0 == y1) return NULL;
     return new BestCandidateSampler(x0, x1, y0, y1, samplesPerPixel,
-        shutterOpen, shutterClose);
+        shutterOpen, shutterClose, sampleTable);
 }
 
 
 int BestCandidateSampler::GetMoreSamples(Sample *sample, RNG &rng) {
 again:
-    if (tableOffset == SAMPLE_TABLE_SIZE) {
+    if (tableOffset == sampleTable->size) {
         // Advance to next best-candidate sample table position
         tableOffset = 0;
         if (++xTile > xTileEnd) {
@@ -65,14 +316,15 @@ again:
     }
     // Compute raster sample from table
 #define WRAP(x) ((x) >= 1 ? ((x)-1) : (x))
-    sample->imageX = (xTile + sampleTable[tableOffset][0]) * tableWidth;
-    sample->imageY = (yTile + sampleTable[tableOffset][1]) * tableWidth;
-    sample->time  = Lerp(WRAP(sampleOffsets[0] + sampleTable[tableOffset][2]),
+    const float *tableSample = (*sampleTable.GetPtr())[tableOffset];
+    sample->imageX = (xTile + tableSample[0]) * tableWidth;
+    sample->imageY = (yTile + tableSample[1]) * tableWidth;
+    sample->time  = Lerp(WRAP(sampleOffsets[0] + tableSample[2]),
                               shutterOpen, shutterClose);
     sample->lensU = WRAP(sampleOffsets[1] +
-                         sampleTable[tableOffset][3]);
+                         tableSample[3]);
     sample->lensV = WRAP(sampleOffsets[2] +
-                         sampleTable[tableOffset][4]);
+                         tableSample[4]);
 
     // Check sample against crop window, goto _again_ if outside
     if (sample->imageX < xPixelStart || sample->imageX >= xPixelEnd ||
@@ -98,8 +350,20 @@ BestCandidateSampler *CreateBestCandidateSampler(const ParamSet &params, const F
     film->GetSampleExtent(&xstart, &xend, &ystart, &yend);
     int nsamp = params.FindOneInt("pixelsamples", 4);
     if (PbrtOptions.quickRender) nsamp = 1;
+    int tableRes = max(1, params.FindOneInt("tableresolution", 64));
+    string tableFile = params.FindOneFilename("tablefile", "");
+
+    // Read sample table from _tableFile_ or compute it
+    Reference<BestCandidateTable> table;
+    if (tableFile != "")
+        table = ReadBestCandidateTable(tableFile, tableRes);
+    if (!table) {
+        table = ComputeBestCandidateTable(tableRes);
+        if (tableFile != "")
+            WriteBestCandidateTable(tableFile, table.GetPtr());
+    }
     return new BestCandidateSampler(xstart, xend, ystart, yend, nsamp,
-         camera->shutterOpen, camera->shutterClose);
+         camera->shutterOpen, camera->shutterClose, table);
 }
 
 
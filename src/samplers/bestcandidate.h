@@ -41,19 +41,32 @@
 #include "paramset.h"
 #include "film.h"
 
-// BestCandidate Sampling Constants
-#define SQRT_SAMPLE_TABLE_SIZE 64
-#define SAMPLE_TABLE_SIZE (SQRT_SAMPLE_TABLE_SIZE * \
-                           SQRT_SAMPLE_TABLE_SIZE)
+// BestCandidateTable Declarations
+struct BestCandidateTable : public ReferenceCounted {
+    BestCandidateTable(int res)
+        : sqrtSize(res), size(res * res), samples(5 * res * res) { }
+    const float *operator[](int i) const { return &samples[5 * i]; }
+    float *operator[](int i) { return &samples[5 * i]; }
+
+    // BestCandidateTable Data
+    // Each entry holds an image (2), time (1) and lens (2) sample
+    int sqrtSize, size;
+    vector<float> samples;
+};
+
+
+BestCandidateTable *ComputeBestCandidateTable(int sqrtSize);
 
 // BestCandidateSampler Declarations
 class BestCandidateSampler : public Sampler {
 public:
     // BestCandidateSampler Public Methods
     BestCandidateSampler(int xstart, int xend, int ystart, int yend,
-                         int nPixelSamples, float sopen, float sclose)
-        : Sampler(xstart, xend, ystart, yend, nPixelSamples, sopen, sclose) {
-        tableWidth = (float)SQRT_SAMPLE_TABLE_SIZE /
+                         int nPixelSamples, float sopen, float sclose,
+                         const Reference<BestCandidateTable> &table)
+        : Sampler(xstart, xend, ystart, yend, nPixelSamples, sopen, sclose),
+          sampleTable(table) {
+        tableWidth = (float)sampleTable->sqrtSize /
                      (float)sqrtf(nPixelSamples);
         xTileStart = Floor2Int(xstart / tableWidth);
         xTileEnd = Floor2Int(xend / tableWidth);
@@ -79,7 +92,7 @@ private:
     int tableOffset;
     int xTileStart, xTileEnd, yTileStart, yTileEnd;
     int xTile, yTile;
-    static const float sampleTable[SAMPLE_TABLE_SIZE][5];
+    Reference<BestCandidateTable> sampleTable;
     float sampleOffsets[3];
 };
 
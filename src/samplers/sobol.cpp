@@ -0,0 +1,217 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+
+// samplers/sobol.cpp*
+#include "stdafx.h"
+#include "samplers/sobol.h"
+#include "camera.h"
+#include "montecarlo.h"
+
+// SobolSampler Local Definitions
+static inline uint32_t ReverseBits32(uint32_t n) {
+    n = (n << 16) | (n >> 16);
+    n = ((n & 0x00ff00ff) << 8) | ((n & 0xff00ff00) >> 8);
+    n = ((n & 0x0f0f0f0f) << 4) | ((n & 0xf0f0f0f0) >> 4);
+    n = ((n & 0x33333333) << 2) | ((n & 0xcccccccc) >> 2);
+    n = ((n & 0x55555555) << 1) | ((n & 0xaaaaaaaa) >> 1);
+    return n;
+}
+
+
+static inline uint32_t MixBits(uint32_t v) {
+    v ^= v >> 16;
+    v *= 0x7feb352d;
+    v ^= v >> 15;
+    v *= 0x846ca68b;
+    v ^= v >> 16;
+    return v;
+}
+
+
+// Owen scrambling with the Laine-Karras hash: flips each digit based on
+// a hash of the digits that precede it.  Digits are stored
+// least-significant first, i.e. in bit-reversed order.
+static inline uint32_t LaineKarrasPermutation(uint32_t v, uint32_t seed) {
+    v += seed;
+    v ^= v * 0x6c50b47c;
+    v ^= v * 0xb82f1e52;
+    v ^= v * 0xc7afe638;
+    v ^= v * 0x8d22f6e6;
+    return v;
+}
+
+
+// Returns element _i_ of a pseudo-random permutation of [0,n) selected
+// by _p_, without storing the permutation (Kensler, 2013)
+static inline uint32_t PermutationElement(uint32_t i, uint32_t n, uint32_t p) {
+    uint32_t w = n - 1;
+    w |= w >> 1;  w |= w >> 2;  w |= w >> 4;
+    w |= w >> 8;  w |= w >> 16;
+    do {
+        i ^= p;             i *= 0xe170893d;
+        i ^= p >> 16;       i ^= (i & w) >> 4;
+        i ^= p >> 8;        i *= 0x0929eb3f;
+        i ^= p >> 23;       i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;   i *= 0x6935fa69;
+        i ^= (i & w) >> 11; i *= 0x74dcb303;
+        i ^= (i & w) >> 2;  i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;  i *= 0xc860a3df;
+        i &= w;             i ^= i >> 5;
+    } while (i >= n);
+    return (i + p) % n;
+}
+
+
+static inline uint32_t Sobol2Bits(uint32_t n) {
+    uint32_t v = 1u << 31, result = 0;
+    for (; n != 0; n >>= 1, v ^= v >> 1)
+        if (n & 0x1) result ^= v;
+    return result;
+}
+
+
+static inline float ToUnitFloat(uint32_t v) {
+    return min(v * 2.3283064365386963e-10f, OneMinusEpsilon);
+}
+
+
+
+// Maps a pixel sample index to the sequence index used for one dimension.
+// With a known sample _count_ this is a random permutation of [0,count).
+// An open-ended (_count_ of 0) stream instead uses a nested permutation
+// of the index bits, most significant first, so that every prefix of
+// length 2^k still maps to an aligned, well-stratified block of 2^k
+// sequence points.
+static inline uint32_t SampleIndex(uint32_t index, uint32_t count,
+                                   uint32_t hash) {
+    if (count == 0)
+        return ReverseBits32(LaineKarrasPermutation(ReverseBits32(index),
+                                                    MixBits(~hash))) & 0xfffff;
+    return PermutationElement(index, count, hash);
+}
+
+
+static inline float SobolSample1D(uint32_t index, uint32_t hash) {
+    // The van der Corput digits of _index_ are its bits in reverse order
+    return ToUnitFloat(ReverseBits32(LaineKarrasPermutation(index, hash)));
+}
+
+
+static inline void SobolSample2D(uint32_t index, uint32_t hash, float u[2]) {
+    u[0] = ToUnitFloat(ReverseBits32(LaineKarrasPermutation(index, hash)));
+    uint32_t v = ReverseBits32(Sobol2Bits(index));
+    u[1] = ToUnitFloat(ReverseBits32(LaineKarrasPermutation(v, MixBits(hash))));
+}
+
+
+void SobolPixelSample(int x, int y, uint32_t index, uint32_t count,
+        uint32_t seed, float shutterOpen, float shutterClose, Sample *sample) {
+    // Each dimension, or pair of dimensions, gets its own (0,2)-sequence
+    // with the pixel's samples visited in a hashed order and Owen scrambled
+    uint32_t dim = 0;
+    uint32_t pixelHash = MixBits(MixBits(uint32_t(x) ^ seed) ^ uint32_t(y));
+    float u[2];
+    uint32_t h = MixBits(pixelHash ^ (0x9e3779b9 * dim++));
+    SobolSample2D(SampleIndex(index, count, h), h, u);
+    sample->imageX = x + u[0];
+    sample->imageY = y + u[1];
+    h = MixBits(pixelHash ^ (0x9e3779b9 * dim++));
+    SobolSample2D(SampleIndex(index, count, h), h, u);
+    sample->lensU = u[0];
+    sample->lensV = u[1];
+    h = MixBits(pixelHash ^ (0x9e3779b9 * dim++));
+    sample->time = Lerp(SobolSample1D(SampleIndex(index, count, h), h),
+                        shutterOpen, shutterClose);
+
+    // Generate integrator sample arrays from consecutive sequence points
+    for (uint32_t i = 0; i < sample->n1D.size(); ++i) {
+        uint32_t nValues = sample->n1D[i];
+        h = MixBits(pixelHash ^ (0x9e3779b9 * dim++));
+        uint32_t base = SampleIndex(index, count, h) * nValues;
+        for (uint32_t j = 0; j < nValues; ++j)
+            sample->oneD[i][j] = SobolSample1D(base + j, h);
+    }
+    for (uint32_t i = 0; i < sample->n2D.size(); ++i) {
+        uint32_t nValues = sample->n2D[i];
+        h = MixBits(pixelHash ^ (0x9e3779b9 * dim++));
+        uint32_t base = SampleIndex(index, count, h) * nValues;
+        for (uint32_t j = 0; j < nValues; ++j)
+            SobolSample2D(base + j, h, &sample->twoD[i][2*j]);
+    }
+}
+
+
+
+// SobolSampler Method Definitions
+SobolSampler::SobolSampler(int xstart, int xend, int ystart, int yend,
+        int ps, float sopen, float sclose, uint32_t sd)
+    : Sampler(xstart, xend, ystart, yend, ps, sopen, sclose) {
+    xPos = xPixelStart;
+    yPos = yPixelStart;
+    seed = sd;
+}
+
+
+Sampler *SobolSampler::GetSubSampler(int num, int count) {
+    int x0, x1, y0, y1;
+    ComputeSubWindow(num, count, &x0, &x1, &y0, &y1);
+    if (x0 == x1 || y0 == y1) return NULL;
+    return new SobolSampler(x0, x1, y0, y1, samplesPerPixel, shutterOpen,
+                            shutterClose, seed);
+}
+
+
+int SobolSampler::GetMoreSamples(Sample *samples, RNG &rng) {
+    if (yPos == yPixelEnd) return 0;
+    for (int i = 0; i < samplesPerPixel; ++i)
+        SobolPixelSample(xPos, yPos, i, samplesPerPixel, seed,
+                         shutterOpen, shutterClose, &samples[i]);
+    if (++xPos == xPixelEnd) {
+        xPos = xPixelStart;
+        ++yPos;
+    }
+    return samplesPerPixel;
+}
+
+
+SobolSampler *CreateSobolSampler(const ParamSet &params, const Film *film,
+        const Camera *camera) {
+    // Initialize common sampler parameters
+    int xstart, xend, ystart, yend;
+    film->GetSampleExtent(&xstart, &xend, &ystart, &yend);
+    int nsamp = params.FindOneInt("pixelsamples", 16);
+    int seed = params.FindOneInt("seed", 0);
+    if (PbrtOptions.quickRender) nsamp = 1;
+    return new SobolSampler(xstart, xend, ystart, yend, nsamp,
+        camera->shutterOpen, camera->shutterClose, uint32_t(seed));
+}
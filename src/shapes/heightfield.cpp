@@ -33,9 +33,19 @@
 // shapes/heightfield.cpp*
 #include "stdafx.h"
 #include "shapes/heightfield.h"
-#include "shapes/trianglemesh.h"
+#include "shapes/tessutil.h"
+#include "montecarlo.h"
 #include "paramset.h"
 
+// Heightfield Local Definitions
+#define VERT(x,y) ((x)+(y)*nx)
+struct HeightfieldNode {
+    HeightfieldNode(int l = 0, int xx = 0, int yy = 0)
+        : level(l), x(xx), y(yy) { }
+    int level, x, y;
+};
+
+
 // Heightfield Method Definitions
 Heightfield::Heightfield(const Transform *o2w, const Transform *w2o,
         bool ro, int x, int y, const float *zs)
@@ -44,71 +54,248 @@ Heightfield::Heightfield(const Transform *o2w, const Transform *w2o,
     ny = y;
     z = new float[nx*ny];
     memcpy(z, zs, nx*ny*sizeof(float));
+    areaCdfsReady = 0;
+    areaMutex = Mutex::Create();
+
+    // Compute $z$ range of each $2\times{}2$ block of cells
+    int w = nx / 2, h = ny / 2;
+    if (nx > 2 || ny > 2) {
+        zRange.push_back(vector<float>(2 * w * h));
+        zRangeRes.push_back(std::make_pair(w, h));
+        for (int by = 0; by < h; ++by) {
+            for (int bx = 0; bx < w; ++bx) {
+                float zmin = INFINITY, zmax = -INFINITY;
+                for (int yy = 2*by; yy <= min(2*by + 2, ny - 1); ++yy)
+                    for (int xx = 2*bx; xx <= min(2*bx + 2, nx - 1); ++xx) {
+                        zmin = min(zmin, z[VERT(xx, yy)]);
+                        zmax = max(zmax, z[VERT(xx, yy)]);
+                    }
+                zRange[0][2 * (by * w + bx)] = zmin;
+                zRange[0][2 * (by * w + bx) + 1] = zmax;
+            }
+        }
+    }
+
+    // Build coarser levels of $z$ range hierarchy
+    while (w > 1 || h > 1) {
+        int pw = (w + 1) / 2, ph = (h + 1) / 2;
+        const vector<float> &child = zRange.back();
+        vector<float> parent(2 * pw * ph);
+        for (int i = 0; i < pw * ph; ++i) {
+            parent[2*i] = INFINITY;
+            parent[2*i+1] = -INFINITY;
+        }
+        for (int cy = 0; cy < h; ++cy)
+            for (int cx = 0; cx < w; ++cx) {
+                int p = (cy / 2) * pw + cx / 2, c = cy * w + cx;
+                parent[2*p] = min(parent[2*p], child[2*c]);
+                parent[2*p+1] = max(parent[2*p+1], child[2*c+1]);
+            }
+        zRange.push_back(parent);
+        zRangeRes.push_back(std::make_pair(pw, ph));
+        w = pw;
+        h = ph;
+    }
 }
 
 
 Heightfield::~Heightfield() {
     delete[] z;
+    Mutex::Destroy(areaMutex);
 }
 
 
-BBox Heightfield::ObjectBound() const {
-    float minz = z[0], maxz = z[0];
-    for (int i = 1; i < nx*ny; ++i) {
-        if (z[i] < minz) minz = z[i];
-        if (z[i] > maxz) maxz = z[i];
+void Heightfield::InitAreaCdfs() const {
+    if (areaCdfsReady) return;
+    MutexLock lock(*areaMutex);
+    if (areaCdfsReady) return;
+    // Compute cumulative areas of rows and of triangles within each row
+    int nRowTris = 2 * (nx - 1);
+    rowAreaCdf.resize(ny - 1);
+    triAreaCdf.resize((ny - 1) * nRowTris);
+    float area = 0.f;
+    for (int y = 0; y < ny - 1; ++y) {
+        float rowArea = 0.f;
+        for (int i = 0; i < nRowTris; ++i) {
+            rowArea += CellArea(i / 2, y, i % 2);
+            triAreaCdf[y * nRowTris + i] = rowArea;
+        }
+        area += rowArea;
+        rowAreaCdf[y] = area;
     }
-    return BBox(Point(0,0,minz), Point(1,1,maxz));
+    AtomicAdd(&areaCdfsReady, 1);
 }
 
 
-bool Heightfield::CanIntersect() const {
-    return false;
+BBox Heightfield::ObjectBound() const {
+    if (zRange.size() == 0)
+        return BBox(Point(0, 0, min(min(z[0], z[1]), min(z[2], z[3]))),
+                    Point(1, 1, max(max(z[0], z[1]), max(z[2], z[3]))));
+    return BBox(Point(0,0,zRange.back()[0]), Point(1,1,zRange.back()[1]));
 }
 
 
-void Heightfield::Refine(vector<Reference<Shape> > &refined) const {
-    int ntris = 2*(nx-1)*(ny-1);
-    refined.reserve(ntris);
-    int *verts = new int[3*ntris];
-    Point *P = new Point[nx*ny];
-    float *uvs = new float[2*nx*ny];
-    int nverts = nx*ny;
-    int x, y;
-    // Compute heightfield vertex positions
-    int pos = 0;
-    for (y = 0; y < ny; ++y) {
-        for (x = 0; x < nx; ++x) {
-            P[pos].x = uvs[2*pos]   = (float)x / (float)(nx-1);
-            P[pos].y = uvs[2*pos+1] = (float)y / (float)(ny-1);
-            P[pos].z = z[pos];
-            ++pos;
+bool Heightfield::FindHit(const Ray &ray, bool anyHit, int *cell, int *tri,
+        float *tHit, float *b1, float *b2) const {
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    float invX = 1.f / float(nx - 1), invY = 1.f / float(ny - 1);
+    float maxt = ray.maxt;
+    bool hit = false;
+
+    // Traverse $z$ range hierarchy, visiting nearer children first
+    HeightfieldNode todo[128];
+    int todoOffset = 0;
+    todo[todoOffset++] = HeightfieldNode(int(zRange.size()), 0, 0);
+    while (todoOffset > 0) {
+        HeightfieldNode node = todo[--todoOffset];
+        int size = 1 << node.level;
+        int x0 = node.x * size, y0 = node.y * size;
+        int x1 = min(x0 + size, nx - 1), y1 = min(y0 + size, ny - 1);
+        if (node.level > 0) {
+            // Test ray against node's bounds and enqueue its children
+            const vector<float> &zr = zRange[node.level - 1];
+            int n = node.y * zRangeRes[node.level - 1].first + node.x;
+            BBox bounds(Point(x0 * invX, y0 * invY, zr[2*n]),
+                        Point(x1 * invX, y1 * invY, zr[2*n+1]));
+            if (!IntersectBound(bounds, ray, invDir, dirIsNeg, maxt))
+                continue;
+            int half = size / 2;
+            for (int i = 3; i >= 0; --i) {
+                int cx = (i & 1) ^ dirIsNeg[0], cy = (i >> 1) ^ dirIsNeg[1];
+                if (x0 + cx * half < nx - 1 && y0 + cy * half < ny - 1)
+                    todo[todoOffset++] = HeightfieldNode(node.level - 1,
+                        2 * node.x + cx, 2 * node.y + cy);
+            }
+            continue;
         }
-    }
 
-    // Fill in heightfield vertex offset array
-    int *vp = verts;
-    for (y = 0; y < ny-1; ++y) {
-        for (x = 0; x < nx-1; ++x) {
-#define VERT(x,y) ((x)+(y)*nx)
-            *vp++ = VERT(x, y);
-            *vp++ = VERT(x+1, y);
-            *vp++ = VERT(x+1, y+1);
-    
-            *vp++ = VERT(x, y);
-            *vp++ = VERT(x+1, y+1);
-            *vp++ = VERT(x, y+1);
+        // Intersect ray with the cell's two triangles
+        Point p00(x0 * invX, y0 * invY, z[VERT(x0, y0)]);
+        Point p10(x1 * invX, y0 * invY, z[VERT(x1, y0)]);
+        Point p11(x1 * invX, y1 * invY, z[VERT(x1, y1)]);
+        Point p01(x0 * invX, y1 * invY, z[VERT(x0, y1)]);
+        float t, u, v;
+        for (int i = 0; i < 2; ++i) {
+            if (IntersectTriangle(ray, p00, i == 0 ? p10 : p11,
+                                  i == 0 ? p11 : p01, maxt, &t, &u, &v)) {
+                maxt = t;
+                *cell = VERT(x0, y0);
+                *tri = i;
+                *tHit = t;
+                *b1 = u;
+                *b2 = v;
+                hit = true;
+                if (anyHit) return true;
+            }
         }
-#undef VERT
     }
-    ParamSet paramSet;
-    paramSet.AddInt("indices", verts, 3*ntris);
-    paramSet.AddFloat("uv", uvs, 2 * nverts);
-    paramSet.AddPoint("P", P, nverts);
-    refined.push_back(CreateTriangleMeshShape(ObjectToWorld, WorldToObject, ReverseOrientation, paramSet));
-    delete[] P;
-    delete[] uvs;
-    delete[] verts;
+    return hit;
+}
+
+
+bool Heightfield::Intersect(const Ray &r, float *tHit, float *rayEpsilon,
+                            DifferentialGeometry *dg) const {
+    // Transform _Ray_ to object space and find closest hit
+    Ray ray;
+    (*WorldToObject)(r, &ray);
+    int cell, tri;
+    float t, b1, b2;
+    if (!FindHit(ray, false, &cell, &tri, &t, &b1, &b2))
+        return false;
+
+    // Get triangle vertices and $(u,v)$ for hit triangle
+    int x = cell % nx, y = cell / nx;
+    float uvs[3][2] = {
+        { x / float(nx - 1), y / float(ny - 1) },
+        { (x + 1) / float(nx - 1), (y + tri) / float(ny - 1) },
+        { (x + 1 - tri) / float(nx - 1), (y + 1) / float(ny - 1) } };
+    float zs[3] = { z[VERT(x, y)], z[VERT(x + 1, y + tri)],
+                    z[VERT(x + 1 - tri, y + 1)] };
+    Point p1(uvs[0][0], uvs[0][1], zs[0]);
+    Point p2(uvs[1][0], uvs[1][1], zs[1]);
+    Point p3(uvs[2][0], uvs[2][1], zs[2]);
+
+    // Compute triangle partial derivatives
+    float du1 = uvs[0][0] - uvs[2][0];
+    float du2 = uvs[1][0] - uvs[2][0];
+    float dv1 = uvs[0][1] - uvs[2][1];
+    float dv2 = uvs[1][1] - uvs[2][1];
+    Vector dp1 = p1 - p3, dp2 = p2 - p3;
+    float invdet = 1.f / (du1 * dv2 - dv1 * du2);
+    Vector dpdu = ( dv2 * dp1 - dv1 * dp2) * invdet;
+    Vector dpdv = (-du2 * dp1 + du1 * dp2) * invdet;
+
+    // Interpolate $(u,v)$ triangle parametric coordinates
+    float b0 = 1 - b1 - b2;
+    float tu = b0*uvs[0][0] + b1*uvs[1][0] + b2*uvs[2][0];
+    float tv = b0*uvs[0][1] + b1*uvs[1][1] + b2*uvs[2][1];
+
+    // Fill in _DifferentialGeometry_ from heightfield hit
+    const Transform &o2w = *ObjectToWorld;
+    *dg = DifferentialGeometry(r(t), o2w(dpdu), o2w(dpdv),
+                               Normal(0,0,0), Normal(0,0,0), tu, tv, this);
+    *tHit = t;
+    *rayEpsilon = 1e-3f * *tHit;
+    return true;
+}
+
+
+bool Heightfield::IntersectP(const Ray &r) const {
+    Ray ray;
+    (*WorldToObject)(r, &ray);
+    int cell, tri;
+    float t, b1, b2;
+    return FindHit(ray, true, &cell, &tri, &t, &b1, &b2);
+}
+
+
+float Heightfield::CellArea(int x, int y, int tri) const {
+    Point p1 = (*ObjectToWorld)(Point(x / float(nx - 1), y / float(ny - 1),
+                                      z[VERT(x, y)]));
+    Point p2 = (*ObjectToWorld)(Point((x + 1) / float(nx - 1),
+        (y + tri) / float(ny - 1), z[VERT(x + 1, y + tri)]));
+    Point p3 = (*ObjectToWorld)(Point((x + 1 - tri) / float(nx - 1),
+        (y + 1) / float(ny - 1), z[VERT(x + 1 - tri, y + 1)]));
+    return 0.5f * Cross(p2-p1, p3-p1).Length();
+}
+
+
+float Heightfield::Area() const {
+    InitAreaCdfs();
+    return rowAreaCdf.back();
+}
+
+
+Point Heightfield::Sample(float u1, float u2, Normal *Ns) const {
+    // Find row and then triangle in proportion to area
+    float a = u1 * Area();
+    int y = min(int(std::upper_bound(rowAreaCdf.begin(), rowAreaCdf.end(), a) -
+                    rowAreaCdf.begin()), ny - 2);
+    a -= (y > 0) ? rowAreaCdf[y-1] : 0.f;
+    int nRowTris = 2 * (nx - 1);
+    vector<float>::const_iterator row = triAreaCdf.begin() + y * nRowTris;
+    int i = min(int(std::upper_bound(row, row + nRowTris, a) - row),
+                nRowTris - 1);
+    float triStart = (i > 0) ? row[i-1] : 0.f, triArea = row[i] - triStart;
+    int x = i / 2, tri = i % 2;
+    u1 = (triArea > 0.f) ? Clamp((a - triStart) / triArea, 0.f, OneMinusEpsilon)
+                         : 0.f;
+
+    // Sample point on chosen triangle
+    float b1, b2;
+    UniformSampleTriangle(u1, u2, &b1, &b2);
+    const Transform &o2w = *ObjectToWorld;
+    Point p1 = o2w(Point(x / float(nx - 1), y / float(ny - 1),
+                         z[VERT(x, y)]));
+    Point p2 = o2w(Point((x + 1) / float(nx - 1), (y + tri) / float(ny - 1),
+                         z[VERT(x + 1, y + tri)]));
+    Point p3 = o2w(Point((x + 1 - tri) / float(nx - 1),
+                         (y + 1) / float(ny - 1), z[VERT(x + 1 - tri, y + 1)]));
+    Point p = b1 * p1 + b2 * p2 + (1.f - b1 - b2) * p3;
+    *Ns = Normalize(Normal(Cross(p2-p1, p3-p1)));
+    if (ReverseOrientation) *Ns *= -1.f;
+    return p;
 }
 
 
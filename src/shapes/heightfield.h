@@ -38,6 +38,7 @@
 
 // shapes/heightfield.h*
 #include "shape.h"
+#include "parallel.h"
 
 // Heightfield Declarations
 class Heightfield : public Shape {
@@ -45,13 +46,28 @@ public:
     // Heightfield Public Methods
     Heightfield(const Transform *o2, const Transform *w2o, bool ro, int nu, int nv, const float *zs);
     ~Heightfield();
-    bool CanIntersect() const;
-    void Refine(vector<Reference<Shape> > &refined) const;
     BBox ObjectBound() const;
+    bool Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
+                   DifferentialGeometry *dg) const;
+    bool IntersectP(const Ray &ray) const;
+    float Area() const;
+    Point Sample(float u1, float u2, Normal *Ns) const;
 private:
+    // Heightfield Private Methods
+    float CellArea(int x, int y, int tri) const;
+    void InitAreaCdfs() const;
+    bool FindHit(const Ray &ray, bool anyHit, int *cell, int *tri,
+                 float *tHit, float *b1, float *b2) const;
+
     // Heightfield Private Data
     float *z;
     int nx, ny;
+    vector<vector<float> > zRange;
+    vector<std::pair<int, int> > zRangeRes;
+    // Area CDFs are built on first use; only emissive heightfields need them
+    mutable vector<float> rowAreaCdf, triAreaCdf;
+    mutable AtomicInt32 areaCdfsReady;
+    Mutex *areaMutex;
 };
 
 
@@ -34,11 +34,11 @@
 #include "stdafx.h"
 #include "shapes/loopsubdiv.h"
 #include "shapes/trianglemesh.h"
+#include "shapes/tessutil.h"
+#include "montecarlo.h"
+#include "parallel.h"
 #include "paramset.h"
-#include <set>
-#include <map>
-using std::set;
-using std::map;
+#include <algorithm>
 
 // LoopSubdiv Macros
 #define NEXT(i) (((i)+1)%3)
@@ -46,7 +46,6 @@ using std::map;
 
 // LoopSubdiv Local Structures
 struct SDFace;
-struct SDFace;
 struct SDVertex {
     // SDVertex Constructor
     SDVertex(Point pt = Point(0,0,0))
@@ -107,23 +106,127 @@ struct SDFace {
 };
 
 
-struct SDEdge {
-    // SDEdge Constructor
-    SDEdge(SDVertex *v0 = NULL, SDVertex *v1 = NULL) {
-        v[0] = min(v0, v1);
-        v[1] = max(v0, v1);
-        f[0] = f[1] = NULL;
-        f0edgeNum = -1;
+// EdgeTable maps an undirected edge, given by its vertex indices, to a
+// dense edge id using open addressing; it replaces the _std::set_ of
+// edges that used to be rebuilt for every level of subdivision.
+class EdgeTable {
+public:
+    // EdgeTable Public Methods
+    EdgeTable(int nFaces) {
+        uint32_t capacity = RoundUpPow2(max(16, 4 * nFaces));
+        slots.resize(capacity, -1);
+        mask = capacity - 1;
+        ends.reserve(6 * nFaces);
     }
-
-    // SDEdge Comparison Function
-    bool operator<(const SDEdge &e2) const {
-        if (v[0] == e2.v[0]) return v[1] < e2.v[1];
-        return v[0] < e2.v[0];
+    int Lookup(int v0, int v1, bool *isNew) {
+        if (v0 > v1) std::swap(v0, v1);
+        uint32_t h = uint32_t(v0) * 0x9e3779b1u + uint32_t(v1);
+        h ^= h >> 15;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        for (h &= mask; ; h = (h + 1) & mask) {
+            int id = slots[h];
+            if (id == -1) {
+                // Add new edge to table
+                id = slots[h] = int(ends.size() / 2);
+                ends.push_back(v0);
+                ends.push_back(v1);
+                *isNew = true;
+                return id;
+            }
+            if (ends[2*id] == v0 && ends[2*id+1] == v1) {
+                *isNew = false;
+                return id;
+            }
+        }
     }
-    SDVertex *v[2];
-    SDFace *f[2];
-    int f0edgeNum;
+    int Size() const { return int(ends.size() / 2); }
+private:
+    // EdgeTable Private Data
+    vector<int> slots, ends;
+    uint32_t mask;
+};
+
+
+// LoopLevel holds the part of one subdivision level that is needed to
+// compute a single patch: the patch's own faces and their one-ring.
+struct LoopLevel {
+    vector<Point> P;
+    vector<float> uv;
+    vector<int> indices;
+    vector<int> leafIndex;
+};
+
+
+// LoopTessellation holds a patch subdivided to its level and pushed to
+// the limit surface.  Leaf triangles are stored in quadtree order, so the
+// bounds of the quadtree's interior nodes form a four-wide BVH.
+struct LoopTessellation : public ReferenceCounted {
+    // LoopTessellation Public Methods
+    int NumTriangles() const { return int(indices.size() / 3); }
+
+    // LoopTessellation Public Data
+    int level;
+    vector<Point> P;
+    vector<Normal> N;
+    vector<float> uv;
+    vector<int> indices;
+    vector<BBox> nodeBounds;
+    vector<float> areaCdf;
+    float area;
+    AtomicInt32 lastUse;
+};
+
+
+// LoopControlMesh is the input mesh with the adjacency needed to gather a
+// face's one-ring, shared by all of a _LoopSubdiv_'s patches along with a
+// least-recently-used cache of their tessellations.
+struct LoopControlMesh : public ReferenceCounted {
+    // LoopControlMesh Public Methods
+    LoopControlMesh(int nfaces, int nvertices, const int *vi,
+                    const Point *P, int maxCachedTriangles);
+    void OneRing(int face, LoopLevel *level) const;
+    BBox PatchBound(int face) const;
+    Reference<LoopTessellation> GetTessellation(int face) const;
+    Reference<LoopTessellation> Tessellate(int face) const;
+
+    // LoopControlMesh Public Data
+    int nFaces;
+    vector<Point> P;
+    vector<int> vertexIndices, neighbors, faceLevels;
+    vector<int> vertexFaceOffsets, vertexFaces;
+    const Transform *ObjectToWorld;
+
+    mutable TessellationCache<LoopTessellation> cache;
+};
+
+
+// LoopPatch is the lazily tessellated limit surface of one face of the
+// control mesh.
+class LoopPatch : public Shape {
+public:
+    // LoopPatch Public Methods
+    LoopPatch(const Transform *o2w, const Transform *w2o, bool ro,
+              const Reference<LoopControlMesh> &m, int f);
+    BBox ObjectBound() const;
+    BBox WorldBound() const;
+    bool Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
+                   DifferentialGeometry *dg) const;
+    bool IntersectP(const Ray &ray) const;
+    void GetShadingGeometry(const Transform &obj2world,
+            const DifferentialGeometry &dg,
+            DifferentialGeometry *dgShading) const;
+    float Area() const;
+    Point Sample(float u1, float u2, Normal *Ns) const;
+private:
+    // LoopPatch Private Methods
+    int IntersectLeaves(const LoopTessellation &tess, Ray &ray,
+                        bool anyHit, float *b1, float *b2) const;
+
+    // LoopPatch Private Data
+    Reference<LoopControlMesh> mesh;
+    int face;
+    BBox worldBound;
 };
 
 
@@ -151,64 +254,151 @@ inline int SDVertex::valence() {
 }
 
 
+static inline float beta(int valence) {
+    if (valence == 3) return 3.f/16.f;
+    else return 3.f / (8.f * valence);
+}
 
-// LoopSubdiv Method Definitions
-LoopSubdiv::LoopSubdiv(const Transform *o2w, const Transform *w2o,
-                       bool ro, int nfaces, int nvertices,
-                       const int *vertexIndices, const Point *P, int nl)
-    : Shape(o2w, w2o, ro) {
-    nLevels = nl;
-    // Allocate _LoopSubdiv_ vertices and faces
-    int i;
-    SDVertex *verts = new SDVertex[nvertices];
-    for (i = 0; i < nvertices; ++i) {
-        verts[i] = SDVertex(P[i]);
-        vertices.push_back(&verts[i]);
-    }
-    SDFace *fs = new SDFace[nfaces];
-    for (i = 0; i < nfaces; ++i)
-        faces.push_back(&fs[i]);
 
+static inline float gamma(int valence) {
+    return 1.f / (valence + 3.f / (8.f * beta(valence)));
+}
+
+
+// LoopSubdiv Local Functions
+static Point weightOneRing(SDVertex *vert, float beta) {
+    // Put _vert_ one-ring in _Pring_
+    int valence = vert->valence();
+    Point *Pring = ALLOCA(Point, valence);
+    vert->oneRing(Pring);
+    Point P = (1 - valence * beta) * vert->P;
+    for (int i = 0; i < valence; ++i)
+        P += beta * Pring[i];
+    return P;
+}
+
+
+void SDVertex::oneRing(Point *P) {
+    if (!boundary) {
+        // Get one-ring vertices for interior vertex
+        SDFace *face = startFace;
+        do {
+            *P++ = face->nextVert(this)->P;
+            face = face->nextFace(this);
+        } while (face != startFace);
+    }
+    else {
+        // Get one-ring vertices for boundary vertex
+        SDFace *face = startFace, *f2;
+        while ((f2 = face->nextFace(this)) != NULL)
+            face = f2;
+        *P++ = face->nextVert(this)->P;
+        do {
+            *P++ = face->prevVert(this)->P;
+            face = face->prevFace(this);
+        } while (face != NULL);
+    }
+}
+
+
+static Point weightBoundary(SDVertex *vert, float beta) {
+    // Put _vert_ one-ring in _Pring_
+    int valence = vert->valence();
+    Point *Pring = ALLOCA(Point, valence);
+    vert->oneRing(Pring);
+    Point P = (1-2*beta) * vert->P;
+    P += beta * Pring[0];
+    P += beta * Pring[valence-1];
+    return P;
+}
+
+
+static Normal limitNormal(SDVertex *vert) {
+    // Put _vert_ one-ring in _Pring_
+    Vector S(0,0,0), T(0,0,0);
+    int valence = vert->valence();
+    Point *Pring = ALLOCA(Point, valence);
+    vert->oneRing(Pring);
+    if (!vert->boundary) {
+        // Compute tangents of interior face
+        for (int k = 0; k < valence; ++k) {
+            S += cosf(2.f*M_PI*k/valence) * Vector(Pring[k]);
+            T += sinf(2.f*M_PI*k/valence) * Vector(Pring[k]);
+        }
+    } else {
+        // Compute tangents of boundary face
+        S = Pring[valence-1] - Pring[0];
+        if (valence == 2)
+            T = Vector(Pring[0] + Pring[1] - 2 * vert->P);
+        else if (valence == 3)
+            T = Pring[1] - vert->P;
+        else if (valence == 4) // regular
+            T = Vector(-1*Pring[0] + 2*Pring[1] + 2*Pring[2] +
+                       -1*Pring[3] + -2*vert->P);
+        else {
+            float theta = M_PI / float(valence-1);
+            T = Vector(sinf(theta) * (Pring[0] + Pring[valence-1]));
+            for (int k = 1; k < valence-1; ++k) {
+                float wt = (2*cosf(theta) - 2) * sinf((k) * theta);
+                T += Vector(wt * Pring[k]);
+            }
+            T = -T;
+        }
+    }
+    return Normal(Cross(S, T));
+}
+
+
+static void pushToLimit(SDVertex *vert, Point *P, Normal *N) {
+    if (vert->boundary)
+        *P = weightBoundary(vert, 1.f/5.f);
+    else
+        *P = weightOneRing(vert, gamma(vert->valence()));
+    *N = limitNormal(vert);
+}
+
+
+static void buildTopology(const LoopLevel &level, vector<SDVertex> &verts,
+        vector<SDFace> &faces, vector<int> &faceEdges, EdgeTable &edges) {
     // Set face to vertex pointers
-    const int *vp = vertexIndices;
-    for (i = 0; i < nfaces; ++i) {
-        SDFace *f = faces[i];
+    uint32_t nfaces = faces.size();
+    for (uint32_t i = 0; i < verts.size(); ++i)
+        verts[i].P = level.P[i];
+    for (uint32_t i = 0; i < nfaces; ++i) {
         for (int j = 0; j < 3; ++j) {
-            SDVertex *v = vertices[vp[j]];
-            f->v[j] = v;
-            v->startFace = f;
+            SDVertex *v = &verts[level.indices[3*i+j]];
+            faces[i].v[j] = v;
+            v->startFace = &faces[i];
         }
-        vp += 3;
     }
 
     // Set neighbor pointers in _faces_
-    set<SDEdge> edges;
-    for (i = 0; i < nfaces; ++i) {
-        SDFace *f = faces[i];
+    vector<int> openEdges;
+    openEdges.reserve(3 * nfaces);
+    for (uint32_t i = 0; i < nfaces; ++i) {
         for (int edgeNum = 0; edgeNum < 3; ++edgeNum) {
             // Update neighbor pointer for _edgeNum_
-            int v0 = edgeNum, v1 = NEXT(edgeNum);
-            SDEdge e(f->v[v0], f->v[v1]);
-            if (edges.find(e) == edges.end()) {
-                // Handle new edge
-                e.f[0] = f;
-                e.f0edgeNum = edgeNum;
-                edges.insert(e);
-            }
-            else {
+            bool isNew;
+            int e = edges.Lookup(level.indices[3*i+edgeNum],
+                                 level.indices[3*i+NEXT(edgeNum)], &isNew);
+            faceEdges[3*i+edgeNum] = e;
+            if (isNew)
+                openEdges.push_back(3*i+edgeNum);
+            else if (openEdges[e] >= 0) {
                 // Handle previously seen edge
-                e = *edges.find(e);
-                e.f[0]->f[e.f0edgeNum] = f;
-                f->f[edgeNum] = e.f[0];
-                edges.erase(e);
+                SDFace *f0 = &faces[openEdges[e] / 3];
+                f0->f[openEdges[e] % 3] = &faces[i];
+                faces[i].f[edgeNum] = f0;
+                openEdges[e] = -1;
             }
         }
     }
 
     // Finish vertex initialization
-    for (i = 0; i < nvertices; ++i) {
-        SDVertex *v = vertices[i];
+    for (uint32_t i = 0; i < verts.size(); ++i) {
+        SDVertex *v = &verts[i];
         SDFace *f = v->startFace;
+        if (!f) continue;
         do {
             f = f->nextFace(v);
         } while (f && f != v->startFace);
@@ -223,24 +413,341 @@ LoopSubdiv::LoopSubdiv(const Transform *o2w, const Transform *w2o,
 }
 
 
+static void subdivideLevel(const LoopLevel &cur, LoopLevel *next) {
+    uint32_t nv = cur.P.size(), nf = cur.indices.size() / 3;
+    vector<SDVertex> verts(nv);
+    vector<SDFace> faces(nf);
+    vector<int> faceEdges(3 * nf);
+    EdgeTable edges(nf);
+    buildTopology(cur, verts, faces, faceEdges, edges);
+    uint32_t ne = edges.Size();
+
+    // Update vertex positions for even vertices
+    vector<Point> P(nv + ne);
+    vector<float> uv(2 * (nv + ne));
+    for (uint32_t j = 0; j < nv; ++j) {
+        SDVertex *v = &verts[j];
+        if (!v->startFace)
+            P[j] = v->P;
+        else if (!v->boundary) {
+            // Apply one-ring rule for even vertex
+            if (v->regular)
+                P[j] = weightOneRing(v, 1.f/16.f);
+            else
+                P[j] = weightOneRing(v, beta(v->valence()));
+        }
+        else {
+            // Apply boundary rule for even vertex
+            P[j] = weightBoundary(v, 1.f/8.f);
+        }
+        uv[2*j] = cur.uv[2*j];
+        uv[2*j+1] = cur.uv[2*j+1];
+    }
+
+    // Compute new odd edge vertices
+    vector<bool> edgeDone(ne, false);
+    for (uint32_t j = 0; j < nf; ++j) {
+        SDFace *face = &faces[j];
+        for (int k = 0; k < 3; ++k) {
+            // Compute odd vertex on _k_th edge
+            int e = faceEdges[3*j+k];
+            if (edgeDone[e]) continue;
+            edgeDone[e] = true;
+            SDVertex *v0 = face->v[k], *v1 = face->v[NEXT(k)];
+            Point &Pe = P[nv + e];
+            if (!face->f[k]) {
+                Pe =  0.5f * v0->P;
+                Pe += 0.5f * v1->P;
+            }
+            else {
+                Pe =  3.f/8.f * v0->P;
+                Pe += 3.f/8.f * v1->P;
+                Pe += 1.f/8.f * face->otherVert(v0, v1)->P;
+                Pe += 1.f/8.f * face->f[k]->otherVert(v0, v1)->P;
+            }
+            int i0 = cur.indices[3*j+k], i1 = cur.indices[3*j+NEXT(k)];
+            uv[2*(nv+e)] = 0.5f * (cur.uv[2*i0] + cur.uv[2*i1]);
+            uv[2*(nv+e)+1] = 0.5f * (cur.uv[2*i0+1] + cur.uv[2*i1+1]);
+        }
+    }
+
+    // Split faces, tracking quadtree position of the patch's own faces
+    vector<int> childIndices(12 * nf), childLeaf(4 * nf);
+    vector<bool> patchVertex(nv + ne, false);
+    for (uint32_t j = 0; j < nf; ++j) {
+        int *c = &childIndices[12*j];
+        for (int k = 0; k < 3; ++k) {
+            c[3*k+k] = cur.indices[3*j+k];
+            c[3*k+NEXT(k)] = nv + faceEdges[3*j+k];
+            c[3*NEXT(k)+k] = nv + faceEdges[3*j+k];
+            c[9+k] = nv + faceEdges[3*j+k];
+        }
+        for (int k = 0; k < 4; ++k) {
+            childLeaf[4*j+k] = (cur.leafIndex[j] >= 0) ?
+                4 * cur.leafIndex[j] + k : -1;
+            if (childLeaf[4*j+k] >= 0)
+                for (int i = 0; i < 3; ++i)
+                    patchVertex[c[3*k+i]] = true;
+        }
+    }
+
+    // Keep child faces that touch the patch and compact their vertices
+    vector<int> remap(nv + ne, -1);
+    next->P.clear();
+    next->uv.clear();
+    next->indices.clear();
+    next->leafIndex.clear();
+    for (uint32_t j = 0; j < 4 * nf; ++j) {
+        const int *c = &childIndices[3*j];
+        if (!patchVertex[c[0]] && !patchVertex[c[1]] && !patchVertex[c[2]])
+            continue;
+        for (int i = 0; i < 3; ++i) {
+            if (remap[c[i]] == -1) {
+                remap[c[i]] = int(next->P.size());
+                next->P.push_back(P[c[i]]);
+                next->uv.push_back(uv[2*c[i]]);
+                next->uv.push_back(uv[2*c[i]+1]);
+            }
+            next->indices.push_back(remap[c[i]]);
+        }
+        next->leafIndex.push_back(childLeaf[j]);
+    }
+}
+
+
+
+// LoopControlMesh Method Definitions
+LoopControlMesh::LoopControlMesh(int nfaces, int nvertices, const int *vi,
+        const Point *Pt, int maxCached)
+    : nFaces(nfaces), P(Pt, Pt + nvertices),
+      vertexIndices(vi, vi + 3 * nfaces), neighbors(3 * nfaces, -1),
+      faceLevels(nfaces, 0), ObjectToWorld(NULL) {
+    // Set neighbor indices for faces
+    EdgeTable edges(nFaces);
+    vector<int> openEdges;
+    openEdges.reserve(3 * nFaces);
+    for (int i = 0; i < nFaces; ++i) {
+        for (int edgeNum = 0; edgeNum < 3; ++edgeNum) {
+            bool isNew;
+            int e = edges.Lookup(vi[3*i+edgeNum], vi[3*i+NEXT(edgeNum)],
+                                 &isNew);
+            if (isNew)
+                openEdges.push_back(3*i+edgeNum);
+            else if (openEdges[e] >= 0) {
+                neighbors[openEdges[e]] = i;
+                neighbors[3*i+edgeNum] = openEdges[e] / 3;
+                openEdges[e] = -1;
+            }
+        }
+    }
+
+    // Find the faces incident to each vertex
+    vertexFaceOffsets.resize(nvertices + 1, 0);
+    for (int i = 0; i < 3 * nFaces; ++i)
+        ++vertexFaceOffsets[vi[i] + 1];
+    for (int i = 0; i < nvertices; ++i)
+        vertexFaceOffsets[i+1] += vertexFaceOffsets[i];
+    vertexFaces.resize(3 * nFaces);
+    vector<int> fill(vertexFaceOffsets.begin(), vertexFaceOffsets.end() - 1);
+    for (int i = 0; i < 3 * nFaces; ++i)
+        vertexFaces[fill[vi[i]]++] = i / 3;
+    cache.Init(nFaces, maxCached);
+}
+
+
+Reference<LoopTessellation> LoopControlMesh::GetTessellation(int face) const {
+    Reference<LoopTessellation> tess = cache.Lookup(face);
+    if (tess) return tess;
+    return cache.Insert(face, Tessellate(face));
+}
+
+
+void LoopControlMesh::OneRing(int face, LoopLevel *levelp) const {
+    // Gather faces sharing a vertex with _face_, starting with _face_
+    LoopLevel &level = *levelp;
+    vector<int> ringFaces(1, face), ringVerts;
+    for (int i = 0; i < 3; ++i) {
+        int v = vertexIndices[3*face+i];
+        for (int j = vertexFaceOffsets[v]; j < vertexFaceOffsets[v+1]; ++j)
+            if (std::find(ringFaces.begin(), ringFaces.end(),
+                          vertexFaces[j]) == ringFaces.end())
+                ringFaces.push_back(vertexFaces[j]);
+    }
+    for (uint32_t i = 0; i < ringFaces.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            int v = vertexIndices[3*ringFaces[i]+j];
+            int local = int(std::find(ringVerts.begin(), ringVerts.end(), v) -
+                            ringVerts.begin());
+            if (local == int(ringVerts.size())) {
+                ringVerts.push_back(v);
+                level.P.push_back(P[v]);
+                level.uv.push_back(0.f);
+                level.uv.push_back(0.f);
+            }
+            level.indices.push_back(local);
+        }
+        level.leafIndex.push_back(i == 0 ? 0 : -1);
+    }
+    const float cornerUV[3][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 } };
+    for (int i = 0; i < 3; ++i) {
+        level.uv[2*level.indices[i]] = cornerUV[i][0];
+        level.uv[2*level.indices[i]+1] = cornerUV[i][1];
+    }
+}
+
+
+BBox LoopControlMesh::PatchBound(int face) const {
+    // Bound limit surface by control points that influence it two levels down
+    LoopLevel level;
+    OneRing(face, &level);
+    for (int i = 0; i < min(2, faceLevels[face]); ++i) {
+        LoopLevel next;
+        subdivideLevel(level, &next);
+        std::swap(level, next);
+    }
+    BBox bound;
+    for (uint32_t i = 0; i < level.P.size(); ++i)
+        bound = Union(bound, (*ObjectToWorld)(level.P[i]));
+    return bound;
+}
+
+
+Reference<LoopTessellation> LoopControlMesh::Tessellate(int face) const {
+    // Subdivide one-ring of _face_ to the patch's level
+    LoopLevel level;
+    OneRing(face, &level);
+    int nLevels = faceLevels[face];
+    for (int i = 0; i < nLevels; ++i) {
+        LoopLevel next;
+        subdivideLevel(level, &next);
+        std::swap(level, next);
+    }
+
+    // Push the patch's vertices to the limit surface
+    uint32_t nv = level.P.size(), nf = level.indices.size() / 3;
+    vector<SDVertex> verts(nv);
+    vector<SDFace> faces(nf);
+    vector<int> faceEdges(3 * nf);
+    EdgeTable edges(nf);
+    buildTopology(level, verts, faces, faceEdges, edges);
+    int nLeaves = 1 << (2 * nLevels);
+    vector<int> leafFace(nLeaves, -1), remap(nv, -1);
+    Reference<LoopTessellation> tess = new LoopTessellation;
+    tess->level = nLevels;
+    for (uint32_t j = 0; j < nf; ++j)
+        if (level.leafIndex[j] >= 0) leafFace[level.leafIndex[j]] = j;
+    tess->indices.resize(3 * nLeaves);
+    for (int leaf = 0; leaf < nLeaves; ++leaf) {
+        for (int k = 0; k < 3; ++k) {
+            int v = level.indices[3*leafFace[leaf]+k];
+            if (remap[v] == -1) {
+                remap[v] = int(tess->P.size());
+                tess->P.push_back(Point());
+                tess->N.push_back(Normal());
+                pushToLimit(&verts[v], &tess->P.back(), &tess->N.back());
+                tess->uv.push_back(level.uv[2*v]);
+                tess->uv.push_back(level.uv[2*v+1]);
+            }
+            tess->indices[3*leaf+k] = remap[v];
+        }
+    }
+
+    // Snap vertices on edges shared with coarser patches to avoid cracks
+    int nSegments = 1 << nLevels;
+    for (int edge = 0; edge < 3; ++edge) {
+        int nbr = neighbors[3*face+edge];
+        if (nbr < 0 || faceLevels[nbr] >= nLevels) continue;
+        int step = 1 << (nLevels - faceLevels[nbr]);
+        vector<int> edgeVerts(nSegments + 1, -1);
+        for (uint32_t i = 0; i < tess->P.size(); ++i) {
+            // Compute integer barycentric grid coordinates of vertex in _face_
+            int u = Round2Int(tess->uv[2*i] * nSegments);
+            int v = Round2Int(tess->uv[2*i+1] * nSegments);
+            int b[3] = { nSegments - u, u - v, v };
+            if (b[PREV(edge)] == 0)
+                edgeVerts[b[NEXT(edge)]] = i;
+        }
+        for (int j = 0; j < nSegments; ++j) {
+            if (j % step == 0) continue;
+            int j0 = j - j % step, j1 = j0 + step;
+            float t = float(j - j0) / float(step);
+            int v = edgeVerts[j], v0 = edgeVerts[j0], v1 = edgeVerts[j1];
+            Assert(v >= 0 && v0 >= 0 && v1 >= 0);
+            if (v < 0 || v0 < 0 || v1 < 0) continue;
+            tess->P[v] = (1.f - t) * tess->P[v0] + t * tess->P[v1];
+            tess->N[v] = (1.f - t) * tess->N[v0] + t * tess->N[v1];
+        }
+    }
+    for (uint32_t i = 0; i < tess->P.size(); ++i)
+        tess->P[i] = (*ObjectToWorld)(tess->P[i]);
+
+    // Compute quadtree node bounds and leaf areas
+    int nInterior = (nLeaves - 1) / 3;
+    tess->nodeBounds.resize(nInterior);
+    tess->areaCdf.resize(nLeaves);
+    tess->area = 0.f;
+    for (int leaf = 0; leaf < nLeaves; ++leaf) {
+        const Point &p1 = tess->P[tess->indices[3*leaf]];
+        const Point &p2 = tess->P[tess->indices[3*leaf+1]];
+        const Point &p3 = tess->P[tess->indices[3*leaf+2]];
+        tess->area += 0.5f * Cross(p2-p1, p3-p1).Length();
+        tess->areaCdf[leaf] = tess->area;
+        if (nInterior > 0)
+            tess->nodeBounds[(nInterior + leaf - 1) / 4] =
+                Union(Union(tess->nodeBounds[(nInterior + leaf - 1) / 4],
+                            p1), Union(BBox(p2), p3));
+    }
+    for (int node = nInterior - 1; node > 0; --node)
+        tess->nodeBounds[(node - 1) / 4] =
+            Union(tess->nodeBounds[(node - 1) / 4], tess->nodeBounds[node]);
+    return tess;
+}
+
+
+
+// LoopSubdiv Method Definitions
+LoopSubdiv::LoopSubdiv(const Transform *o2w, const Transform *w2o,
+                       bool ro, int nfaces, int nvertices,
+                       const int *vertexIndices, const Point *P, int nl,
+                       float el, int maxCachedTriangles)
+    : Shape(o2w, w2o, ro), nLevels(nl), edgeLength(el) {
+    mesh = new LoopControlMesh(nfaces, nvertices, vertexIndices, P,
+                               maxCachedTriangles);
+    mesh->ObjectToWorld = o2w;
+
+    // Choose subdivision level for each face from its world-space size
+    for (int i = 0; i < nfaces; ++i) {
+        int level = nl;
+        if (edgeLength > 0.f) {
+            float maxEdge = 0.f;
+            for (int k = 0; k < 3; ++k)
+                maxEdge = max(maxEdge,
+                    Distance((*o2w)(P[vertexIndices[3*i+k]]),
+                             (*o2w)(P[vertexIndices[3*i+NEXT(k)]])));
+            for (level = 0; level < nl && maxEdge > edgeLength; ++level)
+                maxEdge *= 0.5f;
+        }
+        mesh->faceLevels[i] = level;
+    }
+}
+
+
 LoopSubdiv::~LoopSubdiv() {
-    delete[] vertices[0];
-    delete[] faces[0];
 }
 
 
 BBox LoopSubdiv::ObjectBound() const {
     BBox b;
-    for (uint32_t i = 0; i < vertices.size(); i++)
-        b = Union(b, vertices[i]->P);
+    for (uint32_t i = 0; i < mesh->P.size(); i++)
+        b = Union(b, mesh->P[i]);
     return b;
 }
 
 
 BBox LoopSubdiv::WorldBound() const {
     BBox b;
-    for (uint32_t i = 0; i < vertices.size(); i++)
-        b = Union(b, (*ObjectToWorld)(vertices[i]->P));
+    for (uint32_t i = 0; i < mesh->P.size(); i++)
+        b = Union(b, (*ObjectToWorld)(mesh->P[i]));
     return b;
 }
 
@@ -251,250 +758,229 @@ bool LoopSubdiv::CanIntersect() const {
 
 
 void LoopSubdiv::Refine(vector<Reference<Shape> > &refined) const {
-    vector<SDFace *> f = faces;
-    vector<SDVertex *> v = vertices;
-    MemoryArena arena;
-    for (int i = 0; i < nLevels; ++i) {
-        // Update _f_ and _v_ for next level of subdivision
-        vector<SDFace *> newFaces;
-        vector<SDVertex *> newVertices;
-
-        // Allocate next level of children in mesh tree
-        for (uint32_t j = 0; j < v.size(); ++j) {
-            v[j]->child = arena.Alloc<SDVertex>();
-            v[j]->child->regular = v[j]->regular;
-            v[j]->child->boundary = v[j]->boundary;
-            newVertices.push_back(v[j]->child);
+    float nTris = mesh->nFaces * powf(4.f, nLevels);
+    if (edgeLength <= 0.f && nTris <= mesh->cache.MaxTriangles()) {
+        // Subdivide whole mesh up front if it fits in the cache budget
+        LoopLevel level;
+        level.P = mesh->P;
+        level.uv.resize(2 * mesh->P.size(), 0.f);
+        level.indices = mesh->vertexIndices;
+        level.leafIndex.resize(mesh->nFaces, 0);
+        for (int i = 0; i < nLevels; ++i) {
+            LoopLevel next;
+            subdivideLevel(level, &next);
+            std::swap(level, next);
         }
-        for (uint32_t j = 0; j < f.size(); ++j)
-            for (int k = 0; k < 4; ++k) {
-                f[j]->children[k] = arena.Alloc<SDFace>();
-                newFaces.push_back(f[j]->children[k]);
-            }
 
-        // Update vertex positions and create new edge vertices
+        // Push vertices to limit surface
+        uint32_t nv = level.P.size(), nf = level.indices.size() / 3;
+        vector<SDVertex> verts(nv);
+        vector<SDFace> faces(nf);
+        vector<int> faceEdges(3 * nf);
+        EdgeTable edges(nf);
+        buildTopology(level, verts, faces, faceEdges, edges);
+        vector<Point> Plimit(nv);
+        vector<Normal> Ns(nv);
+        for (uint32_t i = 0; i < nv; ++i)
+            pushToLimit(&verts[i], &Plimit[i], &Ns[i]);
+
+        // Create _TriangleMesh_ from subdivision mesh
+        ParamSet paramSet;
+        paramSet.AddInt("indices", &level.indices[0], 3*nf);
+        paramSet.AddPoint("P", &Plimit[0], nv);
+        paramSet.AddNormal("N", &Ns[0], nv);
+        refined.push_back(CreateTriangleMeshShape(ObjectToWorld,
+                WorldToObject, ReverseOrientation, paramSet));
+        return;
+    }
 
-        // Update vertex positions for even vertices
-        for (uint32_t j = 0; j < v.size(); ++j) {
-            if (!v[j]->boundary) {
-                // Apply one-ring rule for even vertex
-                if (v[j]->regular)
-                    v[j]->child->P = weightOneRing(v[j], 1.f/16.f);
-                else
-                    v[j]->child->P = weightOneRing(v[j], beta(v[j]->valence()));
-            }
-            else {
-                // Apply boundary rule for even vertex
-                v[j]->child->P = weightBoundary(v[j], 1.f/8.f);
-            }
-        }
+    // Create lazily tessellated _LoopPatch_ for each face
+    refined.reserve(refined.size() + mesh->nFaces);
+    for (int i = 0; i < mesh->nFaces; ++i)
+        refined.push_back(new LoopPatch(ObjectToWorld, WorldToObject,
+                                        ReverseOrientation, mesh, i));
+}
 
-        // Compute new odd edge vertices
-        map<SDEdge, SDVertex *> edgeVerts;
-        for (uint32_t j = 0; j < f.size(); ++j) {
-            SDFace *face = f[j];
-            for (int k = 0; k < 3; ++k) {
-                // Compute odd vertex on _k_th edge
-                SDEdge edge(face->v[k], face->v[NEXT(k)]);
-                SDVertex *vert = edgeVerts[edge];
-                if (!vert) {
-                    // Create and initialize new odd vertex
-                    vert = arena.Alloc<SDVertex>();
-                    newVertices.push_back(vert);
-                    vert->regular = true;
-                    vert->boundary = (face->f[k] == NULL);
-                    vert->startFace = face->children[3];
-
-                    // Apply edge rules to compute new vertex position
-                    if (vert->boundary) {
-                        vert->P =  0.5f * edge.v[0]->P;
-                        vert->P += 0.5f * edge.v[1]->P;
-                    }
-                    else {
-                        vert->P =  3.f/8.f * edge.v[0]->P;
-                        vert->P += 3.f/8.f * edge.v[1]->P;
-                        vert->P += 1.f/8.f * face->otherVert(edge.v[0], edge.v[1])->P;
-                        vert->P += 1.f/8.f *
-                            face->f[k]->otherVert(edge.v[0], edge.v[1])->P;
-                    }
-                    edgeVerts[edge] = vert;
-                }
-            }
-        }
 
-        // Update new mesh topology
 
-        // Update even vertex face pointers
-        for (uint32_t j = 0; j < v.size(); ++j) {
-            SDVertex *vert = v[j];
-            int vertNum = vert->startFace->vnum(vert);
-            vert->child->startFace =
-                vert->startFace->children[vertNum];
-        }
+// LoopPatch Method Definitions
+LoopPatch::LoopPatch(const Transform *o2w, const Transform *w2o, bool ro,
+                     const Reference<LoopControlMesh> &m, int f)
+    : Shape(o2w, w2o, ro), mesh(m), face(f) {
+    worldBound = mesh->PatchBound(face);
+}
 
-        // Update face neighbor pointers
-        for (uint32_t j = 0; j < f.size(); ++j) {
-            SDFace *face = f[j];
-            for (int k = 0; k < 3; ++k) {
-                // Update children _f_ pointers for siblings
-                face->children[3]->f[k] = face->children[NEXT(k)];
-                face->children[k]->f[NEXT(k)] = face->children[3];
-
-                // Update children _f_ pointers for neighbor children
-                SDFace *f2 = face->f[k];
-                face->children[k]->f[k] =
-                    f2 ? f2->children[f2->vnum(face->v[k])] : NULL;
-                f2 = face->f[PREV(k)];
-                face->children[k]->f[PREV(k)] =
-                    f2 ? f2->children[f2->vnum(face->v[k])] : NULL;
-            }
-        }
 
-        // Update face vertex pointers
-        for (uint32_t j = 0; j < f.size(); ++j) {
-            SDFace *face = f[j];
-            for (int k = 0; k < 3; ++k) {
-                // Update child vertex pointer to new even vertex
-                face->children[k]->v[k] = face->v[k]->child;
-
-                // Update child vertex pointer to new odd vertex
-                SDVertex *vert = edgeVerts[SDEdge(face->v[k], face->v[NEXT(k)])];
-                face->children[k]->v[NEXT(k)] = vert;
-                face->children[NEXT(k)]->v[k] = vert;
-                face->children[3]->v[k] = vert;
-            }
-        }
+BBox LoopPatch::ObjectBound() const {
+    return (*WorldToObject)(worldBound);
+}
 
-        // Prepare for next level of subdivision
-        f = newFaces;
-        v = newVertices;
-    }
-    // Push vertices to limit surface
-    Point *Plimit = new Point[v.size()];
-    for (uint32_t i = 0; i < v.size(); ++i) {
-        if (v[i]->boundary)
-            Plimit[i] =  weightBoundary(v[i], 1.f/5.f);
-        else
-            Plimit[i] =  weightOneRing(v[i], gamma(v[i]->valence()));
-    }
-    for (uint32_t i = 0; i < v.size(); ++i)
-        v[i]->P = Plimit[i];
-
-    // Compute vertex tangents on limit surface
-    vector<Normal> Ns;
-    Ns.reserve(v.size());
-    vector<Point> Pring(16, Point());
-    for (uint32_t i = 0; i < v.size(); ++i) {
-        SDVertex *vert = v[i];
-        Vector S(0,0,0), T(0,0,0);
-        int valence = vert->valence();
-        if (valence > (int)Pring.size())
-            Pring.resize(valence);
-        vert->oneRing(&Pring[0]);
-        if (!vert->boundary) {
-            // Compute tangents of interior face
-            for (int k = 0; k < valence; ++k) {
-                S += cosf(2.f*M_PI*k/valence) * Vector(Pring[k]);
-                T += sinf(2.f*M_PI*k/valence) * Vector(Pring[k]);
-            }
-        } else {
-            // Compute tangents of boundary face
-            S = Pring[valence-1] - Pring[0];
-            if (valence == 2)
-                T = Vector(Pring[0] + Pring[1] - 2 * vert->P);
-            else if (valence == 3)
-                T = Pring[1] - vert->P;
-            else if (valence == 4) // regular
-                T = Vector(-1*Pring[0] + 2*Pring[1] + 2*Pring[2] +
-                           -1*Pring[3] + -2*vert->P);
-            else {
-                float theta = M_PI / float(valence-1);
-                T = Vector(sinf(theta) * (Pring[0] + Pring[valence-1]));
-                for (int k = 1; k < valence-1; ++k) {
-                    float wt = (2*cosf(theta) - 2) * sinf((k) * theta);
-                    T += Vector(wt * Pring[k]);
-                }
-                T = -T;
-            }
+
+BBox LoopPatch::WorldBound() const {
+    return worldBound;
+}
+
+
+int LoopPatch::IntersectLeaves(const LoopTessellation &tess, Ray &ray,
+        bool anyHit, float *b1, float *b2) const {
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    int nInterior = int(tess.nodeBounds.size()), hitLeaf = -1;
+    int todo[64], todoOffset = 0;
+    todo[todoOffset++] = 0;
+    while (todoOffset > 0) {
+        int node = todo[--todoOffset];
+        if (node < nInterior) {
+            // Enqueue children of interior node if ray hits its bounds
+            if (IntersectBound(tess.nodeBounds[node], ray, invDir, dirIsNeg,
+                               ray.maxt))
+                for (int c = 4; c >= 1; --c)
+                    todo[todoOffset++] = 4 * node + c;
+            continue;
         }
-        Ns.push_back(Normal(Cross(S, T)));
-    }
-
-    // Create _TriangleMesh_ from subdivision mesh
-    uint32_t ntris = uint32_t(f.size());
-    int *verts = new int[3*ntris];
-    int *vp = verts;
-    uint32_t totVerts = uint32_t(v.size());
-    map<SDVertex *, int> usedVerts;
-    for (uint32_t i = 0; i < totVerts; ++i)
-        usedVerts[v[i]] = i;
-    for (uint32_t i = 0; i < ntris; ++i) {
-        for (int j = 0; j < 3; ++j) {
-            *vp = usedVerts[f[i]->v[j]];
-            ++vp;
+        // Intersect ray with leaf triangle
+        int leaf = node - nInterior;
+        float t, u, v;
+        if (IntersectTriangle(ray, tess.P[tess.indices[3*leaf]],
+                              tess.P[tess.indices[3*leaf+1]],
+                              tess.P[tess.indices[3*leaf+2]], ray.maxt,
+                              &t, &u, &v)) {
+            ray.maxt = t;
+            *b1 = u;
+            *b2 = v;
+            hitLeaf = leaf;
+            if (anyHit) break;
         }
     }
-    ParamSet paramSet;
-    paramSet.AddInt("indices", verts, 3*ntris);
-    paramSet.AddPoint("P", Plimit, totVerts);
-    paramSet.AddNormal("N", &Ns[0], int(Ns.size()));
-    refined.push_back(CreateTriangleMeshShape(ObjectToWorld,
-            WorldToObject, ReverseOrientation, paramSet));
-    delete[] verts;
-    delete[] Plimit;
+    return hitLeaf;
 }
 
 
-Point LoopSubdiv::weightOneRing(SDVertex *vert, float beta) {
-    // Put _vert_ one-ring in _Pring_
-    int valence = vert->valence();
-    Point *Pring = ALLOCA(Point, valence);
-    vert->oneRing(Pring);
-    Point P = (1 - valence * beta) * vert->P;
-    for (int i = 0; i < valence; ++i)
-        P += beta * Pring[i];
-    return P;
+bool LoopPatch::Intersect(const Ray &r, float *tHit, float *rayEpsilon,
+                          DifferentialGeometry *dg) const {
+    Reference<LoopTessellation> tess = mesh->GetTessellation(face);
+    Ray ray(r);
+    float b1, b2;
+    int leaf = IntersectLeaves(*tess.GetPtr(), ray, false, &b1, &b2);
+    if (leaf < 0)
+        return false;
+
+    // Compute triangle partial derivatives
+    const int *vi = &tess->indices[3*leaf];
+    const Point &p1 = tess->P[vi[0]], &p2 = tess->P[vi[1]], &p3 = tess->P[vi[2]];
+    const float *uv0 = &tess->uv[2*vi[0]], *uv1 = &tess->uv[2*vi[1]],
+                *uv2 = &tess->uv[2*vi[2]];
+    float du1 = uv0[0] - uv2[0], du2 = uv1[0] - uv2[0];
+    float dv1 = uv0[1] - uv2[1], dv2 = uv1[1] - uv2[1];
+    Vector dp1 = p1 - p3, dp2 = p2 - p3;
+    float invdet = 1.f / (du1 * dv2 - dv1 * du2);
+    Vector dpdu = ( dv2 * dp1 - dv1 * dp2) * invdet;
+    Vector dpdv = (-du2 * dp1 + du1 * dp2) * invdet;
+
+    // Fill in _DifferentialGeometry_ from patch hit
+    float b0 = 1 - b1 - b2;
+    float tu = b0*uv0[0] + b1*uv1[0] + b2*uv2[0];
+    float tv = b0*uv0[1] + b1*uv1[1] + b2*uv2[1];
+    *dg = DifferentialGeometry(ray(ray.maxt), dpdu, dpdv,
+                               Normal(0,0,0), Normal(0,0,0), tu, tv, this);
+    *tHit = ray.maxt;
+    *rayEpsilon = 1e-3f * *tHit;
+    return true;
 }
 
 
-void SDVertex::oneRing(Point *P) {
-    if (!boundary) {
-        // Get one-ring vertices for interior vertex
-        SDFace *face = startFace;
-        do {
-            *P++ = face->nextVert(this)->P;
-            face = face->nextFace(this);
-        } while (face != startFace);
+bool LoopPatch::IntersectP(const Ray &r) const {
+    Reference<LoopTessellation> tess = mesh->GetTessellation(face);
+    Ray ray(r);
+    float b1, b2;
+    return IntersectLeaves(*tess.GetPtr(), ray, true, &b1, &b2) >= 0;
+}
+
+
+void LoopPatch::GetShadingGeometry(const Transform &obj2world,
+        const DifferentialGeometry &dg,
+        DifferentialGeometry *dgShading) const {
+    Reference<LoopTessellation> tess = mesh->GetTessellation(face);
+    // Find leaf triangle containing $(u,v)$ by descending the quadtree
+    float b[3] = { 1.f - dg.u, dg.u - dg.v, dg.v };
+    int leaf = 0;
+    for (int level = 0; level < tess->level; ++level) {
+        int child = 3;
+        for (int k = 0; k < 3; ++k)
+            if (b[k] >= 0.5f) { child = k; break; }
+        float c[3];
+        for (int k = 0; k < 3; ++k) {
+            if (child == 3) c[k] = 1.f - 2.f * b[PREV(k)];
+            else if (k == child) c[k] = 2.f * b[k] - 1.f;
+            else c[k] = 2.f * b[k];
+        }
+        b[0] = c[0]; b[1] = c[1]; b[2] = c[2];
+        leaf = 4 * leaf + child;
     }
-    else {
-        // Get one-ring vertices for boundary vertex
-        SDFace *face = startFace, *f2;
-        while ((f2 = face->nextFace(this)) != NULL)
-            face = f2;
-        *P++ = face->nextVert(this)->P;
-        do {
-            *P++ = face->prevVert(this)->P;
-            face = face->prevFace(this);
-        } while (face != NULL);
+
+    // Use limit normals to compute shading tangents _ss_ and _ts_
+    const int *vi = &tess->indices[3*leaf];
+    const Normal &n0 = tess->N[vi[0]], &n1 = tess->N[vi[1]],
+                 &n2 = tess->N[vi[2]];
+    Normal ns = Normalize(obj2world(b[0] * n0 + b[1] * n1 + b[2] * n2));
+    Vector ss = Normalize(dg.dpdu);
+    Vector ts = Cross(ss, ns);
+    if (ts.LengthSquared() > 0.f) {
+        ts = Normalize(ts);
+        ss = Cross(ts, ns);
     }
+    else
+        CoordinateSystem((Vector)ns, &ss, &ts);
+
+    // Compute $\dndu$ and $\dndv$ for patch shading geometry
+    const float *uv0 = &tess->uv[2*vi[0]], *uv1 = &tess->uv[2*vi[1]],
+                *uv2 = &tess->uv[2*vi[2]];
+    float du1 = uv0[0] - uv2[0], du2 = uv1[0] - uv2[0];
+    float dv1 = uv0[1] - uv2[1], dv2 = uv1[1] - uv2[1];
+    Normal dn1 = n0 - n2, dn2 = n1 - n2;
+    float invdet = 1.f / (du1 * dv2 - dv1 * du2);
+    Normal dndu = ( dv2 * dn1 - dv1 * dn2) * invdet;
+    Normal dndv = (-du2 * dn1 + du1 * dn2) * invdet;
+    *dgShading = DifferentialGeometry(dg.p, ss, ts,
+        obj2world(dndu), obj2world(dndv), dg.u, dg.v, dg.shape);
+    dgShading->dudx = dg.dudx;  dgShading->dvdx = dg.dvdx;
+    dgShading->dudy = dg.dudy;  dgShading->dvdy = dg.dvdy;
+    dgShading->dpdx = dg.dpdx;  dgShading->dpdy = dg.dpdy;
 }
 
 
-Point LoopSubdiv::weightBoundary(SDVertex *vert, float beta) {
-    // Put _vert_ one-ring in _Pring_
-    int valence = vert->valence();
-    Point *Pring = ALLOCA(Point, valence);
-    vert->oneRing(Pring);
-    Point P = (1-2*beta) * vert->P;
-    P += beta * Pring[0];
-    P += beta * Pring[valence-1];
-    return P;
+float LoopPatch::Area() const {
+    return mesh->GetTessellation(face)->area;
+}
+
+
+Point LoopPatch::Sample(float u1, float u2, Normal *Ns) const {
+    Reference<LoopTessellation> tess = mesh->GetTessellation(face);
+    // Choose leaf triangle in proportion to its area
+    const vector<float> &cdf = tess->areaCdf;
+    float a = u1 * tess->area;
+    int leaf = min(int(std::upper_bound(cdf.begin(), cdf.end(), a) -
+                       cdf.begin()), int(cdf.size()) - 1);
+    float a0 = leaf > 0 ? cdf[leaf-1] : 0.f;
+    u1 = min((a - a0) / (cdf[leaf] - a0), OneMinusEpsilon);
+
+    // Sample point on leaf triangle
+    float b1, b2;
+    UniformSampleTriangle(u1, u2, &b1, &b2);
+    const int *vi = &tess->indices[3*leaf];
+    const Point &p1 = tess->P[vi[0]], &p2 = tess->P[vi[1]], &p3 = tess->P[vi[2]];
+    Point p = b1 * p1 + b2 * p2 + (1.f - b1 - b2) * p3;
+    *Ns = Normalize(Normal(Cross(p2-p1, p3-p1)));
+    if (ReverseOrientation) *Ns *= -1.f;
+    return p;
 }
 
 
 LoopSubdiv *CreateLoopSubdivShape(const Transform *o2w, const Transform *w2o,
         bool reverseOrientation, const ParamSet &params) {
     int nlevels = params.FindOneInt("nlevels", 3);
+    float edgeLength = params.FindOneFloat("edgelength", 0.f);
+    int maxCachedTriangles = params.FindOneInt("cachetriangles", 1 << 20);
     int nps, nIndices;
     const int *vi = params.FindInt("indices", &nIndices);
     const Point *P = params.FindPoint("P", &nps);
@@ -504,7 +990,6 @@ LoopSubdiv *CreateLoopSubdivShape(const Transform *o2w, const Transform *w2o,
     string scheme = params.FindOneString("scheme", "loop");
 
     return new LoopSubdiv(o2w, w2o, reverseOrientation, nIndices/3, nps,
-        vi, P, nlevels);
+        vi, P, nlevels, edgeLength, maxCachedTriangles);
 }
 
-
@@ -38,8 +38,7 @@
 
 // shapes/loopsubdiv.h*
 #include "shape.h"
-struct SDVertex;
-struct SDFace;
+struct LoopControlMesh;
 
 // LoopSubdiv Declarations
 class LoopSubdiv : public Shape {
@@ -47,28 +46,18 @@ public:
     // LoopSubdiv Public Methods
     LoopSubdiv(const Transform *o2w, const Transform *w2o, bool ro,
                int nt, int nv, const int *vi,
-               const Point *P, int nlevels);
+               const Point *P, int nlevels, float edgeLength,
+               int maxCachedTriangles);
     ~LoopSubdiv();
     bool CanIntersect() const;
     void Refine(vector<Reference<Shape> > &refined) const;
     BBox ObjectBound() const;
     BBox WorldBound() const;
 private:
-    // LoopSubdiv Private Methods
-    static float beta(int valence) {
-        if (valence == 3) return 3.f/16.f;
-        else return 3.f / (8.f * valence);
-    }
-    static Point weightOneRing(SDVertex *vert, float beta);
-    static Point weightBoundary(SDVertex *vert, float beta);
-    static float gamma(int valence) {
-        return 1.f / (valence + 3.f / (8.f * beta(valence)));
-    }
-
     // LoopSubdiv Private Data
+    Reference<LoopControlMesh> mesh;
     int nLevels;
-    vector<SDVertex *> vertices;
-    vector<SDFace *> faces;
+    float edgeLength;
 };
 
 
@@ -34,8 +34,12 @@
 #include "stdafx.h"
 #include "shapes/nurbs.h"
 #include "shapes/trianglemesh.h"
+#include "shapes/tessutil.h"
+#include "montecarlo.h"
+#include "parallel.h"
 #include "paramset.h"
 #include "texture.h"
+#include <algorithm>
 
 // NURBS Evaluation Functions
 static int KnotOffset(const float *knot, int order, int np, float t) {
@@ -150,12 +154,788 @@ NURBSEvaluateSurface(int uOrder, const float *uKnot, int ucp, float u,
 
 
 
+// NURBS Local Declarations
+struct NURBSGridNode {
+    BBox bounds;
+    int offset;
+};
+
+
+// NURBSTessellation holds one patch diced into a grid of world-space
+// points and object-space normals, with a BVH over the grid cells built by
+// splitting the grid in half along its longer side.
+struct NURBSTessellation : public ReferenceCounted {
+    // NURBSTessellation Public Methods
+    int NumTriangles() const { return 2 * nU * nV; }
+
+    // NURBSTessellation Public Data
+    int nU, nV;
+    vector<Point> P;
+    vector<Normal> N;
+    vector<NURBSGridNode> nodes;
+    vector<float> areaCdf;
+    float area;
+    AtomicInt32 lastUse;
+};
+
+
+// NURBSPatchDomain is the part of a NURBS's parametric range that lies
+// inside one knot span in each direction.
+struct NURBSPatchDomain {
+    float u0, u1, v0, v1;
+    int uDice, vDice;
+    BBox worldBound;
+};
+
+
+// NURBSSurface holds a NURBS's homogeneous control points and the rational
+// Bezier form of each of its patches, shared by all of the surface's
+// _NURBSPatch_es along with a least-recently-used cache of their
+// tessellations.
+struct NURBSSurface : public ReferenceCounted {
+    // NURBSSurface Public Methods
+    NURBSSurface(const Transform *o2w, int nu, int uorder, const float *uknot,
+                 float umin, float umax, int nv, int vorder,
+                 const float *vknot, float vmin, float vmax, const float *P,
+                 bool isHomogeneous, float edgeLength, int maxCachedTriangles);
+    Point Evaluate(float u, float v, Vector *dPdu, Vector *dPdv) const {
+        return NURBSEvaluateSurface(uorder, &uknot[0], nu, u, vorder,
+                                    &vknot[0], nv, v, &Pw[0], dPdu, dPdv);
+    }
+    Reference<NURBSTessellation> GetTessellation(int patch) const;
+    Reference<NURBSTessellation> Tessellate(int patch) const;
+
+    // NURBSSurface Public Data
+    int nu, uorder, nv, vorder;
+    vector<float> uknot, vknot;
+    vector<Homogeneous3> Pw;
+    vector<NURBSPatchDomain> patches;
+    vector<Homogeneous3> bezier;
+    const Transform *ObjectToWorld;
+
+    mutable TessellationCache<NURBSTessellation> cache;
+};
+
+
+// NURBSPatch is the part of a NURBS inside one pair of knot spans, either
+// tessellated when a ray first reaches its bound or intersected directly
+// with Bezier clipping.
+class NURBSPatch : public Shape {
+public:
+    // NURBSPatch Public Methods
+    NURBSPatch(const Transform *o2w, const Transform *w2o, bool ro,
+               const Reference<NURBSSurface> &s, int p, bool bezierClip);
+    BBox ObjectBound() const;
+    BBox WorldBound() const;
+    bool Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
+                   DifferentialGeometry *dg) const;
+    bool IntersectP(const Ray &ray) const;
+    void GetShadingGeometry(const Transform &obj2world,
+            const DifferentialGeometry &dg,
+            DifferentialGeometry *dgShading) const;
+    float Area() const;
+    Point Sample(float u1, float u2, Normal *Ns) const;
+private:
+    // NURBSPatch Private Methods
+    int IntersectCells(const NURBSTessellation &tess, Ray &ray,
+                       bool anyHit, float *b1, float *b2) const;
+    bool ClipIntersect(const Ray &ray, bool anyHit, float *tHit,
+                       float *uHit, float *vHit) const;
+    void VertexUV(const NURBSTessellation &tess, int vertex,
+                  float uv[2]) const;
+
+    // NURBSPatch Private Data
+    Reference<NURBSSurface> surface;
+    int patch;
+    bool bezierClip;
+};
+
+
+struct NURBSClipRegion {
+    float u0, u1, v0, v1;
+};
+
+
+
+// NURBS Local Functions
+static inline Homogeneous3 Blend(float t, const Homogeneous3 &a,
+                                 const Homogeneous3 &b) {
+    return Homogeneous3((1.f - t) * a.x + t * b.x, (1.f - t) * a.y + t * b.y,
+                        (1.f - t) * a.z + t * b.z, (1.f - t) * a.w + t * b.w);
+}
+
+
+static void BSplineSpanToBezier(int order, const float *knot, int span,
+        const Homogeneous3 *cp, int cpStride, Homogeneous3 *bez,
+        int bezStride) {
+    // Evaluate the span's blossom at its endpoints with de Boor's algorithm
+    int p = order - 1;
+    Homogeneous3 *d = ALLOCA(Homogeneous3, order);
+    for (int i = 0; i < order; ++i) {
+        for (int j = 0; j < order; ++j)
+            d[j] = cp[j * cpStride];
+        for (int r = 1; r <= p; ++r) {
+            float t = (r <= p - i) ? knot[span] : knot[span + 1];
+            for (int j = p; j >= r; --j) {
+                float alpha = (t - knot[span - p + j]) /
+                    (knot[span + 1 + j - r] - knot[span - p + j]);
+                d[j] = Blend(alpha, d[j-1], d[j]);
+            }
+        }
+        bez[i * bezStride] = d[p];
+    }
+}
+
+
+static void RestrictBezier(Homogeneous3 *cp, int n, int stride,
+                           float t0, float t1) {
+    // Keep part of curve before _t1_ with de Casteljau subdivision
+    if (t1 < 1.f)
+        for (int r = 1; r < n; ++r)
+            for (int i = n - 1; i >= r; --i)
+                cp[i*stride] = Blend(t1, cp[(i-1)*stride], cp[i*stride]);
+
+    // Keep part of remaining curve after _t0_
+    float s = t1 > 0.f ? t0 / t1 : 0.f;
+    if (s > 0.f)
+        for (int r = 1; r < n; ++r)
+            for (int i = 0; i < n - r; ++i)
+                cp[i*stride] = Blend(s, cp[i*stride], cp[(i+1)*stride]);
+}
+
+
+static void RestrictBezierPatch(Homogeneous3 *cp, int ou, int ov,
+        float u0, float u1, float v0, float v1) {
+    if (u0 > 0.f || u1 < 1.f)
+        for (int j = 0; j < ov; ++j)
+            RestrictBezier(cp + j * ou, ou, 1, u0, u1);
+    if (v0 > 0.f || v1 < 1.f)
+        for (int i = 0; i < ou; ++i)
+            RestrictBezier(cp + i, ov, ou, v0, v1);
+}
+
+
+static bool ClipBezierPatch(const Homogeneous3 *cp, int ou, int ov,
+                            bool clipU, float *t0, float *t1) {
+    // Find line through origin along the patch's other direction
+    int n = clipU ? ou : ov, m = clipU ? ov : ou;
+    int si = clipU ? 1 : ou, sj = clipU ? ou : 1;
+#define CP(i, j) cp[(i) * si + (j) * sj]
+#define CPX(i, j) (CP(i, j).x / CP(i, j).w)
+#define CPY(i, j) (CP(i, j).y / CP(i, j).w)
+    float lx = CPX(0, m-1) - CPX(0, 0) + CPX(n-1, m-1) - CPX(n-1, 0);
+    float ly = CPY(0, m-1) - CPY(0, 0) + CPY(n-1, m-1) - CPY(n-1, 0);
+    if (lx == 0.f && ly == 0.f) {
+        *t0 = 0.f;
+        *t1 = 1.f;
+        return true;
+    }
+
+    // Bound signed distance to line at each control point column
+    float *lo = ALLOCA(float, n), *hi = ALLOCA(float, n);
+    for (int i = 0; i < n; ++i) {
+        lo[i] = INFINITY;
+        hi[i] = -INFINITY;
+        for (int j = 0; j < m; ++j) {
+            float dist = ly * CP(i, j).x - lx * CP(i, j).y;
+            lo[i] = min(lo[i], dist);
+            hi[i] = max(hi[i], dist);
+        }
+    }
+#undef CP
+#undef CPX
+#undef CPY
+
+    // Intersect convex hull of distance bounds with zero
+    float tmin = INFINITY, tmax = -INFINITY;
+    for (int k = 0; k < 2 * n; ++k) {
+        float xk = float(k / 2) / float(n - 1);
+        float yk = (k & 1) ? hi[k / 2] : lo[k / 2];
+        if (yk == 0.f) {
+            tmin = min(tmin, xk);
+            tmax = max(tmax, xk);
+            continue;
+        }
+        for (int l = k + 1; l < 2 * n; ++l) {
+            float yl = (l & 1) ? hi[l / 2] : lo[l / 2];
+            if (yl == 0.f || (yk < 0.f) == (yl < 0.f)) continue;
+            float xl = float(l / 2) / float(n - 1);
+            float x = xk + (xl - xk) * yk / (yk - yl);
+            tmin = min(tmin, x);
+            tmax = max(tmax, x);
+        }
+    }
+    if (tmin > tmax) return false;
+    *t0 = max(0.f, tmin - 1e-5f);
+    *t1 = min(1.f, tmax + 1e-5f);
+    return true;
+}
+
+
+static inline void GridTriangle(int nU, int tri, int vi[3]) {
+    int cell = tri / 2, u = cell % nU, v = cell / nU;
+    int v00 = v * (nU + 1) + u, v01 = v00 + nU + 1;
+    vi[0] = v00;
+    vi[1] = (tri & 1) ? v01 + 1 : v00 + 1;
+    vi[2] = (tri & 1) ? v01 : v01 + 1;
+}
+
+
+static BBox BuildGridNodes(NURBSTessellation *tess, int u0, int v0,
+                           int u1, int v1) {
+    int node = int(tess->nodes.size());
+    tess->nodes.push_back(NURBSGridNode());
+    BBox bounds;
+    if (u1 - u0 == 1 && v1 - v0 == 1) {
+        // Bound a single grid cell
+        int v00 = v0 * (tess->nU + 1) + u0, v01 = v00 + tess->nU + 1;
+        bounds = Union(Union(BBox(tess->P[v00]), tess->P[v00 + 1]),
+                       Union(BBox(tess->P[v01]), tess->P[v01 + 1]));
+        tess->nodes[node].offset = ~(v0 * tess->nU + u0);
+    }
+    else if (u1 - u0 >= v1 - v0) {
+        int um = (u0 + u1) / 2;
+        bounds = BuildGridNodes(tess, u0, v0, um, v1);
+        tess->nodes[node].offset = int(tess->nodes.size());
+        bounds = Union(bounds, BuildGridNodes(tess, um, v0, u1, v1));
+    }
+    else {
+        int vm = (v0 + v1) / 2;
+        bounds = BuildGridNodes(tess, u0, v0, u1, vm);
+        tess->nodes[node].offset = int(tess->nodes.size());
+        bounds = Union(bounds, BuildGridNodes(tess, u0, vm, u1, v1));
+    }
+    tess->nodes[node].bounds = bounds;
+    return bounds;
+}
+
+
+static inline Normal SurfaceNormal(const NURBSSurface &surface,
+                                   float u, float v) {
+    Vector dpdu, dpdv;
+    surface.Evaluate(u, v, &dpdu, &dpdv);
+    Vector n = Cross(dpdu, dpdv);
+    return n.LengthSquared() > 0.f ? Normal(Normalize(n)) : Normal(0, 0, 0);
+}
+
+
+
+// NURBSSurface Method Definitions
+NURBSSurface::NURBSSurface(const Transform *o2w, int numu, int uo,
+        const float *uk, float u0, float u1, int numv, int vo,
+        const float *vk, float v0, float v1, const float *P,
+        bool isHomogeneous, float edgeLength, int maxCached)
+    : nu(numu), uorder(uo), nv(numv), vorder(vo), uknot(uk, uk + numu + uo),
+      vknot(vk, vk + numv + vo), Pw(numu * numv), ObjectToWorld(o2w) {
+    // Store control points in homogeneous form
+    for (int i = 0; i < nu * nv; ++i) {
+        if (isHomogeneous)
+            Pw[i] = Homogeneous3(P[4*i], P[4*i+1], P[4*i+2], P[4*i+3]);
+        else
+            Pw[i] = Homogeneous3(P[3*i], P[3*i+1], P[3*i+2], 1.f);
+    }
+
+    // Find knot spans that overlap the NURBS's parametric range
+    vector<int> uSpans, vSpans;
+    for (int k = uorder - 1; k < nu; ++k)
+        if (uknot[k] < uknot[k+1] && uknot[k] < u1 && uknot[k+1] > u0)
+            uSpans.push_back(k);
+    for (int k = vorder - 1; k < nv; ++k)
+        if (vknot[k] < vknot[k+1] && vknot[k] < v1 && vknot[k+1] > v0)
+            vSpans.push_back(k);
+
+    // Convert each pair of knot spans to a rational Bezier patch
+    int nus = int(uSpans.size()), nvs = int(vSpans.size());
+    int np = uorder * vorder;
+    patches.resize(nus * nvs);
+    bezier.resize(nus * nvs * np);
+    vector<float> uLength(nus, 0.f), vLength(nvs, 0.f);
+    Homogeneous3 *rows = ALLOCA(Homogeneous3, np);
+    for (int b = 0; b < nvs; ++b) {
+        for (int a = 0; a < nus; ++a) {
+            int ku = uSpans[a], kv = vSpans[b];
+            NURBSPatchDomain &d = patches[b * nus + a];
+            d.u0 = max(uknot[ku], u0);
+            d.u1 = min(uknot[ku+1], u1);
+            d.v0 = max(vknot[kv], v0);
+            d.v1 = min(vknot[kv+1], v1);
+            Homogeneous3 *bez = &bezier[(b * nus + a) * np];
+            for (int j = 0; j < vorder; ++j)
+                BSplineSpanToBezier(uorder, &uknot[0], ku,
+                    &Pw[(kv - vorder + 1 + j) * nu + ku - uorder + 1], 1,
+                    rows + j * uorder, 1);
+            for (int i = 0; i < uorder; ++i)
+                BSplineSpanToBezier(vorder, &vknot[0], kv, rows + i, uorder,
+                                    bez + i, uorder);
+            float du = uknot[ku+1] - uknot[ku], dv = vknot[kv+1] - vknot[kv];
+            RestrictBezierPatch(bez, uorder, vorder,
+                (d.u0 - uknot[ku]) / du, (d.u1 - uknot[ku]) / du,
+                (d.v0 - vknot[kv]) / dv, (d.v1 - vknot[kv]) / dv);
+
+            // Bound patch and measure its control polygon in world space
+            vector<Point> Pe(np);
+            for (int i = 0; i < np; ++i) {
+                Pe[i] = (*ObjectToWorld)(Point(bez[i].x / bez[i].w,
+                    bez[i].y / bez[i].w, bez[i].z / bez[i].w));
+                d.worldBound = Union(d.worldBound, Pe[i]);
+            }
+            for (int j = 0; j < vorder; ++j) {
+                float len = 0.f;
+                for (int i = 0; i < uorder - 1; ++i)
+                    len += Distance(Pe[j*uorder+i], Pe[j*uorder+i+1]);
+                uLength[a] = max(uLength[a], len);
+            }
+            for (int i = 0; i < uorder; ++i) {
+                float len = 0.f;
+                for (int j = 0; j < vorder - 1; ++j)
+                    len += Distance(Pe[j*uorder+i], Pe[(j+1)*uorder+i]);
+                vLength[b] = max(vLength[b], len);
+            }
+        }
+    }
+
+    // Choose dicing rates shared by all patches in a row or column
+    for (int b = 0; b < nvs; ++b) {
+        for (int a = 0; a < nus; ++a) {
+            NURBSPatchDomain &d = patches[b * nus + a];
+            if (edgeLength > 0.f) {
+                d.uDice = Clamp(Ceil2Int(uLength[a] / edgeLength), 1, 256);
+                d.vDice = Clamp(Ceil2Int(vLength[b] / edgeLength), 1, 256);
+            }
+            else {
+                d.uDice = max(1, Ceil2Int(30.f / nus));
+                d.vDice = max(1, Ceil2Int(30.f / nvs));
+            }
+        }
+    }
+    cache.Init(int(patches.size()), maxCached);
+}
+
+
+Reference<NURBSTessellation> NURBSSurface::GetTessellation(int patch) const {
+    Reference<NURBSTessellation> tess = cache.Lookup(patch);
+    if (tess) return tess;
+    return cache.Insert(patch, Tessellate(patch));
+}
+
+
+Reference<NURBSTessellation> NURBSSurface::Tessellate(int patch) const {
+    // Evaluate NURBS over grid of points spanning _patch_
+    const NURBSPatchDomain &d = patches[patch];
+    NURBSTessellation *tess = new NURBSTessellation;
+    tess->nU = d.uDice;
+    tess->nV = d.vDice;
+    tess->P.resize((d.uDice + 1) * (d.vDice + 1));
+    tess->N.resize((d.uDice + 1) * (d.vDice + 1));
+    for (int j = 0; j <= d.vDice; ++j) {
+        float v = Lerp(float(j) / float(d.vDice), d.v0, d.v1);
+        for (int i = 0; i <= d.uDice; ++i) {
+            float u = Lerp(float(i) / float(d.uDice), d.u0, d.u1);
+            Vector dPdu, dPdv;
+            Point pt = Evaluate(u, v, &dPdu, &dPdv);
+            tess->P[j * (d.uDice + 1) + i] = (*ObjectToWorld)(pt);
+            Vector n = Cross(dPdu, dPdv);
+            if (n.LengthSquared() > 0.f)
+                tess->N[j * (d.uDice + 1) + i] = Normal(Normalize(n));
+        }
+    }
+
+    // Build BVH over grid cells and compute triangle areas
+    int nTris = tess->NumTriangles();
+    tess->nodes.reserve(nTris - 1);
+    BuildGridNodes(tess, 0, 0, d.uDice, d.vDice);
+    tess->areaCdf.resize(nTris);
+    tess->area = 0.f;
+    for (int tri = 0; tri < nTris; ++tri) {
+        int vi[3];
+        GridTriangle(tess->nU, tri, vi);
+        const Point &p1 = tess->P[vi[0]], &p2 = tess->P[vi[1]],
+                    &p3 = tess->P[vi[2]];
+        tess->area += 0.5f * Cross(p2-p1, p3-p1).Length();
+        tess->areaCdf[tri] = tess->area;
+    }
+    return tess;
+}
+
+
+
+// NURBSPatch Method Definitions
+NURBSPatch::NURBSPatch(const Transform *o2w, const Transform *w2o, bool ro,
+        const Reference<NURBSSurface> &s, int p, bool bc)
+    : Shape(o2w, w2o, ro), surface(s), patch(p), bezierClip(bc) {
+}
+
+
+BBox NURBSPatch::ObjectBound() const {
+    return (*WorldToObject)(surface->patches[patch].worldBound);
+}
+
+
+BBox NURBSPatch::WorldBound() const {
+    return surface->patches[patch].worldBound;
+}
+
+
+void NURBSPatch::VertexUV(const NURBSTessellation &tess, int vertex,
+                          float uv[2]) const {
+    const NURBSPatchDomain &d = surface->patches[patch];
+    int i = vertex % (tess.nU + 1), j = vertex / (tess.nU + 1);
+    uv[0] = Lerp(float(i) / float(tess.nU), d.u0, d.u1);
+    uv[1] = Lerp(float(j) / float(tess.nV), d.v0, d.v1);
+}
+
+
+int NURBSPatch::IntersectCells(const NURBSTessellation &tess, Ray &ray,
+        bool anyHit, float *b1, float *b2) const {
+    Vector invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    uint32_t dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+    int todo[64], todoOffset = 0, node = 0, hitTri = -1;
+    for (;;) {
+        const NURBSGridNode &n = tess.nodes[node];
+        if (IntersectBound(n.bounds, ray, invDir, dirIsNeg, ray.maxt)) {
+            if (n.offset >= 0) {
+                // Visit first child next and enqueue second child
+                todo[todoOffset++] = n.offset;
+                ++node;
+                continue;
+            }
+            // Intersect ray with grid cell's two triangles
+            int cell = ~n.offset;
+            for (int tri = 2 * cell; tri < 2 * cell + 2; ++tri) {
+                int vi[3];
+                GridTriangle(tess.nU, tri, vi);
+                float t, u, v;
+                if (IntersectTriangle(ray, tess.P[vi[0]], tess.P[vi[1]],
+                                      tess.P[vi[2]], ray.maxt, &t, &u, &v)) {
+                    ray.maxt = t;
+                    *b1 = u;
+                    *b2 = v;
+                    hitTri = tri;
+                    if (anyHit) return hitTri;
+                }
+            }
+        }
+        if (todoOffset == 0) break;
+        node = todo[--todoOffset];
+    }
+    return hitTri;
+}
+
+
+bool NURBSPatch::ClipIntersect(const Ray &ray, bool anyHit, float *tHit,
+                               float *uHit, float *vHit) const {
+    const NURBSSurface &s = *surface.GetPtr();
+    const NURBSPatchDomain &d = s.patches[patch];
+    int ou = s.uorder, ov = s.vorder, np = ou * ov;
+
+    // Project patch onto two planes that meet along the ray
+    Vector n1, n2;
+    CoordinateSystem(Normalize(ray.d), &n1, &n2);
+    float c1 = -Dot(n1, Vector(ray.o)), c2 = -Dot(n2, Vector(ray.o));
+    float invLength2 = 1.f / ray.d.LengthSquared();
+    Homogeneous3 *pool = ALLOCA(Homogeneous3, 33 * np);
+    const Homogeneous3 *bez = &s.bezier[patch * np];
+    for (int i = 0; i < np; ++i) {
+        Vector pw(bez[i].x, bez[i].y, bez[i].z);
+        float w = bez[i].w;
+        pool[i] = Homogeneous3(Dot(n1, pw) + c1 * w, Dot(n2, pw) + c2 * w,
+            Dot(ray.d, pw - w * Vector(ray.o)) * invLength2, w);
+    }
+
+    // Clip away parts of patch that cannot meet the ray
+    const float eps = 1e-4f;
+    NURBSClipRegion todo[32], r = { 0.f, 1.f, 0.f, 1.f };
+    int todoOffset = 0;
+    bool hit = false;
+    float tMax = ray.maxt;
+    for (;;) {
+        Homogeneous3 *cp = pool + todoOffset * np;
+        for (;;) {
+            // Cull region if its hull misses the ray or its parametric range
+            float amin = INFINITY, amax = -INFINITY;
+            float bmin = INFINITY, bmax = -INFINITY;
+            float tmin = INFINITY, tmax = -INFINITY;
+            for (int i = 0; i < np; ++i) {
+                float invw = 1.f / cp[i].w;
+                amin = min(amin, cp[i].x * invw);
+                amax = max(amax, cp[i].x * invw);
+                bmin = min(bmin, cp[i].y * invw);
+                bmax = max(bmax, cp[i].y * invw);
+                tmin = min(tmin, cp[i].z * invw);
+                tmax = max(tmax, cp[i].z * invw);
+            }
+            if (amin > 0.f || amax < 0.f || bmin > 0.f || bmax < 0.f ||
+                tmin > tMax || tmax < ray.mint)
+                break;
+
+            float du = r.u1 - r.u0, dv = r.v1 - r.v0;
+            if (du < eps && dv < eps) {
+                // Refine hit in converged region with Newton's method
+                float u0 = Lerp(0.5f * (r.u0 + r.u1), d.u0, d.u1);
+                float v0 = Lerp(0.5f * (r.v0 + r.v1), d.v0, d.v1);
+                float u = u0, v = v0, f1 = 0.f, f2 = 0.f;
+                for (int iter = 0; iter < 4; ++iter) {
+                    Vector dpdu, dpdv;
+                    Point p = s.Evaluate(u, v, &dpdu, &dpdv);
+                    f1 = Dot(n1, Vector(p)) + c1;
+                    f2 = Dot(n2, Vector(p)) + c2;
+                    float a11 = Dot(n1, dpdu), a12 = Dot(n1, dpdv);
+                    float a21 = Dot(n2, dpdu), a22 = Dot(n2, dpdv);
+                    float det = a11 * a22 - a12 * a21;
+                    if (det == 0.f) break;
+                    u = Clamp(u - (a22 * f1 - a12 * f2) / det, d.u0, d.u1);
+                    v = Clamp(v - (a11 * f2 - a21 * f1) / det, d.v0, d.v1);
+                }
+                Point p = s.Evaluate(u, v, NULL, NULL);
+                f1 = Dot(n1, Vector(p)) + c1;
+                f2 = Dot(n2, Vector(p)) + c2;
+                float tol = max(amax - amin, bmax - bmin);
+                if (f1 * f1 + f2 * f2 > tol * tol) {
+                    // Fall back to center of region if Newton diverged
+                    u = u0;
+                    v = v0;
+                    p = s.Evaluate(u, v, NULL, NULL);
+                }
+                float t = Dot(p - ray.o, ray.d) * invLength2;
+                if (t > ray.mint && t < tMax) {
+                    tMax = t;
+                    *uHit = u;
+                    *vHit = v;
+                    hit = true;
+                }
+                break;
+            }
+
+            // Clip region in $u$ and then in $v$
+            float t0, t1;
+            if (du >= eps) {
+                if (!ClipBezierPatch(cp, ou, ov, true, &t0, &t1)) break;
+                RestrictBezierPatch(cp, ou, ov, t0, t1, 0.f, 1.f);
+                r.u1 = r.u0 + t1 * du;
+                r.u0 = r.u0 + t0 * du;
+            }
+            if (dv >= eps) {
+                if (!ClipBezierPatch(cp, ou, ov, false, &t0, &t1)) break;
+                RestrictBezierPatch(cp, ou, ov, 0.f, 1.f, t0, t1);
+                r.v1 = r.v0 + t1 * dv;
+                r.v0 = r.v0 + t0 * dv;
+            }
+            if (r.u1 - r.u0 <= 0.8f * du || r.v1 - r.v0 <= 0.8f * dv)
+                continue;
+
+            // Split region in half if clipping did not shrink it enough
+            if (todoOffset + 1 == 32) break;
+            Homogeneous3 *lower = cp + np;
+            memcpy(lower, cp, np * sizeof(Homogeneous3));
+            NURBSClipRegion upper = r;
+            if (r.u1 - r.u0 >= r.v1 - r.v0) {
+                RestrictBezierPatch(cp, ou, ov, 0.5f, 1.f, 0.f, 1.f);
+                RestrictBezierPatch(lower, ou, ov, 0.f, 0.5f, 0.f, 1.f);
+                upper.u0 = r.u1 = 0.5f * (r.u0 + r.u1);
+            }
+            else {
+                RestrictBezierPatch(cp, ou, ov, 0.f, 1.f, 0.5f, 1.f);
+                RestrictBezierPatch(lower, ou, ov, 0.f, 1.f, 0.f, 0.5f);
+                upper.v0 = r.v1 = 0.5f * (r.v0 + r.v1);
+            }
+            todo[todoOffset++] = upper;
+            cp = lower;
+        }
+        if ((hit && anyHit) || todoOffset == 0) break;
+        r = todo[--todoOffset];
+    }
+    if (hit) *tHit = tMax;
+    return hit;
+}
+
+
+bool NURBSPatch::Intersect(const Ray &r, float *tHit, float *rayEpsilon,
+                           DifferentialGeometry *dg) const {
+    if (bezierClip) {
+        // Intersect object-space ray with patch by Bezier clipping
+        Ray ray;
+        (*WorldToObject)(r, &ray);
+        float u, v;
+        if (!ClipIntersect(ray, false, tHit, &u, &v))
+            return false;
+        Vector dpdu, dpdv;
+        Point p = surface->Evaluate(u, v, &dpdu, &dpdv);
+        const Transform &o2w = *ObjectToWorld;
+        *dg = DifferentialGeometry(o2w(p), o2w(dpdu), o2w(dpdv),
+                                   Normal(0,0,0), Normal(0,0,0), u, v, this);
+        *rayEpsilon = 5e-4f * *tHit;
+        return true;
+    }
+    Reference<NURBSTessellation> tess = surface->GetTessellation(patch);
+    Ray ray(r);
+    float b1, b2;
+    int tri = IntersectCells(*tess.GetPtr(), ray, false, &b1, &b2);
+    if (tri < 0)
+        return false;
+
+    // Compute triangle partial derivatives
+    int vi[3];
+    GridTriangle(tess->nU, tri, vi);
+    const Point &p1 = tess->P[vi[0]], &p2 = tess->P[vi[1]],
+                &p3 = tess->P[vi[2]];
+    float uv[3][2];
+    for (int i = 0; i < 3; ++i)
+        VertexUV(*tess.GetPtr(), vi[i], uv[i]);
+    float du1 = uv[0][0] - uv[2][0], du2 = uv[1][0] - uv[2][0];
+    float dv1 = uv[0][1] - uv[2][1], dv2 = uv[1][1] - uv[2][1];
+    Vector dp1 = p1 - p3, dp2 = p2 - p3;
+    float invdet = 1.f / (du1 * dv2 - dv1 * du2);
+    Vector dpdu = ( dv2 * dp1 - dv1 * dp2) * invdet;
+    Vector dpdv = (-du2 * dp1 + du1 * dp2) * invdet;
+
+    // Fill in _DifferentialGeometry_ from patch hit
+    float b0 = 1 - b1 - b2;
+    float tu = b0*uv[0][0] + b1*uv[1][0] + b2*uv[2][0];
+    float tv = b0*uv[0][1] + b1*uv[1][1] + b2*uv[2][1];
+    *dg = DifferentialGeometry(ray(ray.maxt), dpdu, dpdv,
+                               Normal(0,0,0), Normal(0,0,0), tu, tv, this);
+    *tHit = ray.maxt;
+    *rayEpsilon = 1e-3f * *tHit;
+    return true;
+}
+
+
+bool NURBSPatch::IntersectP(const Ray &r) const {
+    if (bezierClip) {
+        Ray ray;
+        (*WorldToObject)(r, &ray);
+        float tHit, u, v;
+        return ClipIntersect(ray, true, &tHit, &u, &v);
+    }
+    Reference<NURBSTessellation> tess = surface->GetTessellation(patch);
+    Ray ray(r);
+    float b1, b2;
+    return IntersectCells(*tess.GetPtr(), ray, true, &b1, &b2) >= 0;
+}
+
+
+void NURBSPatch::GetShadingGeometry(const Transform &obj2world,
+        const DifferentialGeometry &dg,
+        DifferentialGeometry *dgShading) const {
+    const NURBSPatchDomain &d = surface->patches[patch];
+    Normal n, dndu, dndv;
+    if (bezierClip) {
+        // Evaluate NURBS normal at $(u,v)$ and at nearby points
+        n = SurfaceNormal(*surface.GetPtr(), dg.u, dg.v);
+        float du = 1e-3f * (d.u1 - d.u0), dv = 1e-3f * (d.v1 - d.v0);
+        if (dg.u + du > d.u1) du = -du;
+        if (dg.v + dv > d.v1) dv = -dv;
+        dndu = (SurfaceNormal(*surface.GetPtr(), dg.u + du, dg.v) - n) / du;
+        dndv = (SurfaceNormal(*surface.GetPtr(), dg.u, dg.v + dv) - n) / dv;
+    }
+    else {
+        // Find grid triangle containing $(u,v)$
+        Reference<NURBSTessellation> tess = surface->GetTessellation(patch);
+        float fu = (dg.u - d.u0) / (d.u1 - d.u0) * tess->nU;
+        float fv = (dg.v - d.v0) / (d.v1 - d.v0) * tess->nV;
+        int i = Clamp(Floor2Int(fu), 0, tess->nU - 1);
+        int j = Clamp(Floor2Int(fv), 0, tess->nV - 1);
+        float su = fu - i, sv = fv - j;
+        int tri = 2 * (j * tess->nU + i) + (sv > su ? 1 : 0), vi[3];
+        GridTriangle(tess->nU, tri, vi);
+        float b[3] = { 1.f - su, su - sv, sv };
+        if (sv > su) {
+            b[0] = 1.f - sv;
+            b[1] = su;
+            b[2] = sv - su;
+        }
+
+        // Interpolate vertex normals and compute $\dndu$ and $\dndv$
+        const Normal &n0 = tess->N[vi[0]], &n1 = tess->N[vi[1]],
+                     &n2 = tess->N[vi[2]];
+        n = b[0] * n0 + b[1] * n1 + b[2] * n2;
+        float uv[3][2];
+        for (int k = 0; k < 3; ++k)
+            VertexUV(*tess.GetPtr(), vi[k], uv[k]);
+        float du1 = uv[0][0] - uv[2][0], du2 = uv[1][0] - uv[2][0];
+        float dv1 = uv[0][1] - uv[2][1], dv2 = uv[1][1] - uv[2][1];
+        Normal dn1 = n0 - n2, dn2 = n1 - n2;
+        float invdet = 1.f / (du1 * dv2 - dv1 * du2);
+        dndu = ( dv2 * dn1 - dv1 * dn2) * invdet;
+        dndv = (-du2 * dn1 + du1 * dn2) * invdet;
+    }
+    if (n == Normal(0, 0, 0)) {
+        *dgShading = dg;
+        return;
+    }
+
+    // Use NURBS normal to compute shading tangents _ss_ and _ts_
+    Normal ns = Normalize(obj2world(n));
+    Vector ss = Normalize(dg.dpdu);
+    Vector ts = Cross(ss, ns);
+    if (ts.LengthSquared() > 0.f) {
+        ts = Normalize(ts);
+        ss = Cross(ts, ns);
+    }
+    else
+        CoordinateSystem((Vector)ns, &ss, &ts);
+    *dgShading = DifferentialGeometry(dg.p, ss, ts,
+        obj2world(dndu), obj2world(dndv), dg.u, dg.v, dg.shape);
+    dgShading->dudx = dg.dudx;  dgShading->dvdx = dg.dvdx;
+    dgShading->dudy = dg.dudy;  dgShading->dvdy = dg.dvdy;
+    dgShading->dpdx = dg.dpdx;  dgShading->dpdy = dg.dpdy;
+}
+
+
+float NURBSPatch::Area() const {
+    return surface->GetTessellation(patch)->area;
+}
+
+
+Point NURBSPatch::Sample(float u1, float u2, Normal *Ns) const {
+    Reference<NURBSTessellation> tess = surface->GetTessellation(patch);
+    // Choose triangle in proportion to its area
+    const vector<float> &cdf = tess->areaCdf;
+    float a = u1 * tess->area;
+    int tri = min(int(std::upper_bound(cdf.begin(), cdf.end(), a) -
+                      cdf.begin()), int(cdf.size()) - 1);
+    float a0 = tri > 0 ? cdf[tri-1] : 0.f;
+    u1 = min((a - a0) / (cdf[tri] - a0), OneMinusEpsilon);
+
+    // Sample point on chosen triangle
+    float b1, b2;
+    UniformSampleTriangle(u1, u2, &b1, &b2);
+    int vi[3];
+    GridTriangle(tess->nU, tri, vi);
+    const Point &p1 = tess->P[vi[0]], &p2 = tess->P[vi[1]],
+                &p3 = tess->P[vi[2]];
+    if (bezierClip) {
+        // Map sample to exact surface so it is consistent with intersections
+        float uv[3][2];
+        for (int i = 0; i < 3; ++i)
+            VertexUV(*tess.GetPtr(), vi[i], uv[i]);
+        float u = b1 * uv[0][0] + b2 * uv[1][0] + (1.f - b1 - b2) * uv[2][0];
+        float v = b1 * uv[0][1] + b2 * uv[1][1] + (1.f - b1 - b2) * uv[2][1];
+        Vector dpdu, dpdv;
+        Point p = (*ObjectToWorld)(surface->Evaluate(u, v, &dpdu, &dpdv));
+        Vector n = Cross((*ObjectToWorld)(dpdu), (*ObjectToWorld)(dpdv));
+        if (n.LengthSquared() > 0.f) {
+            *Ns = Normalize(Normal(n));
+            if (ReverseOrientation) *Ns *= -1.f;
+            return p;
+        }
+    }
+    Point p = b1 * p1 + b2 * p2 + (1.f - b1 - b2) * p3;
+    *Ns = Normalize(Normal(Cross(p2-p1, p3-p1)));
+    if (ReverseOrientation) *Ns *= -1.f;
+    return p;
+}
+
+
+
 // NURBS Method Definitions
 NURBS::NURBS(const Transform *o2w, const Transform *w2o,
         bool ro, int numu, int uo, const float *uk,
         float u0, float u1, int numv, int vo, const float *vk,
-        float v0, float v1, const float *p, bool homogeneous)
-    : Shape(o2w, w2o, ro) {
+        float v0, float v1, const float *p, bool homogeneous, float el,
+        int maxCached, bool bc)
+    : Shape(o2w, w2o, ro), edgeLength(el), maxCachedTriangles(maxCached),
+      bezierClip(bc) {
     nu = numu;    uorder = uo;
     umin = u0;    umax = u1;
     nv = numv;    vorder = vo;
@@ -227,6 +1007,18 @@ BBox NURBS::WorldBound() const {
 
 
 void NURBS::Refine(vector<Reference<Shape> > &refined) const {
+    if (bezierClip || edgeLength > 0.f) {
+        // Split NURBS into lazily tessellated or clipped patches
+        Reference<NURBSSurface> surface = new NURBSSurface(ObjectToWorld,
+            nu, uorder, uknot, umin, umax, nv, vorder, vknot, vmin, vmax, P,
+            isHomogeneous, edgeLength, maxCachedTriangles);
+        refined.reserve(refined.size() + surface->patches.size());
+        for (uint32_t i = 0; i < surface->patches.size(); ++i)
+            refined.push_back(new NURBSPatch(ObjectToWorld, WorldToObject,
+                ReverseOrientation, surface, i, bezierClip));
+        return;
+    }
+
     // Compute NURBS dicing rates
     int diceu = 30, dicev = 30;
     float *ueval = new float[diceu];
@@ -349,9 +1141,22 @@ NURBS *CreateNURBSShape(const Transform *o2w, const Transform *w2o,
         return NULL;
     }
 
+    float edgeLength = params.FindOneFloat("edgelength", 0.f);
+    int maxCachedTriangles = params.FindOneInt("cachetriangles", 1 << 20);
+    string intersection = params.FindOneString("intersection", "tessellate");
+    bool bezierClip = (intersection == "bezierclip");
+    if (!bezierClip && intersection != "tessellate")
+        Warning("NURBS intersection method \"%s\" unknown.  Using "
+                "\"tessellate\".", intersection.c_str());
+    if (bezierClip && uorder * vorder > 64) {
+        Warning("Bezier clipping only supports NURBS with uorder*vorder <= "
+                "64.  Using \"tessellate\".");
+        bezierClip = false;
+    }
     return new NURBS(o2w, w2o, ReverseOrientation, nu, uorder, uknots, u0, u1,
                          nv, vorder, vknots, v0, v1, (float *)P,
-                         isHomogeneous);
+                         isHomogeneous, edgeLength, maxCachedTriangles,
+                         bezierClip);
 }
 
 
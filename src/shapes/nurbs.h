@@ -50,7 +50,8 @@ public:
         bool ReverseOrientation, int nu, int uorder,
         const float *uknot, float umin, float umax,
         int nv, int vorder, const float *vknot, float vmin, float vmax,
-        const float *P, bool isHomogeneous);
+        const float *P, bool isHomogeneous, float edgeLength,
+        int maxCachedTriangles, bool bezierClip);
     ~NURBS();
     BBox ObjectBound() const;
     BBox WorldBound() const;
@@ -63,6 +64,9 @@ private:
     float *uknot, *vknot;
     bool isHomogeneous;
     float *P;
+    float edgeLength;
+    int maxCachedTriangles;
+    bool bezierClip;
 };
 
 
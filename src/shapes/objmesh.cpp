@@ -0,0 +1,482 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// shapes/objmesh.cpp*
+#include "stdafx.h"
+#include "shapes/objmesh.h"
+#include "fileutil.h"
+#include "parallel.h"
+#include "paramset.h"
+#include "parser.h"
+
+// OBJMesh Local Declarations
+struct OBJIndex {
+    // Zero-based indices; _vt_ and _vn_ are -1 if not given
+    int v, vt, vn;
+};
+
+
+struct OBJChunk {
+    OBJChunk() : start(NULL), end(NULL), nv(0), nvt(0), nvn(0),
+        setsMaterial(false), vBase(0), vtBase(0), vnBase(0), nBadFaces(0) { }
+    const char *start, *end;
+    // Vertex counts and last _usemtl_ found by the counting pass
+    int nv, nvt, nvn;
+    bool setsMaterial;
+    string lastMaterial;
+    // Vertices of preceding chunks and material in effect at the start
+    int vBase, vtBase, vnBase;
+    string material;
+    // Vertex data and triangle corners grouped by material
+    vector<Point> P;
+    vector<Normal> N;
+    vector<float> uv;
+    vector<string> groupMaterials;
+    vector<vector<OBJIndex> > groupCorners;
+    int nBadFaces;
+};
+
+
+struct OBJGroup {
+    OBJGroup() : nBadTriangles(0) { }
+    string material;
+    vector<const vector<OBJIndex> *> corners;
+    Reference<Shape> mesh;
+    int nBadTriangles;
+};
+
+
+struct OBJVertexData {
+    const Transform *ObjectToWorld, *WorldToObject;
+    bool reverseOrientation, compact;
+    vector<Point> P;
+    vector<Normal> N;
+    vector<float> uv;
+    Reference<Texture<float> > alphaTexture;
+};
+
+
+class OBJChunkTask : public Task {
+public:
+    OBJChunkTask(OBJChunk *c, bool count) : chunk(c), countOnly(count) { }
+    void Run();
+private:
+    OBJChunk *chunk;
+    bool countOnly;
+};
+
+
+class OBJGroupTask : public Task {
+public:
+    OBJGroupTask(OBJGroup *g, const OBJVertexData *d) : group(g), data(d) { }
+    void Run();
+private:
+    OBJGroup *group;
+    const OBJVertexData *data;
+};
+
+
+
+// OBJMesh Utility Functions
+static inline bool IsOBJSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+static inline const char *SkipOBJSpace(const char *p, const char *end) {
+    while (p < end && IsOBJSpace(*p)) ++p;
+    return p;
+}
+
+
+static inline bool IsOBJKeyword(const char *p, const char *end, const char *kw) {
+    for (; *kw; ++p, ++kw)
+        if (p == end || *p != *kw) return false;
+    return p == end || IsOBJSpace(*p);
+}
+
+
+static string OBJName(const char *p, const char *end) {
+    p = SkipOBJSpace(p, end);
+    while (end > p && IsOBJSpace(end[-1])) --end;
+    return string(p, end);
+}
+
+
+static void ReadOBJFloats(const char *p, const char *end, float *v, int n) {
+    for (int i = 0; i < n; ++i) {
+        p = SkipOBJSpace(p, end);
+        const char *e = p;
+        while (e < end && !IsOBJSpace(*e)) ++e;
+        v[i] = (e > p) ? ParseFloat(p, e) : 0.f;
+        p = e;
+    }
+}
+
+
+static inline bool ReadOBJIndex(const char **pp, const char *end, int count,
+                                int *index) {
+    // OBJ indices are one-based, or relative to the last vertex if negative
+    const char *p = *pp;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+    if (p == end || *p < '0' || *p > '9') return false;
+    int i = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+        if (i < 100000000) i = 10 * i + (*p - '0');
+    *pp = p;
+    *index = negative ? count - i : i - 1;
+    return *index >= 0;
+}
+
+
+static int FindOBJGroup(OBJChunk *chunk, const string &material) {
+    for (uint32_t i = 0; i < chunk->groupMaterials.size(); ++i)
+        if (chunk->groupMaterials[i] == material) return int(i);
+    chunk->groupMaterials.push_back(material);
+    chunk->groupCorners.push_back(vector<OBJIndex>());
+    return int(chunk->groupMaterials.size()) - 1;
+}
+
+
+
+// OBJMesh Task Definitions
+void OBJChunkTask::Run() {
+    string material = chunk->material;
+    int group = -1;
+    vector<OBJIndex> face;
+    if (!countOnly) {
+        chunk->P.reserve(chunk->nv);
+        chunk->N.reserve(chunk->nvn);
+        chunk->uv.reserve(2 * chunk->nvt);
+    }
+    const char *p = chunk->start, *end = chunk->end;
+    while (p < end) {
+        const char *lineEnd = (const char *)memchr(p, '\n', end - p);
+        if (!lineEnd) lineEnd = end;
+        p = SkipOBJSpace(p, lineEnd);
+        if (countOnly) {
+            // Count vertices so that later chunks can resolve their indices
+            if (IsOBJKeyword(p, lineEnd, "v")) ++chunk->nv;
+            else if (IsOBJKeyword(p, lineEnd, "vt")) ++chunk->nvt;
+            else if (IsOBJKeyword(p, lineEnd, "vn")) ++chunk->nvn;
+            else if (IsOBJKeyword(p, lineEnd, "usemtl")) {
+                chunk->setsMaterial = true;
+                chunk->lastMaterial = OBJName(p + 6, lineEnd);
+            }
+        }
+        else if (IsOBJKeyword(p, lineEnd, "v")) {
+            float v[3];
+            ReadOBJFloats(p + 1, lineEnd, v, 3);
+            chunk->P.push_back(Point(v[0], v[1], v[2]));
+        }
+        else if (IsOBJKeyword(p, lineEnd, "vt")) {
+            float v[2];
+            ReadOBJFloats(p + 2, lineEnd, v, 2);
+            chunk->uv.push_back(v[0]);
+            chunk->uv.push_back(v[1]);
+        }
+        else if (IsOBJKeyword(p, lineEnd, "vn")) {
+            float v[3];
+            ReadOBJFloats(p + 2, lineEnd, v, 3);
+            chunk->N.push_back(Normal(v[0], v[1], v[2]));
+        }
+        else if (IsOBJKeyword(p, lineEnd, "f")) {
+            // Read _v_, _v/vt_, _v//vn_, or _v/vt/vn_ face corners
+            int nv = chunk->vBase + int(chunk->P.size());
+            int nvt = chunk->vtBase + int(chunk->uv.size() / 2);
+            int nvn = chunk->vnBase + int(chunk->N.size());
+            bool ok = true;
+            face.clear();
+            for (p = SkipOBJSpace(p + 1, lineEnd); p < lineEnd && ok;
+                 p = SkipOBJSpace(p, lineEnd)) {
+                OBJIndex c;
+                c.vt = c.vn = -1;
+                ok = ReadOBJIndex(&p, lineEnd, nv, &c.v);
+                if (ok && p < lineEnd && *p == '/') {
+                    if (++p < lineEnd && *p != '/')
+                        ok = ReadOBJIndex(&p, lineEnd, nvt, &c.vt);
+                    if (ok && p < lineEnd && *p == '/') {
+                        ++p;
+                        ok = ReadOBJIndex(&p, lineEnd, nvn, &c.vn);
+                    }
+                }
+                ok = ok && (p == lineEnd || IsOBJSpace(*p));
+                face.push_back(c);
+            }
+            if (!ok || face.size() < 3)
+                ++chunk->nBadFaces;
+            else {
+                // Fan-triangulate the face into the current material's group
+                if (group == -1) group = FindOBJGroup(chunk, material);
+                vector<OBJIndex> &corners = chunk->groupCorners[group];
+                for (uint32_t i = 2; i < face.size(); ++i) {
+                    corners.push_back(face[0]);
+                    corners.push_back(face[i-1]);
+                    corners.push_back(face[i]);
+                }
+            }
+        }
+        else if (IsOBJKeyword(p, lineEnd, "usemtl")) {
+            material = OBJName(p + 6, lineEnd);
+            group = -1;
+        }
+        p = (lineEnd < end) ? lineEnd + 1 : end;
+    }
+}
+
+
+void OBJGroupTask::Run() {
+    // Use texture coordinates and normals only if every corner has them
+    bool hasUV = true, hasN = true;
+    uint32_t nCorners = 0;
+    for (uint32_t i = 0; i < group->corners.size(); ++i) {
+        const vector<OBJIndex> &c = *group->corners[i];
+        for (uint32_t j = 0; j < c.size(); ++j) {
+            hasUV &= (c[j].vt >= 0);
+            hasN &= (c[j].vn >= 0);
+        }
+        nCorners += c.size();
+    }
+
+    // Merge identical corners into mesh vertices using a hash table
+    uint32_t tableSize = RoundUpPow2(max(2 * nCorners, 16u));
+    vector<int> table(tableSize, -1);
+    vector<OBJIndex> verts;
+    vector<int> indices;
+    indices.reserve(nCorners);
+    int nv = int(data->P.size()), nvt = int(data->uv.size() / 2);
+    int nvn = int(data->N.size());
+    for (uint32_t i = 0; i < group->corners.size(); ++i) {
+        const vector<OBJIndex> &c = *group->corners[i];
+        for (uint32_t j = 0; j < c.size(); j += 3) {
+            bool inRange = true;
+            for (uint32_t k = j; k < j + 3; ++k)
+                inRange &= (c[k].v < nv && (!hasUV || c[k].vt < nvt) &&
+                            (!hasN || c[k].vn < nvn));
+            if (!inRange) {
+                ++group->nBadTriangles;
+                continue;
+            }
+            for (uint32_t k = j; k < j + 3; ++k) {
+                OBJIndex key = c[k];
+                if (!hasUV) key.vt = -1;
+                if (!hasN) key.vn = -1;
+                uint32_t slot = (uint32_t(key.v) * 73856093u ^
+                                 uint32_t(key.vt) * 19349663u ^
+                                 uint32_t(key.vn) * 83492791u) & (tableSize - 1);
+                while (table[slot] != -1) {
+                    const OBJIndex &e = verts[table[slot]];
+                    if (e.v == key.v && e.vt == key.vt && e.vn == key.vn) break;
+                    slot = (slot + 1) & (tableSize - 1);
+                }
+                if (table[slot] == -1) {
+                    table[slot] = int(verts.size());
+                    verts.push_back(key);
+                }
+                indices.push_back(table[slot]);
+            }
+        }
+    }
+    if (indices.size() == 0) return;
+
+    // Create _TriangleMesh_ for the group's triangles
+    int nVerts = int(verts.size());
+    int *vi = new int[indices.size()];
+    memcpy(vi, &indices[0], indices.size() * sizeof(int));
+    Point *P = new Point[nVerts];
+    Normal *N = hasN ? new Normal[nVerts] : NULL;
+    float *uv = hasUV ? new float[2 * nVerts] : NULL;
+    for (int i = 0; i < nVerts; ++i) {
+        P[i] = data->P[verts[i].v];
+        if (N) N[i] = data->N[verts[i].vn];
+        if (uv) {
+            uv[2*i]   = data->uv[2*verts[i].vt];
+            uv[2*i+1] = data->uv[2*verts[i].vt+1];
+        }
+    }
+    TriangleMesh *mesh = new TriangleMesh(data->ObjectToWorld,
+        data->WorldToObject, data->reverseOrientation,
+        int(indices.size() / 3), nVerts, vi, P, N, uv, data->alphaTexture);
+    if (data->compact)
+        mesh->Compact();
+    group->mesh = mesh;
+}
+
+
+
+// OBJMesh Method Definitions
+OBJMesh::OBJMesh(const Transform *o2w, const Transform *w2o, bool ro,
+                 const vector<Reference<Shape> > &m, const vector<string> &mtls)
+    : Shape(o2w, w2o, ro), meshes(m), materials(mtls) {
+}
+
+
+bool OBJMesh::CanIntersect() const {
+    return false;
+}
+
+
+void OBJMesh::Refine(vector<Reference<Shape> > &refined) const {
+    refined.insert(refined.end(), meshes.begin(), meshes.end());
+}
+
+
+BBox OBJMesh::ObjectBound() const {
+    BBox b;
+    for (uint32_t i = 0; i < meshes.size(); ++i)
+        b = Union(b, meshes[i]->ObjectBound());
+    return b;
+}
+
+
+BBox OBJMesh::WorldBound() const {
+    BBox b;
+    for (uint32_t i = 0; i < meshes.size(); ++i)
+        b = Union(b, meshes[i]->WorldBound());
+    return b;
+}
+
+
+OBJMesh *CreateOBJMeshShape(const Transform *o2w, const Transform *w2o,
+        bool reverseOrientation, const ParamSet &params,
+        map<string, Reference<Texture<float> > > *floatTextures) {
+    string filename = params.FindOneFilename("filename", "");
+    if (filename == "") {
+        Error("No \"filename\" parameter provided for OBJ mesh");
+        return NULL;
+    }
+    MappedFile file(filename);
+    if (!file.IsValid()) {
+        Error("Unable to read OBJ file \"%s\"", filename.c_str());
+        return NULL;
+    }
+
+    // Split the file into chunks that start at line boundaries
+    const char *data = file.Data(), *dataEnd = data + file.Size();
+    size_t nChunks = min(file.Size() / (256 * 1024) + 1,
+                         size_t(8 * NumSystemCores()));
+    vector<OBJChunk> chunks(nChunks);
+    const char *pos = data;
+    for (size_t i = 0; i < nChunks; ++i) {
+        const char *e = dataEnd;
+        if (i + 1 < nChunks) {
+            e = max(pos, data + file.Size() / nChunks * (i + 1));
+            const char *nl = (const char *)memchr(e, '\n', dataEnd - e);
+            e = nl ? nl + 1 : dataEnd;
+        }
+        chunks[i].start = pos;
+        chunks[i].end = pos = e;
+    }
+
+    // Count chunk vertices, then parse chunks with their starting state
+    vector<Task *> tasks;
+    for (size_t i = 0; i < nChunks; ++i)
+        tasks.push_back(new OBJChunkTask(&chunks[i], true));
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    int nv = 0, nvt = 0, nvn = 0;
+    string material;
+    for (size_t i = 0; i < nChunks; ++i) {
+        delete tasks[i];
+        OBJChunk &c = chunks[i];
+        c.vBase = nv;   nv += c.nv;
+        c.vtBase = nvt; nvt += c.nvt;
+        c.vnBase = nvn; nvn += c.nvn;
+        c.material = material;
+        if (c.setsMaterial) material = c.lastMaterial;
+        tasks[i] = new OBJChunkTask(&chunks[i], false);
+    }
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    for (size_t i = 0; i < nChunks; ++i)
+        delete tasks[i];
+    tasks.clear();
+
+    // Gather vertex data and material groups in file order
+    OBJVertexData vertexData;
+    vertexData.ObjectToWorld = o2w;
+    vertexData.WorldToObject = w2o;
+    vertexData.reverseOrientation = reverseOrientation;
+    vertexData.compact = params.FindOneBool("compact", false);
+    vertexData.alphaTexture = FindAlphaTexture(params, floatTextures);
+    vertexData.P.reserve(nv);
+    vertexData.N.reserve(nvn);
+    vertexData.uv.reserve(2 * nvt);
+    vector<OBJGroup> groups;
+    map<string, uint32_t> groupIndex;
+    int nBad = 0;
+    for (size_t i = 0; i < nChunks; ++i) {
+        OBJChunk &c = chunks[i];
+        vertexData.P.insert(vertexData.P.end(), c.P.begin(), c.P.end());
+        vertexData.N.insert(vertexData.N.end(), c.N.begin(), c.N.end());
+        vertexData.uv.insert(vertexData.uv.end(), c.uv.begin(), c.uv.end());
+        vector<Point>().swap(c.P);
+        vector<Normal>().swap(c.N);
+        vector<float>().swap(c.uv);
+        nBad += c.nBadFaces;
+        for (uint32_t j = 0; j < c.groupMaterials.size(); ++j) {
+            if (groupIndex.find(c.groupMaterials[j]) == groupIndex.end()) {
+                groupIndex[c.groupMaterials[j]] = groups.size();
+                groups.push_back(OBJGroup());
+                groups.back().material = c.groupMaterials[j];
+            }
+            groups[groupIndex[c.groupMaterials[j]]].corners.push_back(&c.groupCorners[j]);
+        }
+    }
+
+    // Create a _TriangleMesh_ for each material group in parallel
+    for (uint32_t i = 0; i < groups.size(); ++i)
+        tasks.push_back(new OBJGroupTask(&groups[i], &vertexData));
+    EnqueueTasks(tasks);
+    WaitForAllTasks();
+    vector<Reference<Shape> > meshes;
+    vector<string> materials;
+    for (uint32_t i = 0; i < groups.size(); ++i) {
+        delete tasks[i];
+        nBad += groups[i].nBadTriangles;
+        if (groups[i].mesh) {
+            meshes.push_back(groups[i].mesh);
+            materials.push_back(groups[i].material);
+        }
+    }
+    if (nBad > 0)
+        Warning("Ignored %d malformed faces in OBJ file \"%s\"", nBad,
+                filename.c_str());
+    if (meshes.size() == 0) {
+        Error("No faces found in OBJ file \"%s\"", filename.c_str());
+        return NULL;
+    }
+    return new OBJMesh(o2w, w2o, reverseOrientation, meshes, materials);
+}
+
+
@@ -0,0 +1,68 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#ifndef PBRT_SHAPES_OBJMESH_H
+#define PBRT_SHAPES_OBJMESH_H
+
+// shapes/objmesh.h*
+#include "shapes/trianglemesh.h"
+
+// OBJMesh Declarations
+class OBJMesh : public Shape {
+public:
+    // OBJMesh Public Methods
+    OBJMesh(const Transform *o2w, const Transform *w2o, bool ro,
+            const vector<Reference<Shape> > &meshes,
+            const vector<string> &materials);
+    bool CanIntersect() const;
+    void Refine(vector<Reference<Shape> > &refined) const;
+    BBox ObjectBound() const;
+    BBox WorldBound() const;
+    uint32_t NumGroups() const { return meshes.size(); }
+    const Reference<Shape> &GroupMesh(uint32_t i) const { return meshes[i]; }
+    // Returns the _usemtl_ name of a group's faces, or "" if there was none
+    const string &GroupMaterial(uint32_t i) const { return materials[i]; }
+private:
+    // OBJMesh Private Data
+    vector<Reference<Shape> > meshes;
+    vector<string> materials;
+};
+
+
+OBJMesh *CreateOBJMeshShape(const Transform *o2w, const Transform *w2o,
+    bool reverseOrientation, const ParamSet &params,
+    map<string, Reference<Texture<float> > > *floatTextures = NULL);
+
+#endif // PBRT_SHAPES_OBJMESH_H
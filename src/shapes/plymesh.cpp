@@ -0,0 +1,468 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// shapes/plymesh.cpp*
+#include "stdafx.h"
+#include "shapes/plymesh.h"
+#include "paramset.h"
+#include "fileutil.h"
+
+// PLY Mesh Local Declarations
+enum PLYType { PLY_INVALID, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+               PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+struct PLYProperty {
+    PLYProperty() : type(PLY_INVALID), countType(PLY_INVALID), offset(0) { }
+    string name;
+    PLYType type;
+    // _countType_ is only set for list properties
+    PLYType countType;
+    // Byte offset of the property in fixed-size records
+    uint32_t offset;
+};
+
+
+struct PLYElement {
+    PLYElement() : count(0), recordSize(0) { }
+    string name;
+    uint64_t count;
+    vector<PLYProperty> props;
+    // _recordSize_ is zero if the element has list properties
+    uint32_t recordSize;
+};
+
+
+static bool hostLittleEndian =
+#if defined(__LITTLE_ENDIAN__) || defined(__i386__) || defined(__x86_64__) || defined(PBRT_IS_WINDOWS)
+true
+#elif defined(__BIG_ENDIAN__)
+false
+#else
+#error "Can't detect machine endian-ness at compile-time."
+#endif
+    ;
+
+static const struct { const char *name; PLYType type; } plyTypes[] = {
+    { "char", PLY_INT8 },      { "int8", PLY_INT8 },
+    { "uchar", PLY_UINT8 },    { "uint8", PLY_UINT8 },
+    { "short", PLY_INT16 },    { "int16", PLY_INT16 },
+    { "ushort", PLY_UINT16 },  { "uint16", PLY_UINT16 },
+    { "int", PLY_INT32 },      { "int32", PLY_INT32 },
+    { "uint", PLY_UINT32 },    { "uint32", PLY_UINT32 },
+    { "float", PLY_FLOAT32 },  { "float32", PLY_FLOAT32 },
+    { "double", PLY_FLOAT64 }, { "float64", PLY_FLOAT64 },
+};
+
+
+// PLY Mesh Utility Functions
+static PLYType LookupPLYType(const string &name) {
+    for (uint32_t i = 0; i < sizeof(plyTypes) / sizeof(plyTypes[0]); ++i)
+        if (name == plyTypes[i].name) return plyTypes[i].type;
+    return PLY_INVALID;
+}
+
+
+static inline uint32_t PLYTypeSize(PLYType type) {
+    switch (type) {
+    case PLY_INT8: case PLY_UINT8: return 1;
+    case PLY_INT16: case PLY_UINT16: return 2;
+    case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+    case PLY_FLOAT64: return 8;
+    default: return 0;
+    }
+}
+
+
+template <typename T> static inline T LoadPLY(const char *p, bool swap) {
+    T v;
+    if (!swap)
+        memcpy(&v, p, sizeof(T));
+    else {
+        char *d = (char *)&v;
+        for (uint32_t i = 0; i < sizeof(T); ++i)
+            d[i] = p[sizeof(T) - 1 - i];
+    }
+    return v;
+}
+
+
+static inline double ReadPLYValue(const char *p, PLYType type, bool swap) {
+    switch (type) {
+    case PLY_INT8:    return *(const int8_t *)p;
+    case PLY_UINT8:   return *(const uint8_t *)p;
+    case PLY_INT16:   return LoadPLY<int16_t>(p, swap);
+    case PLY_UINT16:  return LoadPLY<uint16_t>(p, swap);
+    case PLY_INT32:   return LoadPLY<int32_t>(p, swap);
+    case PLY_UINT32:  return LoadPLY<uint32_t>(p, swap);
+    case PLY_FLOAT32: return LoadPLY<float>(p, swap);
+    case PLY_FLOAT64: return LoadPLY<double>(p, swap);
+    default:          return 0.;
+    }
+}
+
+
+static void SplitPLYLine(const char *b, const char *e, vector<string> *tokens) {
+    tokens->clear();
+    while (b < e) {
+        while (b < e && (*b == ' ' || *b == '\t' || *b == '\r')) ++b;
+        const char *t = b;
+        while (b < e && *b != ' ' && *b != '\t' && *b != '\r') ++b;
+        if (b > t) tokens->push_back(string(t, b));
+    }
+}
+
+
+static bool ParsePLYCount(const string &s, uint64_t *count) {
+    if (s.empty()) return false;
+    *count = 0;
+    for (uint32_t i = 0; i < s.size(); ++i) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        *count = *count * 10 + (s[i] - '0');
+    }
+    return true;
+}
+
+
+// Parses the PLY header, returning a pointer to the start of the binary data
+static const char *ReadPLYHeader(const char *data, const char *end,
+        const string &filename, vector<PLYElement> *elements, bool *swap) {
+    const char *pos = data;
+    vector<string> tokens;
+    bool haveFormat = false;
+    for (int lineNum = 0; ; ++lineNum) {
+        const char *nl = pos;
+        while (nl < end && *nl != '\n') ++nl;
+        if (nl == end) {
+            Error("Premature end of PLY header in \"%s\"", filename.c_str());
+            return NULL;
+        }
+        SplitPLYLine(pos, nl, &tokens);
+        pos = nl + 1;
+        if (lineNum == 0) {
+            if (tokens.size() != 1 || tokens[0] != "ply") {
+                Error("\"%s\" is not a PLY file", filename.c_str());
+                return NULL;
+            }
+            continue;
+        }
+        if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info")
+            continue;
+        if (tokens[0] == "end_header")
+            break;
+        if (tokens[0] == "format" && tokens.size() == 3) {
+            if (tokens[1] == "binary_little_endian")
+                *swap = !hostLittleEndian;
+            else if (tokens[1] == "binary_big_endian")
+                *swap = hostLittleEndian;
+            else {
+                Error("PLY format \"%s\" in \"%s\" not supported; convert "
+                      "the file to binary or use ply2pbrt", tokens[1].c_str(),
+                      filename.c_str());
+                return NULL;
+            }
+            haveFormat = true;
+        }
+        else if (tokens[0] == "element" && tokens.size() == 3) {
+            elements->push_back(PLYElement());
+            elements->back().name = tokens[1];
+            if (!ParsePLYCount(tokens[2], &elements->back().count)) {
+                Error("Bad element count \"%s\" in PLY file \"%s\"",
+                      tokens[2].c_str(), filename.c_str());
+                return NULL;
+            }
+        }
+        else if (tokens[0] == "property" && !elements->empty()) {
+            PLYProperty prop;
+            if (tokens.size() == 5 && tokens[1] == "list") {
+                prop.countType = LookupPLYType(tokens[2]);
+                prop.type = LookupPLYType(tokens[3]);
+                prop.name = tokens[4];
+                if (prop.countType == PLY_INVALID ||
+                    prop.countType == PLY_FLOAT32 ||
+                    prop.countType == PLY_FLOAT64)
+                    prop.type = PLY_INVALID;
+            }
+            else if (tokens.size() == 3) {
+                prop.type = LookupPLYType(tokens[1]);
+                prop.name = tokens[2];
+            }
+            if (prop.type == PLY_INVALID) {
+                Error("Unsupported property declaration on line %d of PLY "
+                      "file \"%s\"", lineNum + 1, filename.c_str());
+                return NULL;
+            }
+            elements->back().props.push_back(prop);
+        }
+        else {
+            Error("Unexpected line %d in PLY header of \"%s\"", lineNum + 1,
+                  filename.c_str());
+            return NULL;
+        }
+    }
+    if (!haveFormat) {
+        Error("PLY file \"%s\" has no format line", filename.c_str());
+        return NULL;
+    }
+
+    // Compute property offsets for elements with fixed-size records
+    for (uint32_t i = 0; i < elements->size(); ++i) {
+        PLYElement &elem = (*elements)[i];
+        uint32_t offset = 0;
+        for (uint32_t j = 0; j < elem.props.size(); ++j) {
+            if (elem.props[j].countType != PLY_INVALID) {
+                offset = 0;
+                break;
+            }
+            elem.props[j].offset = offset;
+            offset += PLYTypeSize(elem.props[j].type);
+        }
+        elem.recordSize = offset;
+    }
+    return pos;
+}
+
+
+// Returns the end of the property value at _p_, or NULL if it is truncated
+static inline const char *SkipPLYProperty(const PLYProperty &prop,
+        const char *p, const char *end, bool swap) {
+    uint64_t n = 1;
+    if (prop.countType != PLY_INVALID) {
+        uint32_t countSize = PLYTypeSize(prop.countType);
+        if (uint64_t(end - p) < countSize) return NULL;
+        double c = ReadPLYValue(p, prop.countType, swap);
+        if (c < 0.) return NULL;
+        n = uint64_t(c);
+        p += countSize;
+    }
+    uint64_t size = n * PLYTypeSize(prop.type);
+    if (uint64_t(end - p) < size) return NULL;
+    return p + size;
+}
+
+
+static inline int ReadPLYIndex(const char *p, PLYType type, bool swap) {
+    if (type == PLY_INT32 && !swap) {
+        int32_t v;
+        memcpy(&v, p, sizeof(int32_t));
+        return v;
+    }
+    double v = ReadPLYValue(p, type, swap);
+    return (v >= 0. && v < 2147483647.) ? int(v) : -1;
+}
+
+
+static int FindPLYProperty(const PLYElement &elem, const char *name) {
+    for (uint32_t i = 0; i < elem.props.size(); ++i)
+        if (elem.props[i].name == name) return int(i);
+    return -1;
+}
+
+
+static inline float ReadPLYFloat(const char *record, const PLYProperty &prop,
+                                 bool swap) {
+    if (prop.type == PLY_FLOAT32 && !swap) {
+        float v;
+        memcpy(&v, record + prop.offset, sizeof(float));
+        return v;
+    }
+    return float(ReadPLYValue(record + prop.offset, prop.type, swap));
+}
+
+
+
+// PLY Mesh Function Definitions
+TriangleMesh *CreatePLYMeshShape(const Transform *o2w, const Transform *w2o,
+        bool reverseOrientation, const ParamSet &params,
+        map<string, Reference<Texture<float> > > *floatTextures) {
+    string filename = params.FindOneFilename("filename", "");
+    if (filename == "") {
+        Error("No \"filename\" parameter provided for PLY mesh");
+        return NULL;
+    }
+    MappedFile file(filename);
+    if (!file.IsValid()) {
+        Error("Unable to read PLY file \"%s\"", filename.c_str());
+        return NULL;
+    }
+    const char *data = file.Data(), *end = data + file.Size();
+    vector<PLYElement> elements;
+    bool swap = false;
+    const char *pos = ReadPLYHeader(data, end, filename, &elements, &swap);
+    if (!pos) return NULL;
+
+    // Read PLY elements in place from the mapped file
+    int nverts = -1, ntris = 0;
+    Point *P = NULL;
+    Normal *N = NULL;
+    float *uvs = NULL;
+    int *vi = NULL;
+    const char *error = NULL;
+    for (uint32_t e = 0; e < elements.size() && !error; ++e) {
+        const PLYElement &elem = elements[e];
+        const char *elemStart = pos;
+        if (elem.name == "vertex" && !P) {
+            // Read vertex positions, normals, and texture coordinates
+            int xyz[3] = { FindPLYProperty(elem, "x"), FindPLYProperty(elem, "y"),
+                           FindPLYProperty(elem, "z") };
+            if (xyz[0] == -1 || xyz[1] == -1 || xyz[2] == -1) {
+                error = "vertex positions are missing";
+                break;
+            }
+            if (elem.recordSize == 0) {
+                error = "list properties of vertices are not supported";
+                break;
+            }
+            if (elem.count > uint64_t(0x7fffffff) ||
+                uint64_t(end - pos) / elem.recordSize < elem.count) {
+                error = "vertex data is truncated";
+                break;
+            }
+            int nxyz[3] = { FindPLYProperty(elem, "nx"), FindPLYProperty(elem, "ny"),
+                            FindPLYProperty(elem, "nz") };
+            bool hasN = nxyz[0] != -1 && nxyz[1] != -1 && nxyz[2] != -1;
+            static const char *uvNames[4][2] = { { "u", "v" }, { "s", "t" },
+                { "texture_u", "texture_v" }, { "texture_s", "texture_t" } };
+            int uv[2] = { -1, -1 };
+            for (uint32_t i = 0; i < 4 && (uv[0] == -1 || uv[1] == -1); ++i) {
+                uv[0] = FindPLYProperty(elem, uvNames[i][0]);
+                uv[1] = FindPLYProperty(elem, uvNames[i][1]);
+            }
+            bool hasUV = uv[0] != -1 && uv[1] != -1;
+            nverts = int(elem.count);
+            P = new Point[nverts];
+            if (hasN) N = new Normal[nverts];
+            if (hasUV) uvs = new float[2 * nverts];
+            for (int i = 0; i < nverts; ++i, pos += elem.recordSize) {
+                P[i] = Point(ReadPLYFloat(pos, elem.props[xyz[0]], swap),
+                             ReadPLYFloat(pos, elem.props[xyz[1]], swap),
+                             ReadPLYFloat(pos, elem.props[xyz[2]], swap));
+                if (hasN)
+                    N[i] = Normal(ReadPLYFloat(pos, elem.props[nxyz[0]], swap),
+                                  ReadPLYFloat(pos, elem.props[nxyz[1]], swap),
+                                  ReadPLYFloat(pos, elem.props[nxyz[2]], swap));
+                if (hasUV) {
+                    uvs[2*i]   = ReadPLYFloat(pos, elem.props[uv[0]], swap);
+                    uvs[2*i+1] = ReadPLYFloat(pos, elem.props[uv[1]], swap);
+                }
+            }
+        }
+        else if (elem.name == "face" && !vi) {
+            int idx = FindPLYProperty(elem, "vertex_indices");
+            if (idx == -1) idx = FindPLYProperty(elem, "vertex_index");
+            if (idx == -1 || elem.props[idx].countType == PLY_INVALID) {
+                error = "the vertex index list is missing";
+                break;
+            }
+            const PLYProperty &indexProp = elem.props[idx];
+            uint32_t countSize = PLYTypeSize(indexProp.countType);
+            uint32_t indexSize = PLYTypeSize(indexProp.type);
+
+            // Count triangles of the fan-triangulated faces and check bounds
+            uint64_t nt = 0;
+            const char *p = pos;
+            for (uint64_t f = 0; f < elem.count && p; ++f)
+                for (uint32_t j = 0; j < elem.props.size() && p; ++j) {
+                    if (int(j) == idx && uint64_t(end - p) >= countSize) {
+                        double n = ReadPLYValue(p, indexProp.countType, swap);
+                        if (n >= 3.) nt += uint64_t(n) - 2;
+                    }
+                    p = SkipPLYProperty(elem.props[j], p, end, swap);
+                }
+            if (!p) {
+                error = "face data is truncated";
+                break;
+            }
+            if (nt > uint64_t(0x7fffffff / 3)) {
+                error = "there are too many faces";
+                break;
+            }
+
+            // Fill in triangle vertex indices
+            ntris = int(nt);
+            vi = new int[3 * ntris];
+            int *v = vi;
+            for (uint64_t f = 0; f < elem.count; ++f)
+                for (uint32_t j = 0; j < elem.props.size(); ++j) {
+                    if (int(j) == idx) {
+                        uint32_t n = uint32_t(ReadPLYValue(pos, indexProp.countType, swap));
+                        const char *ip = pos + countSize;
+                        for (uint32_t k = 2; k < n; ++k) {
+                            v[0] = ReadPLYIndex(ip, indexProp.type, swap);
+                            v[1] = ReadPLYIndex(ip + (k-1) * indexSize,
+                                                indexProp.type, swap);
+                            v[2] = ReadPLYIndex(ip + k * indexSize,
+                                                indexProp.type, swap);
+                            v += 3;
+                        }
+                    }
+                    pos = SkipPLYProperty(elem.props[j], pos, end, swap);
+                }
+        }
+        else if (elem.recordSize > 0) {
+            if (uint64_t(end - pos) / elem.recordSize < elem.count) {
+                error = "data is truncated";
+                break;
+            }
+            pos += elem.count * elem.recordSize;
+        }
+        else {
+            for (uint64_t i = 0; i < elem.count && pos; ++i)
+                for (uint32_t j = 0; j < elem.props.size() && pos; ++j)
+                    pos = SkipPLYProperty(elem.props[j], pos, end, swap);
+            if (!pos) {
+                error = "data is truncated";
+                break;
+            }
+        }
+        // Let the OS reclaim pages of elements that have been read
+        file.Release(elemStart - data, pos - elemStart);
+    }
+    if (!error && (!P || !vi))
+        error = "vertex or face elements are missing";
+    for (int i = 0; !error && i < 3 * ntris; ++i)
+        if (vi[i] < 0 || vi[i] >= nverts)
+            error = "a vertex index is out of range";
+    if (error) {
+        Error("Unable to read PLY file \"%s\": %s", filename.c_str(), error);
+        delete[] P;
+        delete[] N;
+        delete[] uvs;
+        delete[] vi;
+        return NULL;
+    }
+    Reference<Texture<float> > alphaTex = FindAlphaTexture(params, floatTextures);
+    TriangleMesh *mesh = new TriangleMesh(o2w, w2o, reverseOrientation,
+                                          ntris, nverts, vi, P, N, uvs, alphaTex);
+    if (params.FindOneBool("compact", false))
+        mesh->Compact();
+    return mesh;
+}
+
+
@@ -0,0 +1,201 @@
+
+/*
+    pbrt source code Copyright(c) 1998-2012 Matt Pharr and Greg Humphreys.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#pragma once
+#endif
+
+#ifndef PBRT_SHAPES_TESSUTIL_H
+#define PBRT_SHAPES_TESSUTIL_H
+
+// shapes/tessutil.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "memory.h"
+#include "parallel.h"
+#include <algorithm>
+
+// Tessellated Shape Inline Functions
+inline bool IntersectBound(const BBox &bounds, const Ray &ray,
+        const Vector &invDir, const uint32_t dirIsNeg[3], float maxt) {
+    // Check for ray intersection against $x$ and $y$ slabs
+    float tmin =  (bounds[  dirIsNeg[0]].x - ray.o.x) * invDir.x;
+    float tmax =  (bounds[1-dirIsNeg[0]].x - ray.o.x) * invDir.x;
+    float tymin = (bounds[  dirIsNeg[1]].y - ray.o.y) * invDir.y;
+    float tymax = (bounds[1-dirIsNeg[1]].y - ray.o.y) * invDir.y;
+    if ((tmin > tymax) || (tymin > tmax))
+        return false;
+    if (tymin > tmin) tmin = tymin;
+    if (tymax < tmax) tmax = tymax;
+
+    // Check for ray intersection against $z$ slab
+    float tzmin = (bounds[  dirIsNeg[2]].z - ray.o.z) * invDir.z;
+    float tzmax = (bounds[1-dirIsNeg[2]].z - ray.o.z) * invDir.z;
+    if ((tmin > tzmax) || (tzmin > tmax))
+        return false;
+    if (tzmin > tmin)
+        tmin = tzmin;
+    if (tzmax < tmax)
+        tmax = tzmax;
+    return (tmin < maxt) && (tmax > ray.mint);
+}
+
+
+inline bool IntersectTriangle(const Ray &ray, const Point &p1,
+        const Point &p2, const Point &p3, float maxt, float *tHit,
+        float *b1, float *b2) {
+    // Compute $\VEC{s}_1$
+    Vector e1 = p2 - p1;
+    Vector e2 = p3 - p1;
+    Vector s1 = Cross(ray.d, e2);
+    float divisor = Dot(s1, e1);
+    if (divisor == 0.)
+        return false;
+    float invDivisor = 1.f / divisor;
+
+    // Compute first barycentric coordinate
+    Vector s = ray.o - p1;
+    *b1 = Dot(s, s1) * invDivisor;
+    if (*b1 < 0. || *b1 > 1.)
+        return false;
+
+    // Compute second barycentric coordinate
+    Vector s2 = Cross(s, e1);
+    *b2 = Dot(ray.d, s2) * invDivisor;
+    if (*b2 < 0. || *b1 + *b2 > 1.)
+        return false;
+
+    // Compute _t_ to intersection point
+    *tHit = Dot(e2, s2) * invDivisor;
+    return *tHit >= ray.mint && *tHit <= maxt;
+}
+
+
+
+// TessellationCache Declarations
+
+// TessellationCache is a thread-safe least-recently-used cache of the
+// tessellations of a shape's patches, bounded by a total triangle count.
+// _T_ must be _ReferenceCounted_ and provide _NumTriangles()_ and an
+// _AtomicInt32 lastUse_ stamp.
+template <typename T> class TessellationCache {
+public:
+    // TessellationCache Public Methods
+    TessellationCache() : maxTriangles(0), cachedTriangles(0), epoch(0) {
+        mutex = RWMutex::Create();
+    }
+    ~TessellationCache() { RWMutex::Destroy(mutex); }
+    void Init(int nPatches, int maxTris) {
+        entries.resize(nPatches);
+        maxTriangles = maxTris;
+    }
+    int MaxTriangles() const { return maxTriangles; }
+    Reference<T> Lookup(int patch);
+    Reference<T> Insert(int patch, const Reference<T> &tess);
+private:
+    // TessellationCache Private Methods
+    TessellationCache(const TessellationCache &);
+    TessellationCache &operator=(const TessellationCache &);
+    static void Touch(T *tess, int32_t stamp) {
+        // Atomically advance _lastUse_ to _stamp_ unless it's already newer
+        int32_t old = tess->lastUse;
+        while (int32_t(uint32_t(stamp) - uint32_t(old)) > 0) {
+            int32_t prev = AtomicCompareAndSwap(&tess->lastUse, stamp, old);
+            if (prev == old) break;
+            old = prev;
+        }
+    }
+
+    // TessellationCache Private Data
+    RWMutex *mutex;
+    vector<Reference<T> > entries;
+    vector<int> cachedPatches;
+    int maxTriangles, cachedTriangles;
+    AtomicInt32 epoch;
+};
+
+
+
+// TessellationCache Method Definitions
+template <typename T>
+Reference<T> TessellationCache<T>::Lookup(int patch) {
+    // Return cached tessellation of _patch_ if present
+    RWMutexLock lock(*mutex, READ);
+    Reference<T> tess = entries[patch];
+    if (tess)
+        Touch(const_cast<T *>(tess.GetPtr()), AtomicAdd(&epoch, 1));
+    return tess;
+}
+
+
+template <typename T>
+Reference<T> TessellationCache<T>::Insert(int patch,
+                                          const Reference<T> &newTess) {
+    RWMutexLock lock(*mutex, WRITE);
+    if (entries[patch]) {
+        // Keep the tessellation another thread inserted first
+        Touch(const_cast<T *>(entries[patch].GetPtr()), AtomicAdd(&epoch, 1));
+        return entries[patch];
+    }
+    Reference<T> tess = newTess;
+    tess->lastUse = AtomicAdd(&epoch, 1);
+    entries[patch] = tess;
+    cachedPatches.push_back(patch);
+    cachedTriangles += tess->NumTriangles();
+    if (cachedTriangles > maxTriangles) {
+        // Evict least recently used tessellations down to 3/4 of budget
+        uint32_t now = tess->lastUse;
+        vector<std::pair<uint32_t, int> > ages;
+        ages.reserve(cachedPatches.size());
+        for (uint32_t i = 0; i < cachedPatches.size(); ++i)
+            ages.push_back(std::make_pair(
+                now - uint32_t(entries[cachedPatches[i]]->lastUse),
+                cachedPatches[i]));
+        std::sort(ages.begin(), ages.end());
+        cachedPatches.clear();
+        cachedTriangles = 0;
+        for (uint32_t i = 0; i < ages.size(); ++i) {
+            int p = ages[i].second;
+            int nt = entries[p]->NumTriangles();
+            if (i == 0 || cachedTriangles + nt <= 3 * (maxTriangles / 4)) {
+                cachedPatches.push_back(p);
+                cachedTriangles += nt;
+            }
+            else
+                entries[p] = NULL;
+        }
+    }
+    return tess;
+}
+
+
+
+#endif // PBRT_SHAPES_TESSUTIL_H
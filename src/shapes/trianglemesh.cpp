@@ -38,12 +38,42 @@
 #include "paramset.h"
 #include "montecarlo.h"
 
+// TriangleMesh Utility Functions
+static uint32_t EncodeOctahedral(const Vector &v) {
+    // Project onto the octahedron and fold the lower hemisphere over it
+    float l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+    if (l1 == 0.f) return 0x7fff7fff;
+    float ox = v.x / l1, oy = v.y / l1;
+    if (v.z < 0.f) {
+        float fx = (1.f - fabsf(oy)) * (ox >= 0.f ? 1.f : -1.f);
+        oy = (1.f - fabsf(ox)) * (oy >= 0.f ? 1.f : -1.f);
+        ox = fx;
+    }
+    uint32_t qx = Round2Int((Clamp(ox, -1.f, 1.f) * .5f + .5f) * 65535.f);
+    uint32_t qy = Round2Int((Clamp(oy, -1.f, 1.f) * .5f + .5f) * 65535.f);
+    return qx | (qy << 16);
+}
+
+
+static inline Vector DecodeOctahedral(uint32_t e) {
+    float ox = (e & 0xffff) * (2.f / 65535.f) - 1.f;
+    float oy = (e >> 16) * (2.f / 65535.f) - 1.f;
+    Vector v(ox, oy, 1.f - fabsf(ox) - fabsf(oy));
+    if (v.z < 0.f) {
+        v.x = (1.f - fabsf(oy)) * (ox >= 0.f ? 1.f : -1.f);
+        v.y = (1.f - fabsf(ox)) * (oy >= 0.f ? 1.f : -1.f);
+    }
+    return Normalize(v);
+}
+
+
 // TriangleMesh Method Definitions
 TriangleMesh::TriangleMesh(const Transform *o2w, const Transform *w2o,
         bool ro, int nt, int nv, const int *vi, const Point *P,
         const Normal *N, const Vector *S, const float *uv,
         const Reference<Texture<float> > &atex)
-    : Shape(o2w, w2o, ro), alphaTexture(atex) {
+    : Shape(o2w, w2o, ro), alphaTexture(atex), vertexIndex16(NULL),
+      octN(NULL), octS(NULL), quantizedUVs(NULL) {
     ntris = nt;
     nverts = nv;
     vertexIndex = new int[3 * ntris];
@@ -72,12 +102,35 @@ TriangleMesh::TriangleMesh(const Transform *o2w, const Transform *w2o,
 }
 
 
+TriangleMesh::TriangleMesh(const Transform *o2w, const Transform *w2o,
+        bool ro, int nt, int nv, int *vi, Point *P, Normal *N, float *uv,
+        const Reference<Texture<float> > &atex)
+    : Shape(o2w, w2o, ro), alphaTexture(atex), vertexIndex16(NULL),
+      octN(NULL), octS(NULL), quantizedUVs(NULL) {
+    ntris = nt;
+    nverts = nv;
+    vertexIndex = vi;
+    p = P;
+    n = N;
+    s = NULL;
+    uvs = uv;
+
+    // Transform adopted mesh vertices to world space in place
+    for (int i = 0; i < nverts; ++i)
+        p[i] = (*ObjectToWorld)(p[i]);
+}
+
+
 TriangleMesh::~TriangleMesh() {
     delete[] vertexIndex;
     delete[] p;
     delete[] s;
     delete[] n;
     delete[] uvs;
+    delete[] vertexIndex16;
+    delete[] octN;
+    delete[] octS;
+    delete[] quantizedUVs;
 }
 
 
@@ -97,6 +150,55 @@ BBox TriangleMesh::WorldBound() const {
 }
 
 
+void TriangleMesh::Compact() {
+    // Store vertex indices in 16 bits if possible
+    if (vertexIndex && nverts <= 65536) {
+        vertexIndex16 = new uint16_t[3 * ntris];
+        for (int i = 0; i < 3 * ntris; ++i)
+            vertexIndex16[i] = uint16_t(vertexIndex[i]);
+        delete[] vertexIndex;
+        vertexIndex = NULL;
+    }
+
+    // Oct-encode shading normals and tangents
+    if (n) {
+        octN = new uint32_t[nverts];
+        for (int i = 0; i < nverts; ++i)
+            octN[i] = EncodeOctahedral(Vector(n[i]));
+        delete[] n;
+        n = NULL;
+    }
+    if (s) {
+        octS = new uint32_t[nverts];
+        for (int i = 0; i < nverts; ++i)
+            octS[i] = EncodeOctahedral(s[i]);
+        delete[] s;
+        s = NULL;
+    }
+
+    // Quantize $(u,v)$ to 16 bits over their range in the mesh
+    if (uvs) {
+        for (int c = 0; c < 2; ++c) {
+            float uvMin = INFINITY, uvMax = -INFINITY;
+            for (int i = 0; i < nverts; ++i) {
+                uvMin = min(uvMin, uvs[2*i+c]);
+                uvMax = max(uvMax, uvs[2*i+c]);
+            }
+            uvOffset[c] = uvMin;
+            uvScale[c] = (uvMax - uvMin) / 65535.f;
+        }
+        quantizedUVs = new uint16_t[2 * nverts];
+        for (int i = 0; i < 2 * nverts; ++i) {
+            float scale = uvScale[i & 1];
+            quantizedUVs[i] = (scale > 0.f) ?
+                uint16_t(Round2Int((uvs[i] - uvOffset[i & 1]) / scale)) : 0;
+        }
+        delete[] uvs;
+        uvs = NULL;
+    }
+}
+
+
 void TriangleMesh::Refine(vector<Reference<Shape> > &refined) const {
     for (int i = 0; i < ntris; ++i)
         refined.push_back(new Triangle(ObjectToWorld,
@@ -107,6 +209,8 @@ void TriangleMesh::Refine(vector<Reference<Shape> > &refined) const {
 
 BBox Triangle::ObjectBound() const {
     // Get triangle vertices in _p1_, _p2_, and _p3_
+    int v[3];
+    mesh->GetVertexIndices(tri, v);
     const Point &p1 = mesh->p[v[0]];
     const Point &p2 = mesh->p[v[1]];
     const Point &p3 = mesh->p[v[2]];
@@ -117,6 +221,8 @@ BBox Triangle::ObjectBound() const {
 
 BBox Triangle::WorldBound() const {
     // Get triangle vertices in _p1_, _p2_, and _p3_
+    int v[3];
+    mesh->GetVertexIndices(tri, v);
     const Point &p1 = mesh->p[v[0]];
     const Point &p2 = mesh->p[v[1]];
     const Point &p3 = mesh->p[v[2]];
@@ -130,6 +236,8 @@ bool Triangle::Intersect(const Ray &ray, float *tHit, float *rayEpsilon,
     // Compute $\VEC{s}_1$
 
     // Get triangle vertices in _p1_, _p2_, and _p3_
+    int v[3];
+    mesh->GetVertexIndices(tri, v);
     const Point &p1 = mesh->p[v[0]];
     const Point &p2 = mesh->p[v[1]];
     const Point &p3 = mesh->p[v[2]];
@@ -213,6 +321,8 @@ bool Triangle::IntersectP(const Ray &ray) const {
     // Compute $\VEC{s}_1$
 
     // Get triangle vertices in _p1_, _p2_, and _p3_
+    int v[3];
+    mesh->GetVertexIndices(tri, v);
     const Point &p1 = mesh->p[v[0]];
     const Point &p2 = mesh->p[v[1]];
     const Point &p3 = mesh->p[v[2]];
@@ -283,6 +393,8 @@ bool Triangle::IntersectP(const Ray &ray) const {
 
 float Triangle::Area() const {
     // Get triangle vertices in _p1_, _p2_, and _p3_
+    int v[3];
+    mesh->GetVertexIndices(tri, v);
     const Point &p1 = mesh->p[v[0]];
     const Point &p2 = mesh->p[v[1]];
     const Point &p3 = mesh->p[v[2]];
@@ -293,11 +405,23 @@ float Triangle::Area() const {
 void Triangle::GetShadingGeometry(const Transform &obj2world,
         const DifferentialGeometry &dg,
         DifferentialGeometry *dgShading) const {
-    if (!mesh->n && !mesh->s) {
+    bool hasN = mesh->n || mesh->octN, hasS = mesh->s || mesh->octS;
+    if (!hasN && !hasS) {
         *dgShading = dg;
         return;
     }
     // Initialize _Triangle_ shading geometry with _n_ and _s_
+    int v[3];
+    mesh->GetVertexIndices(tri, v);
+    Normal n[3];
+    Vector s[3];
+    for (int i = 0; i < 3; ++i) {
+        // Decode compact normals and tangents if needed
+        if (mesh->n) n[i] = mesh->n[v[i]];
+        else if (hasN) n[i] = Normal(DecodeOctahedral(mesh->octN[v[i]]));
+        if (mesh->s) s[i] = mesh->s[v[i]];
+        else if (hasS) s[i] = DecodeOctahedral(mesh->octS[v[i]]);
+    }
 
     // Compute barycentric coordinates for point
     float b[3];
@@ -319,13 +443,9 @@ void Triangle::GetShadingGeometry(const Transform &obj2world,
     // Use _n_ and _s_ to compute shading tangents for triangle, _ss_ and _ts_
     Normal ns;
     Vector ss, ts;
-    if (mesh->n) ns = Normalize(obj2world(b[0] * mesh->n[v[0]] +
-                                          b[1] * mesh->n[v[1]] +
-                                          b[2] * mesh->n[v[2]]));
+    if (hasN) ns = Normalize(obj2world(b[0] * n[0] + b[1] * n[1] + b[2] * n[2]));
     else   ns = dg.nn;
-    if (mesh->s) ss = Normalize(obj2world(b[0] * mesh->s[v[0]] +
-                                          b[1] * mesh->s[v[1]] +
-                                          b[2] * mesh->s[v[2]]));
+    if (hasS) ss = Normalize(obj2world(b[0] * s[0] + b[1] * s[1] + b[2] * s[2]));
     else   ss = Normalize(dg.dpdu);
     
     ts = Cross(ss, ns);
@@ -338,7 +458,7 @@ void Triangle::GetShadingGeometry(const Transform &obj2world,
     Normal dndu, dndv;
 
     // Compute $\dndu$ and $\dndv$ for triangle shading geometry
-    if (mesh->n) {
+    if (hasN) {
         float uvs[3][2];
         GetUVs(uvs);
         // Compute deltas for triangle partial derivatives of normal
@@ -346,8 +466,8 @@ void Triangle::GetShadingGeometry(const Transform &obj2world,
         float du2 = uvs[1][0] - uvs[2][0];
         float dv1 = uvs[0][1] - uvs[2][1];
         float dv2 = uvs[1][1] - uvs[2][1];
-        Normal dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-        Normal dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+        Normal dn1 = n[0] - n[2];
+        Normal dn2 = n[1] - n[2];
         float determinant = du1 * dv2 - dv1 * du2;
         if (determinant == 0.f)
             dndu = dndv = Normal(0,0,0);
@@ -427,10 +547,21 @@ TriangleMesh *CreateTriangleMeshShape(const Transform *o2w, const Transform *w2o
             return NULL;
         }
 
+    Reference<Texture<float> > alphaTex = FindAlphaTexture(params, floatTextures);
+    TriangleMesh *mesh = new TriangleMesh(o2w, w2o, reverseOrientation,
+        nvi/3, npi, vi, P, N, S, uvs, alphaTex);
+    if (params.FindOneBool("compact", false))
+        mesh->Compact();
+    return mesh;
+}
+
+
+Reference<Texture<float> > FindAlphaTexture(const ParamSet &params,
+        map<string, Reference<Texture<float> > > *floatTextures) {
     Reference<Texture<float> > alphaTex = NULL;
     string alphaTexName = params.FindTexture("alpha");
     if (alphaTexName != "") {
-        if (floatTextures->find(alphaTexName) != floatTextures->end())
+        if (floatTextures && floatTextures->find(alphaTexName) != floatTextures->end())
             alphaTex = (*floatTextures)[alphaTexName];
         else
             Error("Couldn't find float texture \"%s\" for \"alpha\" parameter",
@@ -438,8 +569,7 @@ TriangleMesh *CreateTriangleMeshShape(const Transform *o2w, const Transform *w2o
     }
     else if (params.FindOneFloat("alpha", 1.f) == 0.f)
         alphaTex = new ConstantTexture<float>(0.f);
-    return new TriangleMesh(o2w, w2o, reverseOrientation, nvi/3, npi, vi, P,
-        N, S, uvs, alphaTex);
+    return alphaTex;
 }
 
 
@@ -447,6 +577,8 @@ Point Triangle::Sample(float u1, float u2, Normal *Ns) const {
     float b1, b2;
     UniformSampleTriangle(u1, u2, &b1, &b2);
     // Get triangle vertices in _p1_, _p2_, and _p3_
+    int v[3];
+    mesh->GetVertexIndices(tri, v);
     const Point &p1 = mesh->p[v[0]];
     const Point &p2 = mesh->p[v[1]];
     const Point &p3 = mesh->p[v[2]];
@@ -64,6 +64,10 @@ public:
                  int ntris, int nverts, const int *vptr,
                  const Point *P, const Normal *N, const Vector *S,
                  const float *uv, const Reference<Texture<float> > &atex);
+    // Takes ownership of _vptr_, _P_, _N_, and _uv_, allocated with _new[]_
+    TriangleMesh(const Transform *o2w, const Transform *w2o, bool ro,
+                 int ntris, int nverts, int *vptr, Point *P, Normal *N,
+                 float *uv, const Reference<Texture<float> > &atex);
     ~TriangleMesh();
     BBox ObjectBound() const;
     BBox WorldBound() const;
@@ -84,6 +88,33 @@ public:
 	of the triangles in the mesh.
 	*/
     void Refine(vector<Reference<Shape> > &refined) const;
+
+    // Replaces vertex data with 16-bit indices, oct-encoded normals and
+    // tangents, and 16-bit $(u,v)$ values, decoded as triangles are shaded
+    void Compact();
+    void GetVertexIndices(int t, int v[3]) const {
+        if (vertexIndex16) {
+            v[0] = vertexIndex16[3*t];
+            v[1] = vertexIndex16[3*t+1];
+            v[2] = vertexIndex16[3*t+2];
+        }
+        else {
+            v[0] = vertexIndex[3*t];
+            v[1] = vertexIndex[3*t+1];
+            v[2] = vertexIndex[3*t+2];
+        }
+    }
+    bool HasUVs() const { return uvs || quantizedUVs; }
+    void GetUV(int v, float uv[2]) const {
+        if (uvs) {
+            uv[0] = uvs[2*v];
+            uv[1] = uvs[2*v+1];
+        }
+        else {
+            uv[0] = uvOffset[0] + uvScale[0] * quantizedUVs[2*v];
+            uv[1] = uvOffset[1] + uvScale[1] * quantizedUVs[2*v+1];
+        }
+    }
     friend class Triangle;
     template <typename T> friend class VertexTexture;
 protected:
@@ -95,6 +126,12 @@ protected:
     Vector *s;
     float *uvs;
     Reference<Texture<float> > alphaTexture;
+
+    // Compact data used instead of _vertexIndex_, _n_, _s_, and _uvs_
+    uint16_t *vertexIndex16;
+    uint32_t *octN, *octS;
+    uint16_t *quantizedUVs;
+    float uvOffset[2], uvScale[2];
 };
 
 
@@ -105,7 +142,7 @@ public:
              TriangleMesh *m, int n)
         : Shape(o2w, w2o, ro) {
         mesh = m;
-        v = &mesh->vertexIndex[3*n];
+        tri = n;
         PBRT_CREATED_TRIANGLE(this);
     }
     BBox ObjectBound() const;
@@ -114,13 +151,12 @@ public:
                    DifferentialGeometry *dg) const;
     bool IntersectP(const Ray &ray) const;
     void GetUVs(float uv[3][2]) const {
-        if (mesh->uvs) {
-            uv[0][0] = mesh->uvs[2*v[0]];
-            uv[0][1] = mesh->uvs[2*v[0]+1];
-            uv[1][0] = mesh->uvs[2*v[1]];
-            uv[1][1] = mesh->uvs[2*v[1]+1];
-            uv[2][0] = mesh->uvs[2*v[2]];
-            uv[2][1] = mesh->uvs[2*v[2]+1];
+        if (mesh->HasUVs()) {
+            int v[3];
+            mesh->GetVertexIndices(tri, v);
+            mesh->GetUV(v[0], uv[0]);
+            mesh->GetUV(v[1], uv[1]);
+            mesh->GetUV(v[2], uv[2]);
         }
         else {
             uv[0][0] = 0.; uv[0][1] = 0.;
@@ -136,12 +172,14 @@ public:
 private:
     // Triangle Private Data
     Reference<TriangleMesh> mesh;
-    int *v;
+    int tri;
 };
 
 
 TriangleMesh *CreateTriangleMeshShape(const Transform *o2w, const Transform *w2o,
     bool reverseOrientation, const ParamSet &params,
     map<string, Reference<Texture<float> > > *floatTextures = NULL);
+Reference<Texture<float> > FindAlphaTexture(const ParamSet &params,
+    map<string, Reference<Texture<float> > > *floatTextures);
 
 #endif // PBRT_SHAPES_TRIANGLEMESH_H